@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 
 class AllPassFilter
 {
@@ -14,9 +15,7 @@ private:
 
     inline void UpdateCoeff(float freq)
     {
-        float omega = k2Pi * freq / sampleRate_;
-        float tanHalfOmega = tanf(omega * 0.5f);
-        a_ = (1.0f - tanHalfOmega) / (1.0f + tanHalfOmega);
+        a_ = FreqToCoeff(freq, sampleRate_);
     }
 
 public:
@@ -31,12 +30,20 @@ public:
 
     static AllPassFilter* create(float sampleRate, bool is2Pole = false)
     {
-        return new AllPassFilter(sampleRate, is2Pole);
+        return ArenaCreate<AllPassFilter>(MEMORY_REGION_FAST, sampleRate, is2Pole);
     }
 
     static void destroy(AllPassFilter* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
+    }
+
+    static inline float FreqToCoeff(float freq, float sampleRate)
+    {
+        float omega = k2Pi * freq / sampleRate;
+        float tanHalfOmega = tanf(omega * 0.5f);
+
+        return (1.0f - tanHalfOmega) / (1.0f + tanHalfOmega);
     }
 
     void SetSampleRate(float sampleRate)
@@ -92,4 +99,9 @@ public:
     {
         UpdateCoeff(freq);
     }
+
+    inline void SetCoeff(float a)
+    {
+        a_ = a;
+    }
 };
@@ -1,12 +1,15 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "BiquadFilter.h"
-#include "DelayLine.h"
+#include "StereoDelayLine.h"
 #include "SineOscillator.h"
 #include "EnvFollower.h"
 #include "DcBlockingFilter.h"
 #include "Compressor.h"
+#include "TailSleep.h"
+#include "CoeffTrajectory.h"
 
 // Techno-leaning reverb damping. One-pole lowpass (high-freq damping) in
 // parallel with a one-pole tracker subtracted to form a highpass (low-freq
@@ -29,12 +32,12 @@ public:
 
     static Damp* create(float sampleRate)
     {
-        return new Damp(sampleRate);
+        return ArenaCreate<Damp>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(Damp* damp)
     {
-        delete damp;
+        ArenaDestroy(damp);
     }
 
     // val is attenuation in dB (~-40..-0.5). More negative = heavier damping.
@@ -55,45 +58,52 @@ public:
 
     float Process(float in)
     {
-        lpState_ += lpCoeff_ * (in - lpState_) + 1e-18f;
-        hpState_ += hpCoeff_ * (in - hpState_) + 1e-18f;
+        lpState_ += lpCoeff_ * (in - lpState_);
+        hpState_ += hpCoeff_ * (in - hpState_);
         return lpState_ - hpState_ * 0.85f;
     }
 }; // End Damp
 
+// Stereo, both channels share the delay times.
 class Diffuse
 {
 public:
     Diffuse()
     {
-        for (int i = 0; i < kAmbienceNofDiffusers; i++)
+        for (int i = 0; i < kAmbienceNofDiffusers - 1; i++)
         {
-            diffuse_[i] = DelayLine::create(kAmbienceBufferSize);
+            diffuse_[i] = StereoDelayLine<kAmbienceDiffuseSize>::create();
         }
+        last_ = StereoDelayLine<kAmbienceLastDiffuseSize>::create();
 
-        fbOut_ = 0;
+        fbOut_[LEFT_CHANNEL] = 0;
+        fbOut_[RIGHT_CHANNEL] = 0;
         df_ = 0;
+        time_ = 0;
         needsUpdate_ = false;
+        active_ = kAmbienceNofDiffusers - 1;
 
         SetSZ(1);
+        UpdateDelayTimes();
         SetRT(0);
     }
     ~Diffuse()
     {
-        for (int i = 0; i < kAmbienceNofDiffusers; i++)
+        for (int i = 0; i < kAmbienceNofDiffusers - 1; i++)
         {
-            DelayLine::destroy(diffuse_[i]);
+            StereoDelayLine<kAmbienceDiffuseSize>::destroy(diffuse_[i]);
         }
+        StereoDelayLine<kAmbienceLastDiffuseSize>::destroy(last_);
     }
 
     static Diffuse* create()
     {
-        return new Diffuse();
+        return ArenaCreate<Diffuse>(MEMORY_REGION_FAST);
     }
 
     static void destroy(Diffuse* diffuse)
     {
-        delete diffuse;
+        ArenaDestroy(diffuse);
     }
 
     void SetSZ(float size)
@@ -123,9 +133,18 @@ public:
         df_ = _df;
     }
 
-    float GetFbOut()
+    float GetFbOut(int channel)
+    {
+        return fbOut_[channel];
+    }
+
+    /**
+     * @brief The allpasses that run, the others pass their input through
+     *        but still write it, so that they can be taken back at any time.
+     */
+    void SetActive(int count)
     {
-        return fbOut_;
+        active_ = std::min(std::max(count, 0), kAmbienceNofDiffusers - 1);
     }
 
     void UpdateDelayTimes()
@@ -142,58 +161,260 @@ public:
         needsUpdate_ = false;
     }
 
-    float Process(const float in, const float x)
+    /**
+     * @brief Read the taps of the next size samples, at most
+     *        kDelayLineBlockSize. The delays are longer than that, so they
+     *        don't depend on what the samples write.
+     *
+     * @param x the crossfade to the new delay times at the first sample
+     * @param xi its increment per sample
+     */
+    void ReadTaps(float x, float xi, size_t size)
     {
-        float out = in;
+        const float maxDelay = kAmbienceBufferSize - 2;
+        for (size_t c = 0; c < 2; c++)
+        {
+            for (int i = 0; i < active_; i++)
+            {
+                diffuse_[i]->readBlock(delayTimes_[i], newDelayTimes_[i], x, xi, c, taps_[i][c], size);
+            }
 
-        for (int i = 0; i < kAmbienceNofDiffusers - 1; i++)
+            int lastDiff = kAmbienceNofDiffusers - 1;
+            last_->readBlock(Min(delayTimes_[lastDiff], maxDelay), Min(newDelayTimes_[lastDiff], maxDelay), x, xi, c, taps_[lastDiff][c], size);
+        }
+    }
+
+    /**
+     * @param i the sample, in the taps last read
+     */
+    void Process(size_t i, const float leftIn, const float rightIn, float &leftOut, float &rightOut)
+    {
+        float out[2] = { leftIn, rightIn };
+
+        for (int k = active_; k < kAmbienceNofDiffusers - 1; k++)
+        {
+            diffuse_[k]->write(out[LEFT_CHANNEL], out[RIGHT_CHANNEL]);
+        }
+        for (int k = 0; k < active_; k++)
         {
-            float prev = HardClip(out - outs_[i] * df_);
-            diffuse_[i]->write(prev);
-            out = HardClip(prev * df_ + outs_[i]);
-            outs_[i] = diffuse_[i]->read(delayTimes_[i], newDelayTimes_[i], x);
+            float prev[2];
+            for (size_t c = 0; c < 2; c++)
+            {
+                float tap = taps_[k][c][i];
+                prev[c] = HardClip(out[c] - tap * df_);
+                out[c] = HardClip(prev[c] * df_ + tap);
+            }
+            diffuse_[k]->write(prev[LEFT_CHANNEL], prev[RIGHT_CHANNEL]);
         }
 
         int lastDiff = kAmbienceNofDiffusers - 1;
-        fbOut_ = outs_[lastDiff] * rt_;
-        diffuse_[lastDiff]->write(out);
-        outs_[lastDiff] = diffuse_[lastDiff]->read(delayTimes_[lastDiff], newDelayTimes_[lastDiff], x);
+        fbOut_[LEFT_CHANNEL] = taps_[lastDiff][LEFT_CHANNEL][i] * rt_;
+        fbOut_[RIGHT_CHANNEL] = taps_[lastDiff][RIGHT_CHANNEL][i] * rt_;
+        last_->write(out[LEFT_CHANNEL], out[RIGHT_CHANNEL]);
 
-        return out;
+        leftOut = out[LEFT_CHANNEL];
+        rightOut = out[RIGHT_CHANNEL];
     }
 
 private:
-    DelayLine *diffuse_[kAmbienceNofDiffusers];
+    StereoDelayLine<kAmbienceDiffuseSize>* diffuse_[kAmbienceNofDiffusers - 1];
+    StereoDelayLine<kAmbienceLastDiffuseSize>* last_;
+    float taps_[kAmbienceNofDiffusers][2][kDelayLineBlockSize];
     float delayTimes_[kAmbienceNofDiffusers], newDelayTimes_[kAmbienceNofDiffusers];
-    float size_, time_, rt_, df_, fbOut_, outs_[kAmbienceNofDiffusers];
+    float size_, time_, rt_, df_, fbOut_[2];
+    int active_;
     bool needsUpdate_;
 }; // End Diffuse
 
+/**
+ * @brief The alternate reverb core: kAmbienceFdnLines delay lines fed back
+ *        into each other through a Householder matrix, y = x - 2/N * sum(x),
+ *        that mixes them all in N operations. The lines' decay gains and the
+ *        one-pole high damping are applied in the same step.
+ *        The line lengths are spread from the size, and swing slowly by
+ *        kAmbienceFdnModDepth, each with its own phase, a new length per
+ *        block that the reads crossfade to like Diffuse's do.
+ *        The left input goes to the even lines, the right to the odd ones,
+ *        with alternating signs, and are read back the same way.
+ *        Lines 2k and 2k + 1 share a StereoDelayLine.
+ */
+class FeedbackDelayNetwork
+{
+private:
+    static constexpr int kNofPairs = kAmbienceFdnLines / 2;
+
+    StereoDelayLine<kAmbienceFdnSize>* lines_[kNofPairs];
+    float taps_[kAmbienceFdnLines][kDelayLineBlockSize];
+    float delayTimes_[kAmbienceFdnLines], newDelayTimes_[kAmbienceFdnLines];
+    float gains_[kAmbienceFdnLines];
+    float damp_[kAmbienceFdnLines];
+    float modSin_[kAmbienceFdnLines], modCos_[kAmbienceFdnLines];
+    float size_, time_, dampCoeff_;
+
+    QuadratureOscillator lfo_;
+
+public:
+    FeedbackDelayNetwork(float sampleRate, size_t blockSize)
+    {
+        for (int i = 0; i < kNofPairs; i++)
+        {
+            lines_[i] = StereoDelayLine<kAmbienceFdnSize>::create();
+        }
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            damp_[k] = 0;
+            modSin_[k] = sinf(k2Pi * k / kAmbienceFdnLines);
+            modCos_[k] = cosf(k2Pi * k / kAmbienceFdnLines);
+        }
+        lfo_.SetFreq(kAmbienceFdnModFreq * blockSize / sampleRate);
+        dampCoeff_ = 0.9f;
+        time_ = 0;
+
+        SetSZ(1);
+        Modulate();
+        UpdateDelayTimes();
+    }
+    ~FeedbackDelayNetwork()
+    {
+        for (int i = 0; i < kNofPairs; i++)
+        {
+            StereoDelayLine<kAmbienceFdnSize>::destroy(lines_[i]);
+        }
+    }
+
+    static FeedbackDelayNetwork* create(float sampleRate, size_t blockSize)
+    {
+        return ArenaCreate<FeedbackDelayNetwork>(MEMORY_REGION_FAST, sampleRate, blockSize);
+    }
+
+    static void destroy(FeedbackDelayNetwork* fdn)
+    {
+        ArenaDestroy(fdn);
+    }
+
+    void SetSZ(float size)
+    {
+        size_ = M2D(size);
+        SetRT(time_);
+    }
+
+    void SetRT(float time)
+    {
+        time_ = time;
+        float rt = M2D(time);
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            gains_[k] = Min(Db2A((size_ * kAmbienceFdnRatios[k] / rt) * -60.f), kAmbienceFdnGainMax);
+        }
+    }
+
+    /**
+     * @param damp Attenuation in Db, as Damp::SetHi()
+     */
+    void SetDamp(float damp)
+    {
+        dampCoeff_ = Clamp(Map(damp, -40.f, -0.5f, 0.05f, 0.9f), 0.001f, 0.999f);
+    }
+
+    /**
+     * @brief The lengths of the next block, called once per block before
+     *        the taps are read.
+     */
+    void Modulate()
+    {
+        lfo_.Step();
+        float s = lfo_.GetSin();
+        float c = lfo_.GetCos();
+        const float minDelay = kDelayLineBlockSize + kAmbienceFdnModDepth;
+        const float maxDelay = kAmbienceFdnSize - kAmbienceFdnModDepth - 2;
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            float mod = (s * modCos_[k] + c * modSin_[k]) * kAmbienceFdnModDepth;
+            newDelayTimes_[k] = Clamp(size_ * kAmbienceFdnRatios[k], minDelay, maxDelay) + mod;
+        }
+    }
+
+    void UpdateDelayTimes()
+    {
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            delayTimes_[k] = newDelayTimes_[k];
+        }
+    }
+
+    /**
+     * @brief As Diffuse::ReadTaps().
+     */
+    void ReadTaps(float x, float xi, size_t size)
+    {
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            lines_[k >> 1]->readBlock(delayTimes_[k], newDelayTimes_[k], x, xi, k & 1, taps_[k], size);
+        }
+    }
+
+    /**
+     * @param i the sample, in the taps last read
+     */
+    void Process(size_t i, const float leftIn, const float rightIn, float &leftOut, float &rightOut)
+    {
+        float taps[kAmbienceFdnLines];
+        float sum = 0;
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            taps[k] = taps_[k][i];
+            sum += taps[k];
+        }
+        float h = sum * (2.f / kAmbienceFdnLines);
+
+        float in[2] = { leftIn, rightIn };
+        float out[2] = { 0, 0 };
+        float writes[kAmbienceFdnLines];
+        for (int k = 0; k < kAmbienceFdnLines; k++)
+        {
+            float sign = (k & 2) ? -1.f : 1.f;
+            out[k & 1] += taps[k] * sign;
+
+            ONE_POLE(damp_[k], (taps[k] - h) * gains_[k], dampCoeff_);
+            writes[k] = SoftClip(damp_[k] + in[k & 1] * sign);
+        }
+        for (int p = 0; p < kNofPairs; p++)
+        {
+            lines_[p]->write(writes[2 * p], writes[2 * p + 1]);
+        }
+
+        leftOut = out[LEFT_CHANNEL] * 0.5f;
+        rightOut = out[RIGHT_CHANNEL] * 0.5f;
+    }
+}; // End FeedbackDelayNetwork
+
 class ReversedBuffer
 {
 public:
     ReversedBuffer(int32_t s) : s_{s}
     {
-        line_ = FloatArray::create(s);
+        line_ = ArenaCreateFloatArray(s);
         i_ = 0; // Input pointer
         o_ = s_ - 1; // Output pointer
         bs_ = s_ >> 1; // Reverse max block size is half the buffer size
         b_ = bs_; // Block pointer
         rb_ = 1.f / b_;
+        d_ = 0;
+        out_ = 0.f;
     }
     ~ReversedBuffer()
     {
-        FloatArray::destroy(line_);
+        ArenaDestroyFloatArray(line_);
     }
 
     static ReversedBuffer* create(int32_t size)
     {
-        return new ReversedBuffer(size);
+        return ArenaCreate<ReversedBuffer>(MEMORY_REGION_FAST, size);
     }
 
     static void destroy(ReversedBuffer* line)
     {
-        delete line;
+        ArenaDestroy(line);
     }
 
     void Clear()
@@ -268,19 +489,28 @@ private:
     SineOscillator *panner_;
 
     Damp *dampFilters_[2];
-    Diffuse *diffusers_[2];
     ReversedBuffer *reversers_[2];
 
+#ifdef USE_AMBIENCE_FDN
+    FeedbackDelayNetwork* fdn_;
+#else
+    Diffuse *diffuser_;
+
     EnvFollower* ef_[2];
-    Compressor* comp_[2];
+    Compressor* comp_;
     DcBlockingFilter* dc_[2];
+#endif
+
+    TailSleep sleep_;
 
     float amp_, pan_, decay_, spaceTime_;
     float reverse_;
     float width_;
     float xi_;
 
-    Lut<float, 32> decayLUT{0.f, -160.f, Lut<float, 32>::Type::LUT_TYPE_EXPO};
+    static constexpr LutTable<float, 32> kDecayTable = MakeLut<float, 32>(0.f, -160.f, 3.0);
+
+    Lut<float, 32> decayLUT{kDecayTable};
 
     /**
      * @param damp Attenuation in Db
@@ -289,6 +519,9 @@ private:
     {
         dampFilters_[LEFT_CHANNEL]->SetHi(damp);
         dampFilters_[RIGHT_CHANNEL]->SetHi(damp);
+#ifdef USE_AMBIENCE_FDN
+        fdn_->SetDamp(damp);
+#endif
     }
 
     /**
@@ -302,19 +535,24 @@ private:
 
     void SetDecayTime(float time)
     {
-        diffusers_[LEFT_CHANNEL]->SetRT(time);
-        diffusers_[RIGHT_CHANNEL]->SetRT(time);
+#ifdef USE_AMBIENCE_FDN
+        fdn_->SetRT(time);
+#else
+        diffuser_->SetRT(time);
+#endif
     }
 
     void SetSize(float size)
     {
         float sz = -(size - 30.f);
-        diffusers_[LEFT_CHANNEL]->SetSZ(sz);
-        diffusers_[RIGHT_CHANNEL]->SetSZ(sz);
+#ifdef USE_AMBIENCE_FDN
+        fdn_->SetSZ(sz);
+#else
+        diffuser_->SetSZ(sz);
 
         float df = (size * 0.004166667f) + 0.5f; // 1 / 240
-        diffusers_[LEFT_CHANNEL]->SetDf(df);
-        diffusers_[RIGHT_CHANNEL]->SetDf(df);
+        diffuser_->SetDf(df);
+#endif
     }
 
     void SetPan(float value)
@@ -392,12 +630,11 @@ public:
         for (size_t i = 0; i < 2; i++)
         {
             dampFilters_[i] = Damp::create(patchState_->sampleRate);
-            diffusers_[i] = Diffuse::create();
             reversers_[i] = ReversedBuffer::create(kAmbienceBufferSize);
+#ifndef USE_AMBIENCE_FDN
             ef_[i] = EnvFollower::create();
             dc_[i] = DcBlockingFilter::create();
-            comp_[i] = Compressor::create(patchState_->sampleRate);
-            comp_[i]->setThreshold(-20);
+#endif
         }
 
         dampFilters_[LEFT_CHANNEL]->SetHp(112);
@@ -406,24 +643,39 @@ public:
         dampFilters_[RIGHT_CHANNEL]->SetHp(96);
         dampFilters_[RIGHT_CHANNEL]->SetLp(51);
 
+#ifdef USE_AMBIENCE_FDN
+        fdn_ = FeedbackDelayNetwork::create(patchState_->sampleRate, patchState_->blockSize);
+#else
+        diffuser_ = Diffuse::create();
+        comp_ = Compressor::create(patchState_->sampleRate);
+        comp_->setThreshold(-20);
+#endif
         panner_ = SineOscillator::create(patchState_->blockRate);
 
         amp_ = 1.f;
         pan_ = 0.5f;
         width_ = 0.72f;
         xi_ = 1.f / patchState_->blockSize;
+        // Longest diffuser and reversed blocks.
+        sleep_.Init(kAmbienceBufferSize / patchState_->blockSize);
     }
     ~Ambience()
     {
         for (size_t i = 0; i < 2; i++)
         {
             Damp::destroy(dampFilters_[i]);
-            Diffuse::destroy(diffusers_[i]);
             ReversedBuffer::destroy(reversers_[i]);
+#ifndef USE_AMBIENCE_FDN
             EnvFollower::destroy(ef_[i]);
             DcBlockingFilter::destroy(dc_[i]);
-            Compressor::destroy(comp_[i]);
+#endif
         }
+#ifdef USE_AMBIENCE_FDN
+        FeedbackDelayNetwork::destroy(fdn_);
+#else
+        Diffuse::destroy(diffuser_);
+        Compressor::destroy(comp_);
+#endif
         SineOscillator::destroy(panner_);
     }
 
@@ -447,37 +699,89 @@ public:
 
         SetPan(patchCtrls_->ambienceAutoPan);
 
-        float d = Modulate(patchCtrls_->ambienceDecay, patchCtrls_->ambienceDecayModAmount, patchState_->modValue, patchCtrls_->ambienceDecayCvAmount, patchCvs_->ambienceDecay, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        SetDecay(d);
-
-        float t = Modulate(patchCtrls_->ambienceSpacetime, patchCtrls_->ambienceSpacetimeModAmount, patchState_->modValue, patchCtrls_->ambienceSpacetimeCvAmount, patchCvs_->ambienceSpacetime, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        SetSpacetime(t);
+        SetDecay(patchState_->params->Get(PARAM_AMBIENCE_DECAY));
+        SetSpacetime(patchState_->params->Get(PARAM_AMBIENCE_SPACETIME));
 
         if (StartupPhase::STARTUP_DONE != patchState_->startupPhase)
         {
             return;
         }
 
+        if (sleep_.Sleep(patchCtrls_->ambienceVol, size))
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+#ifdef USE_AMBIENCE_FDN
+            fdn_->Modulate();
+            fdn_->UpdateDelayTimes();
+#else
+            diffuser_->UpdateDelayTimes();
+#endif
+
+            return;
+        }
+
         float r = 1.f - reverse_;
         float x = 0;
 
+        // Hoisted, none of them change over the block.
+        float a = Map(decay_, 0.f, 1.f, amp_ * 1.3f, amp_);
+        float dryGain, wetGain;
+        CheapEqualPowerGains(patchCtrls_->ambienceVol, dryGain, wetGain, 1.4f);
+        float widthMid = 1.f - width_;
+
+#ifdef USE_AMBIENCE_FDN
+        float fdnGain = a * kAmbienceMakeupGain;
+        fdn_->Modulate();
+#else
+        diffuser_->SetActive(IsQualityReduced(patchState_, QUALITY_AMBIENCE_DIFFUSERS) ? kAmbienceReducedDiffusers : kAmbienceNofDiffusers - 1);
+#endif
+
         for (size_t i = 0; i < size; i++)
         {
+            size_t j = i % kDelayLineBlockSize;
+            if (0 == j)
+            {
+#ifdef USE_AMBIENCE_FDN
+                fdn_->ReadTaps(x, xi_, std::min<size_t>(kDelayLineBlockSize, size - i));
+#else
+                diffuser_->ReadTaps(x, xi_, std::min<size_t>(kDelayLineBlockSize, size - i));
+#endif
+            }
+
             float lIn = Clamp(leftIn[i], -3.f, 3.f);
             float rIn = Clamp(rightIn[i], -3.f, 3.f);
+            float send = sleep_.NextSend();
+            float lSend = lIn * send;
+            float rSend = rIn * send;
 
             float revLeft = reversers_[LEFT_CHANNEL]->LastOut();
             float revRight = reversers_[RIGHT_CHANNEL]->LastOut();
             float reverseMid = Mix2(revLeft, revRight);
 
-            float left = (revLeft * 0.8f + reverseMid * 0.2f) * reverse_ + lIn * r;
-            float right = (revRight * 0.8f + reverseMid * 0.2f) * reverse_ + rIn * r;
+            float left = (revLeft * 0.8f + reverseMid * 0.2f) * reverse_ + lSend * r;
+            float right = (revRight * 0.8f + reverseMid * 0.2f) * reverse_ + rSend * r;
 
-            reversers_[LEFT_CHANNEL]->Process(lIn);
-            reversers_[RIGHT_CHANNEL]->Process(rIn);
+            reversers_[LEFT_CHANNEL]->Process(lSend);
+            reversers_[RIGHT_CHANNEL]->Process(rSend);
 
-            float leftFb = dampFilters_[LEFT_CHANNEL]->Process(left + diffusers_[RIGHT_CHANNEL]->GetFbOut() * 0.82f);
-            float rightFb = dampFilters_[RIGHT_CHANNEL]->Process(right + diffusers_[LEFT_CHANNEL]->GetFbOut() * 0.82f);
+#ifdef USE_AMBIENCE_FDN
+            // The lines keep themselves in check, no compressor needed.
+            float leftFb = dampFilters_[LEFT_CHANNEL]->Process(left * (1.f - pan_) * 2.f);
+            float rightFb = dampFilters_[RIGHT_CHANNEL]->Process(right * pan_ * 2.f);
+
+            fdn_->Process(j, leftFb, rightFb, left, right);
+
+            x += xi_;
+
+            float wetMid = Mix2(left, right);
+            left = (wetMid * widthMid + left * width_) * fdnGain;
+            right = (wetMid * widthMid + right * width_) * fdnGain;
+#else
+            float leftFb = dampFilters_[LEFT_CHANNEL]->Process(left + diffuser_->GetFbOut(RIGHT_CHANNEL) * 0.82f);
+            float rightFb = dampFilters_[RIGHT_CHANNEL]->Process(right + diffuser_->GetFbOut(LEFT_CHANNEL) * 0.82f);
 
             leftFb = SoftClip(left * (1.f - pan_) + leftFb);
             rightFb = SoftClip(right * pan_ + rightFb);
@@ -488,25 +792,31 @@ public:
             leftFb = dc_[LEFT_CHANNEL]->process(leftFb);
             rightFb = dc_[RIGHT_CHANNEL]->process(rightFb);
 
-            left = diffusers_[LEFT_CHANNEL]->Process(leftFb, x);
-            right = diffusers_[RIGHT_CHANNEL]->Process(rightFb, x);
+            diffuser_->Process(j, leftFb, rightFb, left, right);
 
             x += xi_;
 
             float wetMid = Mix2(left, right);
-            left = wetMid * (1.f - width_) + left * width_;
-            right = wetMid * (1.f - width_) + right * width_;
-
-            float a = Map(decay_, 0.f, 1.f, amp_ * 1.3f, amp_);
-
-            left = comp_[LEFT_CHANNEL]->process(left * a) * kAmbienceMakeupGain;
-            right = comp_[RIGHT_CHANNEL]->process(right * a) * kAmbienceMakeupGain;
-
-            leftOut[i] = CheapEqualPowerCrossFade(lIn, left, patchCtrls_->ambienceVol, 1.4f);
-            rightOut[i] = CheapEqualPowerCrossFade(rIn, right, patchCtrls_->ambienceVol, 1.4f);
+            left = wetMid * widthMid + left * width_;
+            right = wetMid * widthMid + right * width_;
+
+            left *= a;
+            right *= a;
+            comp_->process(left, right);
+            left *= kAmbienceMakeupGain;
+            right *= kAmbienceMakeupGain;
+#endif
+            sleep_.Track(left, right);
+
+            leftOut[i] = lIn * dryGain + left * wetGain;
+            rightOut[i] = rIn * dryGain + right * wetGain;
         }
 
-        diffusers_[LEFT_CHANNEL]->UpdateDelayTimes();
-        diffusers_[RIGHT_CHANNEL]->UpdateDelayTimes();
+#ifdef USE_AMBIENCE_FDN
+        fdn_->UpdateDelayTimes();
+#else
+        diffuser_->UpdateDelayTimes();
+#endif
+        sleep_.EndBlock();
     }
 };
@@ -0,0 +1,243 @@
+#pragma once
+
+#include "Commons.h"
+#include <new>
+#include <utility>
+#include <stdint.h>
+
+/**
+ * @brief The heap's memory for what doesn't go in an arena, aligned as the
+ *        most aligned of the requests, kArenaArrayAlignment, so that it can
+ *        be freed without knowing the alignment it was asked for.
+ */
+inline void* HeapAllocate(size_t size)
+{
+    return ::operator new(size, std::align_val_t(kArenaArrayAlignment));
+}
+
+inline void HeapFree(void* ptr)
+{
+    ::operator delete(ptr, std::align_val_t(kArenaArrayAlignment));
+}
+
+enum MemoryRegion
+{
+    MEMORY_REGION_FAST, // Internal SRAM
+    MEMORY_REGION_SLOW, // External SDRAM
+    MEMORY_REGION_LAST,
+};
+
+/**
+ * @brief A bump allocator for one memory region. Memory is only given back
+ *        when the arena is destroyed, so it's meant for what is allocated
+ *        at startup.
+ *        The fast arena reserves its memory in one go: when created before
+ *        any other allocation it takes the internal SRAM, which the heap
+ *        hands out first. The slow arena has no capacity and just accounts
+ *        for what it passes on to the heap, once the internal SRAM is taken
+ *        that's the SDRAM.
+ *        Requests that don't fit an arena, or that are made while the
+ *        arenas are not initialized, go to the heap.
+ *        With USE_INSTANCES, each instance has arenas of its own, bound to
+ *        the thread that runs it, see Bind().
+ */
+class Arena
+{
+private:
+    uint8_t* memory_;
+    size_t capacity_;
+    size_t used_;
+    size_t overflow_;
+
+    static Arena** DefaultArenas()
+    {
+        static Arena* arenas[MEMORY_REGION_LAST] = {};
+
+        return arenas;
+    }
+
+    static Arena** &GetArenas()
+    {
+        static INSTANCE_LOCAL Arena** arenas = DefaultArenas();
+
+        return arenas;
+    }
+
+public:
+    Arena(size_t capacity)
+    {
+        memory_ = capacity > 0 ? new uint8_t[capacity] : NULL;
+        capacity_ = capacity;
+        used_ = 0;
+        overflow_ = 0;
+    }
+    ~Arena()
+    {
+        delete[] memory_;
+    }
+
+    static Arena* create(size_t capacity)
+    {
+        return new Arena(capacity);
+    }
+
+    static void destroy(Arena* obj)
+    {
+        delete obj;
+    }
+
+    /**
+     * @brief Makes this thread allocate from and free to arenas, the
+     *        MEMORY_REGION_LAST of an instance, NULL going back to the
+     *        default ones. Init() and Deinit() act on those bound.
+     *        See USE_INSTANCES.
+     */
+    static void Bind(Arena** arenas)
+    {
+        GetArenas() = arenas ? arenas : DefaultArenas();
+    }
+
+    /**
+     * @brief Create the arenas, before anything else is allocated.
+     */
+    static void Init(size_t fastCapacity)
+    {
+        GetArenas()[MEMORY_REGION_FAST] = Arena::create(fastCapacity);
+        GetArenas()[MEMORY_REGION_SLOW] = Arena::create(0);
+    }
+
+    /**
+     * @brief Destroy the arenas, after everything allocated in them.
+     */
+    static void Deinit()
+    {
+        for (size_t i = 0; i < MEMORY_REGION_LAST; i++)
+        {
+            Arena::destroy(GetArenas()[i]);
+            GetArenas()[i] = NULL;
+        }
+    }
+
+    static Arena* Get(MemoryRegion region)
+    {
+        return GetArenas()[region];
+    }
+
+    inline void* Allocate(size_t size, size_t alignment)
+    {
+        if (NULL == memory_)
+        {
+            used_ += size;
+
+            return HeapAllocate(size);
+        }
+
+        // The address is aligned, new[] only aligns memory_ for the largest
+        // of the basic types.
+        uintptr_t base = reinterpret_cast<uintptr_t>(memory_);
+        size_t start = ((base + used_ + alignment - 1) & ~uintptr_t(alignment - 1)) - base;
+        if (start + size > capacity_)
+        {
+            overflow_ += size;
+
+            return HeapAllocate(size);
+        }
+        used_ = start + size;
+
+        return memory_ + start;
+    }
+
+    inline bool Contains(const void* ptr)
+    {
+        return ptr >= memory_ && ptr < memory_ + capacity_;
+    }
+
+    /**
+     * @brief Bytes taken from the arena's own memory, or passed on to the
+     *        heap by the slow arena.
+     */
+    inline size_t GetUsed()
+    {
+        return used_;
+    }
+
+    inline size_t GetCapacity()
+    {
+        return capacity_;
+    }
+
+    /**
+     * @brief Bytes that didn't fit and went to the heap.
+     */
+    inline size_t GetOverflow()
+    {
+        return overflow_;
+    }
+};
+
+inline void* AllocateMemory(MemoryRegion region, size_t size, size_t alignment = kArenaAlignment)
+{
+    Arena* arena = Arena::Get(region);
+    if (NULL == arena)
+    {
+        return HeapAllocate(size);
+    }
+
+    return arena->Allocate(size, alignment);
+}
+
+inline void FreeMemory(void* ptr)
+{
+    for (size_t i = 0; i < MEMORY_REGION_LAST; i++)
+    {
+        Arena* arena = Arena::Get((MemoryRegion)i);
+        if (arena && arena->Contains(ptr))
+        {
+            return;
+        }
+    }
+    HeapFree(ptr);
+}
+
+/**
+ * @brief Construct an object in a region, for the classes' create().
+ */
+template <typename T, typename... Args>
+inline T* ArenaCreate(MemoryRegion region, Args&&... args)
+{
+    static_assert(alignof(T) <= kArenaArrayAlignment, "The heap's memory of the arenas isn't aligned enough");
+    return new (AllocateMemory(region, sizeof(T), alignof(T) > kArenaAlignment ? alignof(T) : kArenaAlignment)) T(std::forward<Args>(args)...);
+}
+
+/**
+ * @brief Destroy an object made with ArenaCreate(), for the classes'
+ *        destroy().
+ */
+template <typename T>
+inline void ArenaDestroy(T* obj)
+{
+    if (obj)
+    {
+        obj->~T();
+        FreeMemory(obj);
+    }
+}
+
+/**
+ * @brief Create a cleared FloatArray, the small ones go in the fast region
+ *        and those above kArenaFastArrayMax bytes in the slow one.
+ */
+inline FloatArray ArenaCreateFloatArray(size_t size)
+{
+    size_t bytes = size * sizeof(float);
+    MemoryRegion region = bytes > kArenaFastArrayMax ? MEMORY_REGION_SLOW : MEMORY_REGION_FAST;
+    FloatArray array((float*)AllocateMemory(region, bytes, kArenaArrayAlignment), size);
+    array.clear();
+
+    return array;
+}
+
+inline void ArenaDestroyFloatArray(FloatArray array)
+{
+    FreeMemory(array.getData());
+}
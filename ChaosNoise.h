@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include <cmath>
 
@@ -79,6 +80,33 @@ public:
         return noise();
     }
 
+    /**
+     * @brief The next size values into out, the same as that many calls to
+     *        Process(). The frequency is the one set before, the recurrence
+     *        is stepped every sample without a branch, keeping or taking its
+     *        new value.
+     */
+    void Render(float* out, size_t size)
+    {
+        auto increment = floor(freq_ * maxlens_);
+        float y0 = y_[0];
+        float y1 = y_[1];
+        int32_t phs = phs_;
+        for (size_t i = 0; i < size; i++)
+        {
+            phs += increment;
+            bool wrap = phs >= kHlskChaosNoisePhsMax;
+            phs &= kHlskChaosNoisePhsMsk;
+            float y = fabs(chaos_ * y0 - y1 - 0.05f);
+            y1 = wrap ? y0 : y1;
+            y0 = wrap ? y : y0;
+            out[i] = y0;
+        }
+        y_[0] = y0;
+        y_[1] = y1;
+        phs_ = phs;
+    }
+
 private:
     float y_[2];
     float maxlens_, chaos_, freq_;
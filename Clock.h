@@ -3,18 +3,89 @@
 #include "Commons.h"
 #include "TapTempo.h"
 #include "Schmitt.h"
-
+#include "ClockEvents.h"
+
+/**
+ * @brief The tempo, internal or from sync in or the MIDI clock. The edges
+ *        and the MIDI messages are queued by the callbacks with the sample of
+ *        the block they fall on (see ClockEvents.h), so that the external
+ *        clock's period is measured to the sample, and the resets fall on
+ *        the sample of the block given by PatchState::clockOffset.
+ *        A MIDI beat, kClockMidiPpqn clocks, counts as a sync in pulse; a
+ *        start resets on the next beat, a stop drops back to the internal
+ *        clock at once.
+ */
 class Clock
 {
 private:
     PatchCtrls* patchCtrls_;
     PatchState* patchState_;
+    ClockEvents* events_;
 
     Schmitt trigger_;
 
     uint32_t samplesSinceSyncIn_;
+    int32_t samplesSinceEdge_; // Audio samples since the last edge, from the start of the block
+    int32_t edgeLimit_;
+    size_t edgeOffset_;
+    size_t subBlockStart_; // The sample of the host block the block starts on
+    int midiClocks_;
     ClockSource clockSource_;
     bool firstSyncIn_;
+    bool midiStarted_;
+    bool midiStopped_;
+
+    /**
+     * @brief A sync in pulse, or a MIDI beat.
+     */
+    void Edge(size_t offset)
+    {
+        int32_t period = samplesSinceEdge_ + offset;
+        samplesSinceEdge_ = -int32_t(offset);
+
+        patchState_->tempo->trigger(true);
+        if (firstSyncIn_ && period > 0 && period < edgeLimit_)
+        {
+            float p = float(period) / patchState_->blockSize;
+            if (fabsf(p - patchState_->clockPeriod) * patchState_->blockSize > kClockPeriodTolerance)
+            {
+                patchState_->clockPeriod = p;
+            }
+            patchState_->tempo->setFrequency(patchState_->sampleRate / period);
+        }
+
+        samplesSinceSyncIn_ = 0;
+        firstSyncIn_ = true;
+        edgeOffset_ = offset;
+    }
+
+    void Reset(size_t offset)
+    {
+        patchState_->clockReset = true;
+        patchState_->clockOffset = offset;
+    }
+
+    /**
+     * @return true on a beat
+     */
+    bool MidiClock(size_t offset)
+    {
+        if (midiStopped_ || ++midiClocks_ < kClockMidiPpqn)
+        {
+            return false;
+        }
+        midiClocks_ = 0;
+        Edge(offset);
+        // There's no falling edge to wait for.
+        patchState_->tempo->trigger(false);
+        if (midiStarted_)
+        {
+            midiStarted_ = false;
+            Reset(offset);
+        }
+
+        return true;
+    }
 
 public:
     Clock(PatchCtrls* patchCtrls, PatchState* patchState)
@@ -27,8 +98,25 @@ public:
         patchState_->tempo = TapTempo::create(patchState_->blockRate, kLooperChannelBufferLength);
         patchState_->tempo->setFrequency(kInternalClockFreq);
         samplesSinceSyncIn_ = kExternalClockLimit;
+        firstSyncIn_ = false;
+
+        events_ = ClockEvents::create();
+        patchState_->clockEvents = events_;
+        patchState_->clockOffset = 0;
+        patchState_->clockPeriod = patchState_->tempo->getPeriodInSamples();
+        edgeLimit_ = kExternalClockLimit * patchState_->blockSize;
+        samplesSinceEdge_ = edgeLimit_;
+        edgeOffset_ = 0;
+        subBlockStart_ = 0;
+        midiClocks_ = 0;
+        midiStarted_ = false;
+        midiStopped_ = false;
+    }
+    ~Clock()
+    {
+        patchState_->clockEvents = NULL;
+        ClockEvents::destroy(events_);
     }
-    ~Clock() {}
 
     static Clock* create(PatchCtrls* patchCtrls, PatchState* patchState)
     {
@@ -45,12 +133,59 @@ public:
         patchState_->tempo->clock(1);
 
         patchState_->clockReset = false;
+        patchState_->clockOffset = 0;
 
-        // Listen to sync in.
-        if (patchState_->syncIn)
+        // Listen to sync in and to the MIDI clock, the events of the host
+        // block that fall on this one, their offsets into it.
+        if (0 == subBlockStart_)
+        {
+            events_->Latch();
+        }
+        size_t subBlockEnd = subBlockStart_ + patchState_->blockSize;
+        bool syncIn = false;
+        bool stop = false;
+        ClockEvent event;
+        while (events_->Pop(event, subBlockEnd))
         {
-            samplesSinceSyncIn_ = 0;
-            firstSyncIn_ = true;
+            size_t offset = event.offset > subBlockStart_ ? event.offset - subBlockStart_ : 0;
+            switch (event.type)
+            {
+            case CLOCK_EVENT_SYNC_ON:
+                Edge(offset);
+                syncIn = true;
+                break;
+            case CLOCK_EVENT_SYNC_OFF:
+                patchState_->tempo->trigger(false);
+                break;
+            case CLOCK_EVENT_MIDI_CLOCK:
+                syncIn = MidiClock(offset) || syncIn;
+                break;
+            case CLOCK_EVENT_MIDI_START:
+                // The next clock is the first beat.
+                midiClocks_ = kClockMidiPpqn - 1;
+                midiStarted_ = true;
+                midiStopped_ = false;
+                break;
+            case CLOCK_EVENT_MIDI_CONTINUE:
+                midiStopped_ = false;
+                break;
+            case CLOCK_EVENT_MIDI_STOP:
+                midiStarted_ = false;
+                midiStopped_ = true;
+                stop = true;
+                edgeOffset_ = offset;
+                break;
+            }
+        }
+        subBlockStart_ = subBlockEnd < size_t(patchState_->hostBlockSize) ? subBlockEnd : 0;
+        if (samplesSinceEdge_ < edgeLimit_)
+        {
+            samplesSinceEdge_ += patchState_->blockSize;
+        }
+
+        if (stop && !syncIn)
+        {
+            firstSyncIn_ = false;
         }
 
         bool externalClock = samplesSinceSyncIn_ < kExternalClockLimit && firstSyncIn_;
@@ -71,13 +206,13 @@ public:
             // switch to the internal clock.
             patchState_->clockSource = ClockSource::CLOCK_SOURCE_INTERNAL;
             patchState_->tempo->setFrequency(kInternalClockFreq);
-            patchState_->clockReset = true;
+            Reset(stop ? edgeOffset_ : 0);
         }
         else if (ClockSource::CLOCK_SOURCE_INTERNAL == patchState_->clockSource && externalClock)
         {
-            // Switch to the external clock.
+            // Switch to the external clock, from the edge.
             patchState_->clockSource = ClockSource::CLOCK_SOURCE_EXTERNAL;
-            patchState_->clockReset = true;
+            Reset(edgeOffset_);
         }
 
         size_t s = patchState_->tempo->getPeriodInSamples();
@@ -85,6 +220,10 @@ public:
         {
             patchState_->clockSamples = s;
         }
+        if (ClockSource::CLOCK_SOURCE_INTERNAL == patchState_->clockSource)
+        {
+            patchState_->clockPeriod = patchState_->clockSamples;
+        }
 
         patchState_->clockTick = trigger_.Process(patchState_->tempo->isOn());
     }
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "Commons.h"
+#include <atomic>
+
+enum ClockEventType
+{
+    CLOCK_EVENT_SYNC_ON,
+    CLOCK_EVENT_SYNC_OFF,
+    CLOCK_EVENT_MIDI_CLOCK,
+    CLOCK_EVENT_MIDI_START,
+    CLOCK_EVENT_MIDI_CONTINUE,
+    CLOCK_EVENT_MIDI_STOP,
+};
+
+struct ClockEvent
+{
+    ClockEventType type;
+    uint16_t offset; // The sample of the next host block it falls on
+};
+
+/**
+ * @brief The sync in edges and the MIDI realtime messages received since the
+ *        last block, each with the sample of the next block it falls on, so
+ *        that the clock can follow them to the sample. The callbacks push,
+ *        Clock::Process() pops at the start of the next block: there's one
+ *        writer and one reader, each only moves its own index, released
+ *        once the event it passes is written or read. The events that don't
+ *        fit in kClockEventsSize are dropped.
+ *        The events of a block are popped in the order of their offsets,
+ *        those that fall on the same sample in the order they came in.
+ *        With USE_SUB_BLOCKS, the offsets are in the host's block, and each
+ *        sub-block only pops the events that fall on it.
+ */
+class ClockEvents
+{
+private:
+    static_assert(0 == (kClockEventsSize & (kClockEventsSize - 1)), "The queue's size must be a power of 2");
+
+    ClockEvent events_[kClockEventsSize];
+    std::atomic<uint32_t> head_; // The next one pushed
+    std::atomic<uint32_t> tail_; // The next one popped
+    uint32_t end_; // The first one pushed after the host block started, see Latch()
+
+public:
+    ClockEvents()
+    {
+        head_.store(0);
+        tail_.store(0);
+        end_ = 0;
+    }
+    ~ClockEvents() {}
+
+    static ClockEvents* create()
+    {
+        return new ClockEvents();
+    }
+
+    static void destroy(ClockEvents* obj)
+    {
+        delete obj;
+    }
+
+    /**
+     * @param offset the sample of the next host block, clamped to it
+     * @return false if the queue is full
+     */
+    bool Push(ClockEventType type, size_t offset, size_t blockSize)
+    {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= kClockEventsSize)
+        {
+            return false;
+        }
+        ClockEvent &event = events_[head & (kClockEventsSize - 1)];
+        event.type = type;
+        event.offset = std::min<size_t>(offset, blockSize - 1);
+        head_.store(head + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * @brief At the start of a host block, takes the events pushed so far as
+     *        its own. The ones pushed while it's processed wait for the next.
+     *        The events of the block are the reader's until they're popped,
+     *        they're sorted by their offsets, a MIDI message that came
+     *        after a sync edge can fall before it.
+     */
+    void Latch()
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        end_ = head_.load(std::memory_order_acquire);
+
+        // Insertion sort, the events mostly come in order.
+        for (uint32_t i = tail; i != end_; i++)
+        {
+            ClockEvent event = events_[i & (kClockEventsSize - 1)];
+            uint32_t j = i;
+            for (; j != tail && events_[(j - 1) & (kClockEventsSize - 1)].offset > event.offset; j--)
+            {
+                events_[j & (kClockEventsSize - 1)] = events_[(j - 1) & (kClockEventsSize - 1)];
+            }
+            events_[j & (kClockEventsSize - 1)] = event;
+        }
+    }
+
+    /**
+     * @param end the sample of the host block the events popped fall before
+     * @return false if there's no event of the host block left before end
+     */
+    bool Pop(ClockEvent &event, size_t end)
+    {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == end_ || events_[tail & (kClockEventsSize - 1)].offset >= end)
+        {
+            return false;
+        }
+        event = events_[tail & (kClockEventsSize - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+
+        return true;
+    }
+};
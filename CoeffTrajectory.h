@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Commons.h"
+#include <algorithm>
+
+/**
+ * @brief A sine LFO as a rotating phasor, two multiply-adds per step instead
+ *        of a sinf. The phasor is pulled back to the unit circle on every
+ *        step so that it doesn't drift.
+ *        The step is whatever the LFO is advanced by, usually a segment of
+ *        a CoeffTrajectory.
+ */
+class QuadratureOscillator
+{
+private:
+    float sin_, cos_;
+    float stepSin_, stepCos_;
+    float freq_;
+
+public:
+    QuadratureOscillator()
+    {
+        Init();
+    }
+    ~QuadratureOscillator() {}
+
+    void Init(float phase = 0)
+    {
+        sin_ = sinf(phase);
+        cos_ = cosf(phase);
+        stepSin_ = 0;
+        stepCos_ = 1.f;
+        freq_ = 0;
+    }
+
+    /**
+     * @param freq the frequency in cycles per step
+     */
+    inline void SetFreq(float freq)
+    {
+        if (freq != freq_)
+        {
+            freq_ = freq;
+            stepSin_ = sinf(k2Pi * freq);
+            stepCos_ = cosf(k2Pi * freq);
+        }
+    }
+
+    inline void Step()
+    {
+        float s = sin_ * stepCos_ + cos_ * stepSin_;
+        float c = cos_ * stepCos_ - sin_ * stepSin_;
+        float g = 1.5f - 0.5f * (s * s + c * c);
+        sin_ = s * g;
+        cos_ = c * g;
+    }
+
+    inline float GetSin()
+    {
+        return sin_;
+    }
+
+    inline float GetCos()
+    {
+        return cos_;
+    }
+};
+
+/**
+ * @brief The samples between two points of a coefficient trajectory, so that
+ *        there are kCoeffTrajectoryPoints per block.
+ */
+inline size_t CoeffSegmentSize(size_t blockSize)
+{
+    return std::max<size_t>(blockSize / kCoeffTrajectoryPoints, 1);
+}
+
+/**
+ * @brief A filter coefficient that is computed at a few points of the block
+ *        and ramped linearly in between, instead of being recomputed every
+ *        few samples in steps.
+ */
+class CoeffTrajectory
+{
+private:
+    float value_;
+    float target_;
+    float increment_;
+
+public:
+    CoeffTrajectory()
+    {
+        Init(0);
+    }
+    ~CoeffTrajectory() {}
+
+    void Init(float value)
+    {
+        value_ = target_ = value;
+        increment_ = 0;
+    }
+
+    /**
+     * @brief Called at the start of a segment with the coefficient at its
+     *        end.
+     */
+    inline void Set(float target, size_t count)
+    {
+        value_ = target_;
+        target_ = target;
+        increment_ = (target - value_) / count;
+    }
+
+    inline float Next()
+    {
+        value_ += increment_;
+
+        return value_;
+    }
+};
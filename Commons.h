@@ -6,13 +6,33 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <cmath>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 //#define USE_RECORD_THRESHOLD
+//#define USE_PROFILER // Per-stage DSP load accounting, see Profiler.h
+//#define USE_LOOPER_INTERLEAVED // Store the looper's L/R samples frame by frame, see LooperBuffer.h
+//#define USE_SUB_BLOCKS // Process the host's blocks in sub-blocks of kSubBlockSize, see SubBlockBuffer.h
+//#define USE_LOOKAHEAD_LIMITER // Output limiter with lookahead instead of the soft clip, see Limiter.h
+//#define USE_AMBIENCE_FDN // Feedback delay network core for the ambience instead of the diffusers, see Ambience.h
+//#define USE_LOOPER_16BIT // Store the looper's samples as 16 bit integers, for twice the loop time, see LooperBuffer.h
+//#define USE_LOOPER_CLOUD // Play the loop as a cloud of grains, see LooperCloud.h
+//#define USE_LOOPER_STREAMING // Takes longer than the looper's buffer, streamed to a store, see LooperStream.h
+//#define USE_INSTANCES // Several patches side by side on a native host, each on any thread, see tests/instance_host.h
 #define MAX_PATCH_SETTINGS 17 // Increased to accommodate 4 new volume mod/CV parameters in Phase 1B
 #define PATCH_SETTINGS_NAME "technomachine"
 #define PATCH_VERSION_MAJOR 1
 #define PATCH_VERSION_MINOR 1
 
+// What the objects of a patch share, its arenas and its seeds, is bound per
+// thread with USE_INSTANCES, for a host to run several patches side by side.
+#ifdef USE_INSTANCES
+#define INSTANCE_LOCAL thread_local
+#else
+#define INSTANCE_LOCAL
+#endif
+
 // Taken from pichenettes' stmlib.
 #define CONSTRAIN(var, min, max) \
   if (var < (min)) { \
@@ -64,7 +84,14 @@ constexpr float kCvMinThreshold = 0.007f;
 
 constexpr int kStartupWaitSamples = 450; // 300ms (1500 = 1s @ block rate)
 
+constexpr int kSubBlockSize = 32; // The block rate the constants above assume, 1500Hz @ 48kHz
+
+constexpr size_t kSchedulerBlockBudget = 8192; // Units of background work per block, ~ samples written
+constexpr size_t kSchedulerMaxJobs = 6;
+
 constexpr int kRandomSlewSamples = 128;
+constexpr uint32_t kRandomSeed = 0x4f4e4549; // Of the first RandomStream, "ONEI"
+constexpr size_t kRandomLanes = 4; // Streams that RandomStream::Fill() runs side by side
 
 constexpr float kA4Freq = 440.f;
 constexpr int kA4Note = 69;
@@ -78,17 +105,55 @@ constexpr int kLooperFadeSamples = 2400; // 50ms @ audio rate
 static const float kLooperFadeSamplesR = 1.f / kLooperFadeSamples;
 constexpr int kLooperTriggerFadeSamples = 240; // 5ms @ audio rate
 static const float kLooperTriggerFadeSamplesR = 1.f / kLooperTriggerFadeSamples;
+#ifdef USE_LOOPER_16BIT
+static const int32_t kLooperTotalBufferLength = 1680000; // ~17.5 seconds stereo buffer, in as much SDRAM as the float one
+typedef int16_t LooperSample;
+constexpr float kLooperSampleScale = 32767.f; // Full scale of a LooperSample
+#else
 static const int32_t kLooperTotalBufferLength = 840000; // ~8.75 seconds stereo buffer (Increased from ~5.5s)
+typedef float LooperSample;
+constexpr float kLooperSampleScale = 1.f;
+#endif
+static const float kLooperSampleScaleR = 1.f / kLooperSampleScale;
 //static const int32_t kLooperTotalBufferLength = 480000; // samples for both channels (interleaved) = ~8 seconds stereo buffer
 static const int32_t kLooperChannelBufferLength = kLooperTotalBufferLength / 2;
+constexpr int32_t kLooperGuardSamples = 4; // Mirrored at each channel edge, covers the interpolation taps
+static const int32_t kLooperChannelStride = kLooperChannelBufferLength + 2 * kLooperGuardSamples;
+static const int32_t kLooperAllocatedLength = kLooperChannelStride * 2;
+#ifdef USE_LOOPER_INTERLEAVED
+constexpr int32_t kLooperSampleStride = 2; // Distance between two frames of a channel
+constexpr int32_t kLooperChannelOffset = 1; // Distance between the channels of a frame
+#else
+constexpr int32_t kLooperSampleStride = 1;
+static const int32_t kLooperChannelOffset = kLooperChannelStride;
+#endif
+constexpr int32_t kLooperStreamPageFrames = 2100; // Frames of a page of a streamed take
+static const int32_t kLooperStreamWindowPages = kLooperChannelBufferLength / kLooperStreamPageFrames; // Pages that fit in the buffer
+constexpr int32_t kLooperStreamWindows = 32; // The take is this many buffers long, ~4.7 minutes
+static const int32_t kLooperStreamTakeLength = kLooperChannelBufferLength * kLooperStreamWindows;
+static const int32_t kLooperStreamTakePages = kLooperStreamWindowPages * kLooperStreamWindows;
+constexpr int32_t kLooperStreamPagesAhead = 16; // Paged in ahead of the heads, ~0.7s at 1x
+constexpr int32_t kLooperStreamPagesBehind = 1;
+#ifdef USE_LOOPER_STREAMING
+static const int32_t kLooperTakeLength = kLooperStreamTakeLength;
+typedef double LooperPosition; // A float has whole samples only past 2^24, and too few fractions long before
+#else
+static const int32_t kLooperTakeLength = kLooperChannelBufferLength;
+typedef float LooperPosition;
+#endif
+constexpr size_t kLooperCloudHeads = 8; // The grains that overlap
+constexpr float kLooperCloudGrainRatio = 0.25f; // Of the loop's length
+constexpr float kLooperCloudGrainMin = 2400.f; // 50ms
+constexpr float kLooperCloudGrainMax = 24000.f; // 500ms
+constexpr float kLooperCloudSpeedSpread = 0.01f; // About 17 cents
+constexpr float kLooperCloudPanSpread = 0.4f;
+constexpr float kLooperCloudGain = 0.5f; // As loud as one head, for uncorrelated grains: 1 / sqrt(kLooperCloudHeads * 0.5), the mean square of the window
 constexpr float kLooperNoiseLevel = 0.2f;
+constexpr size_t kLooperNoiseChunk = 64; // Samples of noise generated in one go
 constexpr float kLooperInputGain = 1.f;
 constexpr float kLooperResampleGain = 1.f;
 constexpr float kLooperResampleLedAtt = 1.f;
 constexpr float kLooperMakeupGain = 1.3f;
-constexpr int kLooperClearBlocks = 128; // Number of blocks of the buffer to be cleared
-static const int32_t kLooperClearBlockSize = kLooperTotalBufferLength / kLooperClearBlocks;
-static const int32_t kLooperClearBlockTypeSize = kLooperClearBlockSize * 4; // Float
 
 constexpr float kRecordOnsetLevel = 0.005f;
 constexpr float kRecordWindupLevel = 0.00001f;
@@ -99,6 +164,9 @@ constexpr int kWaveTableLength = 2048;
 constexpr int kWaveTableNofTables = 32;
 static const int kWaveTableStepLength = kLooperChannelBufferLength / kWaveTableNofTables;
 static const float kWaveTableNofTablesR = 1.f / kWaveTableNofTables;
+static const float kWaveTableStereoOffset = kWaveTableStepLength * 0.015f; // Left reads before, right after the table
+constexpr int kWaveTableNofLevels = 8; // Octave mip levels, from kWaveTableLength down to 16 samples
+constexpr int kWaveTableCacheTableSize = 2 * kWaveTableLength - (kWaveTableLength >> (kWaveTableNofLevels - 1)) + kWaveTableNofLevels; // All the levels of a table, with a guard sample each
 
 // When internally clocked, base frequency is ~0.18Hz
 // When externally clocked, min bpm is 30 (0.5Hz), max is 300 (5Hz)
@@ -111,9 +179,13 @@ constexpr int kClockUnityRatioIndex = 9;
 static const float kModClockRatios[kClockNofRatios] = { 0.015625f, 0.03125f, 0.0625f, 0.125f, 0.2f, 0.25f, 0.33f, 0.5f, 1, 2, 3, 4, 5, 8, 16, 32, 64};
 static const float kRModClockRatios[kClockNofRatios] = { 64, 32, 16, 8, 5, 4, 3, 2, 1, 0.5f, 0.33f, 0.25f, 0.2f, 0.125f, 0.0625f, 0.03125f, 0.015625f};
 constexpr float kClockTempoSamplesMin = 48; // Minimum number of tempo's samples required to detect a change
+constexpr size_t kClockEventsSize = 32; // Sync in edges and MIDI realtime messages queued between two blocks
+constexpr int kClockMidiPpqn = 24; // MIDI clocks per beat, a beat being taken as a sync in pulse
+constexpr int kClockPeriodTolerance = 2; // Samples the external clock's period can drift by before the echo follows it
 
 constexpr float kOScSineGain = 0.3f;
 static const float kOscSineFadeInc = 1.f / 2400;
+constexpr int kOscUnisonVoices = 4; // Sines per channel in unison, a multiple of 4 up to 8
 constexpr float kOScSuperSawGain = 0.4f;
 constexpr float kOScWaveTablePreGain = 3.f;
 constexpr float kOScWaveTableGain = 0.3f;
@@ -139,19 +211,35 @@ constexpr float kResoGainMin = 0.5f;
 constexpr float kResoGainMax = 1.2f;
 constexpr float kResoMakeupGain = 1.2f;
 constexpr int32_t kResoBufferSize = 2400;
+constexpr uint32_t kResoDelaySize = 4096; // Frames of the poles' delay lines, above kResoBufferSize
+constexpr size_t kResoLanes = 4; // The channels of the poles that are processed, see ResonatorBank
 constexpr float kResoInfiniteFeedbackThreshold = 0.97f; // Increased for more aggressive drones
 constexpr float kResoInfiniteFeedbackLevel = 1.05f;
 constexpr float kWavefolderMakeupGain = 0.5f;
+constexpr int kWavefolderOversampling = 2; // 1, 2 or 4, see Oversampler.h
+constexpr int kLimiterLookahead = 48; // 1ms @ audio rate, the latency of the lookahead limiter
+constexpr float kLimiterCeiling = 0.9f;
+constexpr float kLimiterReleaseCoeff = 0.0004f; // ~50ms @ audio rate
+constexpr int kCompressorDecimation = 8; // Samples between two evaluations of a compressor's gain curve
+static const float kCompressorDecimationR = 1.f / kCompressorDecimation;
+constexpr size_t kCoeffTrajectoryPoints = 4; // Coefficients computed per block by the modulated allpasses
 
 constexpr int kEffectResonator = 0;
 constexpr int kEffectWavefolder = 1;
 constexpr int kEffectStereoWidener = 2;
 constexpr int kEffectPhaser = 3;
 constexpr int kNumEffects = 4;
+constexpr int kOsc2SuperSaw = 0;
+constexpr int kOsc2WaveTable = 1;
+constexpr int kOsc2Voices = 2; // The MIDI note voices, in place of the supersaw
+constexpr int kSlotFadeSamples = 480; // 10ms @ audio rate, switching effects or osc2
+static const float kSlotFadeSamplesR = 1.f / kSlotFadeSamples;
 
 constexpr int32_t kEchoFadeSamples = 2400; // 50 ms @ audio rate
+static const float kEchoFadeSamplesR = 1.f / kEchoFadeSamples;
 constexpr int32_t kEchoMinLengthSamples = 480; // 10 ms @ audio rate
 constexpr int32_t kEchoMaxLengthSamples = 192000; // 4 seconds @ audio rate
+constexpr uint32_t kEchoDelaySize = 262144; // Frames of the delay line, above kEchoMaxLengthSamples
 constexpr int kEchoTaps = 4;
 const float kEchoTapsRatios[kEchoTaps] = { 0.75f, 0.25f, 0.375f, 1.f };  // TAP_LEFT_A (1/2 dot), TAP_LEFT_B (1/8), TAP_RIGHT_A (1/8 dot), TAP_RIGHT_B (1)
 const float kEchoTapsFeedbacks[kEchoTaps] = { 0.35f, 0.65f, 0.55f, 0.45f };
@@ -165,7 +253,16 @@ constexpr int kEchoCompThresMax = -22;
 constexpr float kEchoMakeupGain = 1.2f;
 
 constexpr int32_t kAmbienceBufferSize = 48000;
+constexpr uint32_t kAmbienceDiffuseSize = 32768; // Frames of the first diffusers' delay lines, ~0.6 s at the largest size
+constexpr uint32_t kAmbienceLastDiffuseSize = 65536; // Frames of the last diffuser's delay line, above kAmbienceBufferSize
 constexpr int kAmbienceNofDiffusers = 4;
+constexpr int kAmbienceReducedDiffusers = 1; // Allpasses of the ambience left under load, of kAmbienceNofDiffusers - 1
+constexpr int kAmbienceFdnLines = 8;
+constexpr uint32_t kAmbienceFdnSize = 32768; // Frames of the FDN's delay lines, two lines each, above the largest size
+constexpr float kAmbienceFdnModDepth = 8.f; // Samples the FDN's line lengths swing by
+constexpr float kAmbienceFdnModFreq = 0.25f; // Hz
+constexpr float kAmbienceFdnGainMax = 0.9995f; // Feedback of the lines at the longest decays
+static const float kAmbienceFdnRatios[kAmbienceFdnLines] = { 1.f, 0.887f, 0.793f, 0.705f, 0.631f, 0.563f, 0.503f, 0.449f }; // Line lengths relative to the size
 constexpr float kAmbienceLowDampMin = -0.5f;
 constexpr float kAmbienceLowDampMax = -40.f;
 constexpr float kAmbienceHighDampMin = -0.5f;
@@ -178,19 +275,62 @@ constexpr float kAmbienceMakeupGain = 1.2f;
 
 static const float kOutputFadeInc = 1.f / 16.f;
 constexpr float kOutputMakeupGain = 3.f;
+constexpr float kDcBlockingLambda = 0.995f; // Of the input and output DC blocking filters
+
+constexpr float kSleepLevel = 0.001f; // Wet level under which a stage can sleep, see TailSleep.h
+constexpr float kSleepThreshold = 0.0001f; // Peak of a tail that is considered quiet, -80dB
+
+constexpr size_t kDelayLineBlockSize = 32; // Samples of the delay taps read in one go
+
+constexpr size_t kArenaFastSize = 128 * 1024; // Bytes of internal SRAM reserved at startup for the small DSP state (~100KB used)
+constexpr size_t kArenaFastArrayMax = 32 * 1024; // Bytes, larger arrays go in SDRAM
+constexpr size_t kArenaAlignment = 8;
+constexpr size_t kArenaArrayAlignment = 32; // Cortex-M7 cache line
+
+constexpr float kProfilerCpuFreq = 480000000.f; // STM32H7 @ 480MHz
+constexpr size_t kProfilerRingSize = 64; // Blocks averaged by the profiler
+constexpr size_t kLoadMeterBlocks = 64; // Blocks averaged by the load meter, see LoadMeter.h
+
+constexpr uint8_t kMidiAllNotesOff = 123; // CC that ends the MIDI note mode
+constexpr uint8_t kMidiTimingClock = 0xf8; // Realtime, kClockMidiPpqn per beat
+constexpr uint8_t kMidiStart = 0xfa; // Realtime, the next clock is the first beat
+constexpr uint8_t kMidiContinue = 0xfb; // Realtime, the clocks resume
+constexpr uint8_t kMidiStop = 0xfc; // Realtime, the clocks stop
+constexpr size_t kVoicesMax = 4; // MoogVCO voices played by MIDI notes
+constexpr float kVoicesAttackSec = 0.005f;
+constexpr float kVoicesReleaseSec = 0.3f;
+constexpr float kVoicesIdleLevel = 0.0001f; // Envelope level under which a released voice stops
+constexpr float kVoicesGain = 0.5f; // Headroom for the voices summed
+constexpr float kVoicesLoadHigh = 0.85f; // DSP load above which a voice is dropped
+constexpr float kVoicesLoadLow = 0.6f; // DSP load under which a voice is given back
+constexpr size_t kVoicesAdaptBlocks = kLoadMeterBlocks; // Blocks between two voice count changes
+constexpr float kQualityLoadHigh = 0.9f; // DSP load above which a quality step is taken, past the voices'
+constexpr float kQualityLoadLow = 0.5f; // DSP load under which a quality step is given back
+constexpr size_t kQualityAdaptBlocks = kLoadMeterBlocks * 2; // Blocks between two quality changes
+constexpr size_t kSnapshotSlots = 8; // Snapshots of the controls in the bank, recalled by MIDI program change
+constexpr int kSnapshotSaveIdleBlocks = 3000; // Blocks without a store or a morph before the bank is saved - 2s (1500 = 1s @ block rate)
+constexpr float kSnapshotMorphSecMax = 10.f; // Morph time of CC kMidiSnapshotMorph at 127
+constexpr uint8_t kMidiSnapshotMorph = 20; // CC that sets the morph time of the next recalls
+constexpr uint8_t kMidiSnapshotStore = 21; // CC that stores the controls in the slot of its value
+constexpr size_t kProfilerReportSize = 15; // Bytes of a profiler SysEx report
+constexpr int kProfilerReportBlocks = 75; // Blocks between two reports - 50ms (1500 = 1s @ block rate)
 
 // Analog oscillator character constants
 constexpr float kOscDriftCentsMax = 3.0f;      // ±3 cents thermal drift
 constexpr float kOscDriftUpdateSec = 0.5f;     // New drift target every 0.5s
+constexpr int kOscDriveOversampling = 1;       // 1, 2 or 4, the drive is mild enough not to need it
 constexpr float kOscDriftSmoothCoeff = 0.0001f; // 1-pole smoothing coefficient
 constexpr float kOscSubMix = 0.3f;             // Sub-oscillator mix level (30%)
 
 constexpr float kParamCatchUpDelta = 0.005f;
+constexpr float kParamIdleDelta = 0.001f; // Change of an idle knob or fader that wakes it up, about 4 steps of the 12 bit ADC
 
 constexpr int kParamStartMovementLimit = 75; // Samples required to detect the start of a movement - 50ms (1500 = 1s @ block rate)
 constexpr int kParamStopMovementLimit = 225; // Samples required to detect the stop of a movement - 150ms (1500 = 1s @ block rate)
 constexpr int kResetLimit = 75; // Samples waited for both RECORD and RANDOM buttons to be pressed for resetting parameters - 50ms (1500 = 1s @ block rate)
 constexpr int kSaveLimit = 3000; // Samples waited for MOD/CV button to be pressed for saving parameters - 2s (1500 = 1s @ block rate)
+constexpr size_t kSaveMessagesPerBlock = 4; // MIDI messages of a settings save sent per block
+constexpr size_t kSaveMessageCost = 64; // Units of background work of a MIDI message
 constexpr int kGateLimit = 750; // Samples waited for a button gate to go off - 500ms (1500 = 1s @ block rate)
 constexpr int kHoldLimit = 75; // Samples waited for a pressed button to be considered held - 50ms (1500 = 1s @ block rate)
 
@@ -305,6 +445,54 @@ struct PatchCvs
     float ambienceSpacetime;
 };
 
+/**
+ * @brief The destinations of the modulation, see ControlStage.
+ *        The targets are clamped to their range, the offsets are added to a
+ *        base value that the module interpolates.
+ */
+enum PatchParam
+{
+    PARAM_INPUT_VOL,
+
+    PARAM_LOOPER_VOL,
+    PARAM_LOOPER_SPEED_OFFSET,
+    PARAM_LOOPER_START_OFFSET,
+    PARAM_LOOPER_LENGTH_OFFSET,
+
+    PARAM_OSC1_VOL,
+    PARAM_OSC2_VOL,
+    PARAM_OSC_PITCH_OFFSET,
+    PARAM_OSC_DETUNE,
+
+    PARAM_FILTER_CUTOFF,
+    PARAM_FILTER_RESONANCE,
+
+    PARAM_RESONATOR_TUNE,
+    PARAM_RESONATOR_FEEDBACK,
+    PARAM_RESONATOR_DISSONANCE,
+
+    PARAM_ECHO_REPEATS,
+    PARAM_ECHO_DENSITY,
+
+    PARAM_AMBIENCE_DECAY,
+    PARAM_AMBIENCE_SPACETIME,
+
+    PARAM_LAST
+};
+
+/**
+ * @brief The modulated parameters of a block, computed once by ControlStage.
+ */
+struct alignas(kArenaArrayAlignment) PatchParams
+{
+    float values[PARAM_LAST];
+
+    inline float Get(PatchParam param) const
+    {
+        return values[param];
+    }
+};
+
 enum FuncMode
 {
     FUNC_MODE_NONE,
@@ -330,25 +518,53 @@ enum StartupPhase
     STARTUP_DONE,
 };
 
+/**
+ * @brief The steps the quality governor takes down under load, in order: at
+ *        the level n, the first n are taken. See Governor.h.
+ */
+enum QualityStep
+{
+    QUALITY_OVERSAMPLING, // The wavefolder runs at the base rate
+    QUALITY_AMBIENCE_DIFFUSERS, // Only kAmbienceReducedDiffusers of the ambience's allpasses
+    QUALITY_ECHO_VIBRATO, // No vibrato in the echo's feedback
+    QUALITY_TONAL_SHADOW, // No tonal shadow
+    QUALITY_WAVETABLE_INTERPOLATION, // The wavetables are read at the nearest sample
+    QUALITY_LAST,
+};
+
+class Profiler;
+class LoadMeter;
+class VoicePool;
+class LooperStore;
+class SnapshotBank;
+class SnapshotStore;
+class SaveQueue;
+class ClockEvents;
+
 struct PatchState
 {
     float sampleRate;
     float blockRate;
     int blockSize;
+    int hostBlockSize; // The platform's, a multiple of blockSize with USE_SUB_BLOCKS
 
-    FloatArray inputLevel;
-    FloatArray efModLevel;
+    // The input's level over the last block, rectified mean and RMS, for
+    // the leds and the envelope follower.
+    float inputLevel;
+    float inputRms;
 
     bool modActive;
     float modValue;
 
     ClockSource clockSource;
     TapTempo* tempo;
+    ClockEvents* clockEvents; // Set by the clock, for the callbacks
 
-    bool syncIn;
     bool clockReset;
+    size_t clockOffset; // The sample of the block that clockReset falls on
     bool clockTick;
     size_t clockSamples;
+    float clockPeriod; // The external clock's, in the tempo's samples to the audio sample
 
     bool clearLooperFlag;
     bool oscPitchCenterFlag;
@@ -378,13 +594,55 @@ struct PatchState
     FuncMode funcMode;
 
     StartupPhase startupPhase;
+
+    const PatchParams* params;
+
+    Profiler* profiler;
+    LoadMeter* loadMeter; // Set by the platform, NULL for the voices and the quality not to adapt to the load
+    VoicePool* voices;
+    LooperStore* looperStore; // Set by the platform for USE_LOOPER_STREAMING, else the take is kept in memory
+    SnapshotBank* snapshots;
+    SnapshotStore* snapshotStore; // Set by the platform to keep the bank, else it's kept in memory
+    SaveQueue* saveQueue; // Set by the ui, NULL when there's nothing to save to
+
+    int qualityLevel; // The quality steps taken, see QualityStep
 };
 
+inline bool IsQualityReduced(const PatchState* patchState, QualityStep step)
+{
+    return step < patchState->qualityLevel;
+}
+
 inline bool AreEquals(float val1, float val2, float d = kEps)
 {
     return fabs(val1 - val2) <= d;
 }
 
+/**
+ * @brief Sets the FPU of the calling thread to flush denormals to zero, and
+ *        to return the default NaN, so that the filters and feedback paths
+ *        that decay into silence don't slow down on denormals. Called once
+ *        by the patch before anything is processed.
+ *        On the native builds: FZ and DN of the FPCR, or FTZ and DAZ of the
+ *        MXCSR, SSE having no default NaN mode.
+ */
+inline void EnableFlushToZero()
+{
+#if defined(__arm__)
+    uint32_t fpscr;
+    asm volatile("vmrs %0, fpscr" : "=r"(fpscr));
+    fpscr |= (1 << 24) | (1 << 25); // FZ, DN
+    asm volatile("vmsr fpscr, %0" : : "r"(fpscr));
+#elif defined(__aarch64__)
+    uint64_t fpcr;
+    asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+    fpcr |= (1 << 24) | (1 << 25); // FZ, DN
+    asm volatile("msr fpcr, %0" : : "r"(fpcr));
+#elif defined(__SSE__)
+    _mm_setcsr(_mm_getcsr() | 0x8040); // FTZ, DAZ
+#endif
+}
+
 /**
  * @brief Taken from DaisySP.
  *
@@ -434,6 +692,74 @@ inline float Clamp(float in, float min = 0.f, float max = 1.f)
     return Min(Max(in, min), max);
 }
 
+/**
+ * @brief Convert a sample to the looper's storage format, 16 bit integers
+ *        are clipped and rounded.
+ */
+inline LooperSample ToLooperSample(float value)
+{
+#ifdef USE_LOOPER_16BIT
+    return static_cast<LooperSample>(rintf(Clamp(value, -1.f, 1.f) * kLooperSampleScale));
+#else
+    return value;
+#endif
+}
+
+inline float FromLooperSample(LooperSample sample)
+{
+    return sample * kLooperSampleScaleR;
+}
+
+/**
+ * @brief Convert a value to a half precision float, for the snapshots.
+ *        Rounded to the nearest, the values too small for a normal half are
+ *        flushed to zero and the ones too large become infinite.
+ */
+inline uint16_t FloatToHalf(float value)
+{
+    union { float f; uint32_t u; } bits = { value };
+    uint16_t sign = (bits.u >> 16) & 0x8000;
+    if (value != value)
+    {
+        return 0x7e00; // NaN
+    }
+    uint32_t magnitude = bits.u & 0x7fffffff;
+    if (magnitude < 0x38800000)
+    {
+        return sign; // Under 2^-14
+    }
+    // Rebias the exponent and round the mantissa, the carry goes to the
+    // exponent.
+    magnitude = (magnitude - 0x38000000 + 0x1000) >> 13;
+    if (magnitude >= 0x7c00)
+    {
+        return sign | 0x7c00;
+    }
+
+    return sign | magnitude;
+}
+
+inline float HalfToFloat(uint16_t half)
+{
+    union { uint32_t u; float f; } bits;
+    uint32_t sign = (half & 0x8000) << 16;
+    uint32_t magnitude = half & 0x7fff;
+    if (magnitude >= 0x7c00)
+    {
+        bits.u = sign | 0x7f800000 | ((magnitude & 0x3ff) << 13); // Inf, NaN
+    }
+    else if (magnitude < 0x400)
+    {
+        bits.u = sign; // Zero, as are the subnormals
+    }
+    else
+    {
+        bits.u = sign | ((magnitude << 13) + 0x38000000);
+    }
+
+    return bits.f;
+}
+
 /**
  * @brief Taken from DaisySP.
  *
@@ -459,6 +785,132 @@ float Power(float f, float n = 2, bool approx = false)
     return pow(f, n);
 }
 
+/**
+ * @brief 2^x for x in [0, 1], as a series, for the tables built at compile
+ *        time.
+ */
+constexpr double ConstExp2(double x)
+{
+    double y = x * 0.693147180559945309;
+    double term = 1.0;
+    double sum = 1.0;
+    for (int i = 1; i < 24; i++)
+    {
+        term *= y / i;
+        sum += term;
+    }
+
+    return sum;
+}
+
+/**
+ * @brief log2(x) for x > 0, as a series, for the tables built at compile
+ *        time.
+ */
+constexpr double ConstLog2(double x)
+{
+    // x = m * 2^e with m in [1, 2), then ln(m) = 2 * atanh((m - 1) / (m + 1)).
+    int e = 0;
+    for (; x >= 2.0; x *= 0.5)
+    {
+        e++;
+    }
+    for (; x < 1.0; x *= 2.0)
+    {
+        e--;
+    }
+    double z = (x - 1.0) / (x + 1.0);
+    double z2 = z * z;
+    double term = z;
+    double sum = 0;
+    for (int i = 1; i < 40; i += 2)
+    {
+        sum += term / i;
+        term *= z2;
+    }
+
+    return e + 2.0 * sum / 0.693147180559945309;
+}
+
+/**
+ * @brief x^y for x >= 0, for the tables built at compile time.
+ */
+constexpr double ConstPow(double x, double y)
+{
+    if (x <= 0)
+    {
+        return 0;
+    }
+    double p = y * ConstLog2(x);
+    int n = static_cast<int>(p);
+    n -= p < n ? 1 : 0;
+    double r = ConstExp2(p - n);
+    for (; n > 0; n--)
+    {
+        r *= 2.0;
+    }
+    for (; n < 0; n++)
+    {
+        r *= 0.5;
+    }
+
+    return r;
+}
+
+constexpr int kCentsTableSize = 128; // Steps per octave
+
+struct CentsTable
+{
+    float ratios[kCentsTableSize + 1];
+};
+
+constexpr CentsTable MakeCentsTable()
+{
+    CentsTable table{};
+    for (int i = 0; i <= kCentsTableSize; i++)
+    {
+        table.ratios[i] = static_cast<float>(ConstExp2(static_cast<double>(i) / kCentsTableSize));
+    }
+
+    return table;
+}
+
+// The ratios of the steps of an octave, 2^(i / kCentsTableSize).
+static constexpr CentsTable kCentsTable = MakeCentsTable();
+
+/**
+ * @brief 2^x, interpolated from kCentsTable, the whole octaves going to the
+ *        exponent. Within 4e-6 of the exact value, from 2^-126 to 2^127.
+ */
+inline float Pow2(float x)
+{
+    float y = x * kCentsTableSize;
+    int32_t i = static_cast<int32_t>(floorf(y));
+    float f = y - i;
+
+    // Whole octaves, the floor division keeps the step positive.
+    int32_t octaves = i >> 7;
+    i &= kCentsTableSize - 1;
+    static_assert(kCentsTableSize == 1 << 7, "The octave shift must match kCentsTableSize");
+    octaves = octaves < -126 ? -126 : (octaves > 127 ? 127 : octaves);
+
+    union
+    {
+        uint32_t u;
+        float f;
+    } scale = {uint32_t(octaves + 127) << 23};
+
+    return (kCentsTable.ratios[i] + (kCentsTable.ratios[i + 1] - kCentsTable.ratios[i]) * f) * scale.f;
+}
+
+/**
+ * @brief The frequency ratio of an interval.
+ */
+inline float CentsToRatio(float cents)
+{
+    return Pow2(cents * (1.f / 1200.f));
+}
+
 /**
  * @brief Frequency to period in samples conversion.
  *
@@ -479,7 +931,7 @@ inline float F2S(float freq, float sampleRate = 48000.f)
  */
 inline float M2F(float m)
 {
-    return Power(2.f, (m - kA4Note) / kSemi4Oct) * kA4Freq;
+    return Pow2((m - kA4Note) * (1.f / kSemi4Oct)) * kA4Freq;
 }
 
 /**
@@ -523,11 +975,130 @@ enum RandomAmount
     RANDOM_CUSTOM,
 };
 
-inline float RandomFloat(float min = 0.f, float max = kOne)
+inline uint32_t* DefaultRandomSeed()
+{
+    static uint32_t seed = kRandomSeed;
+
+    return &seed;
+}
+
+inline uint32_t* &RandomSeed()
+{
+    static INSTANCE_LOCAL uint32_t* seed = DefaultRandomSeed();
+
+    return seed;
+}
+
+/**
+ * @brief The seeds of the streams that aren't given one, in the order they
+ *        are made, so that a render starts from the same ones every time.
+ */
+inline uint32_t NextRandomSeed()
+{
+    *RandomSeed() += 0x9e3779b9;
+
+    return *RandomSeed();
+}
+
+/**
+ * @brief Starts the seeds over, for the streams made next to get the same
+ *        ones as a render made from scratch, or to start from another seed.
+ */
+inline void ResetRandomSeeds(uint32_t seed = kRandomSeed)
+{
+    *RandomSeed() = seed;
+}
+
+/**
+ * @brief Makes the streams made next on this thread take their seeds from
+ *        seeds, which an instance keeps as its own, NULL going back to the
+ *        default ones. See USE_INSTANCES.
+ */
+inline void BindRandomSeeds(uint32_t* seeds)
 {
-    return min == max ? min : min + randf() * (max - min);
+    RandomSeed() = seeds ? seeds : DefaultRandomSeed();
 }
 
+/**
+ * @brief A xorshift32 generator, one per module. Fill() runs kRandomLanes
+ *        streams side by side, which don't depend on one another and can be
+ *        pipelined, or vectorized where there's SIMD.
+ */
+class RandomStream
+{
+private:
+    uint32_t lanes_[kRandomLanes];
+
+    static inline uint32_t Step(uint32_t &x)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+
+        return x;
+    }
+
+    static inline uint32_t Hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352d;
+        x ^= x >> 15;
+        x *= 0x846ca68b;
+        x ^= x >> 16;
+
+        return 0 == x ? 1 : x; // xorshift stays at 0
+    }
+
+public:
+    RandomStream(uint32_t seed = 0)
+    {
+        Seed(seed);
+    }
+    ~RandomStream() {}
+
+    /**
+     * @param seed 0 for the next of the default seeds
+     */
+    void Seed(uint32_t seed)
+    {
+        seed = 0 == seed ? NextRandomSeed() : seed;
+        for (size_t k = 0; k < kRandomLanes; k++)
+        {
+            lanes_[k] = Hash(seed + k * 0x9e3779b9);
+        }
+    }
+
+    inline uint32_t Next()
+    {
+        return Step(lanes_[0]);
+    }
+
+    /**
+     * @brief From min to max.
+     */
+    inline float NextFloat(float min = 0.f, float max = kOne)
+    {
+        return min + (Next() >> 8) * (1.f / 16777216.f) * (max - min);
+    }
+
+    void Fill(float* output, size_t size, float min = 0.f, float max = kOne)
+    {
+        float scale = (max - min) * (1.f / 16777216.f);
+        size_t i = 0;
+        for (; i + kRandomLanes <= size; i += kRandomLanes)
+        {
+            for (size_t k = 0; k < kRandomLanes; k++)
+            {
+                output[i + k] = min + (Step(lanes_[k]) >> 8) * scale;
+            }
+        }
+        for (; i < size; i++)
+        {
+            output[i] = min + (Step(lanes_[0]) >> 8) * scale;
+        }
+    }
+};
+
 /**
  * @brief Maps the value that ranges from aMin to aMax to a value that
  *        ranges from bMin to bMax. Supports inverted ranges.
@@ -636,7 +1207,8 @@ inline float Mix4(float a, float b, float c, float d)
 
 inline float Db2A(float db)
 {
-    return Power(10.f, db / 20.f);
+    // 10^(db / 20) = 2^(db * log2(10) / 20)
+    return Pow2(db * 0.166096404744368f);
 }
 
 inline float LinearCrossFade(float a, float b, float pos)
@@ -704,6 +1276,22 @@ float CheapEqualPowerCrossFade(float from, float to, float pos, float p = kEqual
 
     return from * d * d + to * c * c;
 }
+/**
+ * @brief The gains CheapEqualPowerCrossFade() applies, for a position that
+ *        doesn't change over the block.
+ */
+void CheapEqualPowerGains(float pos, float &fromGain, float &toGain, float p = kEqualCrossFadeP)
+{
+    float invPos = 1.f - pos;
+    float k = -6.0026608f + p * (6.8773512f - 1.5838104f * p);
+    float a = pos * invPos;
+    float b = a * (1.f + k * a);
+    float c = (b + pos);
+    float d = (b + invPos);
+
+    fromGain = d * d;
+    toGain = c * c;
+}
 void CheapEqualPowerCrossFade(AudioBuffer &from, AudioBuffer &to, float pos, AudioBuffer &out, float p = kEqualCrossFadeP)
 {
     float invPos = 1.f - pos;
@@ -786,6 +1374,33 @@ float SoftClip(float x)
   }
 }
 
+/**
+ * @brief tanh as a 7/6 Pade approximant, within 1e-4 of tanhf. Past +-4.97
+ *        it's 1.
+ */
+float FastTanh(float x)
+{
+    x = Clamp(x, -4.97f, 4.97f);
+    float x2 = x * x;
+
+    return x * (135135.f + x2 * (17325.f + x2 * (378.f + x2))) / (135135.f + x2 * (62370.f + x2 * (3150.f + x2 * 28.f)));
+}
+
+/**
+ * @brief sin(2 * pi * phase), a minimax polynomial over a quarter of the
+ *        cycle that the phase is folded to, within 1e-6 of sinf. The phase
+ *        is in cycles, in [0, 1).
+ */
+inline float FastSine(float phase)
+{
+    float r = phase - 0.25f;
+    r -= r >= 0.5f ? 1.f : 0.f;
+    float x = 0.25f - fabsf(r);
+    float x2 = x * x;
+
+    return x * (6.28316394f + x2 * (-41.3371315f + x2 * (81.3404239f + x2 * -70.9934295f)));
+}
+
 float HardClip(float x, float limit = 1.f)
 {
     return Clamp(x, -limit, limit);
@@ -862,64 +1477,46 @@ private:
 };
 
 template<typename T, int size>
-class Lut
+struct LutTable
 {
-public:
-    enum Type
-    {
-        LUT_TYPE_EXPO,
-        LUT_TYPE_LINEAR,
-    };
-
-private:
-    T lut_[size];
-    T min_;
-    T max_;
-    Type type_;
-    float expoY_ = 3;
-    HysteresisQuantizer quantizer_;
+    T values[size];
+};
 
-    void Linear()
+/**
+ * @brief A table from min to max, min + (max - min) * x^expo for x from 0
+ *        to 1, built at compile time so that it's in flash.
+ */
+template<typename T, int size>
+constexpr LutTable<T, size> MakeLut(T min, T max, double expo = 1.0)
+{
+    LutTable<T, size> table{};
+    for (int i = 0; i < size; i++)
     {
-        float d = (1.f / (size - 1));
-        for (size_t i = 0; i < size; i++)
-        {
-            float x = d * i;
-            lut_[i] = min_ + (max_ - min_) * x;
-        }
+        double x = static_cast<double>(i) / (size - 1);
+        double y = 1.0 == expo || size - 1 == i ? x : ConstPow(x, expo);
+        table.values[i] = static_cast<T>(min + (max - min) * y);
     }
 
-    void Expo()
-    {
-        float d = (1.f / (size - 1));
-        for (size_t i = 0; i < size; i++)
-        {
-            float x = d * i;
-            lut_[i] = min_ + (max_ - min_) * (x == 1 ? 1 : fast_powf(x, expoY_));
-        }
-    }
+    return table;
+}
+
+/**
+ * @brief The values of a table built with MakeLut(), picked with hysteresis.
+ */
+template<typename T, int size>
+class Lut
+{
+private:
+    const T* lut_;
+    HysteresisQuantizer quantizer_;
 
 public:
-    Lut(T min, T max, Type type = LUT_TYPE_LINEAR) : min_{min}, max_{max}, type_{type}
+    Lut(const LutTable<T, size> &table) : lut_{table.values}
     {
         quantizer_.Init(size, 0.15f, false);
-
-        if (LUT_TYPE_EXPO == type)
-        {
-            Expo();
-        }
-        else if (LUT_TYPE_LINEAR == type)
-        {
-            Linear();
-        }
     }
     ~Lut() {}
 
-    void SetExpo(float y)
-    {
-        expoY_ = y;
-    }
-
     T GetValue(int pos)
     {
         return lut_[pos];
@@ -931,45 +1528,62 @@ public:
     }
 };
 
-// These is taken and adapted from code found in Emilie Gillet's eurorack repo.
-float Modulate(
-    float baseValue,
+/**
+ * @brief Maps a mod or CV amount knob to [-1, 1], with a deadband in the
+ *        center.
+ */
+inline float AttenuverterAmount(float amount)
+{
+    amount = CenterMap(amount);
+
+    return amount >= -0.1f && amount <= 0.1f ? 0.f : amount;
+}
+
+/**
+ * @brief Reduce noise when there's nothing connected to the CV.
+ */
+inline float DenoiseCv(float cvValue)
+{
+    return cvValue >= -kCvMinThreshold && cvValue <= kCvMinThreshold ? kCvMinThreshold : cvValue;
+}
+
+/**
+ * @brief What Modulate() adds to the base value, before the clamping.
+ */
+float ModulationOffset(
     float modAmount,
     float modValue,
     float cvAmount = 0,
     float cvValue = 0,
-    float minValue = -1.f,
-    float maxValue = 1.f,
     bool modAttenuverters = false,
     bool cvAttenuverters = false
 ) {
     if (modAttenuverters)
     {
-        modAmount = CenterMap(modAmount);
-        // Deadband in the center.
-        if (modAmount >= -0.1f && modAmount <= 0.1f)
-        {
-            modAmount = 0.f;
-        }
+        modAmount = AttenuverterAmount(modAmount);
     }
 
     if (cvAttenuverters)
     {
-        cvAmount = CenterMap(cvAmount);
-        // Deadband in the center.
-        if (cvAmount >= -0.1f && cvAmount <= 0.1f)
-        {
-            cvAmount = 0.f;
-        }
+        cvAmount = AttenuverterAmount(cvAmount);
     }
 
-    // Reduce noise when there's nothing connected to the CV.
-    if (cvValue >= -kCvMinThreshold && cvValue <= kCvMinThreshold)
-    {
-        cvValue = kCvMinThreshold;
-    }
+    return modAmount * modValue + cvAmount * DenoiseCv(cvValue);
+}
 
-    baseValue += modAmount * modValue + cvAmount * cvValue;
+// These is taken and adapted from code found in Emilie Gillet's eurorack repo.
+float Modulate(
+    float baseValue,
+    float modAmount,
+    float modValue,
+    float cvAmount = 0,
+    float cvValue = 0,
+    float minValue = -1.f,
+    float maxValue = 1.f,
+    bool modAttenuverters = false,
+    bool cvAttenuverters = false
+) {
+    baseValue += ModulationOffset(modAmount, modValue, cvAmount, cvValue, modAttenuverters, cvAttenuverters);
     CONSTRAIN(baseValue, minValue, maxValue);
 
     return baseValue;
@@ -2,9 +2,15 @@
 
 #include <cmath>
 #include "Commons.h"
+#include "Arena.h"
 
 /**
  * https://git.iem.at/audioplugins/IEMPluginSuite/blob/master/resources/Compressor.h
+ *
+ * Stereo linked: the detector follows the louder channel, sample by sample,
+ * and both get the same gain. The gain curve is only evaluated every
+ * kCompressorDecimation samples, in the log domain (fast_powf), and ramped
+ * linearly in between.
  */
 class Compressor
 {
@@ -21,12 +27,32 @@ private:
     float cteRL_;
 
     // State variables
-    float leftS1_ = 0.f, rightS1_ = 0.f;
+    float s1_ = 0.f;
+    float gain_ = 1.f, gainInc_ = 0.f;
+    int counter_ = 0;
+
+    inline void Detect(float left, float right)
+    {
+        // Ballistics filter and envelope generation
+        float sideInput = Max(fabsf(left), fabsf(right));
+        float cte = (sideInput >= s1_ ? cteAT_ : cteRL_);
+        s1_ = sideInput + cte * (s1_ - sideInput);
+
+        // Compressor transfer function, at the decimated rate
+        if (0 == counter_--)
+        {
+            counter_ = kCompressorDecimation - 1;
+            float cv = (s1_ <= thrlin_ ? 1.f : fast_powf(s1_ * thrlinr_, expo_));
+            gainInc_ = (cv - gain_) * kCompressorDecimationR;
+        }
+        gain_ += gainInc_;
+    }
 
 public:
     Compressor(float sampleRate)
     {
         sampleRate_ = sampleRate;
+        threshold_ = 0.f;
 
         setRatio(4.f);
         setAttack(1.f);
@@ -40,12 +66,12 @@ public:
 
     static Compressor* create(float sampleRate)
     {
-        return new Compressor(sampleRate);
+        return ArenaCreate<Compressor>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(Compressor* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     void setThreshold(float value)
@@ -78,20 +104,11 @@ public:
         cteRL_ = exp (-2.f * M_PI * 1000.f / release_ / sampleRate_);
     }
 
-    float process(float input)
+    inline void process(float &left, float &right)
     {
-        float leftSideInput = fabs(input);
-
-        // Ballistics filter and envelope generation
-        float leftCte = (leftSideInput >= leftS1_ ? cteAT_ : cteRL_);
-        float leftEnv = leftSideInput + leftCte * (leftS1_ - leftSideInput);
-        leftS1_ = leftEnv;
-
-        // Compressor transfer function
-        float leftCv = (leftEnv <= thrlin_ ? 1.f : fast_powf(leftEnv * thrlinr_, expo_));
-
-        // Processing
-        return input * leftCv;
+        Detect(left, right);
+        left *= gain_;
+        right *= gain_;
     }
 
     void process(AudioBuffer &input, AudioBuffer &output)
@@ -104,26 +121,9 @@ public:
 
         for (int i = 0; i < size; i++)
         {
-            // Detector (peak)
-            float leftSideInput = abs(leftIn[i]);
-            float rightSideInput = abs(rightIn[i]);
-
-            // Ballistics filter and envelope generation
-            float leftCte = (leftSideInput >= leftS1_ ? cteAT_ : cteRL_);
-            float leftEnv = leftSideInput + leftCte * (leftS1_ - leftSideInput);
-            leftS1_ = leftEnv;
-
-            float rightCte = (rightSideInput >= rightS1_ ? cteAT_ : cteRL_);
-            float rightEnv = rightSideInput + rightCte * (rightS1_ - rightSideInput);
-            rightS1_ = rightEnv;
-
-            // Compressor transfer function
-            float leftCv = (leftEnv <= thrlin_ ? 1.f : fast_powf(leftEnv / thrlin_, expo_));
-            float rightCv = (rightEnv <= thrlin_ ? 1.f : fast_powf(rightEnv / thrlin_, expo_));
-
-            // Processing
-            leftOut[i] = leftIn[i] * leftCv;
-            rightOut[i] = rightIn[i] * rightCv;
+            Detect(leftIn[i], rightIn[i]);
+            leftOut[i] = leftIn[i] * gain_;
+            rightOut[i] = rightIn[i] * gain_;
         }
     }
 };
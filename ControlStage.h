@@ -0,0 +1,200 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include <float.h>
+
+/**
+ * @brief A modulation destination: where its inputs are, and its range.
+ */
+struct ModRoute
+{
+    const float* base;
+    const float* modAmount;
+    const float* cvAmount;
+    const float* cvValue;
+    float min, max;
+
+    // The inputs and the mod amount of the last evaluation, to skip the
+    // destination while they don't change.
+    float last[4];
+    float modScale;
+};
+
+/**
+ * @brief The control rate part of the block: once the UI has been polled and
+ *        the modulation has run, evaluates all the modulation destinations
+ *        into a PatchParams snapshot. The audio modules read them from
+ *        patchState->params only, so that the whole block sees the same
+ *        values.
+ *        The destinations are the rows of a routing matrix. The rows whose
+ *        inputs changed are gathered into arrays and evaluated in one loop,
+ *        the others keep their values. A new destination just needs a
+ *        PatchParam and a SetRoute().
+ */
+class ControlStage
+{
+private:
+    PatchCtrls* patchCtrls_;
+    PatchCvs* patchCvs_;
+    PatchState* patchState_;
+
+    PatchParams* params_;
+    ModRoute routes_[PARAM_LAST];
+
+    // The rows being evaluated.
+    int rows_[PARAM_LAST];
+    float base_[PARAM_LAST];
+    float modAmount_[PARAM_LAST];
+    float cvAmount_[PARAM_LAST];
+    float cvValue_[PARAM_LAST];
+    float min_[PARAM_LAST];
+    float max_[PARAM_LAST];
+    float value_[PARAM_LAST];
+    float modScale_[PARAM_LAST];
+
+    float zero_;
+    float lastModValue_;
+    bool lastModAttenuverters_;
+    bool lastCvAttenuverters_;
+    bool init_;
+
+    void SetRoute(PatchParam param, const float* base, const float* modAmount, const float* cvAmount, const float* cvValue, float min, float max)
+    {
+        ModRoute& route = routes_[param];
+        route.base = base ? base : &zero_;
+        route.modAmount = modAmount ? modAmount : &zero_;
+        route.cvAmount = cvAmount ? cvAmount : &zero_;
+        route.cvValue = cvValue ? cvValue : &zero_;
+        route.min = min;
+        route.max = max;
+        route.modScale = 0;
+    }
+
+    /**
+     * @brief An offset has no base and isn't clamped.
+     */
+    void SetOffsetRoute(PatchParam param, const float* modAmount, const float* cvAmount, const float* cvValue)
+    {
+        SetRoute(param, NULL, modAmount, cvAmount, cvValue, -FLT_MAX, FLT_MAX);
+    }
+
+public:
+    ControlStage(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
+    {
+        patchCtrls_ = patchCtrls;
+        patchCvs_ = patchCvs;
+        patchState_ = patchState;
+
+        params_ = ArenaCreate<PatchParams>(MEMORY_REGION_FAST);
+        patchState_->params = params_;
+
+        zero_ = 0;
+        lastModValue_ = 0;
+        lastModAttenuverters_ = false;
+        lastCvAttenuverters_ = false;
+        init_ = true;
+
+        PatchCtrls* c = patchCtrls_;
+        PatchCvs* v = patchCvs_;
+
+        SetRoute(PARAM_INPUT_VOL, &c->inputVol, &c->inputVolModAmount, &c->inputVolCvAmount, &v->inputVol, 0.f, 1.f);
+
+        SetRoute(PARAM_LOOPER_VOL, &c->looperVol, &c->looperVolModAmount, &c->looperVolCvAmount, &v->looperVol, 0.f, 1.f);
+        SetOffsetRoute(PARAM_LOOPER_SPEED_OFFSET, &c->looperSpeedModAmount, &c->looperSpeedCvAmount, &v->looperSpeed);
+        SetOffsetRoute(PARAM_LOOPER_START_OFFSET, &c->looperStartModAmount, &c->looperStartCvAmount, &v->looperStart);
+        SetOffsetRoute(PARAM_LOOPER_LENGTH_OFFSET, &c->looperLengthModAmount, &c->looperLengthCvAmount, &v->looperLength);
+
+        SetRoute(PARAM_OSC1_VOL, &c->osc1Vol, &c->osc1VolModAmount, &c->osc1VolCvAmount, &v->osc1Vol, 0.f, 1.f);
+        SetRoute(PARAM_OSC2_VOL, &c->osc2Vol, &c->osc2VolModAmount, &c->osc2VolCvAmount, &v->osc2Vol, 0.f, 1.f);
+        // The pitch CV goes through the UI's V/Oct tracking instead.
+        SetOffsetRoute(PARAM_OSC_PITCH_OFFSET, &c->oscPitchModAmount, NULL, NULL);
+        SetRoute(PARAM_OSC_DETUNE, &c->oscDetune, &c->oscDetuneModAmount, &c->oscDetuneCvAmount, &v->oscDetune, 0.f, 1.f);
+
+        SetRoute(PARAM_FILTER_CUTOFF, &c->filterCutoff, &c->filterCutoffModAmount, &c->filterCutoffCvAmount, &v->filterCutoff, -1.f, 1.f);
+        SetRoute(PARAM_FILTER_RESONANCE, &c->filterResonance, &c->filterResonanceModAmount, &c->filterResonanceCvAmount, &v->filterResonance, -1.f, 1.f);
+
+        SetRoute(PARAM_RESONATOR_TUNE, &c->resonatorTune, &c->resonatorTuneModAmount, &c->resonatorTuneCvAmount, &v->resonatorTune, -1.f, 1.f);
+        SetRoute(PARAM_RESONATOR_FEEDBACK, &c->resonatorFeedback, &c->resonatorFeedbackModAmount, &c->resonatorFeedbackCvAmount, &v->resonatorFeedback, -1.f, 1.f);
+        SetRoute(PARAM_RESONATOR_DISSONANCE, &c->resonatorDissonance, NULL, NULL, NULL, -1.f, 1.f);
+
+        SetRoute(PARAM_ECHO_REPEATS, &c->echoRepeats, &c->echoRepeatsModAmount, &c->echoRepeatsCvAmount, &v->echoRepeats, -1.f, 1.f);
+        SetRoute(PARAM_ECHO_DENSITY, &c->echoDensity, &c->echoDensityModAmount, &c->echoDensityCvAmount, &v->echoDensity, -1.f, 1.f);
+
+        SetRoute(PARAM_AMBIENCE_DECAY, &c->ambienceDecay, &c->ambienceDecayModAmount, &c->ambienceDecayCvAmount, &v->ambienceDecay, -1.f, 1.f);
+        SetRoute(PARAM_AMBIENCE_SPACETIME, &c->ambienceSpacetime, &c->ambienceSpacetimeModAmount, &c->ambienceSpacetimeCvAmount, &v->ambienceSpacetime, -1.f, 1.f);
+    }
+    ~ControlStage()
+    {
+        patchState_->params = NULL;
+        ArenaDestroy(params_);
+    }
+
+    static ControlStage* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
+    {
+        return ArenaCreate<ControlStage>(MEMORY_REGION_FAST, patchCtrls, patchCvs, patchState);
+    }
+
+    static void destroy(ControlStage* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    void Process()
+    {
+        const float modValue = patchState_->modValue;
+        const bool modAttenuverters = patchState_->modAttenuverters;
+        const bool cvAttenuverters = patchState_->cvAttenuverters;
+
+        // A new mod value only matters to the rows that are modulated.
+        bool all = init_ || modAttenuverters != lastModAttenuverters_ || cvAttenuverters != lastCvAttenuverters_;
+        bool modChanged = modValue != lastModValue_;
+        init_ = false;
+        lastModValue_ = modValue;
+        lastModAttenuverters_ = modAttenuverters;
+        lastCvAttenuverters_ = cvAttenuverters;
+
+        // Gather the rows whose inputs changed.
+        int n = 0;
+        for (int i = 0; i < PARAM_LAST; i++)
+        {
+            ModRoute& route = routes_[i];
+            float in[4] = { *route.base, *route.modAmount, *route.cvAmount, *route.cvValue };
+            if (!all && !(modChanged && route.modScale != 0) &&
+                in[0] == route.last[0] && in[1] == route.last[1] && in[2] == route.last[2] && in[3] == route.last[3])
+            {
+                continue;
+            }
+            for (size_t j = 0; j < 4; j++)
+            {
+                route.last[j] = in[j];
+            }
+
+            rows_[n] = i;
+            base_[n] = in[0];
+            modAmount_[n] = in[1];
+            cvAmount_[n] = in[2];
+            cvValue_[n] = in[3];
+            min_[n] = route.min;
+            max_[n] = route.max;
+            n++;
+        }
+
+        // Same as Modulate().
+        for (int k = 0; k < n; k++)
+        {
+            float modAmount = modAttenuverters ? AttenuverterAmount(modAmount_[k]) : modAmount_[k];
+            float cvAmount = cvAttenuverters ? AttenuverterAmount(cvAmount_[k]) : cvAmount_[k];
+            float value = base_[k] + (modAmount * modValue + cvAmount * DenoiseCv(cvValue_[k]));
+            CONSTRAIN(value, min_[k], max_[k]);
+            value_[k] = value;
+            modScale_[k] = modAmount;
+        }
+
+        for (int k = 0; k < n; k++)
+        {
+            params_->values[rows_[k]] = value_[k];
+            routes_[rows_[k]].modScale = modScale_[k];
+        }
+    }
+};
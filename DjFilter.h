@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "StateVariableFilter.h"
 
 class DjFilter
@@ -66,12 +67,12 @@ public:
 
     static DjFilter* create(float sampleRate)
     {
-        return new DjFilter(sampleRate);
+        return ArenaCreate<DjFilter>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(DjFilter* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     void SetFilter(float value)
@@ -1,13 +1,15 @@
 #pragma once
 
 #include "Commons.h"
-#include "DelayLine.h"
+#include "StereoDelayLine.h"
 #include "EnvFollower.h"
 #include "SineOscillator.h"
 #include "ParameterInterpolator.h"
 #include "DjFilter.h"
 #include "Compressor.h"
 #include "AllPassFilter.h"
+#include "CoeffTrajectory.h"
+#include "TailSleep.h"
 #include <stdint.h>
 
 enum EchoTap
@@ -32,21 +34,37 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
 
-    DelayLine* lines_[2]; // Optimized: Left and Right shared buffers
+    StereoDelayLine<kEchoDelaySize>* line_; // The left taps read the left channel, the right taps the right one
     DjFilter* filter_;
     EnvFollower* ef_[2];
-    Compressor* comp_[2];
+    Compressor* comp_;
 
     HysteresisQuantizer densityQuantizer_;
+    TailSleep sleep_;
 
     int clockRatiosIndex_;
     float echoDensity_, oldDensity_;
 
     float levels_[kEchoTaps], outs_[kEchoTaps];
+    float taps_[kEchoTaps][kDelayLineBlockSize];
     float tapsTimes_[kEchoTaps], newTapsTimes_[kEchoTaps], maxTapsTimes_[kEchoTaps];
+
+    // A tap that moves with the external clock fades from its time to the
+    // new one over kEchoFadeSamples, reading both; it reads once the rest of
+    // the time.
+    enum TapState
+    {
+        TAP_STABLE,
+        TAP_FADING,
+    };
+    TapState tapsStates_[kEchoTaps];
+    float fadeTimes_[kEchoTaps]; // The one a fading tap goes to
+    float fades_[kEchoTaps]; // How far it has gone
+    int32_t fadeSamples_[kEchoTaps]; // Left of its fade
     float repeats_, filterValue_;
 
     bool externalClock_;
+    float clockPeriod_; // The one the taps were last set from
     bool infinite_;
     float tapBlendLeft_;
     float tapBlendRight_;
@@ -54,37 +72,140 @@ private:
     float feedbackLow_[2];
 
     AllPassFilter* vibratoAp_[2];
-    float vibratoPhase_;
-    int vibratoCoeffCounter_;
+    CoeffTrajectory vibratoCoeffs_[2];
+    QuadratureOscillator vibratoLfo_;
+    size_t vibratoSegment_;
+    bool vibrato_; // Ramped out while the quality is reduced
     static constexpr float kEchoVibratoMinFreq = 600.f;
     static constexpr float kEchoVibratoMaxFreq = 3000.f;
     static constexpr float kEchoVibratoRate = 0.35f;
 
     inline float ShapeFeedback(float in, int channel)
     {
-        feedbackTone_[channel] += kEchoFeedbackToneCoeff * (in - feedbackTone_[channel]) + 1e-18f;
-        feedbackLow_[channel] += kEchoFeedbackLowCoeff * (feedbackTone_[channel] - feedbackLow_[channel]) + 1e-18f;
+        feedbackTone_[channel] += kEchoFeedbackToneCoeff * (in - feedbackTone_[channel]);
+        feedbackLow_[channel] += kEchoFeedbackLowCoeff * (feedbackTone_[channel] - feedbackLow_[channel]);
         return feedbackTone_[channel] - feedbackLow_[channel] * kEchoFeedbackLowTrim;
     }
 
-    inline float ProcessVibrato(float in, int channel)
+    /**
+     * @brief Called for each sample before ProcessVibrato(), the LFO steps
+     *        and the coefficients are computed at the start of the segments.
+     *        The right channel is in antiphase. Without the vibrato the
+     *        coefficients ramp to 0, the allpasses then only delay by two
+     *        samples.
+     */
+    inline void UpdateVibrato(size_t i, size_t size)
     {
-        vibratoPhase_ += k2Pi * kEchoVibratoRate / patchState_->sampleRate;
-        if (vibratoPhase_ > k2Pi) vibratoPhase_ -= k2Pi;
+        if (0 != i % vibratoSegment_)
+        {
+            return;
+        }
+
+        size_t count = std::min<size_t>(vibratoSegment_, size - i);
+        if (!vibrato_)
+        {
+            for (size_t c = 0; c < 2; c++)
+            {
+                vibratoCoeffs_[c].Set(0, count);
+            }
 
-        float lfo = sinf(vibratoPhase_ + channel * kPi);
-        float freq = kEchoVibratoMinFreq + (kEchoVibratoMaxFreq - kEchoVibratoMinFreq) * (0.5f + 0.5f * lfo);
+            return;
+        }
 
-        // Update allpass coefficients every 8 samples to save CPU
-        if (++vibratoCoeffCounter_ >= 8)
+        vibratoLfo_.Step();
+        float lfo = vibratoLfo_.GetSin();
+        for (size_t c = 0; c < 2; c++)
         {
-            vibratoCoeffCounter_ = 0;
-            vibratoAp_[channel]->SetFreq(freq);
+            float freq = kEchoVibratoMinFreq + (kEchoVibratoMaxFreq - kEchoVibratoMinFreq) * (0.5f + 0.5f * (LEFT_CHANNEL == c ? lfo : -lfo));
+            vibratoCoeffs_[c].Set(AllPassFilter::FreqToCoeff(freq, patchState_->sampleRate), count);
         }
+    }
+
+    inline float ProcessVibrato(float in, int channel)
+    {
+        vibratoAp_[channel]->SetCoeff(vibratoCoeffs_[channel].Next());
 
         return vibratoAp_[channel]->ProcessStatic(in);
     }
 
+    // The shortest tap is longer than a chunk, so the taps of a chunk can be
+    // read before it's written.
+    static_assert(kEchoMinLengthSamples / 4 >= kDelayLineBlockSize, "The echo taps must be longer than kDelayLineBlockSize");
+
+    inline void ReadTap(size_t t, size_t size)
+    {
+        size_t channel = t < TAP_RIGHT_A ? LEFT_CHANNEL : RIGHT_CHANNEL;
+        float* out = taps_[t];
+        if (TAP_STABLE == tapsStates_[t])
+        {
+            line_->readBlock(tapsTimes_[t], channel, out, size);
+
+            return;
+        }
+
+        size_t n = std::min<size_t>(size, fadeSamples_[t]);
+        line_->readBlock(tapsTimes_[t], fadeTimes_[t], fades_[t], kEchoFadeSamplesR, channel, out, n);
+        fades_[t] += n * kEchoFadeSamplesR;
+        fadeSamples_[t] -= n;
+        if (0 == fadeSamples_[t])
+        {
+            tapsTimes_[t] = fadeTimes_[t];
+            tapsStates_[t] = TAP_STABLE;
+            // The rest of the chunk, n samples on.
+            if (n < size)
+            {
+                line_->readBlock(tapsTimes_[t] - n, channel, out + n, size - n);
+            }
+        }
+    }
+
+    inline void ReadTaps(size_t size)
+    {
+        for (size_t t = 0; t < kEchoTaps; t++)
+        {
+            ReadTap(t, size);
+        }
+    }
+
+    /**
+     * @brief Called once per block. With the internal clock the taps glide
+     *        along with the density, read once. With the external one a tap
+     *        whose time changes starts fading to it, a change that comes
+     *        during a fade waiting for it to end.
+     */
+    void UpdateTaps(bool glide)
+    {
+        for (size_t t = 0; t < kEchoTaps; t++)
+        {
+            if (glide)
+            {
+                // A fade started with the external clock goes on, to the
+                // gliding time.
+                float &time = TAP_FADING == tapsStates_[t] ? fadeTimes_[t] : tapsTimes_[t];
+                time = newTapsTimes_[t];
+            }
+            else if (TAP_STABLE == tapsStates_[t] && newTapsTimes_[t] != tapsTimes_[t])
+            {
+                tapsStates_[t] = TAP_FADING;
+                fadeTimes_[t] = newTapsTimes_[t];
+                fades_[t] = 0;
+                fadeSamples_[t] = kEchoFadeSamples;
+            }
+        }
+    }
+
+    /**
+     * @brief The taps go to their new times at once, while the echo sleeps.
+     */
+    void JumpTaps()
+    {
+        for (size_t t = 0; t < kEchoTaps; t++)
+        {
+            tapsTimes_[t] = newTapsTimes_[t];
+            tapsStates_[t] = TAP_STABLE;
+        }
+    }
+
     void SetTapTime(int idx, float time)
     {
         newTapsTimes_[idx] = Clamp(time, kEchoMinLengthSamples * kEchoTapsRatios[idx], (kEchoMaxLengthSamples - 1) * kEchoTapsRatios[idx]);
@@ -132,22 +253,23 @@ private:
         SetLevel(TAP_RIGHT_B, r * kEchoTapsFeedbacks[TAP_RIGHT_B]);
 
         float thrs = Map(repeats_, 0.f, 1.f, kEchoCompThresMin, kEchoCompThresMax);
-        comp_[LEFT_CHANNEL]->setThreshold(thrs);
-        comp_[RIGHT_CHANNEL]->setThreshold(thrs);
+        comp_->setThreshold(thrs);
     }
 
     void SetDensity(float value)
     {
         if (ClockSource::CLOCK_SOURCE_EXTERNAL == patchState_->clockSource)
         {
+            // The taps follow the clock's period to the sample.
             int newIndex = densityQuantizer_.Process(value);
-            if (newIndex == clockRatiosIndex_ && externalClock_)
+            if (newIndex == clockRatiosIndex_ && externalClock_ && clockPeriod_ == patchState_->clockPeriod)
             {
                 return;
             }
             clockRatiosIndex_ = newIndex;
+            clockPeriod_ = patchState_->clockPeriod;
 
-            float d = kModClockRatios[clockRatiosIndex_] * patchState_->clockSamples * kEchoExternalClockMultiplier;
+            float d = kModClockRatios[clockRatiosIndex_] * clockPeriod_ * kEchoExternalClockMultiplier;
             for (size_t i = 0; i < kEchoTaps; i++)
             {
                 SetTapTime(i, d * kEchoTapsRatios[i]);
@@ -192,24 +314,26 @@ public:
         patchCvs_ = patchCvs;
         patchState_ = patchState;
 
-        // Optimized: Create only 2 delay lines (Left/Right)
-        for (size_t i = 0; i < 2; i++)
-        {
-            lines_[i] = DelayLine::create(kEchoMaxLengthSamples);
-        }
+        line_ = StereoDelayLine<kEchoDelaySize>::create();
 
+        echoDensity_ = 1.f;
+        oldDensity_ = 0;
         for (size_t i = 0; i < kEchoTaps; i++)
         {
             tapsTimes_[i] = kEchoMaxLengthSamples - 1;
             SetMaxTapTime(i, tapsTimes_[i] * kEchoTapsRatios[i]);
+            tapsStates_[i] = TAP_STABLE;
+            fadeTimes_[i] = tapsTimes_[i];
+            fades_[i] = 0;
+            fadeSamples_[i] = 0;
             levels_[i] = 0;
             outs_[i] = 0;
         }
 
-        echoDensity_ = 1.f;
         clockRatiosIndex_ = 0;
 
         externalClock_ = false;
+        clockPeriod_ = 0;
         infinite_ = false;
         tapBlendLeft_ = kEchoTapBlendLeft;
         tapBlendRight_ = kEchoTapBlendRight;
@@ -217,8 +341,14 @@ public:
         feedbackTone_[RIGHT_CHANNEL] = 0.f;
         feedbackLow_[LEFT_CHANNEL] = 0.f;
         feedbackLow_[RIGHT_CHANNEL] = 0.f;
-        vibratoPhase_ = 0.f;
-        vibratoCoeffCounter_ = 0;
+        float vibratoCoeff = AllPassFilter::FreqToCoeff((kEchoVibratoMinFreq + kEchoVibratoMaxFreq) * 0.5f, patchState_->sampleRate);
+        for (size_t i = 0; i < 2; i++)
+        {
+            vibratoCoeffs_[i].Init(vibratoCoeff);
+        }
+        vibratoSegment_ = CoeffSegmentSize(patchState_->blockSize);
+        vibrato_ = true;
+        vibratoLfo_.SetFreq(kEchoVibratoRate * vibratoSegment_ / patchState_->sampleRate);
 
         for (size_t i = 0; i < 2; i++)
         {
@@ -227,27 +357,25 @@ public:
 
         filter_ = DjFilter::create(patchState_->sampleRate);
 
+        comp_ = Compressor::create(patchState_->sampleRate);
+        comp_->setThreshold(-16);
         for (size_t i = 0; i < 2; i++)
         {
-            comp_[i] = Compressor::create(patchState_->sampleRate);
-            comp_[i]->setThreshold(-16);
             ef_[i] = EnvFollower::create();
         }
 
         densityQuantizer_.Init(kClockUnityRatioIndex, 0.15f, false);
+        // The taps reach as far as the line.
+        sleep_.Init(kEchoMaxLengthSamples / patchState_->blockSize);
     }
     ~Echo()
     {
-        // Destroy only the 2 lines
-        for (size_t i = 0; i < 2; i++)
-        {
-            DelayLine::destroy(lines_[i]);
-        }
+        StereoDelayLine<kEchoDelaySize>::destroy(line_);
         DjFilter::destroy(filter_);
+        Compressor::destroy(comp_);
         for (size_t i = 0; i < 2; i++)
         {
             AllPassFilter::destroy(vibratoAp_[i]);
-            Compressor::destroy(comp_[i]);
             EnvFollower::destroy(ef_[i]);
         }
     }
@@ -262,17 +390,14 @@ public:
         delete obj;
     }
 
-    // Process entry point - dispatches to specialized version based on clock mode.
-    // Optimization: Branch hoisted outside loop to eliminate misprediction stalls.
     void process(AudioBuffer &input, AudioBuffer &output)
     {
         size_t size = output.getSize();
 
         SetFilter(patchCtrls_->echoFilter);
 
-        float d = Modulate(patchCtrls_->echoDensity, patchCtrls_->echoDensityModAmount, patchState_->modValue, patchCtrls_->echoDensityCvAmount, patchCvs_->echoDensity, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        float r = Modulate(patchCtrls_->echoRepeats, patchCtrls_->echoRepeatsModAmount, patchState_->modValue, patchCtrls_->echoRepeatsCvAmount, patchCvs_->echoRepeats, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        SetRepeats(r);
+        float d = patchState_->params->Get(PARAM_ECHO_DENSITY);
+        SetRepeats(patchState_->params->Get(PARAM_ECHO_REPEATS));
 
         if (StartupPhase::STARTUP_DONE != patchState_->startupPhase)
         {
@@ -281,81 +406,30 @@ public:
 
         // Update density ONCE per block for internal clock (was being called every sample!)
         // For external clock, SetDensity is called to handle clock ratio quantization.
-        if (externalClock_)
-        {
-            SetDensity(d);
-            processExternalClock(input, output, size);
-        }
-        else
-        {
-            SetDensity(d);
-            processInternalClock(input, output, size);
-        }
-    }
+        // The taps fade on the block the clock changes too.
+        bool externalClock = externalClock_;
+        SetDensity(d);
+        bool glide = !externalClock && !externalClock_;
+        vibrato_ = !IsQualityReduced(patchState_, QUALITY_ECHO_VIBRATO);
 
-private:
-    // External clock: tap times crossfade smoothly between old and new values.
-    void processExternalClock(AudioBuffer &input, AudioBuffer &output, size_t size)
-    {
-        FloatArray leftIn = input.getSamples(LEFT_CHANNEL);
-        FloatArray rightIn = input.getSamples(RIGHT_CHANNEL);
-        FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
-        FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
-
-        float x = 0;
-        float xi = 1.f / static_cast<float>(size);
-
-        for (size_t i = 0; i < size; i++)
+        if (sleep_.Sleep(patchCtrls_->echoVol, size))
         {
-            outs_[TAP_LEFT_A] = lines_[LEFT_CHANNEL]->read(tapsTimes_[TAP_LEFT_A], newTapsTimes_[TAP_LEFT_A], x);
-            outs_[TAP_LEFT_B] = lines_[LEFT_CHANNEL]->read(tapsTimes_[TAP_LEFT_B], newTapsTimes_[TAP_LEFT_B], x);
-            outs_[TAP_RIGHT_A] = lines_[RIGHT_CHANNEL]->read(tapsTimes_[TAP_RIGHT_A], newTapsTimes_[TAP_RIGHT_A], x);
-            outs_[TAP_RIGHT_B] = lines_[RIGHT_CHANNEL]->read(tapsTimes_[TAP_RIGHT_B], newTapsTimes_[TAP_RIGHT_B], x);
-            x += xi;
-
-            float leftFb = SoftClip(outs_[TAP_LEFT_A] * levels_[TAP_LEFT_A] * (1.f - kEchoFeedbackSkew) + outs_[TAP_RIGHT_A] * levels_[TAP_RIGHT_A] * (1.f + kEchoFeedbackSkew));
-            float rightFb = SoftClip(outs_[TAP_LEFT_B] * levels_[TAP_LEFT_B] * (1.f + kEchoFeedbackSkew) + outs_[TAP_RIGHT_B] * levels_[TAP_RIGHT_B] * (1.f - kEchoFeedbackSkew));
-
-            if (infinite_)
+            JumpTaps();
+            if (&input != &output)
             {
-                leftFb *= 1.08f - ef_[LEFT_CHANNEL]->process(leftFb);
-                rightFb *= 1.08f - ef_[RIGHT_CHANNEL]->process(rightFb);
+                output.copyFrom(input);
             }
-            leftFb = ShapeFeedback(leftFb, LEFT_CHANNEL);
-            rightFb = ShapeFeedback(rightFb, RIGHT_CHANNEL);
-            leftFb = ProcessVibrato(leftFb, LEFT_CHANNEL);
-            rightFb = ProcessVibrato(rightFb, RIGHT_CHANNEL);
-
-            float lIn = Clamp(leftIn[i], -3.f, 3.f);
-            float rIn = Clamp(rightIn[i], -3.f, 3.f);
 
-            float leftFilter, rightFilter;
-            filter_->Process(lIn, rIn, leftFilter, rightFilter);
-
-            leftFb += leftFilter;
-            rightFb += rightFilter;
-
-            lines_[LEFT_CHANNEL]->write(leftFb);
-            lines_[RIGHT_CHANNEL]->write(rightFb);
-
-            float left = LinearCrossFade(outs_[TAP_LEFT_A], outs_[TAP_LEFT_B], tapBlendLeft_);
-            float right = LinearCrossFade(outs_[TAP_RIGHT_A], outs_[TAP_RIGHT_B], tapBlendRight_);
-
-            left = comp_[LEFT_CHANNEL]->process(left) * kEchoMakeupGain;
-            right = comp_[RIGHT_CHANNEL]->process(right) * kEchoMakeupGain;
-
-            leftOut[i] = CheapEqualPowerCrossFade(lIn, left, patchCtrls_->echoVol, 1.8f);
-            rightOut[i] = CheapEqualPowerCrossFade(rIn, right, patchCtrls_->echoVol, 1.8f);
+            return;
         }
 
-        for (size_t j = 0; j < kEchoTaps; j++)
-        {
-            tapsTimes_[j] = newTapsTimes_[j];
-        }
+        UpdateTaps(glide);
+        ProcessTaps(input, output, size);
+        sleep_.EndBlock();
     }
 
-    // Internal clock: direct tap reads, no crossfade needed.
-    void processInternalClock(AudioBuffer &input, AudioBuffer &output, size_t size)
+private:
+    void ProcessTaps(AudioBuffer &input, AudioBuffer &output, size_t size)
     {
         FloatArray leftIn = input.getSamples(LEFT_CHANNEL);
         FloatArray rightIn = input.getSamples(RIGHT_CHANNEL);
@@ -364,10 +438,16 @@ private:
 
         for (size_t i = 0; i < size; i++)
         {
-            outs_[TAP_LEFT_A] = lines_[LEFT_CHANNEL]->read(newTapsTimes_[TAP_LEFT_A]);
-            outs_[TAP_LEFT_B] = lines_[LEFT_CHANNEL]->read(newTapsTimes_[TAP_LEFT_B]);
-            outs_[TAP_RIGHT_A] = lines_[RIGHT_CHANNEL]->read(newTapsTimes_[TAP_RIGHT_A]);
-            outs_[TAP_RIGHT_B] = lines_[RIGHT_CHANNEL]->read(newTapsTimes_[TAP_RIGHT_B]);
+            UpdateVibrato(i, size);
+            size_t j = i % kDelayLineBlockSize;
+            if (0 == j)
+            {
+                ReadTaps(std::min<size_t>(kDelayLineBlockSize, size - i));
+            }
+            for (size_t t = 0; t < kEchoTaps; t++)
+            {
+                outs_[t] = taps_[t][j];
+            }
 
             float leftFb = SoftClip(outs_[TAP_LEFT_A] * levels_[TAP_LEFT_A] * (1.f - kEchoFeedbackSkew) + outs_[TAP_RIGHT_A] * levels_[TAP_RIGHT_A] * (1.f + kEchoFeedbackSkew));
             float rightFb = SoftClip(outs_[TAP_LEFT_B] * levels_[TAP_LEFT_B] * (1.f + kEchoFeedbackSkew) + outs_[TAP_RIGHT_B] * levels_[TAP_RIGHT_B] * (1.f - kEchoFeedbackSkew));
@@ -385,20 +465,22 @@ private:
             float lIn = Clamp(leftIn[i], -3.f, 3.f);
             float rIn = Clamp(rightIn[i], -3.f, 3.f);
 
+            float send = sleep_.NextSend();
             float leftFilter, rightFilter;
-            filter_->Process(lIn, rIn, leftFilter, rightFilter);
+            filter_->Process(lIn * send, rIn * send, leftFilter, rightFilter);
 
             leftFb += leftFilter;
             rightFb += rightFilter;
 
-            lines_[LEFT_CHANNEL]->write(leftFb);
-            lines_[RIGHT_CHANNEL]->write(rightFb);
+            line_->write(leftFb, rightFb);
 
             float left = LinearCrossFade(outs_[TAP_LEFT_A], outs_[TAP_LEFT_B], tapBlendLeft_);
             float right = LinearCrossFade(outs_[TAP_RIGHT_A], outs_[TAP_RIGHT_B], tapBlendRight_);
 
-            left = comp_[LEFT_CHANNEL]->process(left) * kEchoMakeupGain;
-            right = comp_[RIGHT_CHANNEL]->process(right) * kEchoMakeupGain;
+            comp_->process(left, right);
+            left *= kEchoMakeupGain;
+            right *= kEchoMakeupGain;
+            sleep_.Track(left, right);
 
             leftOut[i] = CheapEqualPowerCrossFade(lIn, left, patchCtrls_->echoVol, 1.8f);
             rightOut[i] = CheapEqualPowerCrossFade(rIn, right, patchCtrls_->echoVol, 1.8f);
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "SignalProcessor.h"
+#include "Arena.h"
 
 // Version of EnvelopeFollower with configurable lambda.
 class EnvFollower : public SignalProcessor
@@ -24,11 +25,11 @@ public:
 
     static EnvFollower* create()
     {
-        return new EnvFollower();
+        return ArenaCreate<EnvFollower>(MEMORY_REGION_FAST);
     }
     static void destroy(EnvFollower* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     float process(float x)
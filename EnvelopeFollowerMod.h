@@ -47,7 +47,7 @@ public:
     {
         // Smooth the envelope.
         float l = MapExpo(patchCtrls_->modSpeed, 0.f, 1.f, 0.998f, 0.85f);
-        s_ = s_* l + Map(patchState_->inputLevel.getRms(), 0, 0.6f, -0.5f, 0.5f) * (1.f - l);
+        s_ = s_* l + Map(patchState_->inputRms, 0, 0.6f, -0.5f, 0.5f) * (1.f - l);
 
         return s_;
     }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "StateVariableFilter.h"
 #include "ChaosNoise.h"
 #include "DcBlockingFilter.h"
@@ -35,24 +36,24 @@ public:
     {
         sr_ = sampleRate;
         s_ = size;
-        line_ = FloatArray::create(size);
+        line_ = ArenaCreateFloatArray(size);
         w_ = 0;
         d_ = 1.f;
         c_ = 0.7f;
     }
     ~Allpass()
     {
-        FloatArray::destroy(line_);
+        ArenaDestroyFloatArray(line_);
     }
 
     static Allpass* create(float sampleRate, int size)
     {
-        return new Allpass(sampleRate, size);
+        return ArenaCreate<Allpass>(MEMORY_REGION_FAST, sampleRate, size);
     }
 
     static void destroy(Allpass* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     void SetDelay(float d)
@@ -138,12 +139,12 @@ public:
 
     static CombFilter* create(float sampleRate)
     {
-        return new CombFilter(sampleRate);
+        return ArenaCreate<CombFilter>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(CombFilter* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     void SetFrequency(float freq)
@@ -184,9 +185,11 @@ private:
     PatchState* patchState_;
     StateVariableFilter* filters_[2];
     CombFilter* combs_[2];
-    MoogLadderFilter* moogFilters_[2];
+    MoogLadderFilter* moogFilter_;
+    AudioBuffer* moogBuffer_;
     bool useMoog_;
     ChaosNoise noise_;
+    FloatArray noiseLane_; // The noise of a block, the left and right samples one after the other
     FilterMode mode_, lastMode_;
     DcBlockingFilter* dc_[2];
     EnvFollower* ef_[2];
@@ -201,6 +204,7 @@ private:
     float feedback_;
     float oldCutoff_;
     float oldResonance_;
+    float oldMoogGain_;
 
     void SetMode(float value)
     {
@@ -286,6 +290,7 @@ private:
             combs_[LEFT_CHANNEL]->SetResonance(r);
             combs_[RIGHT_CHANNEL]->SetFrequency(f);
             combs_[RIGHT_CHANNEL]->SetResonance(r);
+            freq_ = f;
             filterGain_ = MapExpo(resoValue_, 0.f, 1.f, kFilterCombGainMax, kFilterCombGainMin);
             break;
         }
@@ -303,12 +308,22 @@ private:
         SetFreqHz(cutoff);
     }
 
+    /**
+     * @brief The level of the noise, only mixed in at the highest
+     *        resonances. It never goes down as the resonance goes up, so
+     *        it's 0 all along a ramp when it's 0 at its higher end.
+     */
+    static inline float NoiseLevel(float reso)
+    {
+        return VariableCrossFade(0.f, 0.1f, reso, 0.15f, 0.9f);
+    }
+
     void SetReso(float value)
     {
         resoValue_ = Clamp(value);
         reso_ = VariableCrossFade(0.5f, 10.f, value, 0.9f);
         drive_ = VariableCrossFade(0.f, 0.25f, value, 0.15f, 0.9f);
-        noiseLevel_ = VariableCrossFade(0.f, 0.1f, value, 0.15f, 0.9f);
+        noiseLevel_ = NoiseLevel(value);
     }
 
 public:
@@ -321,29 +336,38 @@ public:
 
         noise_.Init(patchState_->sampleRate);
         noise_.SetChaos(kFilterChaosNoise);
+        noiseLane_ = ArenaCreateFloatArray(2 * patchState_->blockSize);
 
         for (size_t i = 0; i < 2; i++)
         {
             filters_[i] = StateVariableFilter::create(patchState_->sampleRate);
             combs_[i] = CombFilter::create(patchState_->sampleRate);
-            moogFilters_[i] = MoogLadderFilter::create(patchState_->sampleRate);
             dc_[i] = DcBlockingFilter::create();
             ef_[i] = EnvFollower::create();
         }
 
+        moogFilter_ = MoogLadderFilter::create(patchState_->sampleRate);
+        moogBuffer_ = AudioBuffer::create(2, patchState_->blockSize);
+
         mode_ = lastMode_ = FilterMode::LP;
         freq_ = 22000.f;
         amp_ = Db2A(120);
         oldCutoff_ = 0.f;
         oldResonance_ = 0.f;
+        oldMoogGain_ = 0.f;
+
+        SetReso(0.f);
+        SetFreqHz(freq_);
     }
     ~Filter()
     {
+        MoogLadderFilter::destroy(moogFilter_);
+        AudioBuffer::destroy(moogBuffer_);
+        ArenaDestroyFloatArray(noiseLane_);
         for (size_t i = 0; i < 2; i++)
         {
             StateVariableFilter::destroy(filters_[i]);
             CombFilter::destroy(combs_[i]);
-            MoogLadderFilter::destroy(moogFilters_[i]);
             DcBlockingFilter::destroy(dc_[i]);
             EnvFollower::destroy(ef_[i]);
         }
@@ -379,10 +403,11 @@ public:
             patchState_->filterModeFlag = false;
         }
 
-        float r = Modulate(patchCtrls_->filterResonance, patchCtrls_->filterResonanceModAmount, patchState_->modValue, patchCtrls_->filterResonanceCvAmount, patchCvs_->filterResonance, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator resoParam(&oldResonance_, r, size, ParameterInterpolator::BY_SIZE);
+        float resoStart = oldResonance_;
+        float resoEnd = patchState_->params->Get(PARAM_FILTER_RESONANCE);
+        ParameterInterpolator resoParam(&oldResonance_, resoEnd, size, ParameterInterpolator::BY_SIZE);
 
-        float c = Modulate(patchCtrls_->filterCutoff, patchCtrls_->filterCutoffModAmount, patchState_->modValue, patchCtrls_->filterCutoffCvAmount, patchCvs_->filterCutoff, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        float c = patchState_->params->Get(PARAM_FILTER_CUTOFF);
         
         // Optimize: Calculate Hz endpoints and interpolate, avoiding MapLog per sample.
 
@@ -420,6 +445,20 @@ public:
             return;
         }
 
+        // The Moog ladder runs on the whole block after the input stage.
+        const bool moog = useMoog_ && FilterMode::CF == mode_;
+        FloatArray moogLeft = moogBuffer_->getSamples(LEFT_CHANNEL);
+        FloatArray moogRight = moogBuffer_->getSamples(RIGHT_CHANNEL);
+
+        // The noise of the block is made ahead, at the frequency of the end of
+        // the last one, unless no noise is mixed in all along. Then the level
+        // stays 0 and the lane's last values are dropped.
+        if (0 != noiseLevel_ || 0 != NoiseLevel(std::max(resoStart, resoEnd)))
+        {
+            noise_.Render(noiseLane_.getData(), 2 * size);
+        }
+        const float* noise = noiseLane_.getData();
+
         int coeffUpdateCounter = 0;
         for (size_t i = 0; i < size; i++)
         {
@@ -444,8 +483,8 @@ public:
                 SetFreqHz(hz);
             }
 
-            float nLeft = noise_.Process() * noiseLevel_;
-            float nRight = noise_.Process() * noiseLevel_ * 0.97f;
+            float nLeft = noise[2 * i] * noiseLevel_;
+            float nRight = noise[2 * i + 1] * noiseLevel_ * 0.97f;
 
             float lIn = Clamp(leftIn[i], -3.f, 3.f);
             float rIn = Clamp(rightIn[i], -3.f, 3.f);
@@ -456,31 +495,22 @@ public:
             float lf = LinearCrossFade(lIn + nLeft, ls, drive_);
             float rf = LinearCrossFade(rIn + nRight, rs, drive_);
 
+            if (moog)
+            {
+                moogLeft[i] = lf;
+                moogRight[i] = rf;
+
+                continue;
+            }
+
             float lo, ro;
             if (FilterMode::CF == mode_)
             {
-                if (useMoog_)
-                {
-                    // Moog ladder filter mode
-                    moogFilters_[LEFT_CHANNEL]->setCutoff(freq_);
-                    moogFilters_[LEFT_CHANNEL]->setResonance(resoValue_ * 4.0f); // Scale 0-1 to 0-4
-                    moogFilters_[LEFT_CHANNEL]->setDrive(1.0f + drive_ * 4.0f);
-                    
-                    moogFilters_[RIGHT_CHANNEL]->setCutoff(freq_);
-                    moogFilters_[RIGHT_CHANNEL]->setResonance(resoValue_ * 4.0f);
-                    moogFilters_[RIGHT_CHANNEL]->setDrive(1.0f + drive_ * 4.0f);
-                    
-                    lo = moogFilters_[LEFT_CHANNEL]->process(lf) * filterGain_;
-                    ro = moogFilters_[RIGHT_CHANNEL]->process(rf) * filterGain_;
-                }
-                else
-                {
-                    // Original comb filter mode
-                    lo = SoftClip(combs_[LEFT_CHANNEL]->Process(lf) * filterGain_);
-                    ro = SoftClip(combs_[RIGHT_CHANNEL]->Process(rf) * filterGain_);
-                    lo = dc_[LEFT_CHANNEL]->process(lo);
-                    ro = dc_[RIGHT_CHANNEL]->process(ro);
-                }
+                // Original comb filter mode
+                lo = SoftClip(combs_[LEFT_CHANNEL]->Process(lf) * filterGain_);
+                ro = SoftClip(combs_[RIGHT_CHANNEL]->Process(rf) * filterGain_);
+                lo = dc_[LEFT_CHANNEL]->process(lo);
+                ro = dc_[RIGHT_CHANNEL]->process(ro);
             }
             else
             {
@@ -493,5 +523,22 @@ public:
             leftOut[i] = CheapEqualPowerCrossFade(lIn, lo * kFilterMakeupGain, patchCtrls_->filterVol);
             rightOut[i] = CheapEqualPowerCrossFade(rIn, ro * kFilterMakeupGain, patchCtrls_->filterVol);
         }
+
+        if (moog)
+        {
+            // Moog ladder filter mode, the parameters ramp over the block.
+            moogFilter_->setCutoff(freq_);
+            moogFilter_->setResonance(resoValue_ * 4.0f); // Scale 0-1 to 0-4
+            moogFilter_->setDrive(1.0f + drive_ * 4.0f);
+            moogFilter_->process(*moogBuffer_, *moogBuffer_);
+
+            ParameterInterpolator gainParam(&oldMoogGain_, filterGain_ * kFilterMakeupGain, size, ParameterInterpolator::BY_SIZE);
+            for (size_t i = 0; i < size; i++)
+            {
+                float g = gainParam.Next();
+                leftOut[i] = CheapEqualPowerCrossFade(Clamp(leftIn[i], -3.f, 3.f), moogLeft[i] * g, patchCtrls_->filterVol);
+                rightOut[i] = CheapEqualPowerCrossFade(Clamp(rightIn[i], -3.f, 3.f), moogRight[i] * g, patchCtrls_->filterVol);
+            }
+        }
     }
 };
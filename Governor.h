@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+
+/**
+ * @brief Trades quality for DSP load: while the load stays above
+ *        kQualityLoadHigh, the next of the QualityStep is taken, and while
+ *        it's under kQualityLoadLow the last one taken is given back, no more
+ *        often than kQualityAdaptBlocks so that the load measured can settle.
+ *        The steps come in the order they can be missed in, the modules read
+ *        PatchState::qualityLevel once per block. The voices are dropped
+ *        first, see VoicePool::Adapt().
+ */
+class QualityGovernor
+{
+private:
+    PatchState* patchState_;
+    size_t adaptBlocks_;
+
+public:
+    QualityGovernor(PatchState* patchState)
+    {
+        patchState_ = patchState;
+        adaptBlocks_ = 0;
+    }
+    ~QualityGovernor() {}
+
+    static QualityGovernor* create(PatchState* patchState)
+    {
+        return ArenaCreate<QualityGovernor>(MEMORY_REGION_FAST, patchState);
+    }
+
+    static void destroy(QualityGovernor* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    /**
+     * @brief Called once per block with the DSP load, 1 being the whole
+     *        block.
+     */
+    void Adapt(float load)
+    {
+        if (++adaptBlocks_ < kQualityAdaptBlocks)
+        {
+            return;
+        }
+
+        int level = patchState_->qualityLevel;
+        if (load > kQualityLoadHigh && level < QUALITY_LAST)
+        {
+            patchState_->qualityLevel = level + 1;
+            adaptBlocks_ = 0;
+        }
+        else if (load < kQualityLoadLow && level > 0)
+        {
+            patchState_->qualityLevel = level - 1;
+            adaptBlocks_ = 0;
+        }
+    }
+};
@@ -1,27 +1,44 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 
 class Limiter
 {
 private:
     float peak_;
 
+    // Lookahead
+    float delay_[2][kLimiterLookahead];
+    int delayIndex_;
+    float gain_, target_, step_;
+    int hold_; // Samples before the release, the last peak over the ceiling still in the delay
+
 public:
     Limiter(float peak)
     {
         peak_ = peak;
+
+        for (int i = 0; i < kLimiterLookahead; i++)
+        {
+            delay_[LEFT_CHANNEL][i] = 0;
+            delay_[RIGHT_CHANNEL][i] = 0;
+        }
+        delayIndex_ = 0;
+        gain_ = target_ = 1.f;
+        step_ = 0;
+        hold_ = 0;
     }
     ~Limiter() { }
 
     static Limiter* create(float peak = 0.5f)
     {
-        return new Limiter(peak);
+        return ArenaCreate<Limiter>(MEMORY_REGION_FAST, peak);
     }
 
     static void destroy(Limiter* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     // Ported and adapted from Emilie Gillet's Limiter in Rings.
@@ -45,6 +62,71 @@ public:
         }
     }
 
+    /**
+     * @brief Keeps the output under kLimiterCeiling without clipping it:
+     *        the signal is delayed by kLimiterLookahead samples, and a peak
+     *        that comes in makes the gain ramp down to what it needs by the
+     *        time it goes out. The gain is the same on both channels and
+     *        recovers with kLimiterReleaseCoeff once the last peak over the
+     *        ceiling has gone out.
+     */
+    void ProcessLookahead(AudioBuffer& input, AudioBuffer& output)
+    {
+        FloatArray leftIn = input.getSamples(LEFT_CHANNEL);
+        FloatArray rightIn = input.getSamples(RIGHT_CHANNEL);
+        FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
+        FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
+
+        for (size_t i = 0; i < output.getSize(); i++)
+        {
+            float left = leftIn[i];
+            float right = rightIn[i];
+
+            float peak = Max(fabsf(left), fabsf(right));
+            float need = peak > kLimiterCeiling ? kLimiterCeiling / peak : 1.f;
+            // The step only grows while ramping down, for the peaks already in
+            // the delay to still get their gain by the time they go out.
+            if (need < target_)
+            {
+                target_ = need;
+                step_ = Max(step_, (gain_ - target_) * (1.f / kLimiterLookahead));
+            }
+            if (need < 1.f)
+            {
+                hold_ = kLimiterLookahead;
+            }
+
+            if (gain_ > target_)
+            {
+                gain_ = Max(gain_ - step_, target_);
+            }
+
+            leftOut[i] = delay_[LEFT_CHANNEL][delayIndex_] * gain_;
+            rightOut[i] = delay_[RIGHT_CHANNEL][delayIndex_] * gain_;
+
+            // The release is for the next sample, after the peaks have gone out.
+            if (hold_ > 0)
+            {
+                hold_--;
+            }
+            else if (gain_ <= target_)
+            {
+                ONE_POLE(target_, 1.f, kLimiterReleaseCoeff);
+                gain_ = target_;
+            }
+            if (gain_ <= target_)
+            {
+                step_ = 0;
+            }
+            delay_[LEFT_CHANNEL][delayIndex_] = left;
+            delay_[RIGHT_CHANNEL][delayIndex_] = right;
+            if (++delayIndex_ == kLimiterLookahead)
+            {
+                delayIndex_ = 0;
+            }
+        }
+    }
+
     void ProcessSoft(AudioBuffer& input, AudioBuffer& output)
     {
         for (size_t i = 0; i < output.getSize(); i++)
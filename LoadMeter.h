@@ -0,0 +1,122 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+
+// The timer of the load meter and of the profiler, compiled in either way.
+#ifdef __arm__
+// Cortex-M7 DWT cycle counter (ARMv7-M debug registers).
+#define PROFILER_DEMCR (*(volatile uint32_t*)0xE000EDFC)
+#define PROFILER_DWT_CTRL (*(volatile uint32_t*)0xE0001000)
+#define PROFILER_DWT_CYCCNT (*(volatile uint32_t*)0xE0001004)
+#define PROFILER_DWT_LAR (*(volatile uint32_t*)0xE0001FB0)
+
+typedef uint32_t ProfilerTick; // CPU cycles, wraps every ~9s @ 480MHz
+
+inline void ProfilerInitTimer()
+{
+    PROFILER_DEMCR |= 1 << 24; // TRCENA
+    PROFILER_DWT_LAR = 0xC5ACCE55; // Unlock the DWT on the M7
+    PROFILER_DWT_CTRL |= 1; // CYCCNTENA
+}
+
+inline ProfilerTick ProfilerNow()
+{
+    return PROFILER_DWT_CYCCNT;
+}
+
+inline float ProfilerTicksPerSecond()
+{
+    return kProfilerCpuFreq;
+}
+#else
+#include <chrono>
+
+typedef uint64_t ProfilerTick; // Nanoseconds
+
+inline void ProfilerInitTimer()
+{
+}
+
+inline ProfilerTick ProfilerNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline float ProfilerTicksPerSecond()
+{
+    return 1e9f;
+}
+#endif // __arm__
+
+/**
+ * @brief The DSP load of the whole block, always compiled in, for the voice
+ *        pool and the quality governor to adapt to (see VoicePool::Adapt()
+ *        and QualityGovernor::Adapt()). Unlike the profiler, it only reads
+ *        the timer twice per block, and the load is the average of the last
+ *        kLoadMeterBlocks blocks, taken once they've all been measured.
+ */
+class LoadMeter
+{
+private:
+    ProfilerTick start_;
+    uint64_t sum_;
+    size_t blocks_;
+    float budgetR_; // Of the blocks averaged
+    float load_;
+
+public:
+    LoadMeter(float sampleRate, int blockSize)
+    {
+        ProfilerInitTimer();
+        budgetR_ = sampleRate / (ProfilerTicksPerSecond() * blockSize * kLoadMeterBlocks);
+        start_ = 0;
+        sum_ = 0;
+        blocks_ = 0;
+        load_ = 0;
+    }
+    ~LoadMeter() {}
+
+    static LoadMeter* create(float sampleRate, int blockSize)
+    {
+        return ArenaCreate<LoadMeter>(MEMORY_REGION_FAST, sampleRate, blockSize);
+    }
+
+    static void destroy(LoadMeter* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    inline void Begin()
+    {
+        start_ = ProfilerNow();
+    }
+
+    inline void End()
+    {
+        AddBlock(ProfilerNow() - start_);
+    }
+
+    /**
+     * @brief Account a block that took ticks, End() measures them.
+     */
+    inline void AddBlock(ProfilerTick ticks)
+    {
+        sum_ += ticks;
+        if (++blocks_ == kLoadMeterBlocks)
+        {
+            load_ = sum_ * budgetR_;
+            sum_ = 0;
+            blocks_ = 0;
+        }
+    }
+
+    /**
+     * @brief Average load of the whole block, 1 is the full budget.
+     */
+    inline float GetLoad()
+    {
+        return load_;
+    }
+};
@@ -2,6 +2,12 @@
 
 #include "Commons.h"
 #include "LooperBuffer.h"
+#ifdef USE_LOOPER_STREAMING
+#include "LooperStream.h"
+#endif
+#ifdef USE_LOOPER_CLOUD
+#include "LooperCloud.h"
+#endif
 #include "WaveTableBuffer.h"
 #include "SquareWaveOscillator.h"
 #include "Schmitt.h"
@@ -19,23 +25,32 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
     LooperBuffer* buffer_;
+#ifdef USE_LOOPER_CLOUD
+    LooperCloud* cloud_;
+#endif
+#ifdef USE_LOOPER_STREAMING
+    LooperStream* stream_;
+    LooperStore* store_;
+    MemoryLooperStore* memoryStore_;
+#endif
     DjFilter* filter_;
     Limiter* limiter_;
     EnvFollower* ef_[2];
 
     AudioBuffer* sosOut_;
+    AudioBuffer* recordIn_;
 
     PlaybackDirection direction_;
 
     float wPhase_;
-    float phase_;
+    LooperPosition phase_;
     float speed_;
     float speedValue_;
     float filterValue_;
     float oldStartValue_, oldLengthValue_, oldSpeedValue_;
     float inputGain_, feedback_, triggerFadeVolume_, speedVolume_;
-    float length_, start_;
-    float newLength_, newStart_;
+    LooperPosition length_, start_;
+    LooperPosition newLength_, newStart_;
     float fadePhase_, fadeSamples_, fadeSamplesR_;
     float fadeThreshold_;
     float oldVol_;
@@ -43,16 +58,20 @@ private:
     bool triggered_;
     bool boc_;
     bool cleared_;
-    bool fade_, startFade_, triggerFadeOut_, triggerFadeIn_;
+    bool fade_, startFade_, triggerFadeOut_, triggerFadeIn_, triggerReset_;
 
     int triggerFadeIndex_;
+    size_t triggerOffset_; // The sample of the block the trigger falls on
 
     uint32_t bufferPhase_;
 
     Schmitt trigger_;
 
-    Lut<uint32_t, 128> startLUT_{0, kLooperChannelBufferLength - 1};
-    Lut<uint32_t, 128> lengthLUT_{kLooperLoopLengthMin, kLooperChannelBufferLength, Lut<uint32_t, 128>::Type::LUT_TYPE_EXPO};
+    static constexpr LutTable<uint32_t, 128> kStartTable = MakeLut<uint32_t, 128>(0, kLooperTakeLength - 1);
+    static constexpr LutTable<uint32_t, 128> kLengthTable = MakeLut<uint32_t, 128>(kLooperLoopLengthMin, kLooperTakeLength, 3.0);
+
+    Lut<uint32_t, 128> startLUT_{kStartTable};
+    Lut<uint32_t, 128> lengthLUT_{kLengthTable};
 
     void MapSpeed()
     {
@@ -225,15 +244,17 @@ private:
             else
             {
                 // Otherwise just reset the phase.
-                phase_ = 0.f;
+                triggerReset_ = true;
             }
         }
 
         boc_ = false;
 
-        for (size_t i = 0; i < size; i++)
+        if (buffer_->IsRecording())
         {
-            if (buffer_->IsRecording())
+            // The sound on sound is the previous block's output, so the whole
+            // block can be prepared and written at once.
+            for (size_t i = 0; i < size; i++)
             {
                 float left, right;
                 filter_->Process(input.getSamples(LEFT_CHANNEL)[i], input.getSamples(RIGHT_CHANNEL)[i], left, right);
@@ -244,23 +265,86 @@ private:
                 left *= 1.f - ef_[LEFT_CHANNEL]->process(left);
                 right *= 1.f - ef_[RIGHT_CHANNEL]->process(right);
 
-                buffer_->Write(wPhase_, left, right);
+                recordIn_->getSamples(LEFT_CHANNEL)[i] = left;
+                recordIn_->getSamples(RIGHT_CHANNEL)[i] = right;
+            }
 
-                wPhase_++;
-                if (wPhase_ >= kLooperChannelBufferLength)
-                {
-                    wPhase_ -= kLooperChannelBufferLength;
-                }
+#ifdef USE_LOOPER_STREAMING
+            // The block is dropped while its pages aren't in the buffer.
+            if (stream_->Writable(wPhase_, size))
+            {
+                buffer_->Write(LooperBuffer::Wrap(wPhase_), *recordIn_);
+                stream_->Written(wPhase_, size);
+            }
+#else
+            buffer_->Write(LooperBuffer::Wrap(wPhase_), *recordIn_);
+#endif
+
+            wPhase_ += size;
+            if (wPhase_ >= kLooperTakeLength)
+            {
+                wPhase_ -= kLooperTakeLength;
+            }
+        }
+
+#ifdef USE_LOOPER_CLOUD
+        // The grains have their own windows, the loop's fades aren't used.
+        fade_ = startFade_ = lengthFade_ = false;
+        triggerFadeOut_ = triggerReset_ = false;
+        bool steady = true;
+#else
+        // Without any fade in progress or due within the block, the read
+        // head just moves by speed_ at every sample.
+        bool steady = !fade_ && !triggerFadeOut_ && !triggerFadeIn_ && !triggerReset_;
+        if (steady)
+        {
+            LooperPosition last = phase_ + speed_ * (size - 1);
+            steady = (PlaybackDirection::PLAYBACK_FORWARD == direction_ && last < newLength_ - fadeThreshold_) ||
+                (PlaybackDirection::PLAYBACK_BACKWARDS == direction_ && last > fadeThreshold_) ||
+                PlaybackDirection::PLAYBACK_STALLED == direction_;
+        }
+#endif
+        if (steady)
+        {
+            start_ = newStart_;
+            length_ = newLength_;
+
+#ifdef USE_LOOPER_CLOUD
+            cloud_->Read(start_, length_, speed_, direction_, *sosOut_);
+#else
+            buffer_->Read(start_ + phase_, speed_, *sosOut_, direction_);
+            phase_ += speed_ * size;
+#endif
+
+            sosOut_->getSamples(LEFT_CHANNEL).multiply(speedVolume_, output.getSamples(LEFT_CHANNEL));
+            sosOut_->getSamples(RIGHT_CHANNEL).multiply(speedVolume_, output.getSamples(RIGHT_CHANNEL));
+
+            bufferPhase_ += size;
+            if (bufferPhase_ >= kLooperChannelBufferLength)
+            {
+                boc_ = true;
+                bufferPhase_ -= kLooperChannelBufferLength;
             }
 
+            return;
+        }
+
+        for (size_t i = 0; i < size; i++)
+        {
             float left = 0;
             float right = 0;
 
+            if (triggerReset_ && i == triggerOffset_)
+            {
+                phase_ = 0.f;
+                triggerReset_ = false;
+            }
+
             buffer_->Read(start_ + phase_, left, right, direction_);
 
             if (fade_)
             {
-                float start = newStart_;
+                LooperPosition start = newStart_;
                 if (!startFade_ && !lengthFade_)
                 {
                     start -= newLength_ * direction_;
@@ -311,7 +395,7 @@ private:
                 length_ = newLength_;
             }
 
-            if (triggerFadeOut_ || triggerFadeIn_)
+            if ((triggerFadeOut_ || triggerFadeIn_) && i >= triggerOffset_)
             {
                 triggerFadeVolume_ = triggerFadeIndex_ * kLooperTriggerFadeSamplesR;
                 if (triggerFadeOut_)
@@ -377,8 +461,23 @@ public:
         patchState_ = patchState;
 
         buffer_ = LooperBuffer::create();
+#ifdef USE_LOOPER_STREAMING
+        // Without a store from the platform, the take is kept in memory.
+        memoryStore_ = NULL;
+        store_ = patchState_->looperStore;
+        if (NULL == store_)
+        {
+            memoryStore_ = MemoryLooperStore::create();
+            store_ = memoryStore_;
+        }
+        stream_ = LooperStream::create(buffer_, store_);
+#endif
         filter_ = DjFilter::create(patchState_->sampleRate);
+#ifdef USE_LOOPER_CLOUD
+        cloud_ = LooperCloud::create(patchState_, buffer_);
+#endif
         sosOut_ = AudioBuffer::create(2, patchState_->blockSize);
+        recordIn_ = AudioBuffer::create(2, patchState_->blockSize);
         limiter_ = Limiter::create();
 
         direction_ = PlaybackDirection::PLAYBACK_FORWARD;
@@ -390,7 +489,7 @@ public:
         speed_ = 1.f;
         phase_ = 0;
         wPhase_ = bufferPhase_ = 0;
-        length_ = newLength_ = kLooperChannelBufferLength;
+        length_ = newLength_ = kLooperTakeLength;
         start_ = newStart_ = 0;
         filterValue_ = 0;
         fadePhase_ = 0;
@@ -406,6 +505,8 @@ public:
         triggerFadeVolume_ = 0;
         triggerFadeOut_ = false;
         triggerFadeIn_ = false;
+        triggerReset_ = false;
+        triggerOffset_ = 0;
         oldStartValue_ = 0;
         oldLengthValue_ = 1.f;
         oldVol_ = 0.0f;
@@ -417,9 +518,17 @@ public:
     }
     ~Looper()
     {
+#ifdef USE_LOOPER_STREAMING
+        LooperStream::destroy(stream_);
+        MemoryLooperStore::destroy(memoryStore_);
+#endif
+#ifdef USE_LOOPER_CLOUD
+        LooperCloud::destroy(cloud_);
+#endif
         LooperBuffer::destroy(buffer_);
         DjFilter::destroy(filter_);
         AudioBuffer::destroy(sosOut_);
+        AudioBuffer::destroy(recordIn_);
         Limiter::destroy(limiter_);
 
         for (size_t i = 0; i < 2; i++)
@@ -438,18 +547,27 @@ public:
         delete obj;
     }
 
-    FloatArray *GetBuffer()
+    LooperBuffer *GetBuffer()
     {
-        return buffer_->GetBuffer();
+        return buffer_;
     }
 
+#ifdef USE_LOOPER_STREAMING
+    LooperStream *GetStream()
+    {
+        return stream_;
+    }
+#endif
+
     void Process(AudioBuffer &input, AudioBuffer &output)
     {
         input.multiply(patchCtrls_->looperResampling ? kLooperResampleGain : kLooperInputGain);
 
         if (ClockSource::CLOCK_SOURCE_EXTERNAL == patchState_->clockSource && (trigger_.Process(patchState_->clockReset)))
         {
+            // From the sample of the edge.
             triggered_ = true;
+            triggerOffset_ = patchState_->clockOffset;
         }
         else if (ClockSource::CLOCK_SOURCE_INTERNAL == patchState_->clockSource)
         {
@@ -460,15 +578,18 @@ public:
 
         MapSpeed();
         ParameterInterpolator speedParam(&oldSpeedValue_, speedValue_, kLooperInterpolationBlocks, ParameterInterpolator::BY_SIZE);
-        float rs = Modulate(speedParam.Next(), patchCtrls_->looperSpeedModAmount, patchState_->modValue, patchCtrls_->looperSpeedCvAmount, patchCvs_->looperSpeed, -2.f, 2.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        float rs = speedParam.Next() + patchState_->params->Get(PARAM_LOOPER_SPEED_OFFSET);
+        CONSTRAIN(rs, -2.f, 2.f);
         SetSpeed(rs);
 
         ParameterInterpolator startParam(&oldStartValue_, patchCtrls_->looperStart, kLooperInterpolationBlocks, ParameterInterpolator::BY_SIZE);
-        float t = Modulate(startParam.Next(), patchCtrls_->looperStartModAmount, patchState_->modValue, patchCtrls_->looperStartCvAmount, patchCvs_->looperStart, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        float t = startParam.Next() + patchState_->params->Get(PARAM_LOOPER_START_OFFSET);
+        CONSTRAIN(t, -1.f, 1.f);
         SetStart(t);
 
         ParameterInterpolator lengthParam(&oldLengthValue_, patchCtrls_->looperLength, kLooperInterpolationBlocks, ParameterInterpolator::BY_SIZE);
-        float l = Modulate(lengthParam.Next(), patchCtrls_->looperLengthModAmount, patchState_->modValue, patchCtrls_->looperLengthCvAmount, patchCvs_->looperLength, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        float l = lengthParam.Next() + patchState_->params->Get(PARAM_LOOPER_LENGTH_OFFSET);
+        CONSTRAIN(l, -1.f, 1.f);
         SetLength(l);
 
         SetFilter(patchCtrls_->looperFilter);
@@ -492,18 +613,27 @@ public:
         {
             output.clear();
             patchState_->clearLooperFlag = false;
+            buffer_->Clear();
+#ifdef USE_LOOPER_STREAMING
+            stream_->Clear();
+#endif
             cleared_ = true;
         }
         else if (cleared_)
         {
             output.clear();
-            if (buffer_->Clear())
-            {
-                cleared_ = false;
-            }
+            cleared_ = buffer_->IsClearing();
         }
 
         WriteRead(input, output);
+        triggerOffset_ = 0;
+
+#ifdef USE_LOOPER_STREAMING
+        // What the heads are going to need next.
+        stream_->SetHead(STREAM_HEAD_WRITE, wPhase_, buffer_->IsRecording());
+        stream_->SetHead(STREAM_HEAD_READ, start_ + phase_, direction_);
+        stream_->SetHead(STREAM_HEAD_FADE, newStart_, fade_ || newStart_ != start_ ? direction_ : 0);
+#endif
 
         if (PlaybackDirection::PLAYBACK_STALLED == direction_)
         {
@@ -511,8 +641,7 @@ public:
         }
         else
         {
-            float vol = Modulate(patchCtrls_->looperVol, patchCtrls_->looperVolModAmount, patchState_->modValue, patchCtrls_->looperVolCvAmount, patchCvs_->looperVol, 0.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-            ParameterInterpolator volParam(&oldVol_, vol * kLooperMakeupGain, output.getSize(), ParameterInterpolator::BY_SIZE);
+            ParameterInterpolator volParam(&oldVol_, patchState_->params->Get(PARAM_LOOPER_VOL) * kLooperMakeupGain, output.getSize(), ParameterInterpolator::BY_SIZE);
             for (size_t i = 0; i < output.getSize(); i++)
             {
                 float vol = volParam.Next();
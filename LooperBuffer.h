@@ -1,8 +1,11 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "EnvFollower.h"
+#include "Scheduler.h"
 #include <algorithm>
+#include <string.h>
 
 enum PlaybackDirection
 {
@@ -11,6 +14,14 @@ enum PlaybackDirection
     PLAYBACK_BACKWARDS = -1
 };
 
+/**
+ * @brief Writes one channel of the looper buffer. The channel pointer is the
+ *        first sample of the channel, kLooperGuardSamples before and after it
+ *        are mirrored copies of the opposite edge so that reads don't need to
+ *        wrap. Consecutive samples are kLooperSampleStride apart.
+ *        The samples are converted to the storage format as they're written,
+ *        and back for the fades.
+ */
 class WriteHead
 {
 private:
@@ -22,22 +33,18 @@ private:
         WRITE_STATUS_ACTIVE,
     };
 
-    FloatArray* buffer_;
+    LooperSample* channel_;
 
     WriteStatus status_;
 
-    uint32_t index_;
-    uint32_t start_;
-    uint32_t end_;
-
     int fadeIndex_;
 
     bool doFade_;
 
 public:
-    WriteHead(FloatArray* buffer)
+    WriteHead(LooperSample* channel)
     {
-        buffer_ = buffer;
+        channel_ = channel;
 
         status_ = WRITE_STATUS_INACTIVE;
 
@@ -47,14 +54,14 @@ public:
     }
     ~WriteHead() {}
 
-    static WriteHead* create(FloatArray* buffer)
+    static WriteHead* create(LooperSample* channel)
     {
-        return new WriteHead(buffer);
+        return ArenaCreate<WriteHead>(MEMORY_REGION_FAST, channel);
     }
 
     static void destroy(WriteHead* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     inline bool IsWriting()
@@ -82,62 +89,142 @@ public:
         }
     }
 
-    inline void Write(uint32_t position, float value)
+    /**
+     * @brief Copy the samples at each edge of the channel into the guard
+     *        samples past the opposite edge.
+     */
+    inline void MirrorGuards()
     {
-        while (position >= kLooperTotalBufferLength)
-        {
-            position -= kLooperTotalBufferLength;
-        }
-        while (position < 0)
+        for (int32_t i = 0; i < kLooperGuardSamples; i++)
         {
-            position += kLooperTotalBufferLength;
+            channel_[(i - kLooperGuardSamples) * kLooperSampleStride] = channel_[(kLooperChannelBufferLength - kLooperGuardSamples + i) * kLooperSampleStride];
+            channel_[(kLooperChannelBufferLength + i) * kLooperSampleStride] = channel_[i * kLooperSampleStride];
         }
+    }
+
+    /**
+     * @brief Write a contiguous segment, position + size must not go past the
+     *        end of the channel.
+     */
+    inline void Write(uint32_t position, const float* values, size_t size)
+    {
+        LooperSample* out = channel_ + position * kLooperSampleStride;
 
-        if (doFade_)
+        for (size_t i = 0; i < size; i++)
         {
-            float x = fadeIndex_ * kLooperFadeSamplesR;
-            if (WRITE_STATUS_FADE_IN == status_)
+            float value = values[i];
+
+            if (doFade_)
             {
-                x = 1.f - x;
+                float x = fadeIndex_ * kLooperFadeSamplesR;
+                if (WRITE_STATUS_FADE_IN == status_)
+                {
+                    x = 1.f - x;
+                }
+                fadeIndex_++;
+                if (fadeIndex_ == kLooperFadeSamples)
+                {
+                    x = WRITE_STATUS_FADE_OUT == status_;
+                    doFade_ = false;
+                    status_ = (WRITE_STATUS_FADE_IN == status_ ? WRITE_STATUS_ACTIVE : WRITE_STATUS_INACTIVE);
+                }
+                value = CheapEqualPowerCrossFade(value, FromLooperSample(out[i * kLooperSampleStride]), x);
             }
-            fadeIndex_++;
-            if (fadeIndex_ == kLooperFadeSamples)
+
+            if (WRITE_STATUS_INACTIVE != status_)
             {
-                x = WRITE_STATUS_FADE_OUT == status_;
-                doFade_ = false;
-                status_ = (WRITE_STATUS_FADE_IN == status_ ? WRITE_STATUS_ACTIVE : WRITE_STATUS_INACTIVE);
+                out[i * kLooperSampleStride] = ToLooperSample(value);
             }
-            value = CheapEqualPowerCrossFade(value, buffer_->getElement(position), x);
         }
 
-        if (WRITE_STATUS_INACTIVE != status_)
+        if (position < kLooperGuardSamples || position + size > kLooperChannelBufferLength - kLooperGuardSamples)
         {
-            buffer_->setElement(position, value);
+            MirrorGuards();
         }
     }
 };
 
-class LooperBuffer
+/**
+ * @brief The looper's stereo buffer. Each channel is stored between two
+ *        blocks of kLooperGuardSamples guard samples, which mirror the
+ *        opposite edge of the channel: once the integer position of a read
+ *        is wrapped, the interpolation taps can be fetched without any
+ *        further wrapping.
+ *        By default the channels are stored one after the other, with
+ *        USE_LOOPER_INTERLEAVED the samples of a frame are next to each
+ *        other so that a stereo read or write touches a single cache line.
+ *        Seeding the buffer with noise and clearing it are background jobs,
+ *        so the buffer can be played while they're going on.
+ *        The samples are floats, or with USE_LOOPER_16BIT 16 bit integers
+ *        that take half the memory and bandwidth: the reads interpolate the
+ *        integers and scale the result once.
+ */
+class LooperBuffer : public BackgroundJob
 {
 private:
-    FloatArray buffer_;
+    enum FillMode
+    {
+        FILL_MODE_NONE,
+        FILL_MODE_NOISE,
+        FILL_MODE_ZERO,
+    };
+
+    LooperSample* buffer_;
+
+    LooperSample* channels_[2];
 
-    float* clearBlock_;
+    FillMode fillMode_;
+    int32_t fillIndex_;
+    RandomStream noise_;
+
+    uint32_t changeStart_;
+    uint32_t changeSize_;
 
     WriteHead* writeHeads_[2];
 
+    /**
+     * @brief Catmull-Rom interpolation of the 4 taps around x, dir is the
+     *        direction of the playback. The taps are interpolated as they
+     *        are stored, the result is to be scaled by kLooperSampleScaleR.
+     */
+    static inline float Interpolate(const LooperSample* x, int32_t dir, float f)
+    {
+        dir *= kLooperSampleStride;
+
+        float xm1 = x[-dir];
+        float x0 = x[0];
+        float x1 = x[dir];
+        float x2 = x[dir * 2];
+
+        // c0 = x0
+        // c1 = 0.5 * (x1 - xm1)
+        // c2 = xm1 - 2.5*x0 + 2*x1 - 0.5*x2
+        // c3 = 0.5*(x2 - xm1) + 1.5*(x0 - x1)
+        // out = ((c3*f + c2)*f + c1)*f + c0
+        float c1 = 0.5f * (x1 - xm1);
+        float c2 = xm1 - 2.5f * x0 + 2.f * x1 - 0.5f * x2;
+        float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+
+        return ((c3 * f + c2) * f + c1) * f + x0;
+    }
+
 public:
     LooperBuffer()
     {
-        buffer_ = FloatArray::create(kLooperTotalBufferLength);
-        buffer_.noise();
-        buffer_.multiply(kLooperNoiseLevel); // Tame the noise a bit
+        buffer_ = (LooperSample*)AllocateMemory(MEMORY_REGION_SLOW, kLooperAllocatedLength * sizeof(LooperSample), kArenaArrayAlignment);
+        memset(buffer_, 0, kLooperAllocatedLength * sizeof(LooperSample));
 
-        clearBlock_ = buffer_.getData();
+        // Seeded in the background.
+        fillMode_ = FILL_MODE_NOISE;
+        fillIndex_ = 0;
+
+        changeStart_ = 0;
+        changeSize_ = 0;
 
         for (size_t i = 0; i < 2; i++)
         {
-            writeHeads_[i] = WriteHead::create(&buffer_);
+            channels_[i] = buffer_ + kLooperGuardSamples * kLooperSampleStride + kLooperChannelOffset * i;
+            writeHeads_[i] = WriteHead::create(channels_[i]);
         }
     }
     ~LooperBuffer()
@@ -146,6 +233,7 @@ public:
         {
             WriteHead::destroy(writeHeads_[i]);
         }
+        FreeMemory(buffer_);
     }
 
     static LooperBuffer* create()
@@ -158,137 +246,243 @@ public:
         delete obj;
     }
 
-    FloatArray* GetBuffer()
+    /**
+     * @brief The first sample of a channel, the guard samples are at negative
+     *        indexes and past kLooperChannelBufferLength. Index it with
+     *        position * kLooperSampleStride.
+     */
+    inline LooperSample* GetChannel(size_t channel)
     {
-        return &buffer_;
+        return channels_[channel];
     }
 
-    inline bool Clear()
+    static inline int32_t Wrap(int32_t position)
     {
-        if (clearBlock_ == buffer_.getData() + kLooperTotalBufferLength)
+        if (position >= kLooperChannelBufferLength || position < 0)
         {
-            clearBlock_ =  buffer_.getData();
-
-            return true;
+            // The positions of a streamed take can be many buffers away.
+            position %= kLooperChannelBufferLength;
+            if (position < 0)
+            {
+                position += kLooperChannelBufferLength;
+            }
         }
 
-        memset(clearBlock_, 0, kLooperClearBlockTypeSize);
-        clearBlock_ += kLooperClearBlockSize;
-
-        return false;
+        return position;
     }
 
-    inline void Write(uint32_t i, float left, float right)
+    /**
+     * @brief Start clearing the buffer, this replaces the seeding if it's
+     *        still going on.
+     */
+    inline void Clear()
     {
-        writeHeads_[LEFT_CHANNEL]->Write(i, left);
-        writeHeads_[RIGHT_CHANNEL]->Write(i + kLooperChannelBufferLength, right);
+        fillMode_ = FILL_MODE_ZERO;
+        fillIndex_ = 0;
     }
 
-    inline bool IsRecording()
+    inline bool IsClearing()
     {
-        return writeHeads_[LEFT_CHANNEL]->IsWriting() && writeHeads_[RIGHT_CHANNEL]->IsWriting();
+        return FILL_MODE_ZERO == fillMode_;
     }
 
-    inline void StartRecording()
+    /**
+     * @brief Fill the next part of the buffer.
+     */
+    size_t Run(size_t budget) override
     {
-        writeHeads_[LEFT_CHANNEL]->Start();
-        writeHeads_[RIGHT_CHANNEL]->Start();
+        if (FILL_MODE_NONE == fillMode_ || 0 == budget)
+        {
+            return 0;
+        }
+
+        size_t size = std::min<size_t>(budget, kLooperAllocatedLength - fillIndex_);
+        LooperSample* block = buffer_ + fillIndex_;
+        if (FILL_MODE_NOISE == fillMode_)
+        {
+            // A tamed noise, generated a chunk at a time.
+            float noise[kLooperNoiseChunk];
+            for (size_t i = 0; i < size; i += kLooperNoiseChunk)
+            {
+                size_t count = std::min<size_t>(size - i, kLooperNoiseChunk);
+                noise_.Fill(noise, count, -kLooperNoiseLevel, kLooperNoiseLevel);
+                for (size_t j = 0; j < count; j++)
+                {
+                    block[i + j] = ToLooperSample(noise[j]);
+                }
+            }
+        }
+        else
+        {
+            memset(block, 0, size * sizeof(LooperSample));
+        }
+        fillIndex_ += size;
+
+        changeStart_ = 0;
+        changeSize_ = kLooperChannelBufferLength;
+
+        if (kLooperAllocatedLength == fillIndex_)
+        {
+            writeHeads_[LEFT_CHANNEL]->MirrorGuards();
+            writeHeads_[RIGHT_CHANNEL]->MirrorGuards();
+            fillMode_ = FILL_MODE_NONE;
+        }
+
+        return size;
     }
 
-    inline void StopRecording()
+    /**
+     * @brief Write a block starting at position, wrapping at the end of the
+     *        channels at most once.
+     */
+    inline void Write(uint32_t position, AudioBuffer& input)
     {
-        writeHeads_[LEFT_CHANNEL]->Stop();
-        writeHeads_[RIGHT_CHANNEL]->Stop();
+        const float* left = input.getSamples(LEFT_CHANNEL).getData();
+        const float* right = input.getSamples(RIGHT_CHANNEL).getData();
+        size_t size = input.getSize();
+        size_t segment = std::min<size_t>(size, kLooperChannelBufferLength - position);
+
+        MarkChange(position, size);
+
+        writeHeads_[LEFT_CHANNEL]->Write(position, left, segment);
+        writeHeads_[RIGHT_CHANNEL]->Write(position, right, segment);
+        if (segment < size)
+        {
+            writeHeads_[LEFT_CHANNEL]->Write(0, left + segment, size - segment);
+            writeHeads_[RIGHT_CHANNEL]->Write(0, right + segment, size - segment);
+        }
     }
 
-    inline float ReadLeft(int32_t position)
+    /**
+     * @brief Add a range to the one that changed since the last
+     *        TakeChange(), the smallest range that covers both.
+     */
+    inline void MarkChange(uint32_t start, uint32_t size)
     {
-        while (position >= kLooperChannelBufferLength)
+        if (0 == changeSize_)
         {
-            position -= kLooperChannelBufferLength;
+            changeStart_ = start;
+            changeSize_ = std::min<uint32_t>(size, kLooperChannelBufferLength);
+
+            return;
         }
-        while (position < 0)
+
+        // Either range extended up to the end of the other one.
+        uint32_t after = std::max<uint32_t>(Wrap(start - changeStart_) + size, changeSize_);
+        uint32_t before = std::max<uint32_t>(Wrap(changeStart_ - start) + changeSize_, size);
+        if (before < after)
         {
-            position += kLooperChannelBufferLength;
+            changeStart_ = start;
+            after = before;
         }
+        changeSize_ = std::min<uint32_t>(after, kLooperChannelBufferLength);
+    }
 
-        return buffer_[position];
+    inline void MirrorGuards()
+    {
+        writeHeads_[LEFT_CHANNEL]->MirrorGuards();
+        writeHeads_[RIGHT_CHANNEL]->MirrorGuards();
     }
 
-    inline float ReadRight(int32_t position)
+    /**
+     * @brief Get the range of the channels that changed since the last call,
+     *        writes are contiguous so this is where the write head passed.
+     *
+     * @return true if anything changed
+     */
+    inline bool TakeChange(uint32_t& start, uint32_t& size)
     {
-        position += kLooperChannelBufferLength;
+        start = changeStart_;
+        size = changeSize_;
+        changeSize_ = 0;
 
-        while (position >= kLooperTotalBufferLength)
-        {
-            position -= kLooperChannelBufferLength;
-        }
-        while (position < kLooperChannelBufferLength)
-        {
-            position += kLooperChannelBufferLength;
-        }
+        return size > 0;
+    }
 
-        return buffer_[position];
+    inline bool IsRecording()
+    {
+        return writeHeads_[LEFT_CHANNEL]->IsWriting() && writeHeads_[RIGHT_CHANNEL]->IsWriting();
     }
 
-    // Helper to read 4 points for Hermite interpolation
-    // p: integer position
-    // dir: direction (1 or -1)
-    inline void Read4Left(int32_t p, int32_t dir, float& xm1, float& x0, float& x1, float& x2)
+    inline void StartRecording()
     {
-        xm1 = ReadLeft(p - dir);
-        x0  = ReadLeft(p);
-        x1  = ReadLeft(p + dir);
-        x2  = ReadLeft(p + dir * 2);
+        writeHeads_[LEFT_CHANNEL]->Start();
+        writeHeads_[RIGHT_CHANNEL]->Start();
     }
 
-    inline void Read4Right(int32_t p, int32_t dir, float& xm1, float& x0, float& x1, float& x2)
+    inline void StopRecording()
     {
-        xm1 = ReadRight(p - dir);
-        x0  = ReadRight(p);
-        x1  = ReadRight(p + dir);
-        x2  = ReadRight(p + dir * 2);
+        writeHeads_[LEFT_CHANNEL]->Stop();
+        writeHeads_[RIGHT_CHANNEL]->Stop();
     }
 
-    inline void Read(float p, float &left, float &right, PlaybackDirection direction = PLAYBACK_FORWARD)
+    inline void Read(LooperPosition p, float &left, float &right, PlaybackDirection direction = PLAYBACK_FORWARD)
     {
         if (direction == PLAYBACK_STALLED) {
-            left = 0.f; 
+            left = 0.f;
             right = 0.f;
             return;
         }
 
-        int32_t i = int32_t(p);
+        int32_t i = int32_t(std::floor(p));
         float f = p - i;
+        i = Wrap(i);
 
-        // Cubic Hermite Interpolation
-        // Requires 4 points: y[-1], y[0], y[1], y[2]
-        // In our case, relative to direction: x(i-1), x(i), x(i+1), x(i+2)
-        
-        float lm1, l0, l1, l2;
-        float rm1, r0, r1, r2;
-        int32_t dir = (int32_t)direction;
+        i *= kLooperSampleStride;
+        left = Interpolate(channels_[LEFT_CHANNEL] + i, direction, f) * kLooperSampleScaleR;
+        right = Interpolate(channels_[RIGHT_CHANNEL] + i, direction, f) * kLooperSampleScaleR;
+    }
 
-        Read4Left(i, dir, lm1, l0, l1, l2);
-        Read4Right(i, dir, rm1, r0, r1, r2);
+    /**
+     * @brief Read a block of frames starting at start and moving by
+     *        increment each frame. The number of frames that fit before the
+     *        edge of the channel is worked out once per segment, so there's
+     *        at most one wrap per block when |increment| < 1 block.
+     *        The sign of increment must match the direction.
+     */
+    inline void Read(LooperPosition start, float increment, AudioBuffer& output, PlaybackDirection direction = PLAYBACK_FORWARD)
+    {
+        float* left = output.getSamples(LEFT_CHANNEL).getData();
+        float* right = output.getSamples(RIGHT_CHANNEL).getData();
+        size_t size = output.getSize();
 
-        // Hermite implementation (Catmull-Rom)
-        // c0 = x0
-        // c1 = 0.5 * (x1 - xm1)
-        // c2 = xm1 - 2.5*x0 + 2*x1 - 0.5*x2
-        // c3 = 0.5*(x2 - xm1) + 1.5*(x0 - x1)
-        // out = ((c3*f + c2)*f + c1)*f + c0
+        if (direction == PLAYBACK_STALLED || increment == 0)
+        {
+            memset(left, 0, size * sizeof(float));
+            memset(right, 0, size * sizeof(float));
+            return;
+        }
 
-        // Left
-        float c1 = 0.5f * (l1 - lm1);
-        float c2 = lm1 - 2.5f * l0 + 2.f * l1 - 0.5f * l2;
-        float c3 = 0.5f * (l2 - lm1) + 1.5f * (l0 - l1);
-        left = ((c3 * f + c2) * f + c1) * f + l0;
-
-        // Right
-        c1 = 0.5f * (r1 - rm1);
-        c2 = rm1 - 2.5f * r0 + 2.f * r1 - 0.5f * r2;
-        c3 = 0.5f * (r2 - rm1) + 1.5f * (r0 - r1);
-        right = ((c3 * f + c2) * f + c1) * f + r0;
+        // Once wrapped, a float position is precise enough.
+        int32_t i = int32_t(std::floor(start));
+        float position = Wrap(i) + float(start - i);
+
+        size_t n = 0;
+        while (n < size)
+        {
+            // Frames before the integer position leaves the channel.
+            float frames = PLAYBACK_FORWARD == direction ? ceilf((kLooperChannelBufferLength - position) / increment) : floorf(position / -increment) + 1.f;
+            size_t segment = std::min<size_t>(size - n, std::max<size_t>(frames, 1));
+
+            for (size_t j = n; j < n + segment; j++)
+            {
+                i = int32_t(position);
+                float f = position - i;
+                i *= kLooperSampleStride;
+                left[j] = Interpolate(channels_[LEFT_CHANNEL] + i, direction, f) * kLooperSampleScaleR;
+                right[j] = Interpolate(channels_[RIGHT_CHANNEL] + i, direction, f) * kLooperSampleScaleR;
+                position += increment;
+            }
+            n += segment;
+
+            if (position >= kLooperChannelBufferLength)
+            {
+                position -= kLooperChannelBufferLength;
+            }
+            else if (position < 0)
+            {
+                position += kLooperChannelBufferLength;
+            }
+        }
     }
-};
\ No newline at end of file
+};
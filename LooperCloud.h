@@ -0,0 +1,183 @@
+#pragma once
+
+#include "Commons.h"
+#include "LooperBuffer.h"
+
+// The stream pages the buffer in around its heads, the grains are anywhere
+// in the loop.
+#ifdef USE_LOOPER_STREAMING
+#error "USE_LOOPER_CLOUD can't stream, it needs the whole loop in the buffer"
+#endif
+
+/**
+ * @brief The cloud mode of the looper: kLooperCloudHeads read heads play
+ *        grains of the loop, each from a random position of the loop, at
+ *        the looper's speed give or take kLooperCloudSpeedSpread, panned at
+ *        random and shaped by a sine window.
+ *        The grains are a whole number of blocks long, a quarter of the loop
+ *        within kLooperCloudGrainMin and kLooperCloudGrainMax, and staggered
+ *        so that as many of them overlap at any time. They start where they
+ *        fit in the loop, the heads that still leave it, those of grains
+ *        longer than the loop or of a loop that moved, wrap in it. The window is ramped
+ *        over each block from its value at the block's edges.
+ *        The heads are read in the order of their positions, so that those
+ *        reading the same part of the buffer follow one another and find it
+ *        in the cache.
+ */
+class LooperCloud
+{
+private:
+    struct Head
+    {
+        LooperPosition position;
+        float speed;
+        float leftGain;
+        float rightGain;
+        int blocks; // Of the grain
+        int block; // The next one
+    };
+
+    PatchState* patchState_;
+    LooperBuffer* buffer_;
+    AudioBuffer* scratch_;
+
+    RandomStream random_;
+
+    Head heads_[kLooperCloudHeads];
+    size_t order_[kLooperCloudHeads];
+    bool started_;
+
+    void Spawn(Head &head, LooperPosition start, LooperPosition length, float speed, int blocks, size_t size)
+    {
+        float pan = random_.NextFloat(0.5f - kLooperCloudPanSpread, 0.5f + kLooperCloudPanSpread);
+        CheapEqualPowerGains(pan, head.leftGain, head.rightGain);
+
+        head.speed = speed * (1.f + random_.NextFloat(-kLooperCloudSpeedSpread, kLooperCloudSpeedSpread));
+        // Backwards, the grain ends where it starts forwards.
+        LooperPosition travel = fabsf(head.speed) * blocks * size;
+        LooperPosition room = std::max<LooperPosition>(length - travel, 0);
+        head.position = start + random_.NextFloat() * room + (head.speed < 0 ? travel : 0);
+        WrapInLoop(head, start, length);
+        head.blocks = blocks;
+        head.block = 0;
+    }
+
+    static inline void WrapInLoop(Head &head, LooperPosition start, LooperPosition length)
+    {
+        if (length <= 0 || (head.position >= start && head.position < start + length))
+        {
+            return;
+        }
+        head.position = start + std::fmod(head.position - start, length);
+        if (head.position < start)
+        {
+            head.position += length;
+        }
+    }
+
+    inline float Window(const Head &head, int block)
+    {
+        return FastSine(0.5f * block / head.blocks);
+    }
+
+public:
+    LooperCloud(PatchState* patchState, LooperBuffer* buffer)
+    {
+        patchState_ = patchState;
+        buffer_ = buffer;
+        scratch_ = AudioBuffer::create(2, patchState_->blockSize);
+
+        for (size_t i = 0; i < kLooperCloudHeads; i++)
+        {
+            Head &head = heads_[i];
+            head.position = 0;
+            head.speed = 1.f;
+            head.leftGain = head.rightGain = 0;
+            head.blocks = 1;
+            head.block = 0;
+            order_[i] = i;
+        }
+        started_ = false;
+    }
+    ~LooperCloud()
+    {
+        AudioBuffer::destroy(scratch_);
+    }
+
+    static LooperCloud* create(PatchState* patchState, LooperBuffer* buffer)
+    {
+        return new LooperCloud(patchState, buffer);
+    }
+
+    static void destroy(LooperCloud* obj)
+    {
+        delete obj;
+    }
+
+    /**
+     * @brief Play a block of the loop that starts at start and is length
+     *        long.
+     */
+    void Read(LooperPosition start, LooperPosition length, float speed, PlaybackDirection direction, AudioBuffer &output)
+    {
+        size_t size = output.getSize();
+        output.clear();
+        if (PLAYBACK_STALLED == direction)
+        {
+            return;
+        }
+
+        int blocks = Clamp(length * kLooperCloudGrainRatio, kLooperCloudGrainMin, kLooperCloudGrainMax) / size;
+        blocks = std::max<int>(blocks, 1);
+        for (size_t i = 0; i < kLooperCloudHeads; i++)
+        {
+            if (!started_)
+            {
+                // Staggered, the first grains start midway.
+                Spawn(heads_[i], start, length, speed, blocks, size);
+                heads_[i].block = i * blocks / kLooperCloudHeads;
+            }
+            else if (heads_[i].block >= heads_[i].blocks)
+            {
+                Spawn(heads_[i], start, length, speed, blocks, size);
+            }
+        }
+        started_ = true;
+
+        // Insertion sort, the order barely changes from a block to the next.
+        for (size_t i = 1; i < kLooperCloudHeads; i++)
+        {
+            size_t h = order_[i];
+            size_t j = i;
+            for (; j > 0 && heads_[order_[j - 1]].position > heads_[h].position; j--)
+            {
+                order_[j] = order_[j - 1];
+            }
+            order_[j] = h;
+        }
+
+        float* left = output.getSamples(LEFT_CHANNEL).getData();
+        float* right = output.getSamples(RIGHT_CHANNEL).getData();
+        const float* grainLeft = scratch_->getSamples(LEFT_CHANNEL).getData();
+        const float* grainRight = scratch_->getSamples(RIGHT_CHANNEL).getData();
+        for (size_t i = 0; i < kLooperCloudHeads; i++)
+        {
+            Head &head = heads_[order_[i]];
+
+            float window = Window(head, head.block) * kLooperCloudGain;
+            float increment = (Window(head, head.block + 1) * kLooperCloudGain - window) / size;
+            head.block++;
+
+            buffer_->Read(head.position, head.speed, *scratch_, direction);
+            head.position += head.speed * size;
+            WrapInLoop(head, start, length);
+
+            for (size_t j = 0; j < size; j++)
+            {
+                left[j] += grainLeft[j] * window * head.leftGain;
+                right[j] += grainRight[j] * window * head.rightGain;
+                window += increment;
+            }
+        }
+    }
+};
@@ -0,0 +1,433 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include "LooperBuffer.h"
+#include "Scheduler.h"
+#include <string.h>
+
+/**
+ * @brief Where the pages of a long take are kept, a page being
+ *        kLooperStreamPageFrames stereo frames, interleaved, of LooperSample. The transfers
+ *        are asynchronous like DMA ones: once a transfer has started, its
+ *        frames mustn't be touched until IsBusy() is false again. One
+ *        transfer at a time.
+ */
+class LooperStore
+{
+public:
+    virtual ~LooperStore() {}
+
+    virtual void BeginWrite(uint32_t page, const LooperSample* frames) = 0;
+    virtual void BeginRead(uint32_t page, LooperSample* frames) = 0;
+    virtual bool IsBusy() = 0;
+};
+
+/**
+ * @brief A store in memory, for the native builds. The transfers are done
+ *        as soon as they start.
+ */
+class MemoryLooperStore : public LooperStore
+{
+private:
+    static constexpr size_t kPageSize = kLooperStreamPageFrames * 2;
+
+    LooperSample* pages_;
+
+public:
+    MemoryLooperStore()
+    {
+        pages_ = (LooperSample*)AllocateMemory(MEMORY_REGION_SLOW, kLooperStreamTakePages * kPageSize * sizeof(LooperSample), kArenaArrayAlignment);
+    }
+    ~MemoryLooperStore()
+    {
+        FreeMemory(pages_);
+    }
+
+    static MemoryLooperStore* create()
+    {
+        return new MemoryLooperStore();
+    }
+
+    static void destroy(MemoryLooperStore* obj)
+    {
+        delete obj;
+    }
+
+    void BeginWrite(uint32_t page, const LooperSample* frames) override
+    {
+        memcpy(pages_ + page * kPageSize, frames, kPageSize * sizeof(LooperSample));
+    }
+
+    void BeginRead(uint32_t page, LooperSample* frames) override
+    {
+        memcpy(frames, pages_ + page * kPageSize, kPageSize * sizeof(LooperSample));
+    }
+
+    bool IsBusy() override
+    {
+        return false;
+    }
+};
+
+enum StreamHead
+{
+    STREAM_HEAD_WRITE,
+    STREAM_HEAD_READ,
+    STREAM_HEAD_FADE,
+    STREAM_HEAD_LAST,
+};
+
+/**
+ * @brief Streams a take of kLooperStreamTakeLength frames through the
+ *        looper's buffer, which becomes a cache of the take's pages: the
+ *        frame t of the take is at t % kLooperChannelBufferLength of the
+ *        channels, so the looper reads and writes the buffer as it always
+ *        did and the wavetables see the pages that are in it.
+ *        Each block the looper tells where its heads are, and the pages
+ *        around them are paged in, from the nearest ahead of each head. The
+ *        write head comes first, then the read head, then where a fade is
+ *        going to. A page that has been written to is written back to the
+ *        store before its slot is given to another one, and the pages that
+ *        have never been written are blank and don't need to be read.
+ *        The write head only writes to the pages that are in the buffer,
+ *        when it outruns the paging its blocks are dropped and counted.
+ *        There are two staging buffers, one that can be filled or emptied
+ *        while the store transfers the other.
+ */
+class LooperStream : public BackgroundJob
+{
+private:
+    static_assert(0 == kLooperChannelBufferLength % kLooperStreamPageFrames, "The looper's buffer must be a whole number of pages");
+
+    static constexpr size_t kPageSize = kLooperStreamPageFrames * 2;
+    static constexpr size_t kCopyCost = kPageSize;
+    static_assert(kCopyCost <= kSchedulerBlockBudget, "A page must be copied within a block's budget");
+
+    struct Head
+    {
+        int32_t page;
+        int32_t direction;
+        bool active;
+    };
+
+    struct Transfer
+    {
+        int32_t page;
+        int32_t slot; // Where a read goes, -1 for a write
+        bool pending;
+    };
+
+    LooperBuffer* buffer_;
+    LooperStore* store_;
+    LooperSample* staging_[2];
+    Transfer transfers_[2];
+    size_t next_;
+
+    int32_t pages_[kLooperStreamWindowPages]; // The page in each slot, -1 while it's paged in
+    bool dirty_[kLooperStreamWindowPages];
+    uint32_t claims_[kLooperStreamWindowPages]; // The run a slot has been claimed in
+    uint32_t written_[(kLooperStreamTakePages + 31) / 32];
+    uint32_t run_;
+    uint32_t dropped_; // Frames the write head couldn't write since Clear()
+
+    Head heads_[STREAM_HEAD_LAST];
+
+    static inline int32_t WrapPage(int32_t page)
+    {
+        page %= kLooperStreamTakePages;
+
+        return page < 0 ? page + kLooperStreamTakePages : page;
+    }
+
+    inline bool IsWritten(int32_t page)
+    {
+        return written_[page >> 5] & (1u << (page & 31));
+    }
+
+    /**
+     * @brief Copy a slot of the buffer to frames, or back.
+     */
+    void Copy(int32_t slot, LooperSample* frames, bool toBuffer)
+    {
+        LooperSample* left = buffer_->GetChannel(LEFT_CHANNEL) + slot * kLooperStreamPageFrames * kLooperSampleStride;
+        LooperSample* right = buffer_->GetChannel(RIGHT_CHANNEL) + slot * kLooperStreamPageFrames * kLooperSampleStride;
+        for (int32_t i = 0; i < kLooperStreamPageFrames; i++)
+        {
+            if (toBuffer)
+            {
+                left[i * kLooperSampleStride] = frames[i * 2];
+                right[i * kLooperSampleStride] = frames[i * 2 + 1];
+            }
+            else
+            {
+                frames[i * 2] = left[i * kLooperSampleStride];
+                frames[i * 2 + 1] = right[i * kLooperSampleStride];
+            }
+        }
+    }
+
+    /**
+     * @brief A page has been paged in, the wavetables are told that its
+     *        part of the buffer changed.
+     */
+    void Place(int32_t slot, int32_t page)
+    {
+        pages_[slot] = page;
+        dirty_[slot] = false;
+        if (0 == slot || kLooperStreamWindowPages - 1 == slot)
+        {
+            buffer_->MirrorGuards();
+        }
+        buffer_->MarkChange(slot * kLooperStreamPageFrames, kLooperStreamPageFrames);
+    }
+
+    bool IsPending(int32_t slot)
+    {
+        for (size_t i = 0; i < 2; i++)
+        {
+            if (transfers_[i].pending && transfers_[i].slot == slot)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /**
+     * @brief The first slot that the heads want for another page than the
+     *        one it holds or is being paged in, the page is returned in page.
+     */
+    int32_t FindMiss(int32_t &page)
+    {
+        run_++;
+        for (size_t h = 0; h < STREAM_HEAD_LAST; h++)
+        {
+            const Head &head = heads_[h];
+            if (!head.active)
+            {
+                continue;
+            }
+            for (int32_t k = -kLooperStreamPagesBehind; k <= kLooperStreamPagesAhead; k++)
+            {
+                int32_t p = WrapPage(head.page + k * head.direction);
+                int32_t slot = p % kLooperStreamWindowPages;
+                if (claims_[slot] == run_)
+                {
+                    // Taken by a head that comes first.
+                    continue;
+                }
+                claims_[slot] = run_;
+                if (pages_[slot] != p && !IsPending(slot))
+                {
+                    page = p;
+
+                    return slot;
+                }
+            }
+        }
+
+        return -1;
+    }
+
+public:
+    LooperStream(LooperBuffer* buffer, LooperStore* store)
+    {
+        buffer_ = buffer;
+        store_ = store;
+
+        for (size_t i = 0; i < 2; i++)
+        {
+            staging_[i] = (LooperSample*)AllocateMemory(MEMORY_REGION_FAST, kPageSize * sizeof(LooperSample), kArenaArrayAlignment);
+            transfers_[i].pending = false;
+        }
+        next_ = 0;
+
+        // The buffer starts with the first pages of the take.
+        for (int32_t i = 0; i < kLooperStreamWindowPages; i++)
+        {
+            pages_[i] = i;
+            dirty_[i] = false;
+            claims_[i] = 0;
+        }
+        Clear();
+        run_ = 0;
+
+        for (size_t i = 0; i < STREAM_HEAD_LAST; i++)
+        {
+            heads_[i].page = 0;
+            heads_[i].direction = 1;
+            heads_[i].active = false;
+        }
+    }
+    ~LooperStream()
+    {
+        for (size_t i = 0; i < 2; i++)
+        {
+            FreeMemory(staging_[i]);
+        }
+    }
+
+    static LooperStream* create(LooperBuffer* buffer, LooperStore* store)
+    {
+        return new LooperStream(buffer, store);
+    }
+
+    static void destroy(LooperStream* obj)
+    {
+        delete obj;
+    }
+
+    static inline int32_t Wrap(int32_t position)
+    {
+        position %= kLooperStreamTakeLength;
+
+        return position < 0 ? position + kLooperStreamTakeLength : position;
+    }
+
+    /**
+     * @brief The whole take is blank again, along with the buffer that the
+     *        looper is clearing.
+     */
+    void Clear()
+    {
+        memset(written_, 0, sizeof(written_));
+        memset(dirty_, 0, sizeof(dirty_));
+        dropped_ = 0;
+    }
+
+    inline uint32_t GetDropped()
+    {
+        return dropped_;
+    }
+
+    /**
+     * @brief Where a head is in the take, for the block.
+     *
+     * @param direction 1 forward, -1 backwards, 0 for a head that isn't used
+     */
+    inline void SetHead(StreamHead head, LooperPosition position, int32_t direction)
+    {
+        heads_[head].page = Wrap(int32_t(std::floor(position))) / kLooperStreamPageFrames;
+        heads_[head].direction = direction < 0 ? -1 : 1;
+        heads_[head].active = 0 != direction;
+    }
+
+    /**
+     * @brief Whether the pages of size frames from position of the take are
+     *        all in the buffer. Written where they aren't, the frames would
+     *        take the slot of a page that is still to be written back or
+     *        paged in, the block is dropped instead and counted.
+     */
+    inline bool Writable(int32_t position, size_t size)
+    {
+        int32_t first = Wrap(position) / kLooperStreamPageFrames;
+        int32_t last = Wrap(position + size - 1) / kLooperStreamPageFrames;
+        for (int32_t page = first;; page = WrapPage(page + 1))
+        {
+            if (pages_[page % kLooperStreamWindowPages] != page)
+            {
+                dropped_ += size;
+
+                return false;
+            }
+            if (page == last)
+            {
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Called after the looper has written size frames from position
+     *        of the take, once Writable() said it could.
+     */
+    inline void Written(int32_t position, size_t size)
+    {
+        int32_t first = Wrap(position) / kLooperStreamPageFrames;
+        int32_t last = Wrap(position + size - 1) / kLooperStreamPageFrames;
+        for (int32_t page = first;; page = WrapPage(page + 1))
+        {
+            dirty_[page % kLooperStreamWindowPages] = true;
+            written_[page >> 5] |= 1u << (page & 31);
+            if (page == last)
+            {
+                break;
+            }
+        }
+    }
+
+    /**
+     * @brief Ends the transfers that the store is done with and starts the
+     *        next one.
+     */
+    size_t Run(size_t budget) override
+    {
+        if (store_->IsBusy())
+        {
+            return 0;
+        }
+
+        size_t used = 0;
+        for (size_t i = 0; i < 2; i++)
+        {
+            Transfer &t = transfers_[i];
+            if (t.pending && t.slot >= 0 && used + kCopyCost <= budget)
+            {
+                Copy(t.slot, staging_[i], true);
+                Place(t.slot, t.page);
+                used += kCopyCost;
+                t.pending = false;
+            }
+            else if (t.pending && t.slot < 0)
+            {
+                t.pending = false;
+            }
+        }
+
+        if (used + kCopyCost > budget || transfers_[next_].pending)
+        {
+            return used;
+        }
+
+        int32_t page;
+        int32_t slot = FindMiss(page);
+        if (slot < 0)
+        {
+            return used;
+        }
+
+        Transfer &t = transfers_[next_];
+        LooperSample* frames = staging_[next_];
+        if (dirty_[slot] && pages_[slot] >= 0)
+        {
+            // Write the page back first, the slot is paged in next time.
+            Copy(slot, frames, false);
+            store_->BeginWrite(pages_[slot], frames);
+            dirty_[slot] = false;
+            t.page = pages_[slot];
+            t.slot = -1;
+            t.pending = true;
+        }
+        else if (IsWritten(page))
+        {
+            pages_[slot] = -1;
+            store_->BeginRead(page, frames);
+            t.page = page;
+            t.slot = slot;
+            t.pending = true;
+        }
+        else
+        {
+            memset(frames, 0, kPageSize * sizeof(LooperSample));
+            Copy(slot, frames, true);
+            Place(slot, page);
+        }
+        next_ = 1 - next_;
+
+        return used + kCopyCost;
+    }
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Commons.h"
+#include "SaveQueue.h"
 
 extern PatchProcessor* getInitialisingPatchProcessor();
 
@@ -119,3 +120,41 @@ public:
         }
     }
 };
+
+/**
+ * @brief Saves the settings through the firmware: MIDI START, the file index
+ *        as a channel pressure (0: ".prm", 1: ".alt", 2: ".mod", 3: ".cv"),
+ *        a pitch bend per value and MIDI STOP, that has the firmware write
+ *        the file.
+ */
+class MidiSaveSink : public SaveSink
+{
+public:
+    static MidiSaveSink* create()
+    {
+        return new MidiSaveSink();
+    }
+
+    static void destroy(MidiSaveSink* obj)
+    {
+        delete obj;
+    }
+
+    void Begin(FuncMode file) override
+    {
+        getInitialisingPatchProcessor()->patch->sendMidi(
+            MidiMessage(USB_COMMAND_SINGLE_BYTE, START, 0, 0));
+        getInitialisingPatchProcessor()->patch->sendMidi(MidiMessage::cp(0, file));
+    }
+
+    void Send(size_t index, int16_t value) override
+    {
+        getInitialisingPatchProcessor()->patch->sendMidi(MidiMessage::pb(index, value));
+    }
+
+    void End() override
+    {
+        getInitialisingPatchProcessor()->patch->sendMidi(
+            MidiMessage(USB_COMMAND_SINGLE_BYTE, STOP, 0, 0));
+    }
+};
@@ -2,7 +2,7 @@
 
 #include "Commons.h"
 #include "MorphingOscillator.h"
-#include "NoiseOscillator.h"
+#include "SampleHoldOscillator.h"
 #include "LorenzAttractor.h"
 #include "EnvelopeFollowerMod.h"
 #include "Schmitt.h"
@@ -51,7 +51,7 @@ public:
         lfo_->setOscillator(INVERTED_RAMP, PhaseShiftOscillator<InvertedRampOscillator>::create(0, patchState_->blockRate));
         lfo_->setOscillator(RAMP, PhaseShiftOscillator<RampOscillator>::create(0, patchState_->blockRate));
         lfo_->setOscillator(SQUARE, PhaseShiftOscillator<SquareWaveOscillator>::create(0, patchState_->blockRate));
-        lfo_->setOscillator(SH, NoiseOscillator::create(patchState_->blockRate));
+        lfo_->setOscillator(SH, SampleHoldOscillator::create(patchState_->blockRate));
         lfo_->setOscillator(EF, EnvelopeFollowerMod::create(patchCtrls_, patchState_));
         lfo_->setFrequency(kInternalClockFreq);
         lfo_->morph(0.f);
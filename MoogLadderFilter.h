@@ -1,83 +1,84 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 
 /**
  * @brief Moog transistor ladder filter (24dB/octave)
- * 
+ *
  * Implementation of the classic Moog ladder filter with:
  * - 4 cascaded one-pole lowpass stages (24dB/octave)
  * - Resonance feedback from stage 4 back to input
  * - tanh saturation for that warm Moog drive
- * 
+ *
  * Based on the topology from:
  * - Moog Minimoog Model D
  * - Moog Mother-32
  * - Moog Mavis
- * 
+ *
  * The key characteristics:
  * 1. Steep 24dB rolloff (4 x 6dB stages)
  * 2. Resonance creates a peak before cutoff ("scream")
  * 3. Saturation at each stage creates warmth
  * 4. Self-oscillation at high resonance
+ *
+ * The filter is stereo and block based: each channel has its own ladder and
+ * both are run side by side as two lanes. Cutoff, resonance and drive are
+ * targets reached by a linear ramp over the next block, the tanh is
+ * approximated with SoftClip().
  */
 class MoogLadderFilter
 {
 private:
-    float stage_[4];      // Four filter stages
-    float delay_[4];      // State variables for denormal protection
+    float stage_[4][2];   // Four filter stages, one lane per channel
+    float out_[2];        // Last output, for the resonance feedback
     float sampleRate_;
     float cutoff_;
-    float resonance_;
-    float drive_;
-    float cutoffFreq_;
+    float resonance_, oldResonance_;
+    float drive_, oldDrive_;
+    float g_, oldG_;
 
     inline void updateCoefficients()
     {
         // Clamp cutoff to Nyquist
         float f = Clamp(cutoff_, 20.0f, sampleRate_ * 0.45f);
-        
-        // Normalized cutoff frequency (0 to 1)
-        // Moog ladder uses a warped frequency to match analog behavior
-        float wc = f / sampleRate_;
-        
-        // Bilinear transform with pre-warping
-        // The Moog ladder has a specific non-linear frequency response
-        float wd = k2Pi * f;
-        float wa = 2.0f * sampleRate_ * tanf(wd / (2.0f * sampleRate_));
-        float g = wa / (2.0f * sampleRate_);
-        
+
+        // Bilinear transform with pre-warping, the one-pole stages are
+        // zero-delay (TPT) so that they keep stable up to Nyquist.
+        float g = tanf(kPi * f / sampleRate_);
+
         // Store the coefficient
-        cutoffFreq_ = g;
+        g_ = g / (1.0f + g);
     }
 
 public:
     MoogLadderFilter(float sampleRate)
-        : sampleRate_(sampleRate), cutoff_(1000.0f), 
-          resonance_(0.0f), drive_(1.0f), cutoffFreq_(0.0f)
+        : sampleRate_(sampleRate), cutoff_(1000.0f),
+          resonance_(0.0f), oldResonance_(0.0f), drive_(1.0f), oldDrive_(1.0f)
     {
-        for (int i = 0; i < 4; i++)
-        {
-            stage_[i] = 0.0f;
-            delay_[i] = 0.0f;
-        }
+        reset();
         updateCoefficients();
+        oldG_ = g_;
     }
 
     static MoogLadderFilter* create(float sampleRate)
     {
-        return new MoogLadderFilter(sampleRate);
+        return ArenaCreate<MoogLadderFilter>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(MoogLadderFilter* filter)
     {
-        delete filter;
+        ArenaDestroy(filter);
     }
 
     void setCutoff(float cutoff)
     {
-        cutoff_ = Clamp(cutoff, 20.0f, 20000.0f);
-        updateCoefficients();
+        cutoff = Clamp(cutoff, 20.0f, 20000.0f);
+        if (cutoff != cutoff_)
+        {
+            cutoff_ = cutoff;
+            updateCoefficients();
+        }
     }
 
     void setResonance(float resonance)
@@ -92,62 +93,47 @@ public:
         drive_ = Clamp(drive, 0.5f, 5.0f);
     }
 
-    /**
-     * @brief Process a single sample through the ladder filter
-     * 
-     * @param input Input sample
-     * @return float Filtered output
-     */
-    inline float process(float input)
-    {
-        // Resonance feedback: take output from stage 4, scale by resonance, 
-        // subtract from input (negative feedback)
-        float feedback = stage_[3] * resonance_;
-        
-        // Input with feedback
-        float x = input - feedback;
-        
-        // Apply drive saturation to input
-        // This is where the Moog "warmth" comes from
-        x = tanhf(x * drive_) / drive_;
-        
-        // Four one-pole lowpass stages
-        // Each stage: y = y + g * (x - y) where g is the cutoff coefficient
-        for (int i = 0; i < 4; i++)
-        {
-            stage_[i] += cutoffFreq_ * (x - stage_[i]) + 1e-18f;  // + denormal protection
-            x = stage_[i];
-        }
-        
-        return stage_[3];
-    }
-
     /**
      * @brief Process stereo audio buffer
      */
     void process(AudioBuffer& input, AudioBuffer& output)
     {
-        FloatArray leftIn = input.getSamples(LEFT_CHANNEL);
-        FloatArray rightIn = input.getSamples(RIGHT_CHANNEL);
-        FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
-        FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
+        float* in[2] = { input.getSamples(LEFT_CHANNEL).getData(), input.getSamples(RIGHT_CHANNEL).getData() };
+        float* out[2] = { output.getSamples(LEFT_CHANNEL).getData(), output.getSamples(RIGHT_CHANNEL).getData() };
         size_t size = input.getSize();
-        
-        for (size_t i = 0; i < size; i++)
-        {
-            leftOut[i] = process(leftIn[i]);
-            rightOut[i] = process(rightIn[i]);
-        }
-    }
 
-    /**
-     * @brief Process mono channel
-     */
-    void process(float* input, float* output, size_t size)
-    {
+        ParameterInterpolator gParam(&oldG_, g_, size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator resoParam(&oldResonance_, resonance_, size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator driveParam(&oldDrive_, drive_, size, ParameterInterpolator::BY_SIZE);
+
         for (size_t i = 0; i < size; i++)
         {
-            output[i] = process(input[i]);
+            float g = gParam.Next();
+            float reso = resoParam.Next();
+            float drive = driveParam.Next();
+            float driveR = 1.0f / drive;
+
+            for (size_t c = 0; c < 2; c++)
+            {
+                // Resonance feedback: take output from stage 4, scale by
+                // resonance, subtract from input (negative feedback)
+                float x = in[c][i] - out_[c] * reso;
+
+                // Apply drive saturation to input
+                // This is where the Moog "warmth" comes from
+                x = SoftClip(x * drive) * driveR;
+
+                // Four one-pole lowpass stages
+                for (size_t s = 0; s < 4; s++)
+                {
+                    float v = g * (x - stage_[s][c]);
+                    x = v + stage_[s][c];
+                    stage_[s][c] = x + v;
+                }
+
+                out_[c] = x;
+                out[c][i] = x;
+            }
         }
     }
 
@@ -155,8 +141,10 @@ public:
     {
         for (int i = 0; i < 4; i++)
         {
-            stage_[i] = 0.0f;
-            delay_[i] = 0.0f;
+            stage_[i][LEFT_CHANNEL] = 0.0f;
+            stage_[i][RIGHT_CHANNEL] = 0.0f;
         }
+        out_[LEFT_CHANNEL] = 0.0f;
+        out_[RIGHT_CHANNEL] = 0.0f;
     }
 };
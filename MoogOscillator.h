@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "RampOscillator.h"
 #include "SquareWaveOscillator.h"
 
@@ -37,12 +38,12 @@ public:
 
     static MoogOscillator* create(float sampleRate)
     {
-        return new MoogOscillator(sampleRate);
+        return ArenaCreate<MoogOscillator>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(MoogOscillator* osc)
     {
-        delete osc;
+        ArenaDestroy(osc);
     }
 
     void setSubMix(float mix)
@@ -1,8 +1,11 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "RampOscillator.h"
 #include "SquareWaveOscillator.h"
+#include "Oversampler.h"
+#include "PitchUnit.h"
 
 /**
  * @brief Moog-style Voltage Controlled Oscillator
@@ -23,26 +26,24 @@ private:
     AntialiasedRampOscillator* mainOsc_;
     AntialiasedSquareWaveOscillator* subOsc_;
     float sampleRate_;
-    
-    // Analog drift
-    float driftState_;
-    float driftTarget_;
-    int driftCounter_;
-    
+
+    // Detune and analog drift
+    PitchUnit pitch_;
+
     // Parameters
     float subMix_;
     float drive_;
-    float detuneCents_;
+
+    Oversampler oversampler_;
 
 public:
     MoogVCO(float sampleRate, float detuneCents = 0.0f)
-        : sampleRate_(sampleRate), subMix_(0.3f), drive_(1.0f), detuneCents_(detuneCents)
+        : sampleRate_(sampleRate), subMix_(0.3f), drive_(1.0f)
     {
         mainOsc_ = AntialiasedRampOscillator::create(sampleRate);
         subOsc_ = AntialiasedSquareWaveOscillator::create(sampleRate);
-        driftState_ = 0.f;
-        driftTarget_ = 0.f;
-        driftCounter_ = 0;
+        pitch_.Init(sampleRate, kOscDriftCentsMax, detuneCents);
+        oversampler_.SetFactor(kOscDriveOversampling);
     }
 
     ~MoogVCO()
@@ -53,12 +54,12 @@ public:
 
     static MoogVCO* create(float sampleRate, float detuneCents = 0.0f)
     {
-        return new MoogVCO(sampleRate, detuneCents);
+        return ArenaCreate<MoogVCO>(MEMORY_REGION_FAST, sampleRate, detuneCents);
     }
 
     static void destroy(MoogVCO* osc)
     {
-        delete osc;
+        ArenaDestroy(osc);
     }
 
     void setSubMix(float mix)
@@ -73,54 +74,60 @@ public:
 
     void setDetune(float cents)
     {
-        detuneCents_ = cents;
-    }
-
-    void setFrequency(float freq)
-    {
-        // Apply detune
-        float detunedFreq = freq * fast_powf(2.f, detuneCents_ / 1200.f);
-        mainOsc_->setFrequency(detunedFreq);
-        subOsc_->setFrequency(detunedFreq * 0.5f);
+        pitch_.SetDetune(cents);
     }
 
     void processBlock(float freq, FloatArray output, size_t size, float volume)
     {
-        // Analog pitch drift
-        driftCounter_ += size;
-        if (driftCounter_ >= (int)(sampleRate_ * kOscDriftUpdateSec))
-        {
-            driftTarget_ = RandomFloat(-1.f, 1.f);
-            driftCounter_ = 0;
-        }
-        ONE_POLE(driftState_, driftTarget_, kOscDriftSmoothCoeff);
-        float driftCents = driftState_ * kOscDriftCentsMax;
-        float driftFactor = fast_powf(2.f, driftCents / 1200.f);
-        
-        float driftedFreq = freq * driftFactor;
-        
+        pitch_.Update(freq, size);
+
         for (size_t i = 0; i < size; i++)
         {
-            setFrequency(driftedFreq);
-            
+            float f = pitch_.Next();
+            mainOsc_->setFrequency(f);
+            subOsc_->setFrequency(f * 0.5f);
+
             float main = mainOsc_->generate();
             float sub = subOsc_->generate();
             
             // Classic Moog mix: saw + sub-oscillator
             float mix = main + sub * subMix_;
             
-            // Apply drive (tanh saturation for warmth)
-            float out = SoftClip(mix * drive_);
+            // Apply drive (tanh saturation for warmth), oversampled so
+            // that it doesn't alias.
+            float drive = drive_;
+            float out = oversampler_.Process(mix, [drive](float x) { return SoftClip(x * drive); });
             
             output[i] = out * volume;
         }
     }
 
+    /**
+     * @brief As processBlock(), for a mono source that's added to both
+     *        channels of a mix.
+     */
+    void processBlockAdd(float freq, FloatArray left, FloatArray right, size_t size, float volume)
+    {
+        pitch_.Update(freq, size);
+
+        for (size_t i = 0; i < size; i++)
+        {
+            float f = pitch_.Next();
+            mainOsc_->setFrequency(f);
+            subOsc_->setFrequency(f * 0.5f);
+
+            float out = generate() * volume;
+            left[i] += out;
+            right[i] += out;
+        }
+    }
+
     float generate()
     {
         float main = mainOsc_->generate();
         float sub = subOsc_->generate();
         float mix = main + sub * subMix_;
-        return SoftClip(mix * drive_);
+        float drive = drive_;
+        return oversampler_.Process(mix, [drive](float x) { return SoftClip(x * drive); });
     }
 };
@@ -0,0 +1,274 @@
+#pragma once
+
+#include "Commons.h"
+
+/**
+ * @brief The halfband lowpass of the oversamplers: 31 taps, Kaiser windowed
+ *        (beta 7), passband up to 0.17 of the oversampled rate and 70dB down
+ *        from 0.33. A halfband filter has its odd taps at zero but the center
+ *        one, 0.5, so only the taps on both sides of the center at odd
+ *        distances are kept, from the nearest.
+ */
+constexpr int kHalfbandNofCoeffs = 8;
+constexpr int kHalfbandHistory = kHalfbandNofCoeffs * 2;
+constexpr float kHalfbandCoeffs[kHalfbandNofCoeffs] = {
+    3.137195823e-01f, -9.308523723e-02f, 4.398647160e-02f, -2.159067148e-02f,
+    9.803523146e-03f, -3.772257231e-03f, 1.064443005e-03f, -1.258541307e-04f,
+};
+
+/**
+ * @brief The last kHalfbandHistory values, written twice so that they can be
+ *        read without wrapping. At(0) is the last one.
+ */
+class HalfbandHistory
+{
+private:
+    float values_[kHalfbandHistory * 2];
+    int index_;
+
+public:
+    HalfbandHistory()
+    {
+        for (int i = 0; i < kHalfbandHistory * 2; i++)
+        {
+            values_[i] = 0;
+        }
+        index_ = 0;
+    }
+
+    inline void Push(float value)
+    {
+        index_ = (index_ + kHalfbandHistory - 1) & (kHalfbandHistory - 1);
+        values_[index_] = values_[index_ + kHalfbandHistory] = value;
+    }
+
+    inline float At(int i) const
+    {
+        return values_[index_ + i];
+    }
+
+    /**
+     * @brief The filter's even phase, the taps centered between 7 and 8.
+     */
+    inline float Convolve() const
+    {
+        const float* x = values_ + index_;
+        float sum = 0;
+        for (int j = 0; j < kHalfbandNofCoeffs; j++)
+        {
+            sum += kHalfbandCoeffs[j] * (x[kHalfbandNofCoeffs - 1 - j] + x[kHalfbandNofCoeffs + j]);
+        }
+
+        return sum;
+    }
+};
+
+/**
+ * @brief Doubles the rate of a signal, polyphase: the even outputs are the
+ *        filter's even phase, the odd ones only need the center tap.
+ */
+class HalfbandUpsampler
+{
+private:
+    HalfbandHistory x_;
+
+public:
+    inline void Process(float in, float &out0, float &out1)
+    {
+        x_.Push(in);
+        out0 = 2.f * x_.Convolve();
+        out1 = x_.At(kHalfbandNofCoeffs - 1);
+    }
+};
+
+/**
+ * @brief Halves the rate of a signal, the inverse of HalfbandUpsampler. The
+ *        output is delayed by kHalfbandNofCoeffs * 2 - 1 samples of the
+ *        oversampled rate.
+ */
+class HalfbandDownsampler
+{
+private:
+    HalfbandHistory even_;
+    HalfbandHistory odd_;
+
+public:
+    inline float Process(float in0, float in1)
+    {
+        even_.Push(in0);
+        odd_.Push(in1);
+
+        return even_.Convolve() + 0.5f * odd_.At(kHalfbandNofCoeffs);
+    }
+};
+
+/**
+ * @brief Runs a nonlinear stage at 1x, 2x or 4x the sample rate, so that the
+ *        harmonics it adds above the Nyquist frequency are filtered out
+ *        instead of aliasing. 4x is two 2x stages.
+ *        The stage is whatever can be called with a sample and returns one.
+ *        The output is delayed by GetLatency() samples, Align() delays a dry
+ *        signal as much to mix it back.
+ *        SetReduced() runs the stage at 1x, delayed as much as the
+ *        oversampled one, the switch is crossfaded.
+ */
+class Oversampler
+{
+private:
+    static constexpr int kAlignSize = 32;
+    static constexpr int kFadeSamples = 32;
+
+    HalfbandUpsampler up_[2];
+    HalfbandDownsampler down_[2];
+    float delayed_;
+    float align_[kAlignSize];
+    float reducedAlign_[kAlignSize];
+    int alignIndex_;
+    int reducedIndex_;
+    int factor_;
+    bool reduced_;
+    int fade_;
+
+    void ClearFilters()
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            up_[i] = HalfbandUpsampler();
+            down_[i] = HalfbandDownsampler();
+        }
+        delayed_ = 0;
+    }
+
+    template <typename Stage>
+    inline float ProcessOversampled(float in, Stage stage)
+    {
+        float a, b;
+        up_[0].Process(in, a, b);
+        if (2 == factor_)
+        {
+            return down_[0].Process(stage(a), stage(b));
+        }
+
+        float a0, a1, b0, b1;
+        up_[1].Process(delayed_, a0, a1);
+        up_[1].Process(a, b0, b1);
+        delayed_ = b;
+        float c = down_[1].Process(stage(a0), stage(a1));
+        float d = down_[1].Process(stage(b0), stage(b1));
+
+        return down_[0].Process(c, d);
+    }
+
+    template <typename Stage>
+    inline float ProcessReduced(float in, Stage stage)
+    {
+        reducedAlign_[reducedIndex_] = stage(in);
+        float out = reducedAlign_[(reducedIndex_ - GetLatency()) & (kAlignSize - 1)];
+        reducedIndex_ = (reducedIndex_ + 1) & (kAlignSize - 1);
+
+        return out;
+    }
+
+public:
+    Oversampler(int factor = 1)
+    {
+        delayed_ = 0;
+        for (int i = 0; i < kAlignSize; i++)
+        {
+            align_[i] = 0;
+            reducedAlign_[i] = 0;
+        }
+        alignIndex_ = 0;
+        reducedIndex_ = 0;
+        reduced_ = false;
+        fade_ = 0;
+        SetFactor(factor);
+    }
+    ~Oversampler() {}
+
+    /**
+     * @param factor 1, 2 or 4
+     */
+    void SetFactor(int factor)
+    {
+        factor_ = factor >= 4 ? 4 : (factor >= 2 ? 2 : 1);
+    }
+
+    inline int GetFactor()
+    {
+        return factor_;
+    }
+
+    /**
+     * @brief Runs the stage at 1x or back at the factor, the latency stays
+     *        the same. Both run while the switch is crossfaded, the path
+     *        switched to is first run for GetLatency() samples to fill its
+     *        delay.
+     */
+    void SetReduced(bool reduced)
+    {
+        if (reduced == reduced_ || 1 == factor_)
+        {
+            return;
+        }
+        reduced_ = reduced;
+        if (fade_ > 0)
+        {
+            // Back to the path being left, both are running: the fade goes
+            // back from where it is.
+            fade_ = fade_ < kFadeSamples ? kFadeSamples - fade_ : 0;
+            return;
+        }
+        if (!reduced)
+        {
+            // The filters hold what came in before the switch to 1x.
+            ClearFilters();
+        }
+        fade_ = GetLatency() + kFadeSamples;
+    }
+
+    inline bool IsReduced()
+    {
+        return reduced_;
+    }
+
+    /**
+     * @brief The delay of the output, in samples. Each 2x stage takes as many
+     *        samples of its rate as the filter has taps but one, the 4x one
+     *        is padded by a sample of the 2x rate to make it a whole number.
+     */
+    inline int GetLatency()
+    {
+        return 4 == factor_ ? 23 : (2 == factor_ ? 15 : 0);
+    }
+
+    inline float Align(float dry)
+    {
+        align_[alignIndex_] = dry;
+        float out = align_[(alignIndex_ - GetLatency()) & (kAlignSize - 1)];
+        alignIndex_ = (alignIndex_ + 1) & (kAlignSize - 1);
+
+        return out;
+    }
+
+    template <typename Stage>
+    inline float Process(float in, Stage stage)
+    {
+        if (1 == factor_)
+        {
+            return stage(in);
+        }
+        if (0 == fade_)
+        {
+            return reduced_ ? ProcessReduced(in, stage) : ProcessOversampled(in, stage);
+        }
+
+        float reduced = ProcessReduced(in, stage);
+        float oversampled = ProcessOversampled(in, stage);
+        fade_--;
+        // The weight of the path being left.
+        float left = (fade_ < kFadeSamples ? fade_ : kFadeSamples) * (1.f / kFadeSamples);
+
+        return reduced_ ? LinearCrossFade(reduced, oversampled, left) : LinearCrossFade(oversampled, reduced, left);
+    }
+};
@@ -174,7 +174,7 @@ private:
     float nextValue_;
     float slewInc_;
 
-    uint32_t randomSeed_;
+    RandomStream random_;
 
     bool bipolar_;
     bool active_;
@@ -202,7 +202,6 @@ public:
         bipolar_ = bipolar;
         active_ = active;
         softTakeover_ = patchState->softTakeover;
-        randomSeed_ = rand();
         slewInc_ = 0;
 
         selectedParam_ = LockableParamName::PARAM_LOCKABLE_MAIN;
@@ -286,10 +285,7 @@ public:
 
     inline void Randomize(RandomAmount amount, bool semitones = false)
     {
-        randomSeed_ ^= randomSeed_ << 13;
-        randomSeed_ ^= randomSeed_ >> 17;
-        randomSeed_ ^= randomSeed_ << 5;
-        float rf = randomSeed_ * (1 / 4294967296.0f); // Random number between 0 and 1
+        float rf = random_.NextFloat(0.f, 1.f);
         float s1 = *value_ < 0.5f ? 1 : -1;
         float s2 = rf < 0.5f ? 1 : -1;
 
@@ -412,6 +408,15 @@ public:
         return catchUp_;
     }
 
+    /**
+     * @brief Whether another Process() with the same control value would
+     *        leave the parameter as it is.
+     */
+    inline bool IsSettled()
+    {
+        return !active_ || PARAM_STATE_MORPHING != state_;
+    }
+
     inline void Process(float ctrlValue, bool moving)
     {
         ctrlValue_ = ctrlValue;
@@ -496,6 +501,68 @@ protected:
     int samplesSinceStartMoving_;
     int samplesSinceStopMoving_;
 
+    float idleValue_;
+    bool idle_;
+
+    /**
+     * @brief The control is read, and stays idle until it's read more than
+     *        kParamIdleDelta away from where it went idle.
+     *
+     * @return false if it's idle
+     */
+    inline bool ReadValue(float value)
+    {
+        if (idle_ && fabsf(value - idleValue_) <= kParamIdleDelta)
+        {
+            return false;
+        }
+        idle_ = false;
+        readValue_ = value;
+
+        if (lpCoeff_ > 0 && !first_)
+        {
+            ONE_POLE(ctrlValue_, readValue_, lpCoeff_);
+        }
+        else
+        {
+            ctrlValue_ = readValue_;
+        }
+
+        return true;
+    }
+
+    /**
+     * @brief Called after Process(): the control goes idle once it has
+     *        stopped, its value has been filtered to within kParamIdleDelta
+     *        of where it's read and the parameters are settled, then
+     *        Process() has nothing to do.
+     */
+    inline void Settle(LockableParam* params)
+    {
+        if (moving_ || samplesSinceStartMoving_ > 0 ||
+            samplesSinceStopMoving_ <= kParamStopMovementLimit ||
+            fabsf(ctrlValue_ - readValue_) > kParamIdleDelta * 0.5f)
+        {
+            return;
+        }
+        for (size_t i = 0; i < LockableParamName::PARAM_LOCKABLE_LAST; i++)
+        {
+            if (!params[i].IsSettled())
+            {
+                return;
+            }
+        }
+
+        // Where the filter would end up, the step is too small to be heard.
+        ctrlValue_ = readValue_;
+        for (size_t i = 0; i < LockableParamName::PARAM_LOCKABLE_LAST; i++)
+        {
+            params[i].Process(ctrlValue_, moving_);
+        }
+        idleValue_ = readValue_;
+        idle_ = true;
+    }
+
 public:
     CatchUpController(){}
     ~CatchUpController(){}
@@ -505,6 +572,20 @@ public:
         return moving_;
     }
 
+    inline bool IsIdle()
+    {
+        return idle_;
+    }
+
+    /**
+     * @brief The parameters have been changed by something other than the
+     *        control, they have to be processed again.
+     */
+    inline void Wake()
+    {
+        idle_ = false;
+    }
+
     virtual ParamCatchUp GetCatchUpState() { return ParamCatchUp::PARAM_CATCH_UP_NONE; }
     virtual bool Process() { return false; }
     virtual void Reset() {}
@@ -541,6 +622,8 @@ public:
         moving_ = false;
         samplesSinceStartMoving_ = 0;
         samplesSinceStopMoving_ = 0;
+        idleValue_ = 0.f;
+        idle_ = false;
     }
     ~KnobController() {}
 
@@ -563,16 +646,19 @@ public:
 
     inline void SetBipolarMod(bool bipolar)
     {
+        Wake();
         lockableParams_[LockableParamName::PARAM_LOCKABLE_MOD].SetBipolar(bipolar);
     }
 
     inline void SetBipolarCv(bool bipolar)
     {
+        Wake();
         lockableParams_[LockableParamName::PARAM_LOCKABLE_CV].SetBipolar(bipolar);
     }
 
     inline void SetValue(float value, LockableParamName name = LockableParamName::PARAM_LOCKABLE_MAIN)
     {
+        Wake();
         if (LockableParamName::PARAM_LOCKABLE_MAIN == name)
         {
             lockableParams_[name].InitValue(value);
@@ -585,11 +671,13 @@ public:
 
     inline void UndoRedo(LockableParamName name = LockableParamName::PARAM_LOCKABLE_MAIN)
     {
+        Wake();
         lockableParams_[name].UndoRedo();
     }
 
     inline void Randomize(RandomAmount amount, LockableParamName name = LockableParamName::PARAM_LOCKABLE_MAIN, bool semitones = false)
     {
+        Wake();
         for (size_t i = 0; i < LockableParamName::PARAM_LOCKABLE_LAST; i++)
         {
             lockableParams_[i].Lock();
@@ -600,6 +688,7 @@ public:
 
     inline void Reset()
     {
+        Wake();
         switch (selectedParam_)
         {
         case LockableParamName::PARAM_LOCKABLE_MOD:
@@ -645,6 +734,7 @@ public:
         }
 
         selectedParam_ = selectedParam;
+        Wake();
 
         // If the selected parameter is inactive, set it to the main parameter
         // and return,
@@ -664,20 +754,16 @@ public:
 
     inline void Read(ParamKnob ctrl)
     {
-        readValue_ = getInitialisingPatchProcessor()->patch->getParameterValue(paramKnobMap[ctrl]);
-
-        if (lpCoeff_ > 0 && !first_)
-        {
-            ONE_POLE(ctrlValue_, readValue_, lpCoeff_);
-        }
-        else
-        {
-            ctrlValue_ = readValue_;
-        }
+        ReadValue(getInitialisingPatchProcessor()->patch->getParameterValue(paramKnobMap[ctrl]));
     }
 
     inline bool Process()
     {
+        if (idle_)
+        {
+            return false;
+        }
+
         bool started = samplesSinceStartMoving_ > kParamStartMovementLimit;
         bool stopped = samplesSinceStopMoving_ > kParamStopMovementLimit;
 
@@ -724,6 +810,7 @@ public:
         {
             lockableParams_[i].Process(ctrlValue_, moving_);
         }
+        Settle(lockableParams_);
 
         return moving_;
     }
@@ -787,6 +874,8 @@ public:
         moving_ = false;
         samplesSinceStartMoving_ = 0;
         samplesSinceStopMoving_ = 0;
+        idleValue_ = 0.f;
+        idle_ = false;
     }
     ~FaderController() {}
 
@@ -808,6 +897,7 @@ public:
 
     inline void SetValue(float value, LockableParamName name = LockableParamName::PARAM_LOCKABLE_MAIN)
     {
+        Wake();
         if (LockableParamName::PARAM_LOCKABLE_MAIN == name)
         {
             lockableParams_[name].InitValue(value);
@@ -820,6 +910,7 @@ public:
 
     inline void Reset()
     {
+        Wake();
         switch (selectedParam_)
         {
         case LockableParamName::PARAM_LOCKABLE_MOD:
@@ -861,6 +952,7 @@ public:
         }
 
         selectedParam_ = selectedParam;
+        Wake();
 
         // If the selected parameter is inactive, set it to the main parameter
         // and return,
@@ -880,20 +972,16 @@ public:
 
     inline void Read(ParamFader fader)
     {
-        readValue_ = getInitialisingPatchProcessor()->patch->getParameterValue(paramFaderMap[fader]);
-
-        if (lpCoeff_ > 0 && !first_)
-        {
-            ONE_POLE(ctrlValue_, readValue_, lpCoeff_);
-        }
-        else
-        {
-            ctrlValue_ = readValue_;
-        }
+        ReadValue(getInitialisingPatchProcessor()->patch->getParameterValue(paramFaderMap[fader]));
     }
 
     inline bool Process()
     {
+        if (idle_)
+        {
+            return false;
+        }
+
         bool started = samplesSinceStartMoving_ > kParamStartMovementLimit;
         bool stopped = samplesSinceStopMoving_ > kParamStopMovementLimit;
 
@@ -940,6 +1028,7 @@ public:
         {
             lockableParams_[i].Process(ctrlValue_, moving_);
         }
+        Settle(lockableParams_);
 
         return moving_;
     }
@@ -1039,7 +1128,7 @@ public:
         else
         {
             undoValue_ = *mainParam_;
-            redoValue_ = RandomFloat();
+            redoValue_ = random_.NextFloat();
             *mainParam_ = redoValue_;
             canUndo_ = true;
         }
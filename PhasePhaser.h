@@ -3,6 +3,7 @@
 #include "Commons.h"
 #include "StereoEffect.h"
 #include "AllPassFilter.h"
+#include "CoeffTrajectory.h"
 
 class PhasePhaser : public StereoEffect
 {
@@ -15,10 +16,12 @@ private:
     AllPassFilter* apLeft_[kPhaserStages];
     AllPassFilter* apRight_[kPhaserStages];
 
+    // Both channels share the coefficients.
+    CoeffTrajectory coeffs_[kPhaserStages];
+    QuadratureOscillator lfo_;
+
     float oldDepth_;
-    float oldRate_;
     float oldFreq_;
-    float phase_;
 
     static constexpr float kPhaserMinFreq = 200.f;
     static constexpr float kPhaserMaxFreq = 3000.f;
@@ -28,7 +31,7 @@ private:
 public:
     PhasePhaser(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
         : patchCtrls_(patchCtrls), patchCvs_(patchCvs), patchState_(patchState),
-          oldDepth_(0.f), oldRate_(0.f), oldFreq_(0.f), phase_(0.f)
+          oldDepth_(0.f), oldFreq_(0.f)
     {
         for (int i = 0; i < kPhaserStages; i++)
         {
@@ -61,36 +64,35 @@ public:
         float rate = Clamp(patchCtrls_->resonatorFeedback, 0.01f, 10.f);
         float baseFreq = Map(Clamp(patchCtrls_->resonatorTune, 0.f, 1.f), 0.f, 1.f, kPhaserMinFreq, kPhaserMaxFreq);
 
-        ParameterInterpolator depthParam(&oldDepth_, depth, size, ParameterInterpolator::BY_SIZE);
-        ParameterInterpolator rateParam(&oldRate_, rate, size, ParameterInterpolator::BY_SIZE);
-        ParameterInterpolator freqParam(&oldFreq_, baseFreq, size, ParameterInterpolator::BY_SIZE);
+        // The LFO steps and the coefficients are computed once per segment.
+        size_t segment = CoeffSegmentSize(size);
+        lfo_.SetFreq(rate * segment / patchState_->sampleRate);
 
-        float phaseInc = k2Pi * rate / patchState_->sampleRate;
-        int coeffUpdateCounter = 0;
+        ParameterInterpolator depthParam(&oldDepth_, depth, size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator freqParam(&oldFreq_, baseFreq, (size + segment - 1) / segment, ParameterInterpolator::BY_SIZE);
 
         for (size_t i = 0; i < size; i++)
         {
             float d = depthParam.Next();
-            float r = rateParam.Next();
-            float f = freqParam.Next();
-
-            phase_ += phaseInc;
-            if (phase_ > k2Pi) phase_ -= k2Pi;
 
-            float lfo = sinf(phase_);
-            float modFreq = f + f * lfo * 0.5f;
-
-            // Update allpass coefficients every 8 samples to save CPU
-            if (++coeffUpdateCounter >= 8)
+            if (0 == i % segment)
             {
-                coeffUpdateCounter = 0;
+                size_t count = std::min<size_t>(segment, size - i);
+                lfo_.Step();
+                float f = freqParam.Next();
+                float modFreq = f + f * lfo_.GetSin() * 0.5f;
                 for (int s = 0; s < kPhaserStages; s++)
                 {
                     float stageFreq = modFreq * (1.0f + s * 0.08f);
-                    apLeft_[s]->SetFreq(stageFreq);
-                    apRight_[s]->SetFreq(stageFreq);
+                    coeffs_[s].Set(AllPassFilter::FreqToCoeff(stageFreq, patchState_->sampleRate), count);
                 }
             }
+            for (int s = 0; s < kPhaserStages; s++)
+            {
+                float a = coeffs_[s].Next();
+                apLeft_[s]->SetCoeff(a);
+                apRight_[s]->SetCoeff(a);
+            }
 
             float le = left[i];
             float ri = right[i];
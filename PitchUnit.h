@@ -0,0 +1,113 @@
+#pragma once
+
+#include "Commons.h"
+
+/**
+ * @brief The pitch of an oscillator: once per block, the frequency is
+ *        detuned and drifted, then Next() ramps to it, sample by sample,
+ *        from where the last block ended.
+ *        The drift is the VCO's thermal instability, a new random target
+ *        every kOscDriftUpdateSec that the pitch slides to.
+ */
+class PitchUnit
+{
+private:
+    float sampleRate_;
+    float driftCents_;
+    float detuneCents_;
+    float hold_;
+
+    float driftState_;
+    float driftTarget_;
+    int driftCounter_;
+    RandomStream random_;
+
+    float freq_;
+    float target_;
+    float increment_;
+    float max_;
+
+public:
+    PitchUnit()
+    {
+        Init(48000.f, 0);
+    }
+    ~PitchUnit() {}
+
+    /**
+     * @param driftCents the depth of the drift, 0 for none
+     */
+    void Init(float sampleRate, float driftCents = kOscDriftCentsMax, float detuneCents = 0)
+    {
+        sampleRate_ = sampleRate;
+        driftCents_ = driftCents;
+        detuneCents_ = detuneCents;
+        hold_ = 0;
+        driftState_ = 0;
+        driftTarget_ = 0;
+        driftCounter_ = 0;
+        freq_ = target_ = max_ = kOscFreqMin;
+        increment_ = 0;
+    }
+
+    void SetDetune(float cents)
+    {
+        detuneCents_ = cents;
+    }
+
+    /**
+     * @brief Changes smaller than this many Hz are ignored, so that the
+     *        frequency doesn't jitter.
+     */
+    void SetHold(float hz)
+    {
+        hold_ = hz;
+    }
+
+    /**
+     * @brief Set the frequency of the block.
+     */
+    inline void Update(float freq, size_t size)
+    {
+        float cents = detuneCents_;
+        if (driftCents_ > 0)
+        {
+            driftCounter_ += size;
+            if (driftCounter_ >= (int)(sampleRate_ * kOscDriftUpdateSec))
+            {
+                driftTarget_ = random_.NextFloat(-1.f, 1.f);
+                driftCounter_ = 0;
+            }
+            ONE_POLE(driftState_, driftTarget_, kOscDriftSmoothCoeff);
+            cents += driftState_ * driftCents_;
+        }
+
+        float target = cents == 0 ? freq : freq * CentsToRatio(cents);
+        if (fabsf(target - target_) < hold_)
+        {
+            target = target_;
+        }
+        freq_ = target_;
+        max_ = Max(freq_, target);
+        target_ = target;
+        increment_ = (target - freq_) / size;
+    }
+
+    /**
+     * @brief The frequency of the next sample.
+     */
+    inline float Next()
+    {
+        freq_ += increment_;
+
+        return freq_;
+    }
+
+    /**
+     * @brief The highest frequency of the block.
+     */
+    inline float GetMax()
+    {
+        return max_;
+    }
+};
@@ -0,0 +1,270 @@
+#pragma once
+
+#include "Commons.h"
+#include "LoadMeter.h"
+
+/**
+ * @brief Stages of the audio chain that can be timed by the profiler. The
+ *        effect stages follow the order of the kEffect* indexes.
+ */
+enum ProfilerStage
+{
+    PROFILER_STAGE_CLOCK,
+    PROFILER_STAGE_UI,
+    PROFILER_STAGE_INPUT,
+    PROFILER_STAGE_LOOPER,
+    PROFILER_STAGE_OSC1,
+    PROFILER_STAGE_OSC2_SUPERSAW,
+    PROFILER_STAGE_OSC2_WAVETABLE,
+    PROFILER_STAGE_OSC2_VOICES,
+    PROFILER_STAGE_FILTER_1,
+    PROFILER_STAGE_FILTER_2,
+    PROFILER_STAGE_FILTER_3,
+    PROFILER_STAGE_FILTER_4,
+    PROFILER_STAGE_RESONATOR,
+    PROFILER_STAGE_WAVEFOLDER,
+    PROFILER_STAGE_STEREO_WIDENER,
+    PROFILER_STAGE_PHASER,
+    PROFILER_STAGE_TONAL_SHADOW,
+    PROFILER_STAGE_ECHO,
+    PROFILER_STAGE_AMBIENCE,
+    PROFILER_STAGE_OUTPUT,
+    PROFILER_STAGE_JOBS,
+    PROFILER_STAGE_BLOCK, // The whole processAudio call
+    // Timed once, not part of the blocks
+    PROFILER_STAGE_STARTUP, // The construction of the patch
+    PROFILER_STAGE_LAST,
+};
+
+static_assert(PROFILER_STAGE_RESONATOR + kEffectPhaser == PROFILER_STAGE_PHASER, "Effect stages must follow the effect indexes");
+
+static const char* const kProfilerStageNames[PROFILER_STAGE_LAST] = {
+    "clock",
+    "ui",
+    "input",
+    "looper",
+    "osc1 sine",
+    "osc2 supersaw",
+    "osc2 wavetable",
+    "osc2 voices",
+    "filter pos 1",
+    "filter pos 2",
+    "filter pos 3",
+    "filter pos 4",
+    "resonator",
+    "wavefolder",
+    "stereo widener",
+    "phaser",
+    "tonal shadow",
+    "echo",
+    "ambience",
+    "output/limiter",
+    "jobs",
+    "block",
+    "startup",
+};
+
+#ifdef USE_PROFILER
+
+struct ProfilerStats
+{
+    uint64_t total;
+    ProfilerTick max;
+    uint32_t count;
+};
+
+/**
+ * @brief Accumulates the time spent in each stage of the audio chain. Stages
+ *        are bracketed with the PROFILER_BEGIN/PROFILER_END macros, which
+ *        compile to nothing unless USE_PROFILER is defined.
+ *        Besides the lifetime stats, the ticks of the last kProfilerRingSize
+ *        blocks are kept in a ring for a running average and maximum. The
+ *        ring advances on EndBlock(). The stages after the block are timed
+ *        once and only have their lifetime stats.
+ */
+class Profiler
+{
+private:
+    ProfilerStats stats_[PROFILER_STAGE_LAST];
+    ProfilerTick start_[PROFILER_STAGE_LAST];
+    ProfilerTick current_[PROFILER_STAGE_LAST];
+    ProfilerTick ring_[PROFILER_STAGE_LAST][kProfilerRingSize];
+    uint64_t ringSum_[PROFILER_STAGE_LAST];
+
+    size_t ringIndex_;
+    float blockBudget_;
+
+    inline void Encode(uint32_t value, uint8_t* data)
+    {
+        for (size_t i = 0; i < 5; i++)
+        {
+            data[i] = value & 0x7f;
+            value >>= 7;
+        }
+    }
+
+public:
+    Profiler(float sampleRate, int blockSize)
+    {
+        ProfilerInitTimer();
+        blockBudget_ = ProfilerTicksPerSecond() * blockSize / sampleRate;
+        Reset();
+    }
+    ~Profiler() {}
+
+    static Profiler* create(float sampleRate, int blockSize)
+    {
+        return new Profiler(sampleRate, blockSize);
+    }
+
+    static void destroy(Profiler* obj)
+    {
+        delete obj;
+    }
+
+    inline void Reset()
+    {
+        for (size_t i = 0; i < PROFILER_STAGE_LAST; i++)
+        {
+            stats_[i].total = 0;
+            stats_[i].max = 0;
+            stats_[i].count = 0;
+            start_[i] = 0;
+            current_[i] = 0;
+            ringSum_[i] = 0;
+            for (size_t j = 0; j < kProfilerRingSize; j++)
+            {
+                ring_[i][j] = 0;
+            }
+        }
+        ringIndex_ = 0;
+    }
+
+    inline void Begin(ProfilerStage stage)
+    {
+        start_[stage] = ProfilerNow();
+    }
+
+    inline void End(ProfilerStage stage)
+    {
+        ProfilerTick elapsed = ProfilerNow() - start_[stage];
+        ProfilerStats* stats = &stats_[stage];
+        stats->total += elapsed;
+        stats->count++;
+        if (elapsed > stats->max)
+        {
+            stats->max = elapsed;
+        }
+        current_[stage] += elapsed;
+    }
+
+    /**
+     * @brief Push the ticks of the current block into the ring. Called once
+     *        per block, after the last stage.
+     */
+    inline void EndBlock()
+    {
+        for (size_t i = 0; i <= PROFILER_STAGE_BLOCK; i++)
+        {
+            ringSum_[i] += current_[i];
+            ringSum_[i] -= ring_[i][ringIndex_];
+            ring_[i][ringIndex_] = current_[i];
+            current_[i] = 0;
+        }
+        ringIndex_ = (ringIndex_ + 1) % kProfilerRingSize;
+    }
+
+    inline const ProfilerStats& GetStats(size_t stage)
+    {
+        return stats_[stage];
+    }
+
+    /**
+     * @brief Average ticks per block over the ring.
+     */
+    inline ProfilerTick GetAverage(size_t stage)
+    {
+        return ringSum_[stage] / kProfilerRingSize;
+    }
+
+    /**
+     * @brief Maximum ticks per block over the ring.
+     */
+    inline ProfilerTick GetMax(size_t stage)
+    {
+        ProfilerTick max = 0;
+        for (size_t i = 0; i < kProfilerRingSize; i++)
+        {
+            if (ring_[stage][i] > max)
+            {
+                max = ring_[stage][i];
+            }
+        }
+
+        return max;
+    }
+
+    /**
+     * @brief The ticks available for processing a block.
+     */
+    inline float GetBlockBudget()
+    {
+        return blockBudget_;
+    }
+
+    /**
+     * @brief Average load of the whole block, 1 is the full budget.
+     */
+    inline float GetLoad()
+    {
+        return GetAverage(PROFILER_STAGE_BLOCK) / blockBudget_;
+    }
+
+    /**
+     * @brief Whether a block in the ring went over the budget.
+     */
+    inline bool IsOverrun()
+    {
+        return GetMax(PROFILER_STAGE_BLOCK) > blockBudget_;
+    }
+
+    /**
+     * @brief Fill a SysEx report for a stage:
+     *        F0 7D 4F <stage> <avg: 5 bytes> <max: 5 bytes> F7
+     *        Ticks are 7 bit encoded, LSB first.
+     *
+     * @return size_t the size of the message, kProfilerReportSize
+     */
+    inline size_t GetReport(size_t stage, uint8_t* data)
+    {
+        data[0] = 0xf0;
+        data[1] = 0x7d; // Non-commercial manufacturer ID
+        data[2] = 0x4f;
+        data[3] = stage;
+        if (stage > PROFILER_STAGE_BLOCK)
+        {
+            const ProfilerStats& stats = stats_[stage];
+            Encode(stats.count ? stats.total / stats.count : 0, &data[4]);
+            Encode(stats.max, &data[9]);
+        }
+        else
+        {
+            Encode(GetAverage(stage), &data[4]);
+            Encode(GetMax(stage), &data[9]);
+        }
+        data[14] = 0xf7;
+
+        return kProfilerReportSize;
+    }
+};
+
+#define PROFILER_BEGIN(profiler, stage) do { if (profiler) (profiler)->Begin(stage); } while (0)
+#define PROFILER_END(profiler, stage) do { if (profiler) (profiler)->End(stage); } while (0)
+
+#else
+
+// The stage is still taken, for the stages passed around not to be unused.
+#define PROFILER_BEGIN(profiler, stage) do { (void)(stage); } while (0)
+#define PROFILER_END(profiler, stage) do { (void)(stage); } while (0)
+
+#endif // USE_PROFILER
@@ -1,168 +1,228 @@
 #pragma once
 
 #include "Commons.h"
-#include "DelayLine.h"
+#include "Arena.h"
 #include "BiquadFilter.h"
 #include "EnvFollower.h"
 #include "DcBlockingFilter.h"
 #include "Compressor.h"
 #include "StereoEffect.h"
+#include "TailSleep.h"
+#include <string.h>
 
-class Pole
+/**
+ * @brief The resonator's poles, as a bank of kResoLanes lanes: the left and
+ *        right channels of the first pole, the left one of the second and the
+ *        right one of the third, the two others being silent.
+ *        All the state of the lanes - delay, lowpass, DC blocker and envelope
+ *        follower - is kept in arrays, so that each stage runs over the lanes
+ *        in a loop without branches, and the delay lines are interleaved like
+ *        StereoDelayLine's, a frame of the 4 lanes per write.
+ */
+class ResonatorBank
 {
+private:
+    static constexpr uint32_t kMask = kResoDelaySize - 1;
+    static constexpr size_t kPoles = 3;
+    static constexpr int kLanePoles[kResoLanes] = { 0, 0, 1, 2 };
+    static constexpr float kLaneSigns[kResoLanes] = { 1.f, -1.f, 1.f, -1.f };
+
+    float* buffer_;
+    uint32_t writeIndex_;
+
+    // Lowpass, transposed direct form II. b1 is 2 * b0 and b2 is b0.
+    float b0_[kResoLanes];
+    float a1_[kResoLanes];
+    float a2_[kResoLanes];
+    float z1_[kResoLanes];
+    float z2_[kResoLanes];
+
+    // DC blocker.
+    float dcX1_[kResoLanes];
+    float dcY1_[kResoLanes];
+
+    // Envelope follower, for the infinite feedback.
+    float ef_[kResoLanes];
+
+    uint32_t delayInts_[kResoLanes];
+    float delayFracs_[kResoLanes];
+    float notes_[kResoLanes];
+    float outs_[kResoLanes];
+
+    float offsets_[kPoles];
+    float detunes_[kPoles];
+
+    float sampleRate_, msr_;
+    float reso_;
+    float feedback_;
+    float filter_;
+
+    bool infinite_;
+
+    void SetFreq(size_t lane)
+    {
+        // RBJ cookbook lowpass.
+        float w = 2.f * M_PI * (M2F(notes_[lane]) + filter_) / sampleRate_;
+        float c = cosf(w);
+        float a = sinf(w) / (2.f * reso_);
+        float a0 = 1.f / (1.f + a);
+
+        b0_[lane] = (1.f - c) * 0.5f * a0;
+        a1_[lane] = -2.f * c * a0;
+        a2_[lane] = (1.f - a) * a0;
+    }
+
+    void SetNote(size_t pole)
+    {
+        for (size_t i = 0; i < kResoLanes; i++)
+        {
+            if (kLanePoles[i] != (int)pole)
+            {
+                continue;
+            }
+            notes_[i] = offsets_[pole] + detunes_[pole] * kLaneSigns[i];
+
+            float delay = Clamp(msr_ * Db2A(notes_[i]), 0, kResoBufferSize - 2);
+            delayInts_[i] = static_cast<uint32_t>(delay);
+            delayFracs_[i] = delay - delayInts_[i];
+
+            SetFreq(i);
+        }
+    }
+
 public:
-    Pole(float sampleRate)
+    ResonatorBank(float sampleRate)
     {
         sampleRate_ = sampleRate;
         msr_ = sampleRate_ / 1000.f;
 
-        for (size_t i = 0; i < 2; i++)
+        // 64KB, kept in the fast region like the three stereo lines it
+        // replaces.
+        size_t bytes = kResoDelaySize * kResoLanes * sizeof(float);
+        buffer_ = (float*)AllocateMemory(MEMORY_REGION_FAST, bytes, kArenaArrayAlignment);
+        memset(buffer_, 0, bytes);
+        writeIndex_ = 0;
+
+        for (size_t i = 0; i < kResoLanes; i++)
         {
-            delays_[i] = DelayLine::create(kResoBufferSize);
-            lpfs_[i] = BiquadFilter::create(sampleRate_);
-            dc_[i] = DcBlockingFilter::create();
-            ef_[i] = EnvFollower::create();
+            b0_[i] = a1_[i] = a2_[i] = z1_[i] = z2_[i] = 0;
+            dcX1_[i] = dcY1_[i] = 0;
+            ef_[i] = 0;
+            delayInts_[i] = 0;
+            delayFracs_[i] = 0;
+            notes_[i] = 0;
+            outs_[i] = 0;
+        }
+        for (size_t i = 0; i < kPoles; i++)
+        {
+            offsets_[i] = 0;
+            detunes_[i] = 0;
         }
 
         reso_ = FilterStage::BUTTERWORTH_Q;
-        offset_ = 0;
         feedback_ = 0;
         filter_ = 0;
-        detune_ = 0;
         infinite_ = false;
     }
-    ~Pole()
+    ~ResonatorBank()
     {
-        for (size_t i = 0; i < 2; i++)
-        {
-            DelayLine::destroy(delays_[i]);
-            BiquadFilter::destroy(lpfs_[i]);
-            DcBlockingFilter::destroy(dc_[i]);
-            EnvFollower::destroy(ef_[i]);
-        }
+        FreeMemory(buffer_);
     }
 
-    static Pole* create(float sampleRate)
+    static ResonatorBank* create(float sampleRate)
     {
-        return new Pole(sampleRate);
+        return ArenaCreate<ResonatorBank>(MEMORY_REGION_FAST, sampleRate);
     }
 
-    static void destroy(Pole* pole)
+    static void destroy(ResonatorBank* obj)
     {
-        delete pole;
+        ArenaDestroy(obj);
     }
 
-    float GetSemiOffset()
+    float GetSemiOffset(size_t pole)
     {
-        return offset_;
+        return offsets_[pole];
     }
 
     /**
      * @param offset Semitones, -24 to 24
      */
-    void SetSemiOffset(float offset)
+    void SetSemiOffset(size_t pole, float offset)
     {
-        offset_ = offset * -0.5f + 17.667f;
-        SetNote();
+        offsets_[pole] = offset * -0.5f + 17.667f;
+        SetNote(pole);
     }
 
-    void SetFilter(float filter)
+    void SetDissonance(size_t pole, float detune)
     {
-        filter_ = filter;
-        SetFreq();
+        detunes_[pole] = detune;
+        SetNote(pole);
     }
 
-    void SetFeedback(float feedback)
+    /**
+     * @brief The feedback, resonance and filter cutoff offset, shared by all
+     *        the poles.
+     */
+    void SetFeedback(float feedback, float reso, float filter)
     {
         infinite_ = feedback > kResoInfiniteFeedbackThreshold;
         feedback_ = VariableCrossFade(0.f, 1.f, feedback, kResoInfiniteFeedbackThreshold - 0.01f);
-    }
-
-    void SetDissonance(float detune)
-    {
-        detune_ = detune;
-        SetNote();
-    }
-
-    void SetReso(float reso)
-    {
-        reso_ = reso;
-        SetFreq();
-    }
-
-    // Process just one of the two channels.
-    float Process(float in, int channel)
-    {
-        float out = lpfs_[channel]->process(outs_[channel]) * feedback_;
-
-        float mix = SoftClip(dc_[channel]->process(in + out));
-
-        // Handle infinite feedback.
-        if (infinite_)
+        if (reso != reso_ || filter != filter_)
         {
-            mix *= feedback_ * kResoInfiniteFeedbackLevel - ef_[channel]->process(mix);
+            reso_ = reso;
+            filter_ = filter;
+            for (size_t i = 0; i < kResoLanes; i++)
+            {
+                SetFreq(i);
+            }
         }
-
-        delays_[channel]->write(mix);
-        outs_[channel] = delays_[channel]->read(delayTimes_[channel]);
-
-        return out;
     }
 
-    void Process(float leftIn, float rightIn, float &leftOut, float &rightOut)
+    /**
+     * @brief Runs a sample through the lanes.
+     *
+     * @param outs the output of each lane
+     */
+    inline void Process(float leftIn, float rightIn, float* outs)
     {
-        leftOut = lpfs_[LEFT_CHANNEL]->process(outs_[LEFT_CHANNEL]) * feedback_;
-        rightOut = lpfs_[RIGHT_CHANNEL]->process(outs_[RIGHT_CHANNEL]) * feedback_;
+        const float ins[kResoLanes] = { leftIn, rightIn, leftIn, rightIn };
+        float* frame = buffer_ + writeIndex_ * kResoLanes;
+        float level = feedback_ * kResoInfiniteFeedbackLevel;
 
-        float leftMix = SoftClip(dc_[LEFT_CHANNEL]->process(leftIn + leftOut));
-        float rightMix = SoftClip(dc_[RIGHT_CHANNEL]->process(rightIn + rightOut));
-
-        // Handle infinite feedback.
-        if (infinite_)
+        for (size_t i = 0; i < kResoLanes; i++)
         {
-            leftMix *= feedback_ * kResoInfiniteFeedbackLevel - ef_[LEFT_CHANNEL]->process(leftMix);
-            rightMix *= feedback_ * kResoInfiniteFeedbackLevel - ef_[RIGHT_CHANNEL]->process(rightMix);
+            float y = b0_[i] * outs_[i] + z1_[i];
+            z1_[i] = 2.f * b0_[i] * outs_[i] - a1_[i] * y + z2_[i];
+            z2_[i] = b0_[i] * outs_[i] - a2_[i] * y;
+            float out = y * feedback_;
+            outs[i] = out;
+
+            float x = ins[i] + out;
+            dcY1_[i] = x - dcX1_[i] + 0.995f * dcY1_[i];
+            dcX1_[i] = x;
+
+            // SoftClip() without the branches, SoftLimit() is 1 at 3.
+            float mix = SoftLimit(Clamp(dcY1_[i], -3.f, 3.f));
+
+            // Handle infinite feedback. The mix is within -1 and 1, so the
+            // follower needs neither the hard clip nor the clamp.
+            if (infinite_)
+            {
+                ef_[i] = ef_[i] * 0.995f + fabsf(mix) * 0.005f;
+                mix *= level - ef_[i];
+            }
+
+            frame[i] = mix;
         }
+        writeIndex_ = (writeIndex_ + 1) & kMask;
 
-        delays_[LEFT_CHANNEL]->write(leftMix);
-        delays_[RIGHT_CHANNEL]->write(rightMix);
-
-        outs_[LEFT_CHANNEL] = delays_[LEFT_CHANNEL]->read(delayTimes_[LEFT_CHANNEL]);
-        outs_[RIGHT_CHANNEL] = delays_[RIGHT_CHANNEL]->read(delayTimes_[RIGHT_CHANNEL]);
-    }
-
-private:
-    DelayLine *delays_[2];
-    BiquadFilter *lpfs_[2];
-    EnvFollower *ef_[2];
-    DcBlockingFilter* dc_[2];
-    float delayTimes_[2], outs_[2];
-
-    float sampleRate_, msr_;
-    float lf_, rf_;
-    float reso_;
-    float offset_;
-    float feedback_;
-    float filter_;
-    float detune_;
-
-    bool infinite_;
-
-    void SetFreq()
-    {
-        lpfs_[LEFT_CHANNEL]->setLowPass(M2F(lf_) + filter_, reso_);
-        lpfs_[RIGHT_CHANNEL]->setLowPass(M2F(rf_) + filter_, reso_);
-    }
-
-    void SetNote()
-    {
-        lf_ = offset_ + detune_;
-        rf_ = offset_ - detune_;
-
-        delayTimes_[LEFT_CHANNEL] = Clamp(msr_ * Db2A(lf_), 0, kResoBufferSize);
-        delayTimes_[RIGHT_CHANNEL] = Clamp(msr_ * Db2A(rf_), 0, kResoBufferSize);
-
-        SetFreq();
+        for (size_t i = 0; i < kResoLanes; i++)
+        {
+            uint32_t index = writeIndex_ - delayInts_[i] - 1;
+            float a = buffer_[(index & kMask) * kResoLanes + i];
+            float b = buffer_[((index - 1) & kMask) * kResoLanes + i];
+            outs_[i] = a + (b - a) * delayFracs_[i];
+        }
     }
 };
 
@@ -177,12 +237,14 @@ private:
     PatchCtrls* patchCtrls_;
     PatchCvs* patchCvs_;
     PatchState* patchState_;
-    Pole* poles_[3];
+    ResonatorBank* bank_;
 
     BiquadFilter *notches_[2];
     BiquadFilter *hs_[2];
     EnvFollower *ef_[2];
 
+    TailSleep sleep_;
+
     float amp_;
     float dryWet_;
     float range_;
@@ -200,17 +262,17 @@ private:
     {
         if (idx == 0)
         {
-            poles_[0]->SetSemiOffset(offset);
-            poles_[1]->SetSemiOffset(offset + poles_[1]->GetSemiOffset());
-            poles_[2]->SetSemiOffset(offset + poles_[2]->GetSemiOffset());
+            bank_->SetSemiOffset(0, offset);
+            bank_->SetSemiOffset(1, offset + bank_->GetSemiOffset(1));
+            bank_->SetSemiOffset(2, offset + bank_->GetSemiOffset(2));
         }
         else if (idx == 1)
         {
-            poles_[1]->SetSemiOffset(offset + poles_[1]->GetSemiOffset());
+            bank_->SetSemiOffset(1, offset + bank_->GetSemiOffset(1));
         }
         else if (idx == 2)
         {
-            poles_[2]->SetSemiOffset(offset + poles_[2]->GetSemiOffset());
+            bank_->SetSemiOffset(2, offset + bank_->GetSemiOffset(2));
         }
     }
 
@@ -252,12 +314,7 @@ private:
         float reso = Map(value, 0.f, 1.f, 0.5f, 0.6f);
         float filter = Map(value, 0.f, 1.f, 5000.f, 10000.f);
         amp_ = Map(value, 0.f, 1.f, kResoGainMax, kResoGainMin) * 0.577f;
-        for (int i = 0; i < 3; i++)
-        {
-            poles_[i]->SetFeedback(feedback);
-            poles_[i]->SetReso(reso);
-            poles_[i]->SetFilter(filter);
-        }
+        bank_->SetFeedback(feedback, reso, filter);
     }
 
     /*
@@ -273,9 +330,9 @@ private:
         ranges_[1] = Map(value, 0.f, 1.f, 6, 4);
         ranges_[2] = Map(value, 0.f, 1.f, 3, 6);
 
-        poles_[0]->SetDissonance(value);
-        poles_[1]->SetDissonance(value * 2.f);
-        poles_[2]->SetDissonance(value * 3.f);
+        bank_->SetDissonance(0, value);
+        bank_->SetDissonance(1, value * 2.f);
+        bank_->SetDissonance(2, value * 3.f);
     }
 
 public:
@@ -285,10 +342,7 @@ public:
         patchCvs_ = patchCvs;
         patchState_ = patchState;
 
-        for (int i = 0; i < 3; i++)
-        {
-            poles_[i] = Pole::create(patchState_->sampleRate);
-        }
+        bank_ = ResonatorBank::create(patchState_->sampleRate);
 
         for (size_t i = 0; i < 2; i++)
         {
@@ -303,18 +357,18 @@ public:
 
         amp_ = 1.f;
         range_ = 1.f;
+        oldTuning_ = 0.f;
         task_ = 0;
 
         SetDissonance(0);
         SetTune(0);
         SetFeedback(0);
+
+        sleep_.Init(kResoBufferSize / patchState_->blockSize + 1);
     }
     ~Resonator()
     {
-        for (int i = 0; i < 3; i++)
-        {
-            Pole::destroy(poles_[i]);
-        }
+        ResonatorBank::destroy(bank_);
         for (size_t i = 0; i < 2; i++)
         {
             BiquadFilter::destroy(notches_[i]);
@@ -343,12 +397,23 @@ public:
 
         SetDissonance(patchCtrls_->resonatorDissonance);
 
-        float t = Modulate(patchCtrls_->resonatorTune, patchCtrls_->resonatorTuneModAmount, patchState_->modValue, patchCtrls_->resonatorTuneCvAmount, patchCvs_->resonatorTune, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator tuningParam(&oldTuning_, t, size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator tuningParam(&oldTuning_, patchState_->params->Get(PARAM_RESONATOR_TUNE), size, ParameterInterpolator::BY_SIZE);
 
-        float f = Modulate(patchCtrls_->resonatorFeedback, patchCtrls_->resonatorFeedbackModAmount, patchState_->modValue, patchCtrls_->resonatorFeedbackCvAmount, patchCvs_->resonatorFeedback, -1.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        SetFeedback(f);
+        SetFeedback(patchState_->params->Get(PARAM_RESONATOR_FEEDBACK));
 
+        if (sleep_.Sleep(patchCtrls_->resonatorVol, size))
+        {
+            if (&input != &output)
+            {
+                output.copyFrom(input);
+            }
+
+            return;
+        }
+
+        float dryGain, wetGain;
+        CheapEqualPowerGains(patchCtrls_->resonatorVol, dryGain, wetGain, 1.4f);
+        wetGain *= kResoMakeupGain;
 
         for (size_t i = 0; i < size; i++)
         {
@@ -356,18 +421,13 @@ public:
 
             float lIn = Clamp(leftIn[i], -3.f, 3.f);
             float rIn = Clamp(rightIn[i], -3.f, 3.f);
+            float send = sleep_.NextSend();
 
-            float left = poles_[1]->Process(lIn, LEFT_CHANNEL);
-            float right = poles_[2]->Process(rIn, RIGHT_CHANNEL);
-
-            float oLeft = left * 0.75f + right * 0.25f;
-            float oRight = left * 0.25f + right * 0.75f;
+            float outs[kResoLanes];
+            bank_->Process(lIn * send, rIn * send, outs);
 
-            left = 0;
-            right = 0;
-            poles_[0]->Process(lIn, rIn, left, right);
-            oLeft += left;
-            oRight += right;
+            float oLeft = outs[0] + outs[2] * 0.75f + outs[3] * 0.25f;
+            float oRight = outs[1] + outs[2] * 0.25f + outs[3] * 0.75f;
 
             oLeft *= 1.f - ef_[LEFT_CHANNEL]->process(oLeft);
             oRight *= 1.f - ef_[RIGHT_CHANNEL]->process(oRight);
@@ -380,9 +440,11 @@ public:
 
             oLeft = hs_[LEFT_CHANNEL]->process(oLeft);
             oRight = hs_[RIGHT_CHANNEL]->process(oRight);
+            sleep_.Track(oLeft, oRight);
 
-            leftOut[i] = CheapEqualPowerCrossFade(lIn, oLeft * kResoMakeupGain, patchCtrls_->resonatorVol, 1.4f);
-            rightOut[i] = CheapEqualPowerCrossFade(rIn, oRight * kResoMakeupGain, patchCtrls_->resonatorVol, 1.4f);
+            leftOut[i] = lIn * dryGain + oLeft * wetGain;
+            rightOut[i] = rIn * dryGain + oRight * wetGain;
         }
+        sleep_.EndBlock();
     }
 };
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Commons.h"
+#include "Oscillator.h"
+
+/**
+ * @brief The S&H shape of the modulation: a new random value each cycle,
+ *        held until the next. Takes the place of the SDK's NoiseOscillator,
+ *        which draws from the one randf() of the program, with a stream of
+ *        its own so that instances don't share their values. The phase is
+ *        its own, from 0 to 1, so it derives from Oscillator rather than
+ *        OscillatorTemplate.
+ */
+class SampleHoldOscillator : public Oscillator
+{
+private:
+    RandomStream random_;
+    float sr_;
+    float freq_;
+    float pos_;
+    float step_;
+    float sample_;
+
+public:
+    SampleHoldOscillator(float sampleRate)
+    {
+        sr_ = sampleRate;
+        pos_ = 0;
+        sample_ = 0;
+        setFrequency(1.f);
+    }
+    ~SampleHoldOscillator() {}
+
+    static SampleHoldOscillator* create(float sampleRate)
+    {
+        return new SampleHoldOscillator(sampleRate);
+    }
+
+    static void destroy(SampleHoldOscillator* obj)
+    {
+        delete obj;
+    }
+
+    void setFrequency(float freq) override
+    {
+        freq_ = freq;
+        step_ = freq / sr_;
+    }
+
+    float getFrequency() override
+    {
+        return freq_;
+    }
+
+    void setPhase(float phase) override
+    {
+        pos_ = phase;
+    }
+
+    float getPhase() override
+    {
+        return pos_;
+    }
+
+    void reset() override
+    {
+        pos_ = 0;
+    }
+
+    float generate() override
+    {
+        pos_ += step_;
+        if (pos_ >= 1.f)
+        {
+            pos_ -= 1.f;
+            sample_ = random_.NextFloat(-1.f, 1.f);
+        }
+
+        return sample_;
+    }
+};
@@ -0,0 +1,180 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include "Scheduler.h"
+#include <string.h>
+
+/**
+ * @brief Where the settings are saved, a file at a time: Begin(), then the
+ *        values from the first, then End().
+ */
+class SaveSink
+{
+public:
+    virtual ~SaveSink() {}
+
+    virtual void Begin(FuncMode file) = 0;
+    virtual void Send(size_t index, int16_t value) = 0;
+    virtual void End() = 0;
+};
+
+/**
+ * @brief The settings files waiting to be saved, one per FuncMode, sent to
+ *        the sink in the background kSaveMessagesPerBlock messages per block
+ *        at most, as many as the budget left allows, so that a save doesn't
+ *        hold up a block. A file that's enqueued again before it has been
+ *        sent takes the place of the one waiting, and a file that's the same
+ *        as the last one saved (or loaded) isn't saved again, each save
+ *        being a write of the flash.
+ *        The values are 14 bit signed, value * 8192, as they're loaded.
+ */
+class SaveQueue : public BackgroundJob
+{
+private:
+    struct File
+    {
+        int16_t values[MAX_PATCH_SETTINGS];
+        int16_t saved[MAX_PATCH_SETTINGS];
+        bool pending;
+        bool known; // saved holds what's in the flash
+    };
+
+    SaveSink* sink_;
+    File files_[FUNC_MODE_LAST];
+
+    int current_; // The file being sent, -1 for none
+    size_t sent_; // Its values sent, the Begin() being the first message
+    int16_t sending_[MAX_PATCH_SETTINGS];
+    bool busy_;
+    bool done_;
+
+    bool Next()
+    {
+        for (int i = 0; i < FUNC_MODE_LAST; i++)
+        {
+            File &file = files_[i];
+            if (!file.pending)
+            {
+                continue;
+            }
+            file.pending = false;
+            if (file.known && 0 == memcmp(file.values, file.saved, sizeof(file.values)))
+            {
+                continue;
+            }
+            // Copied, so that it can be enqueued again while it's sent.
+            memcpy(sending_, file.values, sizeof(sending_));
+            current_ = i;
+            sent_ = 0;
+
+            return true;
+        }
+
+        return false;
+    }
+
+public:
+    SaveQueue(SaveSink* sink)
+    {
+        sink_ = sink;
+        for (int i = 0; i < FUNC_MODE_LAST; i++)
+        {
+            files_[i].pending = false;
+            files_[i].known = false;
+        }
+        current_ = -1;
+        sent_ = 0;
+        busy_ = false;
+        done_ = false;
+    }
+    ~SaveQueue() {}
+
+    static SaveQueue* create(SaveSink* sink)
+    {
+        return ArenaCreate<SaveQueue>(MEMORY_REGION_FAST, sink);
+    }
+
+    static void destroy(SaveQueue* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    /**
+     * @brief What a file holds, when it has been loaded.
+     */
+    void SetSaved(FuncMode file, const int16_t* values, size_t count)
+    {
+        File &f = files_[file];
+        memset(f.saved, 0, sizeof(f.saved));
+        memcpy(f.saved, values, std::min<size_t>(count, MAX_PATCH_SETTINGS) * sizeof(int16_t));
+        f.known = true;
+    }
+
+    void Enqueue(FuncMode file, const float* values)
+    {
+        File &f = files_[file];
+        for (size_t i = 0; i < MAX_PATCH_SETTINGS; i++)
+        {
+            f.values[i] = rintf(values[i] * 8192);
+        }
+        f.pending = true;
+        busy_ = true;
+    }
+
+    inline bool IsBusy()
+    {
+        return busy_;
+    }
+
+    /**
+     * @brief True once after the files that have been enqueued are saved.
+     */
+    inline bool TakeDone()
+    {
+        bool done = done_;
+        done_ = false;
+
+        return done;
+    }
+
+    size_t Run(size_t budget) override
+    {
+        if (!busy_)
+        {
+            return 0;
+        }
+
+        // No more messages than the budget pays for, even if that's none.
+        size_t used = 0;
+        for (size_t m = 0; m < kSaveMessagesPerBlock && used + kSaveMessageCost <= budget; m++)
+        {
+            if (current_ < 0 && !Next())
+            {
+                busy_ = false;
+                done_ = true;
+                break;
+            }
+
+            if (0 == sent_)
+            {
+                sink_->Begin(FuncMode(current_));
+            }
+            else if (sent_ <= MAX_PATCH_SETTINGS)
+            {
+                sink_->Send(sent_ - 1, sending_[sent_ - 1]);
+            }
+            else
+            {
+                sink_->End();
+                memcpy(files_[current_].saved, sending_, sizeof(sending_));
+                files_[current_].known = true;
+                current_ = -1;
+            }
+            sent_++;
+            used += kSaveMessageCost;
+        }
+
+        return used;
+    }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include <algorithm>
+
+/**
+ * @brief Work that can be spread over many blocks, like filling a buffer.
+ */
+class BackgroundJob
+{
+public:
+    virtual ~BackgroundJob() {}
+
+    /**
+     * @brief Called once per block, even when there's nothing left of the
+     *        budget, so that the job can keep track of what happened in the
+     *        block.
+     *
+     * @param budget the units of work that can be done, a unit being about
+     *        the cost of writing a sample
+     * @return the units used
+     */
+    virtual size_t Run(size_t budget) = 0;
+};
+
+/**
+ * @brief Runs the background jobs at the end of each block, within
+ *        kSchedulerBlockBudget units of work. The jobs run in the order they
+ *        have been added, the first ones get the budget first.
+ */
+class JobScheduler
+{
+private:
+    BackgroundJob* jobs_[kSchedulerMaxJobs];
+    size_t nofJobs_;
+
+public:
+    JobScheduler()
+    {
+        nofJobs_ = 0;
+    }
+    ~JobScheduler() {}
+
+    static JobScheduler* create()
+    {
+        return ArenaCreate<JobScheduler>(MEMORY_REGION_FAST);
+    }
+
+    static void destroy(JobScheduler* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    void Add(BackgroundJob* job)
+    {
+        if (nofJobs_ < kSchedulerMaxJobs)
+        {
+            jobs_[nofJobs_++] = job;
+        }
+    }
+
+    void Process()
+    {
+        size_t budget = kSchedulerBlockBudget;
+        for (size_t i = 0; i < nofJobs_; i++)
+        {
+            budget -= std::min<size_t>(jobs_[i]->Run(budget), budget);
+        }
+    }
+};
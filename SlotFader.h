@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Commons.h"
+
+/**
+ * @brief Switches between the modules of a slot, like the effects, with an
+ *        equal power crossfade of kSlotFadeSamples. Only the outgoing and the
+ *        incoming modules need to run, and only while IsFading(). A third
+ *        module selected while fading waits for the fade to end.
+ */
+class SlotFader
+{
+public:
+    SlotFader()
+    {
+        Init(0);
+    }
+    ~SlotFader() {}
+
+    void Init(int slot)
+    {
+        current_ = previous_ = slot;
+        fadeIndex_ = kSlotFadeSamples;
+    }
+
+    /**
+     * @brief Called at the start of each block with the selected slot, that
+     *        is taken once the fade, if any, has ended.
+     */
+    inline void Select(int slot)
+    {
+        if (slot == current_)
+        {
+            return;
+        }
+
+        if (IsFading())
+        {
+            if (slot != previous_)
+            {
+                // The module fading out would be cut off.
+                return;
+            }
+            // Going back, fade in from where the fade out got to.
+            fadeIndex_ = kSlotFadeSamples - fadeIndex_;
+        }
+        else
+        {
+            fadeIndex_ = 0;
+        }
+        previous_ = current_;
+        current_ = slot;
+    }
+
+    inline bool IsFading()
+    {
+        return fadeIndex_ < kSlotFadeSamples;
+    }
+
+    inline int GetCurrent()
+    {
+        return current_;
+    }
+
+    inline int GetPrevious()
+    {
+        return previous_;
+    }
+
+    /**
+     * @brief Crossfade the output of the previous module into the current
+     *        one's.
+     */
+    inline void Process(AudioBuffer &previous, AudioBuffer &current)
+    {
+        FloatArray fromLeft = previous.getSamples(LEFT_CHANNEL);
+        FloatArray fromRight = previous.getSamples(RIGHT_CHANNEL);
+        FloatArray toLeft = current.getSamples(LEFT_CHANNEL);
+        FloatArray toRight = current.getSamples(RIGHT_CHANNEL);
+
+        size_t size = current.getSize();
+        for (size_t i = 0; i < size; i++)
+        {
+            float x = fadeIndex_ < kSlotFadeSamples ? fadeIndex_ * kSlotFadeSamplesR : 1.f;
+            toLeft[i] = CheapEqualPowerCrossFade(fromLeft[i], toLeft[i], x);
+            toRight[i] = CheapEqualPowerCrossFade(fromRight[i], toRight[i], x);
+            fadeIndex_++;
+        }
+        if (!IsFading())
+        {
+            previous_ = current_;
+        }
+    }
+
+    /**
+     * @brief Add the output of a module to a mix, times gain, faded in if
+     *        it's the current one's or out if it's the previous one's. For
+     *        the modules that add to the mix themselves: both are added, then
+     *        the fade is advanced with Advance().
+     */
+    inline void AddFaded(AudioBuffer &input, AudioBuffer &output, bool current, float gain)
+    {
+        FloatArray inLeft = input.getSamples(LEFT_CHANNEL);
+        FloatArray inRight = input.getSamples(RIGHT_CHANNEL);
+        FloatArray outLeft = output.getSamples(LEFT_CHANNEL);
+        FloatArray outRight = output.getSamples(RIGHT_CHANNEL);
+
+        size_t size = output.getSize();
+        for (size_t i = 0; i < size; i++)
+        {
+            int index = fadeIndex_ + i;
+            float x = index < kSlotFadeSamples ? index * kSlotFadeSamplesR : 1.f;
+            float fromGain, toGain;
+            CheapEqualPowerGains(x, fromGain, toGain);
+            float g = (current ? toGain : fromGain) * gain;
+            outLeft[i] += inLeft[i] * g;
+            outRight[i] += inRight[i] * g;
+        }
+    }
+
+    inline void Advance(size_t size)
+    {
+        fadeIndex_ += size;
+        if (!IsFading())
+        {
+            previous_ = current_;
+        }
+    }
+
+private:
+    int current_, previous_;
+    int fadeIndex_;
+};
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include "Scheduler.h"
+#include <string.h>
+
+/**
+ * @brief Where the bank is saved, as SnapshotBank::GetImage() would give it.
+ *        The image is written a part at a time, from the start, then
+ *        committed. A write that hasn't been committed can be started over.
+ */
+class SnapshotStore
+{
+public:
+    virtual ~SnapshotStore() {}
+
+    virtual void Write(size_t offset, const uint16_t* words, size_t count) = 0;
+    virtual void Commit() = 0;
+    virtual bool IsBusy() = 0;
+};
+
+/**
+ * @brief The bank on its own, for the platforms that have nowhere to save it.
+ *        It's lost when the patch is.
+ */
+class MemorySnapshotStore : public SnapshotStore
+{
+private:
+    uint16_t* image_;
+    size_t size_;
+
+public:
+    MemorySnapshotStore(size_t size)
+    {
+        size_ = size;
+        image_ = (uint16_t*)AllocateMemory(MEMORY_REGION_SLOW, size_ * sizeof(uint16_t), kArenaAlignment);
+    }
+    ~MemorySnapshotStore()
+    {
+        FreeMemory(image_);
+    }
+
+    static MemorySnapshotStore* create(size_t size)
+    {
+        return new MemorySnapshotStore(size);
+    }
+
+    static void destroy(MemorySnapshotStore* obj)
+    {
+        delete obj;
+    }
+
+    void Write(size_t offset, const uint16_t* words, size_t count) override
+    {
+        memcpy(image_ + offset, words, std::min<size_t>(count, size_ - offset) * sizeof(uint16_t));
+    }
+
+    void Commit() override {}
+
+    bool IsBusy() override
+    {
+        return false;
+    }
+};
+
+/**
+ * @brief A bank of kSnapshotSlots snapshots of the whole PatchCtrls, that can
+ *        be recalled at once or morphed to in a given time.
+ *        The bank is kept as the image it's saved as: a header of
+ *        kSnapshotHeaderSize words, the magic, the patch's version, the
+ *        values per snapshot and a bit per slot that has been stored, then
+ *        the slots, each value being a half precision float. A newer minor
+ *        version only adds values at the end of PatchCtrls, the ones that an
+ *        older image lacks are left to the controls.
+ *        Recalling only unpacks a slot, Apply() then sets the controls each
+ *        block, after the ui, until the panel takes them back with
+ *        Release(). The transport (recording, resampling) is always left to
+ *        the panel.
+ *        The bank is saved in the background, once it has been left
+ *        untouched for kSnapshotSaveIdleBlocks, a budget's worth of words per
+ *        block.
+ */
+class SnapshotBank : public BackgroundJob
+{
+public:
+    static constexpr size_t kSnapshotValues = sizeof(PatchCtrls) / sizeof(float);
+    static constexpr size_t kSnapshotHeaderSize = 4;
+    static constexpr size_t kSnapshotImageSize = kSnapshotHeaderSize + kSnapshotSlots * kSnapshotValues;
+
+private:
+    static constexpr uint16_t kSnapshotMagic = 0x534e; // "SN"
+    static constexpr uint16_t kSnapshotVersion = (PATCH_VERSION_MAJOR << 8) | PATCH_VERSION_MINOR;
+    static constexpr uint16_t kSnapshotUnset = 0x7e00; // A NaN, the value is left to the controls
+
+    enum Header
+    {
+        HEADER_MAGIC,
+        HEADER_VERSION,
+        HEADER_VALUES,
+        HEADER_SLOTS,
+    };
+
+    PatchState* patchState_;
+    SnapshotStore* store_;
+    MemorySnapshotStore* memoryStore_;
+
+    uint16_t image_[kSnapshotImageSize];
+
+    PatchCtrls from_;
+    PatchCtrls to_;
+    float morph_;
+    float morphInc_;
+    float morphSec_;
+    int fromSlot_;
+    int toSlot_;
+    bool active_;
+    bool applied_; // The controls are the bank's since the last block
+    bool fromLive_; // The morph starts from the controls as they are
+
+    int idleBlocks_;
+    size_t saved_; // The words of the image written so far
+    bool dirty_;
+    bool saving_;
+
+    inline uint16_t* Slot(size_t slot)
+    {
+        return image_ + kSnapshotHeaderSize + slot * kSnapshotValues;
+    }
+
+    void Unpack(size_t slot, const PatchCtrls &live, PatchCtrls &ctrls)
+    {
+        const uint16_t* values = Slot(slot);
+        const float* in = (const float*)&live;
+        float* out = (float*)&ctrls;
+        for (size_t i = 0; i < kSnapshotValues; i++)
+        {
+            out[i] = kSnapshotUnset == values[i] ? in[i] : HalfToFloat(values[i]);
+        }
+    }
+
+    void Touch()
+    {
+        dirty_ = true;
+        idleBlocks_ = 0;
+        // What has been written of the image is stale.
+        saving_ = false;
+    }
+
+    void Start(PatchCtrls* ctrls)
+    {
+        if (fromLive_ && applied_)
+        {
+            // From where the last morph got to.
+            float* from = (float*)&from_;
+            const float* to = (const float*)&to_;
+            for (size_t i = 0; i < kSnapshotValues; i++)
+            {
+                from[i] += (to[i] - from[i]) * morph_;
+            }
+        }
+        else if (fromLive_)
+        {
+            from_ = *ctrls;
+        }
+        else if (fromSlot_ >= 0)
+        {
+            Unpack(fromSlot_, *ctrls, from_);
+        }
+        Unpack(toSlot_, *ctrls, to_);
+        fromLive_ = false;
+        morph_ = 0;
+        morphInc_ = morphSec_ > 0 ? 1.f / (morphSec_ * patchState_->blockRate) : 1.f;
+        toSlot_ = -1;
+    }
+
+public:
+    SnapshotBank(PatchState* patchState)
+    {
+        patchState_ = patchState;
+
+        memoryStore_ = NULL;
+        store_ = patchState_->snapshotStore;
+        if (NULL == store_)
+        {
+            memoryStore_ = MemorySnapshotStore::create(kSnapshotImageSize);
+            store_ = memoryStore_;
+        }
+
+        for (size_t i = 0; i < kSnapshotImageSize; i++)
+        {
+            image_[i] = kSnapshotUnset;
+        }
+        image_[HEADER_MAGIC] = kSnapshotMagic;
+        image_[HEADER_VERSION] = kSnapshotVersion;
+        image_[HEADER_VALUES] = kSnapshotValues;
+        image_[HEADER_SLOTS] = 0;
+
+        morph_ = 1.f;
+        morphInc_ = 0;
+        morphSec_ = 0;
+        fromSlot_ = -1;
+        toSlot_ = -1;
+        active_ = false;
+        applied_ = false;
+        fromLive_ = false;
+
+        idleBlocks_ = 0;
+        saved_ = 0;
+        dirty_ = false;
+        saving_ = false;
+    }
+    ~SnapshotBank()
+    {
+        MemorySnapshotStore::destroy(memoryStore_);
+    }
+
+    static SnapshotBank* create(PatchState* patchState)
+    {
+        return ArenaCreate<SnapshotBank>(MEMORY_REGION_FAST, patchState);
+    }
+
+    static void destroy(SnapshotBank* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    /**
+     * @brief Takes the bank from an image that has been saved, if it's one
+     *        of this major version.
+     *
+     * @param size the words of the image
+     * @return false if the image was discarded
+     */
+    bool Load(const uint16_t* image, size_t size)
+    {
+        if (size < kSnapshotHeaderSize || kSnapshotMagic != image[HEADER_MAGIC] ||
+            (kSnapshotVersion >> 8) != (image[HEADER_VERSION] >> 8))
+        {
+            return false;
+        }
+        size_t values = image[HEADER_VALUES];
+        if (0 == values || size < kSnapshotHeaderSize + kSnapshotSlots * values)
+        {
+            return false;
+        }
+
+        image_[HEADER_SLOTS] = image[HEADER_SLOTS];
+        for (size_t slot = 0; slot < kSnapshotSlots; slot++)
+        {
+            const uint16_t* in = image + kSnapshotHeaderSize + slot * values;
+            uint16_t* out = Slot(slot);
+            for (size_t i = 0; i < kSnapshotValues; i++)
+            {
+                out[i] = i < values ? in[i] : kSnapshotUnset;
+            }
+        }
+
+        return true;
+    }
+
+    inline const uint16_t* GetImage()
+    {
+        return image_;
+    }
+
+    inline bool IsStored(size_t slot)
+    {
+        return slot < kSnapshotSlots && (image_[HEADER_SLOTS] & (1 << slot));
+    }
+
+    /**
+     * @brief Whether the bank is setting the controls.
+     */
+    inline bool IsActive()
+    {
+        return active_;
+    }
+
+    void Store(size_t slot, const PatchCtrls &ctrls)
+    {
+        if (slot >= kSnapshotSlots)
+        {
+            return;
+        }
+
+        const float* in = (const float*)&ctrls;
+        uint16_t* values = Slot(slot);
+        for (size_t i = 0; i < kSnapshotValues; i++)
+        {
+            values[i] = FloatToHalf(in[i]);
+        }
+        image_[HEADER_SLOTS] |= 1 << slot;
+        Touch();
+    }
+
+    /**
+     * @brief The time the next recalls take to morph to their snapshot, 0
+     *        for at once.
+     */
+    void SetMorphTime(float seconds)
+    {
+        morphSec_ = Max(seconds, 0.f);
+    }
+
+    /**
+     * @brief Morph from where the controls are to a snapshot, in the time
+     *        set by SetMorphTime(). Done by the next Apply(), so it can be
+     *        called from the MIDI callback.
+     */
+    bool Recall(size_t slot)
+    {
+        if (!IsStored(slot))
+        {
+            return false;
+        }
+        fromLive_ = true;
+        fromSlot_ = -1;
+        toSlot_ = slot;
+        active_ = true;
+
+        return true;
+    }
+
+    /**
+     * @brief Morph from a snapshot to another in seconds.
+     */
+    bool Morph(size_t from, size_t to, float seconds)
+    {
+        if (!IsStored(from) || !IsStored(to))
+        {
+            return false;
+        }
+        fromLive_ = false;
+        fromSlot_ = from;
+        toSlot_ = to;
+        morphSec_ = Max(seconds, 0.f);
+        active_ = true;
+
+        return true;
+    }
+
+    /**
+     * @brief Gives the controls back to the panel.
+     */
+    void Release()
+    {
+        active_ = false;
+        applied_ = false;
+        toSlot_ = -1;
+    }
+
+    /**
+     * @brief Called once per block, after the ui has set the controls.
+     */
+    void Apply(PatchCtrls* ctrls)
+    {
+        if (!active_)
+        {
+            return;
+        }
+        if (toSlot_ >= 0)
+        {
+            Start(ctrls);
+        }
+
+        float looperRecording = ctrls->looperRecording;
+        float looperResampling = ctrls->looperResampling;
+        if (morph_ < 1.f)
+        {
+            morph_ = Min(morph_ + morphInc_, 1.f);
+            idleBlocks_ = 0;
+        }
+        const float* from = (const float*)&from_;
+        const float* to = (const float*)&to_;
+        float* out = (float*)ctrls;
+        for (size_t i = 0; i < kSnapshotValues; i++)
+        {
+            out[i] = from[i] + (to[i] - from[i]) * morph_;
+        }
+        ctrls->looperRecording = looperRecording;
+        ctrls->looperResampling = looperResampling;
+        applied_ = true;
+    }
+
+    /**
+     * @brief Saves the image once the bank has been left alone long enough,
+     *        the store gets budget words per block at most.
+     */
+    size_t Run(size_t budget) override
+    {
+        if (!dirty_ || ++idleBlocks_ < kSnapshotSaveIdleBlocks || store_->IsBusy())
+        {
+            return 0;
+        }
+
+        if (!saving_)
+        {
+            saving_ = true;
+            saved_ = 0;
+        }
+        size_t count = std::min<size_t>(kSnapshotImageSize - saved_, budget);
+        if (count > 0)
+        {
+            store_->Write(saved_, image_ + saved_, count);
+            saved_ += count;
+        }
+        if (kSnapshotImageSize == saved_)
+        {
+            store_->Commit();
+            dirty_ = false;
+            saving_ = false;
+        }
+
+        return count;
+    }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include "Interpolator.h"
+#include <stdint.h>
+#include <algorithm>
+
+/**
+ * @brief A stereo delay line of kSize frames. The size is a power of two so
+ *        that the indexes wrap with a mask, and the two channels are stored
+ *        frame by frame in one allocation, so that a stereo read or write
+ *        touches a single cache line.
+ *        Delays are in samples, 0 being the last frame written. The taps that
+ *        don't depend on what is written in the same block can be read in
+ *        one go with readBlock().
+ */
+template <uint32_t kSize>
+class StereoDelayLine
+{
+    static_assert(kSize >= 4 && 0 == (kSize & (kSize - 1)), "The size of a StereoDelayLine must be a power of two");
+
+private:
+    static constexpr uint32_t kMask = kSize - 1;
+
+    FloatArray buffer_;
+    uint32_t writeIndex_;
+
+    inline float Sample(uint32_t index, size_t channel)
+    {
+        return buffer_[((index & kMask) << 1) + channel];
+    }
+
+public:
+    StereoDelayLine()
+    {
+        buffer_ = ArenaCreateFloatArray(kSize * 2);
+        writeIndex_ = 0;
+    }
+    ~StereoDelayLine()
+    {
+        ArenaDestroyFloatArray(buffer_);
+    }
+
+    static StereoDelayLine* create()
+    {
+        return ArenaCreate<StereoDelayLine>(MEMORY_REGION_FAST);
+    }
+
+    static void destroy(StereoDelayLine* line)
+    {
+        ArenaDestroy(line);
+    }
+
+    void clear()
+    {
+        buffer_.clear();
+    }
+
+    inline float readAt(uint32_t delay, size_t channel)
+    {
+        return Sample(writeIndex_ - delay - 1, channel);
+    }
+
+    inline float read(float delay, size_t channel)
+    {
+        delay = Clamp(delay, 0.f, static_cast<float>(kSize - 2));
+        uint32_t d = static_cast<uint32_t>(delay);
+        float frac = delay - d;
+
+        return Interpolator::linear(readAt(d, channel), readAt(d + 1, channel), frac);
+    }
+
+    inline float read(float delay1, float delay2, float x, size_t channel)
+    {
+        float v = read(delay1, channel);
+        if (x == 0)
+        {
+            return v;
+        }
+
+        return v * (1.f - x) + read(delay2, channel) * x;
+    }
+
+    inline void read(float leftDelay, float rightDelay, float &left, float &right)
+    {
+        left = read(leftDelay, LEFT_CHANNEL);
+        right = read(rightDelay, RIGHT_CHANNEL);
+    }
+
+    /**
+     * @brief Read what read() would return for a channel before each of the
+     *        next size writes, the delay must then be at least size - 1.
+     */
+    inline void readBlock(float delay, size_t channel, float* out, size_t size)
+    {
+        delay = Clamp(delay, 0.f, static_cast<float>(kSize - 2));
+        uint32_t d = static_cast<uint32_t>(delay);
+        float frac = delay - d;
+
+        uint32_t index = writeIndex_ - d - 1;
+        for (size_t i = 0; i < size; i++, index++)
+        {
+            out[i] = Interpolator::linear(Sample(index, channel), Sample(index - 1, channel), frac);
+        }
+    }
+
+    /**
+     * @brief As above, crossfading from delay1 to delay2 with x, that
+     *        increases by xi every sample.
+     */
+    inline void readBlock(float delay1, float delay2, float x, float xi, size_t channel, float* out, size_t size)
+    {
+        if (delay1 == delay2 || (x == 0 && xi == 0))
+        {
+            readBlock(delay1, channel, out, size);
+
+            return;
+        }
+
+        delay1 = Clamp(delay1, 0.f, static_cast<float>(kSize - 2));
+        delay2 = Clamp(delay2, 0.f, static_cast<float>(kSize - 2));
+        uint32_t d1 = static_cast<uint32_t>(delay1);
+        uint32_t d2 = static_cast<uint32_t>(delay2);
+        float frac1 = delay1 - d1;
+        float frac2 = delay2 - d2;
+
+        uint32_t index1 = writeIndex_ - d1 - 1;
+        uint32_t index2 = writeIndex_ - d2 - 1;
+        for (size_t i = 0; i < size; i++, index1++, index2++)
+        {
+            float v1 = Interpolator::linear(Sample(index1, channel), Sample(index1 - 1, channel), frac1);
+            float v2 = Interpolator::linear(Sample(index2, channel), Sample(index2 - 1, channel), frac2);
+            out[i] = v1 * (1.f - x) + v2 * x;
+            x += xi;
+        }
+    }
+
+    inline void write(float left, float right)
+    {
+        float* frame = buffer_.getData() + (writeIndex_ << 1);
+        frame[LEFT_CHANNEL] = left;
+        frame[RIGHT_CHANNEL] = right;
+        writeIndex_ = (writeIndex_ + 1) & kMask;
+    }
+};
@@ -1,10 +1,19 @@
 #pragma once
 
 #include "Commons.h"
-#include "SineOscillator.h"
 #include "MoogVCO.h"
 #include "Schmitt.h"
+#include "PitchUnit.h"
 
+static_assert(kOscUnisonVoices >= 4 && kOscUnisonVoices <= 8 && 0 == kOscUnisonVoices % 4, "The unison voices are processed 4 at a time");
+
+/**
+ * @brief OSC1. In standard mode, kOscUnisonVoices sines per channel spread
+ *        from the pitch to the unison interval. The first voice of both
+ *        channels stays on the pitch, the others take turns between the
+ *        channels along the interval. The phases are kept as arrays and the
+ *        voices computed with FastSine, so that they run as one loop.
+ */
 class StereoSineOscillator
 {
 private:
@@ -12,8 +21,13 @@ private:
     PatchCvs* patchCvs_;
     PatchState* patchState_;
 
-    // Standard mode: dual sine oscillators
-    SineOscillator* oscs_[2];
+    // Standard mode: unison sines, phases and increments in cycles
+    float phases_[2][kOscUnisonVoices];
+    float incs_[2][kOscUnisonVoices];
+    float incSteps_[2][kOscUnisonVoices];
+    float positions_[2][kOscUnisonVoices];
+    float sampleRateR_;
+    float oldNorm_;
     
     // Moog mode: Moog VCO (saw + sub)
     MoogVCO* moogVco_;
@@ -21,7 +35,6 @@ private:
 
     Schmitt trigger_;
 
-    float oldFreqs_[2];
     float oldVol_;
 
     bool fadeOut_, fadeIn_;
@@ -56,10 +69,19 @@ public:
         patchState_ = PatchState;
         moogMode_ = moogMode;
 
-        for (size_t i = 0; i < 2; i++)
+        // Where the voices sit along the interval, 0 being the pitch.
+        for (size_t c = 0; c < 2; c++)
         {
-            oscs_[i] = SineOscillator::create(patchState_->sampleRate);
+            for (size_t k = 0; k < kOscUnisonVoices; k++)
+            {
+                phases_[c][k] = 0;
+                incs_[c][k] = 0;
+                incSteps_[c][k] = 0;
+                positions_[c][k] = 0 == k ? 0 : (2.f * k - 1 + c) / (2 * kOscUnisonVoices - 2);
+            }
         }
+        sampleRateR_ = 1.f / patchState_->sampleRate;
+        oldNorm_ = 0;
         
         // OSC1 Moog VCO: 0 cents detune (main voice)
         moogVco_ = MoogVCO::create(patchState_->sampleRate, 0.0f);
@@ -74,10 +96,6 @@ public:
     }
     ~StereoSineOscillator()
     {
-        for (size_t i = 0; i < 2; i++)
-        {
-            SineOscillator::destroy(oscs_[i]);
-        }
         MoogVCO::destroy(moogVco_);
     }
 
@@ -96,31 +114,26 @@ public:
         delete obj;
     }
 
-    void Process(AudioBuffer &output)
+    /**
+     * @brief Adds the oscillator to output, times gain.
+     */
+    void ProcessAdd(AudioBuffer &output, float gain)
     {
         size_t size = output.getSize();
+        float* channels[2] = {output.getSamples(LEFT_CHANNEL).getData(), output.getSamples(RIGHT_CHANNEL).getData()};
 
         if (moogMode_)
         {
             // Moog mode: single sawtooth + sub-oscillator (OSC1)
-            float vol = Modulate(patchCtrls_->osc1Vol, patchCtrls_->osc1VolModAmount, 
-                                patchState_->modValue, patchCtrls_->osc1VolCvAmount, 
-                                patchCvs_->osc1Vol, 0.f, 1.f, 
-                                patchState_->modAttenuverters, patchState_->cvAttenuverters);
-            
+            float vol = patchState_->params->Get(PARAM_OSC1_VOL);
+
             float baseFreq = Clamp(patchCtrls_->oscPitch, kOscFreqMin, kOscFreqMax);
-            moogVco_->processBlock(baseFreq, output.getSamples(LEFT_CHANNEL), size, vol * kOScSineGain);
-            
-            // Copy left to right (mono source, same on both channels)
-            for (size_t i = 0; i < size; i++)
-            {
-                float sample = output.getSamples(LEFT_CHANNEL)[i];
-                output.getSamples(RIGHT_CHANNEL).setElement(i, sample);
-            }
+            // Mono source, same on both channels
+            moogVco_->processBlockAdd(baseFreq, output.getSamples(LEFT_CHANNEL), output.getSamples(RIGHT_CHANNEL), size, vol * kOScSineGain * gain);
         }
         else
         {
-            // Standard mode: dual sine oscillators with unison
+            // Standard mode: unison sines
             float u;
             if (patchCtrls_->oscUnison < 0)
             {
@@ -131,25 +144,28 @@ public:
                 u = Map(patchCtrls_->oscUnison, 0.f, 1.f, 1.f, 2.f);
             }
 
-            float f[2];
-            f[0] = Clamp(patchCtrls_->oscPitch, kOscFreqMin, kOscFreqMax);
-            f[1] = Clamp(f[0] * u, kOscFreqMin, kOscFreqMax);
-
-            ParameterInterpolator freqParams[2] = {
-                ParameterInterpolator(&oldFreqs_[0], f[0], size, ParameterInterpolator::BY_SIZE), 
-                ParameterInterpolator(&oldFreqs_[1], f[1], size, ParameterInterpolator::BY_SIZE)
-            };
-            
-            float vol = Modulate(patchCtrls_->osc1Vol, patchCtrls_->osc1VolModAmount, patchState_->modValue, patchCtrls_->osc1VolCvAmount, patchCvs_->osc1Vol, 0.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-            ParameterInterpolator volParam(&oldVol_, vol * kOScSineGain, size, ParameterInterpolator::BY_SIZE);
+            float f = Clamp(patchCtrls_->oscPitch, kOscFreqMin, kOscFreqMax);
+            float spread = log2f(Clamp(f * u, kOscFreqMin, kOscFreqMax) / f);
 
-            for (size_t i = 0; i < size; i++)
+            for (size_t c = 0; c < 2; c++)
             {
-                for (size_t j = 0; j < 2; j++)
+                for (size_t k = 0; k < kOscUnisonVoices; k++)
                 {
-                    oscs_[j]->setFrequency(freqParams[j].Next());
+                    float inc = f * CentsToRatio(positions_[c][k] * spread * 1200.f) * sampleRateR_;
+                    incSteps_[c][k] = (inc - incs_[c][k]) / size;
                 }
+            }
+
+            // The voices add up in phase on the pitch, but only as their
+            // power once spread, so they are given back some of the level
+            // past a semitone.
+            float norm = 2.f / kOscUnisonVoices * (1.f + (sqrtf(kOscUnisonVoices * 0.5f) - 1.f) * Min(fabsf(spread) * 12.f, 1.f));
 
+            ParameterInterpolator normParam(&oldNorm_, norm, size, ParameterInterpolator::BY_SIZE);
+            ParameterInterpolator volParam(&oldVol_, patchState_->params->Get(PARAM_OSC1_VOL) * kOScSineGain, size, ParameterInterpolator::BY_SIZE);
+
+            for (size_t i = 0; i < size; i++)
+            {
                 if (trigger_.Process(patchState_->oscUnisonCenterFlag) && !fadeOut_)
                 {
                     fadeOut_ = true;
@@ -160,17 +176,41 @@ public:
                 }
                 else if (fadeIn_)
                 {
-                    oscs_[1]->setPhase(oscs_[0]->getPhase());
+                    for (size_t c = 0; c < 2; c++)
+                    {
+                        for (size_t k = 1; k < kOscUnisonVoices; k++)
+                        {
+                            phases_[c][k] = phases_[0][0];
+                        }
+                    }
                     FadeIn();
                 }
 
-                float out = oscs_[0]->generate() * sine1Volume_ + oscs_[1]->generate() * sine2Volume_;
-
-                out = SoftClip(out); // Gentle analog saturation
-                out *= volParam.Next();
-
-                output.getSamples(LEFT_CHANNEL).setElement(i, out);
-                output.getSamples(RIGHT_CHANNEL).setElement(i, out);
+                float n = normParam.Next();
+                float v = volParam.Next() * gain;
+                for (size_t c = 0; c < 2; c++)
+                {
+                    float* phases = phases_[c];
+                    float* incs = incs_[c];
+                    const float* steps = incSteps_[c];
+                    float sines[kOscUnisonVoices];
+                    for (size_t k = 0; k < kOscUnisonVoices; k++)
+                    {
+                        incs[k] += steps[k];
+                        phases[k] += incs[k];
+                        phases[k] -= phases[k] >= 1.f ? 1.f : 0.f;
+                        sines[k] = FastSine(phases[k]);
+                    }
+                    float sum = 0;
+                    for (size_t k = 1; k < kOscUnisonVoices; k++)
+                    {
+                        sum += sines[k];
+                    }
+
+                    float out = (sines[0] * sine1Volume_ + sum * sine2Volume_) * n;
+                    out = SoftClip(out); // Gentle analog saturation
+                    channels[c][i] += out * v;
+                }
             }
         }
     }
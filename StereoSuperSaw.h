@@ -52,31 +52,22 @@ public:
         delete obj;
     }
 
-    void Process(AudioBuffer &output)
+    /**
+     * @brief Adds the oscillator to output, times gain.
+     */
+    void ProcessAdd(AudioBuffer &output, float gain)
     {
         size_t size = output.getSize();
         
-        float freq = Modulate(patchCtrls_->oscPitch, patchCtrls_->oscPitchModAmount, 
-                             patchState_->modValue, 0, 0, 
-                             kOscFreqMin, kOscFreqMax, 
-                             patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        
-        float vol = Modulate(patchCtrls_->osc2Vol, patchCtrls_->osc2VolModAmount, 
-                            patchState_->modValue, patchCtrls_->osc2VolCvAmount, 
-                            patchCvs_->osc2Vol, 0.f, 1.f, 
-                            patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        float freq = patchCtrls_->oscPitch + patchState_->params->Get(PARAM_OSC_PITCH_OFFSET);
+        CONSTRAIN(freq, kOscFreqMin, kOscFreqMax);
+
+        float vol = patchState_->params->Get(PARAM_OSC2_VOL);
         
         // Slightly lower volume than OSC1 (0.85x) to prevent masking
         float targetVol = vol * kOScSuperSawGain * 0.85f;
         
-        // Process block
-        vco_->processBlock(freq, output.getSamples(LEFT_CHANNEL), size, targetVol);
-        
-        // Copy left to right (mono source)
-        for (size_t i = 0; i < size; i++)
-        {
-            float sample = output.getSamples(LEFT_CHANNEL)[i];
-            output.getSamples(RIGHT_CHANNEL).setElement(i, sample);
-        }
+        // Process block, mono source on both channels
+        vco_->processBlockAdd(freq, output.getSamples(LEFT_CHANNEL), output.getSamples(RIGHT_CHANNEL), size, targetVol * gain);
     }
 };
@@ -4,6 +4,7 @@
 #include "WaveTableBuffer.h"
 #include "BiquadFilter.h"
 #include "EnvFollower.h"
+#include "PitchUnit.h"
 #include <stdlib.h>
 #include <stdint.h>
 #include <cmath>
@@ -17,24 +18,19 @@ private:
 
     WaveTableBuffer* wtBuffer_;
     BiquadFilter* filters_[2];
-    BiquadFilter* toneFilters_[2];
     EnvFollower* ef_[2];
 
     HysteresisQuantizer offsetQuantizer_;
 
+    PitchUnit pitch_;
+
     float amp_;
-    float oldFreq_;
     float oldOffset_;
     float phase_;
     float incR_;
     float xi_;
     float oldVol_;
 
-    // Analog drift state
-    float driftState_;
-    float driftTarget_;
-    int driftCounter_;
-
 public:
     StereoWaveTableOscillator(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState, WaveTableBuffer* wtBuffer)
     {
@@ -56,22 +52,18 @@ public:
         {
             filters_[i] = BiquadFilter::create(patchState_->sampleRate);
             filters_[i]->setLowShelf(800, 0.8);
-            toneFilters_[i] = BiquadFilter::create(patchState_->sampleRate);
-            toneFilters_[i]->setLowPass(8000, 0.707f);
             ef_[i] = EnvFollower::create();
         }
-        oldFreq_ = kOscFreqMin;
-
-        driftState_ = 0.f;
-        driftTarget_ = 0.f;
-        driftCounter_ = 0;
+        // Analog pitch drift - thermal VCO instability. Avoid frequency
+        // jittering translating to jumps in the wavetable.
+        pitch_.Init(patchState_->sampleRate);
+        pitch_.SetHold(1.f);
     }
     ~StereoWaveTableOscillator()
     {
         for (size_t i = 0; i < 2; i++)
         {
             BiquadFilter::destroy(filters_[i]);
-            BiquadFilter::destroy(toneFilters_[i]);
             EnvFollower::destroy(ef_[i]);
         }
     }
@@ -86,9 +78,14 @@ public:
         delete osc;
     }
 
-    void Process(AudioBuffer &output)
+    /**
+     * @brief Adds the oscillator to output, times gain.
+     */
+    void ProcessAdd(AudioBuffer &output, float gain)
     {
         size_t size = output.getSize();
+        float* outLeft = output.getSamples(LEFT_CHANNEL).getData();
+        float* outRight = output.getSamples(RIGHT_CHANNEL).getData();
 
         float u = patchCtrls_->oscUnison;
         if (patchCtrls_->oscUnison < 0)
@@ -96,36 +93,19 @@ public:
             u *= 0.5f;
         }
 
-        float f = Modulate(patchCtrls_->oscPitch + patchCtrls_->oscPitch * u, patchCtrls_->oscPitchModAmount, patchState_->modValue, 0, 0, kOscFreqMin, kOscFreqMax, patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        float f = patchCtrls_->oscPitch + patchCtrls_->oscPitch * u + patchState_->params->Get(PARAM_OSC_PITCH_OFFSET);
+        CONSTRAIN(f, kOscFreqMin, kOscFreqMax);
 
-        // Analog pitch drift - thermal VCO instability
-        driftCounter_ += size;
-        if (driftCounter_ >= (int)(patchState_->sampleRate * kOscDriftUpdateSec))
-        {
-            driftTarget_ = RandomFloat(-1.f, 1.f);
-            driftCounter_ = 0;
-        }
-        ONE_POLE(driftState_, driftTarget_, kOscDriftSmoothCoeff);
-        float driftCents = driftState_ * kOscDriftCentsMax;
-        float driftFactor = fast_powf(2.f, driftCents / 1200.f);
-        f *= driftFactor;
-
-        // Avoid frequency jittering translating to jumps in the wavetable.
-        if (fabs(oldFreq_ - f) < 1.f)
-        {
-            f = oldFreq_;
-        }
-        ParameterInterpolator freqParam(&oldFreq_, f, size, ParameterInterpolator::BY_SIZE);
+        pitch_.Update(f, size);
+        wtBuffer_->SetIncrement(pitch_.GetMax() * incR_);
 
-        float o = Modulate(patchCtrls_->oscDetune, patchCtrls_->oscDetuneModAmount, patchState_->modValue, patchCtrls_->oscDetuneCvAmount, patchCvs_->oscDetune, 0, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator offsetParam(&oldOffset_, o, size, ParameterInterpolator::BY_SIZE);
-        float vol = Modulate(patchCtrls_->osc2Vol, patchCtrls_->osc2VolModAmount, patchState_->modValue, patchCtrls_->osc2VolCvAmount, patchCvs_->osc2Vol, 0.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator volParam(&oldVol_, vol * kOScWaveTableGain, size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator offsetParam(&oldOffset_, patchState_->params->Get(PARAM_OSC_DETUNE), size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator volParam(&oldVol_, patchState_->params->Get(PARAM_OSC2_VOL) * kOScWaveTableGain, size, ParameterInterpolator::BY_SIZE);
+        bool nearest = IsQualityReduced(patchState_, QUALITY_WAVETABLE_INTERPOLATION);
 
         for (size_t i = 0; i < size; i++)
-
         {
-            phase_ += freqParam.Next() * incR_;
+            phase_ += pitch_.Next() * incR_;
             if (phase_ >= kWaveTableLength)
             {
                 phase_ -= kWaveTableLength;
@@ -133,16 +113,18 @@ public:
 
             float p = offsetParam.Next();
             int q = offsetQuantizer_.Process(p);
-            float p1 = q * kWaveTableStepLength + phase_;
-            float p2 = p1 + kWaveTableStepLength;
             float x = Clamp((p - kWaveTableNofTablesR * q) / kWaveTableNofTablesR);
-            const float stereoOffset = kWaveTableStepLength * 0.015f;
 
             float left;
             float right;
-            float dummy;
-            wtBuffer_->ReadLinear(p1 - stereoOffset, p2 - stereoOffset, x, left, dummy);
-            wtBuffer_->ReadLinear(p1 + stereoOffset, p2 + stereoOffset, x, dummy, right);
+            if (nearest)
+            {
+                wtBuffer_->ReadNearest(q, phase_, x, left, right);
+            }
+            else
+            {
+                wtBuffer_->Read(q, phase_, x, left, right);
+            }
 
             left *= Map(ef_[LEFT_CHANNEL]->process(left), 0.f, 0.3f, kOScWaveTablePreGain, 1.f);
             right *= Map(ef_[RIGHT_CHANNEL]->process(right), 0.f, 0.3f, kOScWaveTablePreGain, 1.f);
@@ -150,10 +132,6 @@ public:
             left = SoftClip(left);
             right = SoftClip(right);
 
-            // Tone smoothing: tame high-frequency hash from wavetable traversal.
-            left = toneFilters_[LEFT_CHANNEL]->process(left);
-            right = toneFilters_[RIGHT_CHANNEL]->process(right);
-
             left = filters_[LEFT_CHANNEL]->process(left);
             right = filters_[RIGHT_CHANNEL]->process(right);
 
@@ -161,9 +139,9 @@ public:
             left *= 0.96f;
             right *= 0.96f;
 
-            float vol = volParam.Next();
-            output.getSamples(LEFT_CHANNEL)[i] = left * vol;
-            output.getSamples(RIGHT_CHANNEL)[i] = right * vol;
+            float vol = volParam.Next() * gain;
+            outLeft[i] += left * vol;
+            outRight[i] += right * vol;
         }
     }
 };
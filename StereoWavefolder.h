@@ -3,6 +3,8 @@
 #include "Commons.h"
 #include "ParameterInterpolator.h"
 #include "StereoEffect.h"
+#include "TailSleep.h"
+#include "Oversampler.h"
 
 class StereoWavefolder : public StereoEffect
 {
@@ -16,6 +18,9 @@ private:
     float oldOffset_;
     float toneState_[2];
 
+    TailSleep sleep_;
+    Oversampler oversamplers_[2];
+
     inline float PitchFoldBias()
     {
         float pitch = Clamp(patchCtrls_->oscPitch, kOscFreqMin, kOscFreqMax);
@@ -41,7 +46,7 @@ private:
     static inline float Saturate(float in, float drive)
     {
         float x = in * (1.0f + drive * 15.0f); // Increased from 9.0f for more saturation
-        float out = tanhf(x);
+        float out = FastTanh(x);
         return out * (1.0f + drive * 3.0f); // Increased from 2.0f for more gain
     }
 
@@ -56,6 +61,14 @@ public:
         oldOffset_ = 0.0f;
         toneState_[LEFT_CHANNEL] = 0.f;
         toneState_[RIGHT_CHANNEL] = 0.f;
+
+        // No tail, it sleeps as soon as it's muted.
+        sleep_.Init(0);
+
+        for (size_t i = 0; i < 2; i++)
+        {
+            oversamplers_[i].SetFactor(kWavefolderOversampling);
+        }
     }
 
     ~StereoWavefolder() {}
@@ -78,20 +91,29 @@ public:
         FloatArray leftOut = output.getSamples(LEFT_CHANNEL);
         FloatArray rightOut = output.getSamples(RIGHT_CHANNEL);
 
-            float amount = Modulate(patchCtrls_->resonatorFeedback, patchCtrls_->resonatorFeedbackModAmount, 
-                               patchState_->modValue, patchCtrls_->resonatorFeedbackCvAmount, 
-                               patchCvs_->resonatorFeedback, 0.0f, 1.0f, 
-                               patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        
-        float drive = Modulate(patchCtrls_->resonatorTune, patchCtrls_->resonatorTuneModAmount, 
-                              patchState_->modValue, patchCtrls_->resonatorTuneCvAmount, 
-                              patchCvs_->resonatorTune, 0.0f, 1.0f, 
-                              patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        
-        float offset = Modulate(patchCtrls_->resonatorDissonance, 0.0f, 
-                               patchState_->modValue, 0.0f, 
-                               0.0f, -1.0f, 1.0f, 
-                               patchState_->modAttenuverters, patchState_->cvAttenuverters);
+        bool reduced = IsQualityReduced(patchState_, QUALITY_OVERSAMPLING);
+        for (size_t i = 0; i < 2; i++)
+        {
+            oversamplers_[i].SetReduced(reduced);
+        }
+
+        if (sleep_.Sleep(patchCtrls_->resonatorVol, size))
+        {
+            // The dry is still delayed as the wet one would be.
+            for (size_t i = 0; i < size; i++)
+            {
+                leftOut[i] = oversamplers_[LEFT_CHANNEL].Align(leftIn[i]);
+                rightOut[i] = oversamplers_[RIGHT_CHANNEL].Align(rightIn[i]);
+            }
+
+            return;
+        }
+
+        // The snapshot's range is [-1, 1], the folder only takes the positive
+        // half of the feedback and tune.
+        float amount = Clamp(patchState_->params->Get(PARAM_RESONATOR_FEEDBACK), 0.f, 1.f);
+        float drive = Clamp(patchState_->params->Get(PARAM_RESONATOR_TUNE), 0.f, 1.f);
+        float offset = patchState_->params->Get(PARAM_RESONATOR_DISSONANCE);
 
         ParameterInterpolator amountParam(&oldAmount_, amount, size, ParameterInterpolator::BY_SIZE);
         ParameterInterpolator driveParam(&oldDrive_, drive, size, ParameterInterpolator::BY_SIZE);
@@ -104,21 +126,20 @@ public:
             float drv = driveParam.Next();
             float off = offsetParam.Next();
 
-            float left = leftIn[i] + off;
-            float right = rightIn[i] + off;
-
-            float foldedLeft = Wavefold(left, amt);
-            float foldedRight = Wavefold(right, amt);
-
-            float saturatedLeft = Saturate(foldedLeft, drv);
-            float saturatedRight = Saturate(foldedRight, drv);
+            // The fold and the saturation alias, they run oversampled.
+            auto shape = [amt, drv](float x) { return Saturate(Wavefold(x, amt), drv); };
+            float saturatedLeft = oversamplers_[LEFT_CHANNEL].Process(leftIn[i] + off, shape);
+            float saturatedRight = oversamplers_[RIGHT_CHANNEL].Process(rightIn[i] + off, shape);
             saturatedLeft = ToneShape(saturatedLeft, LEFT_CHANNEL, amt, drv);
             saturatedRight = ToneShape(saturatedRight, RIGHT_CHANNEL, amt, drv);
 
-            leftOut[i] = CheapEqualPowerCrossFade(leftIn[i], saturatedLeft * kWavefolderMakeupGain, 
+            float dryLeft = oversamplers_[LEFT_CHANNEL].Align(leftIn[i]);
+            float dryRight = oversamplers_[RIGHT_CHANNEL].Align(rightIn[i]);
+            leftOut[i] = CheapEqualPowerCrossFade(dryLeft, saturatedLeft * kWavefolderMakeupGain, 
                                                  patchCtrls_->resonatorVol, 1.4f);
-            rightOut[i] = CheapEqualPowerCrossFade(rightIn[i], saturatedRight * kWavefolderMakeupGain, 
+            rightOut[i] = CheapEqualPowerCrossFade(dryRight, saturatedRight * kWavefolderMakeupGain, 
                                                   patchCtrls_->resonatorVol, 1.4f);
         }
+        sleep_.EndBlock();
     }
 };
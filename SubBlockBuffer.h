@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Commons.h"
+#include <string.h>
+
+/**
+ * @brief Splits the host's blocks into sub-blocks, so that the chain and its
+ *        control rate work run at the same rate whatever the codec's block
+ *        size. The host block must be a multiple of the sub-block.
+ *        A sub-block is copied in with Load() and back with Store().
+ */
+class SubBlockBuffer
+{
+private:
+    AudioBuffer* buffer_;
+    size_t size_;
+    size_t count_;
+
+public:
+    SubBlockBuffer(size_t hostSize, size_t size)
+    {
+        size_ = size;
+        count_ = hostSize / size;
+        buffer_ = AudioBuffer::create(2, size);
+    }
+    ~SubBlockBuffer()
+    {
+        AudioBuffer::destroy(buffer_);
+    }
+
+    static SubBlockBuffer* create(size_t hostSize, size_t size)
+    {
+        return new SubBlockBuffer(hostSize, size);
+    }
+
+    static void destroy(SubBlockBuffer* obj)
+    {
+        delete obj;
+    }
+
+    /**
+     * @brief The size to process at, the host's block is used as is when
+     *        it's not a multiple of size.
+     */
+    static size_t GetSize(size_t hostSize, size_t size)
+    {
+        return size > 0 && hostSize > size && 0 == hostSize % size ? size : hostSize;
+    }
+
+    inline size_t GetCount()
+    {
+        return count_;
+    }
+
+    inline AudioBuffer& Get()
+    {
+        return *buffer_;
+    }
+
+    inline void Load(AudioBuffer& host, size_t index)
+    {
+        for (size_t c = 0; c < 2; c++)
+        {
+            memcpy(buffer_->getSamples(c).getData(), host.getSamples(c).getData() + index * size_, size_ * sizeof(float));
+        }
+    }
+
+    inline void Store(AudioBuffer& host, size_t index)
+    {
+        for (size_t c = 0; c < 2; c++)
+        {
+            memcpy(host.getSamples(c).getData() + index * size_, buffer_->getSamples(c).getData(), size_ * sizeof(float));
+        }
+    }
+};
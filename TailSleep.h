@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Commons.h"
+
+/**
+ * @brief Lets a wet stage sleep while it can't be heard. When its level is
+ *        zero, the input of the wet path is faded out so that the tail
+ *        decays, and once the tail has been quiet for the hold time the stage
+ *        just passes its input through. It wakes up as soon as the level
+ *        comes back up, with the input fading back in over a block.
+ */
+class TailSleep
+{
+public:
+    TailSleep()
+    {
+        Init(0);
+    }
+    ~TailSleep() {}
+
+    /**
+     * @param holdBlocks the blocks the tail has to be quiet for, 0 for the
+     *        stages without a tail
+     */
+    void Init(int holdBlocks)
+    {
+        holdBlocks_ = holdBlocks;
+        quietBlocks_ = 0;
+        peak_ = 0;
+        send_ = 1.f;
+        sendTarget_ = 1.f;
+        sendIncrement_ = 0;
+        asleep_ = false;
+    }
+
+    /**
+     * @brief Called at the start of the block.
+     *
+     * @return true if the stage can pass the block through
+     */
+    inline bool Sleep(float level, size_t size)
+    {
+        if (level > kSleepLevel)
+        {
+            sendTarget_ = 1.f;
+            quietBlocks_ = 0;
+            asleep_ = false;
+        }
+        else
+        {
+            sendTarget_ = 0.f;
+            asleep_ = asleep_ || (0.f == send_ && quietBlocks_ >= holdBlocks_);
+        }
+        sendIncrement_ = (sendTarget_ - send_) / size;
+
+        return asleep_;
+    }
+
+    /**
+     * @brief The gain of the wet path's input, called for each sample.
+     */
+    inline float NextSend()
+    {
+        send_ += sendIncrement_;
+
+        return send_;
+    }
+
+    /**
+     * @brief Called for each sample of the tail.
+     */
+    inline void Track(float left, float right)
+    {
+        peak_ = Max(peak_, Max(fabsf(left), fabsf(right)));
+    }
+
+    /**
+     * @brief Called at the end of a block that hasn't been slept.
+     */
+    inline void EndBlock()
+    {
+        send_ = sendTarget_;
+        quietBlocks_ = peak_ < kSleepThreshold ? quietBlocks_ + 1 : 0;
+        peak_ = 0;
+    }
+
+private:
+    int holdBlocks_, quietBlocks_;
+    float peak_;
+    float send_, sendTarget_, sendIncrement_;
+    bool asleep_;
+};
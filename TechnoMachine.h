@@ -4,6 +4,10 @@
 #include "WaveTableBuffer.h"
 #include "StereoSineOscillator.h"
 #include "StereoSuperSaw.h"
+#include "VoicePool.h"
+#include "Governor.h"
+#include "SnapshotBank.h"
+#include "SaveQueue.h"
 #include "StereoWaveTableOscillator.h"
 #include "Ambience.h"
 #include "Filter.h"
@@ -16,13 +20,39 @@
 #include "Looper.h"
 #include "Schmitt.h"
 #include "TGate.h"
-#include "EnvFollower.h"
-#include "DcBlockingFilter.h"
 #include "SmoothValue.h"
 #include "Modulation.h"
+#include "ControlStage.h"
 #include "Limiter.h"
+#include "Scheduler.h"
+#include "SlotFader.h"
+#include "Profiler.h"
+#include "LoadMeter.h"
+
+/**
+ * @brief How much of the tonal shadow each effect gets, from one of its
+ *        controls.
+ */
+struct EffectRoute
+{
+    float PatchCtrls::* shadowCtrl;
+    float shadowGain;
+};
 
-class Oneiroi
+static const EffectRoute kEffectRoutes[kNumEffects] = {
+    {&PatchCtrls::resonatorVol, 0.f}, // kEffectResonator
+    {&PatchCtrls::resonatorVol, 0.18f}, // kEffectWavefolder
+    {&PatchCtrls::resonatorVol, 0.12f}, // kEffectStereoWidener
+    {&PatchCtrls::resonatorFeedback, 0.08f}, // kEffectPhaser
+};
+
+/**
+ * @brief The audio chain. The effects and the osc2 variants that aren't
+ *        selected at startup are only built when first selected, or in the
+ *        background once the scheduler is idle, so that the first block comes
+ *        sooner.
+ */
+class Oneiroi : public BackgroundJob
 {
 private:
     PatchCtrls* patchCtrls_;
@@ -32,6 +62,9 @@ private:
     StereoSineOscillator* sine_;
     StereoSuperSaw* saw_;
     StereoWaveTableOscillator* wt_;
+    VoicePool* voices_;
+    QualityGovernor* governor_;
+    SnapshotBank* snapshots_;
     WaveTableBuffer* wtBuffer_;
     Filter* filter_;
     StereoEffect* effects_[kNumEffects];
@@ -42,20 +75,175 @@ private:
     Limiter* limiter_;
 
     Modulation* modulation_;
+    ControlStage* controls_;
+    JobScheduler* scheduler_;
 
     AudioBuffer* resample_;
-    AudioBuffer* osc1Out_;
-    AudioBuffer* osc2Out_;
+    AudioBuffer* fadeOut_;
 
-    StereoDcBlockingFilter* inputDcFilter_;
-    StereoDcBlockingFilter* outputDcFilter_;
+    SlotFader effectSlot_;
+    SlotFader osc2Slot_;
 
-    EnvFollower* inEnvFollower_[2];
+    // The DC blocking filters of the input and the output, per channel,
+    // run inline with the rest of their stage.
+    float inputDcX1_[2];
+    float inputDcY1_[2];
+    float outputDcX1_[2];
+    float outputDcY1_[2];
 
     FilterPosition filterPosition_, lastFilterPosition_;
 
+    // The chain after the sources, one per filter position.
+    typedef void (Oneiroi::*Chain)(AudioBuffer &buffer);
+    Chain chains_[4];
+
     float oldInputVol_;
 
+    static inline float DcBlock(float x, float &x1, float &y1)
+    {
+        y1 = x - x1 + kDcBlockingLambda * y1;
+        x1 = x;
+
+        return y1;
+    }
+
+    StereoEffect* GetEffect(int index)
+    {
+        if (NULL == effects_[index])
+        {
+            switch (index)
+            {
+            case kEffectResonator:
+                effects_[index] = Resonator::create(patchCtrls_, patchCvs_, patchState_);
+                break;
+            case kEffectWavefolder:
+                effects_[index] = StereoWavefolder::create(patchCtrls_, patchCvs_, patchState_);
+                break;
+            case kEffectStereoWidener:
+                effects_[index] = StereoWidener::create(patchCtrls_, patchCvs_, patchState_);
+                break;
+            default:
+                effects_[index] = PhasePhaser::create(patchCtrls_, patchCvs_, patchState_);
+                break;
+            }
+        }
+
+        return effects_[index];
+    }
+
+    StereoSuperSaw* GetSuperSaw()
+    {
+        if (NULL == saw_)
+        {
+            saw_ = StereoSuperSaw::create(patchCtrls_, patchCvs_, patchState_, true);
+        }
+
+        return saw_;
+    }
+
+    StereoWaveTableOscillator* GetWaveTable()
+    {
+        if (NULL == wt_)
+        {
+            wt_ = StereoWaveTableOscillator::create(patchCtrls_, patchCvs_, patchState_, wtBuffer_);
+        }
+
+        return wt_;
+    }
+
+    inline void ProcessEffect(int index, AudioBuffer &buffer)
+    {
+        PROFILER_BEGIN(patchState_->profiler, (ProfilerStage)(PROFILER_STAGE_RESONATOR + index));
+        GetEffect(index)->process(buffer, buffer);
+        PROFILER_END(patchState_->profiler, (ProfilerStage)(PROFILER_STAGE_RESONATOR + index));
+    }
+
+    inline void ProcessOsc2(int index, AudioBuffer &output, float gain)
+    {
+        if (kOsc2WaveTable == index)
+        {
+            PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_OSC2_WAVETABLE);
+            GetWaveTable()->ProcessAdd(output, gain);
+            PROFILER_END(patchState_->profiler, PROFILER_STAGE_OSC2_WAVETABLE);
+        }
+        else if (kOsc2Voices == index)
+        {
+            PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_OSC2_VOICES);
+            voices_->ProcessAdd(output, gain);
+            PROFILER_END(patchState_->profiler, PROFILER_STAGE_OSC2_VOICES);
+        }
+        else
+        {
+            PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_OSC2_SUPERSAW);
+            GetSuperSaw()->ProcessAdd(output, gain);
+            PROFILER_END(patchState_->profiler, PROFILER_STAGE_OSC2_SUPERSAW);
+        }
+    }
+
+    inline void ProcessFilter(ProfilerStage stage, AudioBuffer &buffer)
+    {
+        PROFILER_BEGIN(patchState_->profiler, stage);
+        filter_->process(buffer, buffer);
+        PROFILER_END(patchState_->profiler, stage);
+    }
+
+    /**
+     * @brief The chain from the effects to the ambience with the filter at
+     *        position P. Built once per position, so that the routing is
+     *        only decided once per block.
+     */
+    template <FilterPosition P>
+    void ProcessChain(AudioBuffer &buffer)
+    {
+        if (POSITION_1 == P)
+        {
+            ProcessFilter(PROFILER_STAGE_FILTER_1, buffer);
+        }
+
+        int effectIndex = std::min(std::max(int(patchCtrls_->effectType * (kNumEffects - 0.001f)), 0), kNumEffects - 1);
+        // Same for the effects, the outgoing one gets a copy of the input.
+        effectSlot_.Select(effectIndex);
+        if (effectSlot_.IsFading())
+        {
+            fadeOut_->copyFrom(buffer);
+            ProcessEffect(effectSlot_.GetPrevious(), *fadeOut_);
+            ProcessEffect(effectSlot_.GetCurrent(), buffer);
+            effectSlot_.Process(*fadeOut_, buffer);
+        }
+        else
+        {
+            ProcessEffect(effectSlot_.GetCurrent(), buffer);
+        }
+
+        // The one playing, a new selection can wait for a fade to end.
+        const EffectRoute &route = kEffectRoutes[effectSlot_.GetCurrent()];
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_TONAL_SHADOW);
+        if (!IsQualityReduced(patchState_, QUALITY_TONAL_SHADOW))
+        {
+            tonalShadow_->Process(buffer, patchCtrls_->*route.shadowCtrl * route.shadowGain);
+        }
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_TONAL_SHADOW);
+
+        if (POSITION_2 == P)
+        {
+            ProcessFilter(PROFILER_STAGE_FILTER_2, buffer);
+        }
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_ECHO);
+        echo_->process(buffer, buffer);
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_ECHO);
+        if (POSITION_3 == P)
+        {
+            ProcessFilter(PROFILER_STAGE_FILTER_3, buffer);
+        }
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_AMBIENCE);
+        ambience_->process(buffer, buffer);
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_AMBIENCE);
+        if (POSITION_4 == P)
+        {
+            ProcessFilter(PROFILER_STAGE_FILTER_4, buffer);
+        }
+    }
+
 public:
     Oneiroi(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
     {
@@ -63,18 +251,33 @@ public:
         patchCvs_ = patchCvs;
         patchState_ = patchState;
 
+        controls_ = ControlStage::create(patchCtrls_, patchCvs_, patchState_);
+
         looper_ = Looper::create(patchCtrls_, patchCvs_, patchState_);
         wtBuffer_ = WaveTableBuffer::create(looper_->GetBuffer());
 
         sine_ = StereoSineOscillator::create(patchCtrls_, patchCvs_, patchState_, true);
-        saw_ = StereoSuperSaw::create(patchCtrls_, patchCvs_, patchState_, true);
-        wt_ = StereoWaveTableOscillator::create(patchCtrls_, patchCvs_, patchState_, wtBuffer_);
+        saw_ = NULL;
+        wt_ = NULL;
+
+        // The notes get to the voices through the ui.
+        voices_ = VoicePool::create(patchState_);
+        patchState_->voices = voices_;
+        governor_ = QualityGovernor::create(patchState_);
+        // So are the recalls of the snapshots.
+        snapshots_ = SnapshotBank::create(patchState_);
+        patchState_->snapshots = snapshots_;
 
         filter_ = Filter::create(patchCtrls_, patchCvs_, patchState_, true);  // useMoog=true
-        effects_[kEffectResonator] = Resonator::create(patchCtrls_, patchCvs_, patchState_);
-        effects_[kEffectWavefolder] = StereoWavefolder::create(patchCtrls_, patchCvs_, patchState_);
-        effects_[kEffectStereoWidener] = StereoWidener::create(patchCtrls_, patchCvs_, patchState_);
-        effects_[kEffectPhaser] = PhasePhaser::create(patchCtrls_, patchCvs_, patchState_);
+        filterPosition_ = lastFilterPosition_ = POSITION_1;
+        chains_[POSITION_1] = &Oneiroi::ProcessChain<POSITION_1>;
+        chains_[POSITION_2] = &Oneiroi::ProcessChain<POSITION_2>;
+        chains_[POSITION_3] = &Oneiroi::ProcessChain<POSITION_3>;
+        chains_[POSITION_4] = &Oneiroi::ProcessChain<POSITION_4>;
+        for (size_t i = 0; i < kNumEffects; i++)
+        {
+            effects_[i] = NULL;
+        }
         tonalShadow_ = TonalShadow::create(patchState_->sampleRate);
         echo_ = Echo::create(patchCtrls_, patchCvs_, patchState_);
         ambience_ = Ambience::create(patchCtrls_, patchCvs_, patchState_);
@@ -83,45 +286,55 @@ public:
 
         limiter_ = Limiter::create();
 
+        // The buffer gets seeded first, the tables are built from it.
+        scheduler_ = JobScheduler::create();
+        scheduler_->Add(looper_->GetBuffer());
+#ifdef USE_LOOPER_STREAMING
+        scheduler_->Add(looper_->GetStream());
+#endif
+        scheduler_->Add(wtBuffer_);
+        scheduler_->Add(this);
+        scheduler_->Add(snapshots_);
+        // The ui's saves, last: they're never urgent.
+        if (patchState_->saveQueue)
+        {
+            scheduler_->Add(patchState_->saveQueue);
+        }
+
         resample_ = AudioBuffer::create(2, patchState_->blockSize);
-        osc1Out_ = AudioBuffer::create(2, patchState_->blockSize);
-        osc2Out_ = AudioBuffer::create(2, patchState_->blockSize);
+        fadeOut_ = AudioBuffer::create(2, patchState_->blockSize);
 
         for (size_t i = 0; i < 2; i++)
         {
-            inEnvFollower_[i] = EnvFollower::create();
-            inEnvFollower_[i]->setLambda(0.9f);
+            inputDcX1_[i] = inputDcY1_[i] = 0;
+            outputDcX1_[i] = outputDcY1_[i] = 0;
         }
-
-        inputDcFilter_ = StereoDcBlockingFilter::create();
-        outputDcFilter_ = StereoDcBlockingFilter::create();
         oldInputVol_ = 0.0f;
     }
     ~Oneiroi()
     {
         AudioBuffer::destroy(resample_);
-        AudioBuffer::destroy(osc1Out_);
-        AudioBuffer::destroy(osc2Out_);
+        AudioBuffer::destroy(fadeOut_);
         WaveTableBuffer::destroy(wtBuffer_);
         Looper::destroy(looper_);
         StereoSineOscillator::destroy(sine_);
         StereoSuperSaw::destroy(saw_);
         StereoWaveTableOscillator::destroy(wt_);
+        VoicePool::destroy(voices_);
+        QualityGovernor::destroy(governor_);
+        SnapshotBank::destroy(snapshots_);
         Filter::destroy(filter_);
-        StereoEffect::destroy(effects_[kEffectResonator]);
-        StereoEffect::destroy(effects_[kEffectWavefolder]);
-        StereoEffect::destroy(effects_[kEffectStereoWidener]);
-        StereoEffect::destroy(effects_[kEffectPhaser]);
+        for (size_t i = 0; i < kNumEffects; i++)
+        {
+            StereoEffect::destroy(effects_[i]);
+        }
         TonalShadow::destroy(tonalShadow_);
         Echo::destroy(echo_);
         Ambience::destroy(ambience_);
         Modulation::destroy(modulation_);
         Limiter::destroy(limiter_);
-
-        for (size_t i = 0; i < 2; i++)
-        {
-            EnvFollower::destroy(inEnvFollower_[i]);
-        }
+        JobScheduler::destroy(scheduler_);
+        ControlStage::destroy(controls_);
     }
 
     static Oneiroi* create(PatchCtrls* patchCtrls, PatchCvs* patchCvs, PatchState* patchState)
@@ -134,41 +347,90 @@ public:
         delete obj;
     }
 
+    /**
+     * @brief Build one of the modules that haven't been selected yet, when
+     *        the other jobs have left the whole budget.
+     */
+    size_t Run(size_t budget) override
+    {
+        if (budget < kSchedulerBlockBudget || StartupPhase::STARTUP_DONE != patchState_->startupPhase)
+        {
+            return 0;
+        }
+
+        if (NULL == saw_)
+        {
+            GetSuperSaw();
+        }
+        else if (NULL == wt_)
+        {
+            GetWaveTable();
+        }
+        else
+        {
+            int i = 0;
+            while (i < kNumEffects && effects_[i])
+            {
+                i++;
+            }
+            if (i == kNumEffects)
+            {
+                return 0;
+            }
+            GetEffect(i);
+        }
+
+        return budget;
+    }
+
     inline void Process(AudioBuffer &buffer)
     {
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_INPUT);
+
+        // A snapshot that's recalled or morphed to takes over the panel.
+        snapshots_->Apply(patchCtrls_);
+
         FloatArray left = buffer.getSamples(LEFT_CHANNEL);
         FloatArray right = buffer.getSamples(RIGHT_CHANNEL);
 
-        inputDcFilter_->process(buffer, buffer);
-
         const int size = buffer.getSize();
 
-        // Input leds - branch hoisted outside loop for better pipelining.
+        // DC blocking and metering in one pass, the levels are only read
+        // once per block. While resampling the leds follow the output of the
+        // last block instead, the input having been filtered by the time it's
+        // read otherwise.
+        const float* levelLeft = left.getData();
+        const float* levelRight = right.getData();
+        float levelAtt = 1.f;
         if (patchCtrls_->looperResampling)
         {
-            FloatArray resampleLeft = resample_->getSamples(LEFT_CHANNEL);
-            FloatArray resampleRight = resample_->getSamples(RIGHT_CHANNEL);
-            for (int i = 0; i < size; i++)
-            {
-                float l = Mix2(inEnvFollower_[0]->process(resampleLeft[i]), inEnvFollower_[1]->process(resampleRight[i])) * kLooperResampleLedAtt;
-                patchState_->inputLevel[i] = l;
-            }
+            levelLeft = resample_->getSamples(LEFT_CHANNEL).getData();
+            levelRight = resample_->getSamples(RIGHT_CHANNEL).getData();
+            levelAtt = kLooperResampleLedAtt;
         }
-        else
+        float sumLeft = 0, sumRight = 0;
+        float squaresLeft = 0, squaresRight = 0;
+        for (int i = 0; i < size; i++)
         {
-            for (int i = 0; i < size; i++)
-            {
-                float l = Mix2(inEnvFollower_[0]->process(left[i]), inEnvFollower_[1]->process(right[i]));
-                patchState_->inputLevel[i] = l;
-            }
+            left[i] = DcBlock(left[i], inputDcX1_[0], inputDcY1_[0]);
+            right[i] = DcBlock(right[i], inputDcX1_[1], inputDcY1_[1]);
+            float l = HardClip(levelLeft[i]);
+            float r = HardClip(levelRight[i]);
+            sumLeft += fabsf(l);
+            sumRight += fabsf(r);
+            squaresLeft += l * l;
+            squaresRight += r * r;
         }
+        float sizeR = 1.f / size;
+        patchState_->inputLevel = Mix2(sumLeft * sizeR, sumRight * sizeR) * levelAtt;
+        patchState_->inputRms = Mix2(sqrtf(squaresLeft * sizeR), sqrtf(squaresRight * sizeR)) * levelAtt;
 
         modulation_->Process();
+        controls_->Process();
 
         // Input volume processing - store original input on stack, scale in-place, add back after looper.
         // Optimization: eliminates input_ AudioBuffer allocation (~512 bytes RAM).
-        float vol = Modulate(patchCtrls_->inputVol, patchCtrls_->inputVolModAmount, patchState_->modValue, patchCtrls_->inputVolCvAmount, patchCvs_->inputVol, 0.f, 1.f, patchState_->modAttenuverters, patchState_->cvAttenuverters);
-        ParameterInterpolator inputVolParam(&oldInputVol_, vol, size, ParameterInterpolator::BY_SIZE);
+        ParameterInterpolator inputVolParam(&oldInputVol_, patchState_->params->Get(PARAM_INPUT_VOL), size, ParameterInterpolator::BY_SIZE);
         
         // Save original input and apply volume in single loop.
         float inputL[AUDIO_MAX_BLOCK_SIZE];
@@ -180,6 +442,9 @@ public:
             inputR[i] = right[i] * v;
         }
 
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_INPUT);
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_LOOPER);
+
         if (patchCtrls_->looperResampling)
         {
             looper_->Process(*resample_, buffer);
@@ -189,37 +454,50 @@ public:
             looper_->Process(buffer, buffer);
         }
         
-        // Mix scaled input back into buffer.
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_LOOPER);
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_OSC1);
+
+        // The sources are mixed with their makeup gain, the oscillators
+        // adding themselves to the mix.
         for (int i = 0; i < size; i++)
         {
-            left[i] += inputL[i];
-            right[i] += inputR[i];
+            left[i] = (left[i] + inputL[i]) * kSourcesMakeupGain;
+            right[i] = (right[i] + inputR[i]) * kSourcesMakeupGain;
         }
+        sine_->ProcessAdd(buffer, kSourcesMakeupGain);
 
-        sine_->Process(*osc1Out_);
-        buffer.add(*osc1Out_);
-        patchCtrls_->oscUseWavetable > 0.5f ? wt_->Process(*osc2Out_) : saw_->Process(*osc2Out_);
-        buffer.add(*osc2Out_);
-
-        buffer.multiply(kSourcesMakeupGain);
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_OSC1);
 
-        if (patchCtrls_->filterPosition < 0.25f)
-        {
-            filterPosition_ = FilterPosition::POSITION_1;
-        }
-        else if (patchCtrls_->filterPosition >= 0.25f && patchCtrls_->filterPosition < 0.5f)
+        if (patchState_->loadMeter)
         {
-            filterPosition_ = FilterPosition::POSITION_2;
+            float load = patchState_->loadMeter->GetLoad();
+            voices_->Adapt(load);
+            governor_->Adapt(load);
         }
-        else if (patchCtrls_->filterPosition >= 0.5f && patchCtrls_->filterPosition < 0.75f)
+
+        // Both variants only run while switching. The note voices take the
+        // supersaw's place while MIDI notes are played.
+        int osc2 = voices_->IsActive() ? kOsc2Voices : kOsc2SuperSaw;
+        osc2Slot_.Select(patchCtrls_->oscUseWavetable > 0.5f ? kOsc2WaveTable : osc2);
+        if (osc2Slot_.IsFading())
         {
-            filterPosition_ = FilterPosition::POSITION_3;
+            // Each variant is faded on its own, through the one buffer.
+            fadeOut_->clear();
+            ProcessOsc2(osc2Slot_.GetPrevious(), *fadeOut_, kSourcesMakeupGain);
+            osc2Slot_.AddFaded(*fadeOut_, buffer, false, 1.f);
+            fadeOut_->clear();
+            ProcessOsc2(osc2Slot_.GetCurrent(), *fadeOut_, kSourcesMakeupGain);
+            osc2Slot_.AddFaded(*fadeOut_, buffer, true, 1.f);
+            osc2Slot_.Advance(size);
         }
-        else if (patchCtrls_->filterPosition >= 0.75f)
+        else
         {
-            filterPosition_ = FilterPosition::POSITION_4;
+            ProcessOsc2(osc2Slot_.GetCurrent(), buffer, kSourcesMakeupGain);
         }
 
+        // A quarter of the control per position.
+        filterPosition_ = FilterPosition(std::min(std::max(int(patchCtrls_->filterPosition * 4), 0), int(POSITION_4)));
+
         if (filterPosition_ != lastFilterPosition_)
         {
             lastFilterPosition_ = filterPosition_;
@@ -230,61 +508,45 @@ public:
             patchState_->filterPositionFlag = false;
         }
 
-        // Apply filter at position 1
-        if (FilterPosition::POSITION_1 == filterPosition_)
-        {
-            filter_->process(buffer, buffer);
-        }
-        
-        int effectIndex = (int)(patchCtrls_->effectType * (kNumEffects - 0.001f));
-        if (effectIndex < 0) effectIndex = 0;
-        if (effectIndex >= kNumEffects) effectIndex = kNumEffects - 1;
-        effects_[effectIndex]->process(buffer, buffer);
-        float shadowAmount = 0.f;
-        if (effectIndex == kEffectWavefolder)
-        {
-            shadowAmount = patchCtrls_->resonatorVol * 0.18f;
-        }
-        else if (effectIndex == kEffectStereoWidener)
-        {
-            shadowAmount = patchCtrls_->resonatorVol * 0.12f;
-        }
-        else if (effectIndex == kEffectPhaser)
-        {
-            shadowAmount = patchCtrls_->resonatorFeedback * 0.08f;
-        }
-        tonalShadow_->Process(buffer, shadowAmount);
+        (this->*chains_[filterPosition_])(buffer);
+
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_OUTPUT);
 
-        if (FilterPosition::POSITION_2 == filterPosition_)
+        // DC blocking, makeup gain, limiter and output level in one pass,
+        // the block being captured for resampling on the way out. The
+        // lookahead limiter needs the whole block, so it splits the pass in
+        // two.
+        // TODO: Fade in
+        const float outLevel = StartupPhase::STARTUP_DONE == patchState_->startupPhase ? patchState_->outLevel : 0.f;
+        float* resampleLeft = resample_->getSamples(LEFT_CHANNEL).getData();
+        float* resampleRight = resample_->getSamples(RIGHT_CHANNEL).getData();
+#ifdef USE_LOOKAHEAD_LIMITER
+        for (int i = 0; i < size; i++)
         {
-            filter_->process(buffer, buffer);
+            left[i] = DcBlock(left[i], outputDcX1_[0], outputDcY1_[0]) * kOutputMakeupGain;
+            right[i] = DcBlock(right[i], outputDcX1_[1], outputDcY1_[1]) * kOutputMakeupGain;
         }
-        echo_->process(buffer, buffer);
-        if (FilterPosition::POSITION_3 == filterPosition_)
+        limiter_->ProcessLookahead(buffer, buffer);
+        for (int i = 0; i < size; i++)
         {
-            filter_->process(buffer, buffer);
+            resampleLeft[i] = left[i] = left[i] * outLevel;
+            resampleRight[i] = right[i] = right[i] * outLevel;
         }
-        ambience_->process(buffer, buffer);
-        if (FilterPosition::POSITION_4 == filterPosition_)
+#else
+        for (int i = 0; i < size; i++)
         {
-            filter_->process(buffer, buffer);
+            // As Limiter::ProcessSoft().
+            float l = SoftLimit(DcBlock(left[i], outputDcX1_[0], outputDcY1_[0]) * kOutputMakeupGain) * outLevel;
+            float r = SoftLimit(DcBlock(right[i], outputDcX1_[1], outputDcY1_[1]) * kOutputMakeupGain) * outLevel;
+            left[i] = resampleLeft[i] = l;
+            right[i] = resampleRight[i] = r;
         }
+#endif
 
-        outputDcFilter_->process(buffer, buffer);
-
-        buffer.multiply(kOutputMakeupGain);
-        limiter_->ProcessSoft(buffer, buffer);
-
-        if (StartupPhase::STARTUP_DONE == patchState_->startupPhase)
-        {
-            buffer.multiply(patchState_->outLevel);
-        }
-        else
-        {
-            // TODO: Fade in
-            buffer.clear();
-        }
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_OUTPUT);
 
-        resample_->copyFrom(buffer);
+        PROFILER_BEGIN(patchState_->profiler, PROFILER_STAGE_JOBS);
+        scheduler_->Process();
+        PROFILER_END(patchState_->profiler, PROFILER_STAGE_JOBS);
     }
 };
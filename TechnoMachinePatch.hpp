@@ -4,32 +4,116 @@
 #include "Commons.h"
 #include "Ui.h"
 #include "Clock.h"
+#include "Profiler.h"
+#include "LoadMeter.h"
+#include "Arena.h"
+#include "SubBlockBuffer.h"
 
 class TechnoMachinePatch : public Patch {
 private:
     Ui* ui_;
     Oneiroi* oneiroi_;
     Clock* clock_;
+    SubBlockBuffer* subBlocks_;
 
     PatchCtrls patchCtrls;
     PatchCvs patchCvs;
     PatchState patchState;
 
+#ifdef USE_PROFILER
+    int profilerBlocks_;
+    size_t profilerStage_;
+
+    // Send the report of one stage per kProfilerReportBlocks as SysEx.
+    void SendProfilerReport()
+    {
+        if (++profilerBlocks_ < kProfilerReportBlocks)
+        {
+            return;
+        }
+        profilerBlocks_ = 0;
+
+        uint8_t data[kProfilerReportSize];
+        size_t size = patchState.profiler->GetReport(profilerStage_, data);
+        profilerStage_ = (profilerStage_ + 1) % PROFILER_STAGE_LAST;
+
+        // USB MIDI carries SysEx 3 bytes at a time.
+        for (size_t i = 0; i < size; i += 3)
+        {
+            size_t left = size - i;
+            if (left > 3)
+            {
+                sendMidi(MidiMessage(USB_COMMAND_SYSEX, data[i], data[i + 1], data[i + 2]));
+            }
+            else if (left == 3)
+            {
+                sendMidi(MidiMessage(USB_COMMAND_SYSEX_EOX3, data[i], data[i + 1], data[i + 2]));
+            }
+            else if (left == 2)
+            {
+                sendMidi(MidiMessage(USB_COMMAND_SYSEX_EOX2, data[i], data[i + 1], 0));
+            }
+            else
+            {
+                sendMidi(MidiMessage(USB_COMMAND_SYSEX_EOX1, data[i], 0, 0));
+            }
+        }
+    }
+#endif
+
 public:
     TechnoMachinePatch()
     {
+        // First, so that the fast arena gets the internal SRAM.
+        Arena::Init(kArenaFastSize);
+        // Denormals are flushed instead of guarded against in each filter.
+        EnableFlushToZero();
+
         patchState.sampleRate = getSampleRate();
-        patchState.blockRate = getBlockRate();
+#ifdef USE_SUB_BLOCKS
+        patchState.blockSize = SubBlockBuffer::GetSize(getBlockSize(), kSubBlockSize);
+#else
         patchState.blockSize = getBlockSize();
+#endif
+        patchState.blockRate = patchState.sampleRate / patchState.blockSize;
+        patchState.hostBlockSize = getBlockSize();
+        subBlocks_ = patchState.blockSize < getBlockSize() ? SubBlockBuffer::create(getBlockSize(), patchState.blockSize) : NULL;
+#ifdef USE_PROFILER
+        patchState.profiler = Profiler::create(patchState.sampleRate, patchState.blockSize);
+        profilerBlocks_ = 0;
+        profilerStage_ = 0;
+#else
+        patchState.profiler = NULL;
+#endif
+        patchState.loadMeter = LoadMeter::create(patchState.sampleRate, patchState.blockSize);
+        // There's no storage to stream the looper's takes to, see LooperStream.h.
+        patchState.looperStore = NULL;
+        // Nor that the bank of snapshots can be saved to, the settings' save
+        // path can't carry it, see SnapshotBank.h.
+        patchState.snapshotStore = NULL;
+        PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_STARTUP);
         ui_ = Ui::create(&patchCtrls, &patchCvs, &patchState);
         oneiroi_ = Oneiroi::create(&patchCtrls, &patchCvs, &patchState);
         clock_ = Clock::create(&patchCtrls, &patchState);
+        PROFILER_END(patchState.profiler, PROFILER_STAGE_STARTUP);
+
+        // Startup report of the memory used per region.
+        debugMessage("KB fast/slow/overflow",
+            (int)(Arena::Get(MEMORY_REGION_FAST)->GetUsed() / 1024),
+            (int)(Arena::Get(MEMORY_REGION_SLOW)->GetUsed() / 1024),
+            (int)(Arena::Get(MEMORY_REGION_FAST)->GetOverflow() / 1024));
     }
     ~TechnoMachinePatch()
     {
         Oneiroi::destroy(oneiroi_);
         Ui::destroy(ui_);
         Clock::destroy(clock_);
+        SubBlockBuffer::destroy(subBlocks_);
+#ifdef USE_PROFILER
+        Profiler::destroy(patchState.profiler);
+#endif
+        LoadMeter::destroy(patchState.loadMeter);
+        Arena::Deinit();
     }
 
     void buttonChanged(PatchButtonId bid, uint16_t value, uint16_t samples) override
@@ -42,11 +126,48 @@ public:
         ui_->ProcessMidi(msg);
     }
 
-    void processAudio(AudioBuffer& buffer) override
+    /**
+     * @brief Run the chain on a block of patchState.blockSize.
+     */
+    void ProcessBlock(AudioBuffer& buffer)
     {
+        patchState.loadMeter->Begin();
+        PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_BLOCK);
+
+        PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_CLOCK);
         clock_->Process();
+        PROFILER_END(patchState.profiler, PROFILER_STAGE_CLOCK);
+
+        PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_UI);
         ui_->Poll();
+        PROFILER_END(patchState.profiler, PROFILER_STAGE_UI);
+
         oneiroi_->Process(buffer);
+
+        PROFILER_END(patchState.profiler, PROFILER_STAGE_BLOCK);
+        patchState.loadMeter->End();
+
+#ifdef USE_PROFILER
+        patchState.profiler->EndBlock();
+        SendProfilerReport();
+#endif
+    }
+
+    void processAudio(AudioBuffer& buffer) override
+    {
+        if (NULL == subBlocks_)
+        {
+            ProcessBlock(buffer);
+
+            return;
+        }
+
+        for (size_t i = 0; i < subBlocks_->GetCount(); i++)
+        {
+            subBlocks_->Load(buffer, i);
+            ProcessBlock(subBlocks_->Get());
+            subBlocks_->Store(buffer, i);
+        }
     }
 };
 
@@ -1,12 +1,13 @@
 #pragma once
 
 #include "Commons.h"
-#include "DelayLine.h"
+#include "Arena.h"
+#include "StereoDelayLine.h"
 
 class TonalShadow
 {
 private:
-    static const int32_t kShadowBufferSize = 8192;
+    static const uint32_t kShadowBufferSize = 8192;
     static constexpr float kShadowLeftDelaySeconds = 0.061f;
     static constexpr float kShadowRightDelaySeconds = 0.089f;
     static constexpr float kShadowMaxAmount = 0.18f;
@@ -18,7 +19,7 @@ private:
     static constexpr float kShadowLowpassCoeff = 0.08f;
     static constexpr float kShadowLowCoeff = 0.012f;
 
-    DelayLine* lines_[2];
+    StereoDelayLine<kShadowBufferSize>* line_;
 
     float lpState_[2];
     float lowState_[2];
@@ -28,16 +29,15 @@ private:
 
     inline float ShapeShadow(float in, int channel)
     {
-        lpState_[channel] += kShadowLowpassCoeff * (in - lpState_[channel]) + 1e-18f;
-        lowState_[channel] += kShadowLowCoeff * (lpState_[channel] - lowState_[channel]) + 1e-18f;
+        lpState_[channel] += kShadowLowpassCoeff * (in - lpState_[channel]);
+        lowState_[channel] += kShadowLowCoeff * (lpState_[channel] - lowState_[channel]);
         return lpState_[channel] - lowState_[channel] * kShadowLowTrim;
     }
 
 public:
     TonalShadow(float sampleRate)
     {
-        lines_[LEFT_CHANNEL] = DelayLine::create(kShadowBufferSize);
-        lines_[RIGHT_CHANNEL] = DelayLine::create(kShadowBufferSize);
+        line_ = StereoDelayLine<kShadowBufferSize>::create();
 
         lpState_[LEFT_CHANNEL] = 0.f;
         lpState_[RIGHT_CHANNEL] = 0.f;
@@ -51,18 +51,17 @@ public:
 
     ~TonalShadow()
     {
-        DelayLine::destroy(lines_[LEFT_CHANNEL]);
-        DelayLine::destroy(lines_[RIGHT_CHANNEL]);
+        StereoDelayLine<kShadowBufferSize>::destroy(line_);
     }
 
     static TonalShadow* create(float sampleRate)
     {
-        return new TonalShadow(sampleRate);
+        return ArenaCreate<TonalShadow>(MEMORY_REGION_FAST, sampleRate);
     }
 
     static void destroy(TonalShadow* obj)
     {
-        delete obj;
+        ArenaDestroy(obj);
     }
 
     void Process(AudioBuffer& buffer, float amount)
@@ -77,8 +76,19 @@ public:
         FloatArray right = buffer.getSamples(RIGHT_CHANNEL);
         size_t size = buffer.getSize();
 
+        // The delays are longer than the chunks, so the taps of a chunk
+        // are read before it's written.
+        float taps[2][kDelayLineBlockSize];
         for (size_t i = 0; i < size; i++)
         {
+            size_t j = i % kDelayLineBlockSize;
+            if (0 == j)
+            {
+                size_t chunk = std::min<size_t>(kDelayLineBlockSize, size - i);
+                line_->readBlock(delayLeft_, LEFT_CHANNEL, taps[LEFT_CHANNEL], chunk);
+                line_->readBlock(delayRight_, RIGHT_CHANNEL, taps[RIGHT_CHANNEL], chunk);
+            }
+
             float l = Clamp(left[i], -3.f, 3.f);
             float r = Clamp(right[i], -3.f, 3.f);
 
@@ -89,8 +99,8 @@ public:
             SLOPE(env_, fabsf(mid), 0.02f, 0.0018f);
             float duck = 1.f - Clamp(env_ * kShadowDuckAmount, 0.f, kShadowMaxDuck);
 
-            float shadowLeft = ShapeShadow(lines_[LEFT_CHANNEL]->read(delayLeft_), LEFT_CHANNEL);
-            float shadowRight = ShapeShadow(lines_[RIGHT_CHANNEL]->read(delayRight_), RIGHT_CHANNEL);
+            float shadowLeft = ShapeShadow(taps[LEFT_CHANNEL][j], LEFT_CHANNEL);
+            float shadowRight = ShapeShadow(taps[RIGHT_CHANNEL][j], RIGHT_CHANNEL);
             float shadowMid;
             float shadowSide;
             LR2MS(shadowLeft, shadowRight, shadowMid, shadowSide, kShadowSideWidth);
@@ -105,8 +115,7 @@ public:
             left[i] = SoftLimit(l + wetLeft * duck);
             right[i] = SoftLimit(r + wetRight * duck);
 
-            lines_[LEFT_CHANNEL]->write(l);
-            lines_[RIGHT_CHANNEL]->write(r);
+            line_->write(l, r);
         }
     }
 };
@@ -7,6 +7,7 @@
 #include "VoltsPerOctave.h"
 #include "SquareWaveOscillator.h"
 #include "Schmitt.h"
+#include "ClockEvents.h"
 #include "MidiMessage.h"
 
 enum RandomMode { RANDOM_ALL, RANDOM_OSC, RANDOM_LOOPER, RANDOM_EFFECTS };
@@ -64,6 +65,8 @@ private:
     ModCvButtonController* modCvButton_;
     Led* leds_[LED_LAST];
     MidiController* midiOuts_[PARAM_MIDI_LAST];
+    MidiSaveSink* saveSink_;
+    SaveQueue* saveQueue_;
 
     CatchUpController* movingParam_;
 
@@ -92,7 +95,7 @@ private:
     int hwRevision_;
 
     bool wasCvMap_, recordAndRandomPressed_, recordPressed_, fadeOutOutput_,
-        fadeInOutput_, parameterChangedSinceLastSave_, saving_, saveFlag_,
+        fadeInOutput_, parameterChangedSinceLastSave_, saving_, saveQueued_, saveFlag_,
         undoRedo_, doRandomSlew_;
 
     int lastOctave_, randomizeTask_;
@@ -129,6 +132,7 @@ public:
         fadeInOutput_ = false;
         parameterChangedSinceLastSave_ = false;
         saving_ = false;
+        saveQueued_ = false;
         saveFlag_ = false;
         randomize_ = false;
         undoRedo_ = false;
@@ -157,8 +161,9 @@ public:
         hwRevision_ = 0;
 
         patchState_->funcMode = FuncMode::FUNC_MODE_NONE;
-        patchState_->inputLevel = FloatArray::create(patchState_->blockSize);
-        patchState_->efModLevel = FloatArray::create(patchState_->blockSize);
+        patchState_->inputLevel = 0;
+        patchState_->inputRms = 0;
+        patchState_->qualityLevel = 0;
         patchState_->outLevel = 1.f;
         patchState_->randomSlew = kRandomSlewSamples;
         patchState_->randomHasSlew = false;
@@ -458,10 +463,13 @@ public:
         shiftButton_ = ShiftButtonController::create(leds_[LED_SHIFT]);
         modCvButton_ = ModCvButtonController::create(
             leds_[LED_MOD_AMOUNT], leds_[LED_CV_AMOUNT]);
+
+        // Saved in the background, see SaveQueue.h.
+        saveSink_ = MidiSaveSink::create();
+        saveQueue_ = SaveQueue::create(saveSink_);
+        patchState_->saveQueue = saveQueue_;
     }
     ~Ui() {
-        FloatArray::destroy(patchState_->inputLevel);
-        FloatArray::destroy(patchState_->efModLevel);
         TapTempo::destroy(patchState_->tempo);
         for (size_t i = 0; i < PARAM_KNOB_LAST; i++) {
             KnobController::destroy(knobs_[i]);
@@ -485,6 +493,8 @@ public:
         RandomButtonController::destroy(randomButton_);
         ShiftButtonController::destroy(shiftButton_);
         ModCvButtonController::destroy(modCvButton_);
+        SaveQueue::destroy(saveQueue_);
+        MidiSaveSink::destroy(saveSink_);
     }
 
     static Ui* create(
@@ -546,6 +556,7 @@ public:
         Resource* resource = Resource::load(PATCH_SETTINGS_NAME ".alt");
         if (resource != NULL) {
             int16_t* cfg = (int16_t*)resource->getData();
+            saveQueue_->SetSaved(FuncMode::FUNC_MODE_ALT, cfg, resource->getSize() / sizeof(int16_t));
             knobs_[PARAM_KNOB_AMBIENCE_SPACETIME]->SetValue(cfg[0] / 8192.f, LockableParamName::PARAM_LOCKABLE_ALT); // Ambience auto-pan
             knobs_[PARAM_KNOB_ECHO_DENSITY]->SetValue(cfg[1] / 8192.f, LockableParamName::PARAM_LOCKABLE_ALT); // Echo filter
             knobs_[PARAM_KNOB_FILTER_RESONANCE]->SetValue(cfg[2] / 8192.f, LockableParamName::PARAM_LOCKABLE_ALT); // Filter position
@@ -565,6 +576,7 @@ public:
         Resource* resource = Resource::load(PATCH_SETTINGS_NAME ".mod");
         if (resource) {
             int16_t* cfg = (int16_t*)resource->getData();
+            saveQueue_->SetSaved(FuncMode::FUNC_MODE_MOD, cfg, resource->getSize() / sizeof(int16_t));
             knobs_[PARAM_KNOB_AMBIENCE_DECAY]->SetValue(cfg[0] / 8192.f, LockableParamName::PARAM_LOCKABLE_MOD); // Ambience decay mod amount
             knobs_[PARAM_KNOB_AMBIENCE_SPACETIME]->SetValue(cfg[1] / 8192.f, LockableParamName::PARAM_LOCKABLE_MOD); // Ambience spacetime mod amount
             knobs_[PARAM_KNOB_ECHO_DENSITY]->SetValue(cfg[2] / 8192.f, LockableParamName::PARAM_LOCKABLE_MOD); // Echo density mod amount
@@ -590,6 +602,7 @@ public:
         Resource* resource = Resource::load(PATCH_SETTINGS_NAME ".cv");
         if (resource) {
             int16_t* cfg = (int16_t*)resource->getData();
+            saveQueue_->SetSaved(FuncMode::FUNC_MODE_CV, cfg, resource->getSize() / sizeof(int16_t));
             knobs_[PARAM_KNOB_AMBIENCE_DECAY]->SetValue(cfg[0] / 8192.f, LockableParamName::PARAM_LOCKABLE_CV); // Ambience decay cv amount
             knobs_[PARAM_KNOB_AMBIENCE_SPACETIME]->SetValue(cfg[1] / 8192.f, LockableParamName::PARAM_LOCKABLE_CV); // Ambience spacetime cv amount
             knobs_[PARAM_KNOB_ECHO_DENSITY]->SetValue(cfg[2] / 8192.f, LockableParamName::PARAM_LOCKABLE_CV); // Echo density cv amount
@@ -615,6 +628,7 @@ public:
         Resource* resource = Resource::load(PATCH_SETTINGS_NAME ".prm");
         if (resource) {
             int16_t* cfg = (int16_t*)resource->getData();
+            saveQueue_->SetSaved(FuncMode::FUNC_MODE_NONE, cfg, resource->getSize() / sizeof(int16_t));
             knobs_[PARAM_KNOB_AMBIENCE_DECAY]->SetValue(cfg[0] / 8192.f); // Ambience decay
             knobs_[PARAM_KNOB_AMBIENCE_SPACETIME]->SetValue(cfg[1] / 8192.f); // Ambience spacetime
             knobs_[PARAM_KNOB_ECHO_DENSITY]->SetValue(cfg[2] / 8192.f); // Echo density
@@ -741,23 +755,14 @@ public:
             break;
         }
 
-        // Start the save process.
-        getInitialisingPatchProcessor()->patch->sendMidi(
-            MidiMessage(USB_COMMAND_SINGLE_BYTE, START, 0, 0)); // send MIDI START
-
-        // Send the file index - 0: "oneiroi.prm", 1: "oneiroi.alt", 2: "oneiroi.mod", 3: "oneiroi.cv"
-        getInitialisingPatchProcessor()->patch->sendMidi(MidiMessage::cp(0, funcMode));
+        // Sent in the background, a few messages per block.
+        saveQueue_->Enqueue(funcMode, values);
+    }
 
-        for (size_t i = 0; i < MAX_PATCH_SETTINGS; i++) {
-            // Convert to 14-bit signed int.
-            int16_t value = rintf(values[i] * 8192);
-            // Send the parameter's value.
-            getInitialisingPatchProcessor()->patch->sendMidi(MidiMessage::pb(i, value));
+    void PushClockEvent(ClockEventType type, size_t offset) {
+        if (patchState_->clockEvents) {
+            patchState_->clockEvents->Push(type, offset, patchState_->hostBlockSize);
         }
-
-        // Finish the process.
-        getInitialisingPatchProcessor()->patch->sendMidi(
-            MidiMessage(USB_COMMAND_SINGLE_BYTE, STOP, 0, 0)); // send MIDI STOP
     }
 
     // Callback
@@ -766,8 +771,8 @@ public:
 
         switch (bid) {
         case SYNC_IN:
-            patchState_->tempo->trigger(on, samples);
-            patchState_->syncIn = on;
+            // Followed to the sample by the clock.
+            PushClockEvent(on ? CLOCK_EVENT_SYNC_ON : CLOCK_EVENT_SYNC_OFF, samples);
             break;
 
         case RECORD_IN:
@@ -830,6 +835,47 @@ public:
 
     // Callback.
     void ProcessMidi(MidiMessage msg) {
+        // The realtime messages come without a time, they're taken as at
+        // the start of the next block.
+        switch (msg.data[1]) {
+        case kMidiTimingClock:
+            PushClockEvent(CLOCK_EVENT_MIDI_CLOCK, 0);
+            return;
+        case kMidiStart:
+            PushClockEvent(CLOCK_EVENT_MIDI_START, 0);
+            return;
+        case kMidiContinue:
+            PushClockEvent(CLOCK_EVENT_MIDI_CONTINUE, 0);
+            return;
+        case kMidiStop:
+            PushClockEvent(CLOCK_EVENT_MIDI_STOP, 0);
+            return;
+        default:
+            break;
+        }
+
+        if (msg.isProgramChange()) {
+            patchState_->snapshots->Recall(msg.getProgramChange());
+        }
+        else if (msg.isControlChange() && kMidiSnapshotMorph == msg.getControllerNumber()) {
+            patchState_->snapshots->SetMorphTime(msg.getControllerValue() * kSnapshotMorphSecMax / 127.f);
+        }
+        else if (msg.isControlChange() && kMidiSnapshotStore == msg.getControllerNumber()) {
+            patchState_->snapshots->Store(msg.getControllerValue(), *patchCtrls_);
+        }
+
+        if (patchState_->voices) {
+            if (msg.isNoteOn()) {
+                patchState_->voices->NoteOn(msg.getNote(), msg.getVelocity());
+            }
+            else if (msg.isNoteOff()) {
+                patchState_->voices->NoteOff(msg.getNote());
+            }
+            else if (msg.isControlChange() && kMidiAllNotesOff == msg.getControllerNumber()) {
+                patchState_->voices->AllNotesOff();
+            }
+        }
+
         return;
 
         if (msg.isControlChange()) {
@@ -846,7 +892,17 @@ public:
     }
 
     void HandleLeds() {
-        float level = patchState_->inputLevel.getMean();
+#ifdef USE_PROFILER
+        // The input leds show the DSP load and the overruns instead.
+        leds_[LED_INPUT]->Set(Clamp(patchState_->profiler->GetLoad()));
+        if (patchState_->profiler->IsOverrun()) {
+            leds_[LED_INPUT_PEAK]->On();
+        }
+        else {
+            leds_[LED_INPUT_PEAK]->Off();
+        }
+#else
+        float level = patchState_->inputLevel;
         if (level < 0.7f) {
             leds_[LED_INPUT]->Set(Map(level, 0.f, 1.f, 0.5f, 1.f));
             leds_[LED_INPUT_PEAK]->Off();
@@ -855,6 +911,7 @@ public:
             leds_[LED_INPUT]->Off();
             leds_[LED_INPUT_PEAK]->On();
         }
+#endif
 
         float v = Map(patchState_->modValue, -0.5f, 0.5f, 0.49f, 0.5f + patchCtrls_->modLevel * 0.5f);
         if (v < 0.5f)
@@ -889,6 +946,11 @@ public:
             CatchUpController* ctrl = (i < PARAM_KNOB_LAST)
                 ? (CatchUpController*)knobs_[i]
                 : (CatchUpController*)faders_[i - PARAM_KNOB_LAST];
+            if (ctrl->IsIdle()) {
+                // Untouched since it settled, see CatchUpController.
+                patchState_->moving[i] = false;
+                continue;
+            }
             bool m = ctrl->Process();
             patchState_->moving[i] = m;
             if (m && !moving) {
@@ -897,6 +959,11 @@ public:
             }
         }
 
+        // Moving a control takes the panel back from a recalled snapshot.
+        if (moving) {
+            patchState_->snapshots->Release();
+        }
+
         /*
         if (moving && FuncMode::FUNC_MODE_NONE != patchState_->funcMode)
         {
@@ -1120,7 +1187,7 @@ public:
             case RecordingState::RECORDING_STATE_WAITING_ONSET:
                 if (samplesSinceRecordInReceived_ < kRecordOnsetLimit) {
                     samplesSinceRecordInReceived_++;
-                    if (patchState_->inputLevel.getMean() >= kRecordOnsetLevel) {
+                    if (patchState_->inputLevel >= kRecordOnsetLevel) {
                         recordingState_ = RecordingState::RECORDING_STATE_RECORDING;
                         recordButton_->Set(1);
                     }
@@ -1131,7 +1198,7 @@ public:
                 break;
             case RecordingState::RECORDING_STATE_RECORDING:
                 if (!recordPressed_) {
-                    if (patchState_->inputLevel.getMean() <= kRecordWindupLevel ||
+                    if (patchState_->inputLevel <= kRecordWindupLevel ||
                         samplesSinceRecordingStarted_ >= kLooperChannelBufferLength) {
                         recordingState_ = RecordingState::RECORDING_STATE_STOP;
                     }
@@ -1394,11 +1461,15 @@ public:
             patchState_->outLevel -= kOutputFadeInc;
             if (patchState_->outLevel <= 0) {
                 patchState_->outLevel = 0;
-                if (saving_) {
+                if (saving_ && !saveQueued_) {
                     SaveParametersConfig(FuncMode::FUNC_MODE_NONE);
                     SaveParametersConfig(FuncMode::FUNC_MODE_ALT);
                     SaveParametersConfig(FuncMode::FUNC_MODE_MOD);
                     SaveParametersConfig(FuncMode::FUNC_MODE_CV);
+                    saveQueued_ = true;
+                }
+                else if (saving_ && saveQueue_->TakeDone()) {
+                    // The output stays muted until the firmware has the files.
                     LedName activeLed = LED_MOD_AMOUNT;
                     if (shiftButton_->IsOn()) {
                         activeLed = LED_CV_AMOUNT;
@@ -1407,8 +1478,9 @@ public:
                     fadeOutOutput_ = false;
                     fadeInOutput_ = true;
                     saving_ = false;
+                    saveQueued_ = false;
                 }
-                else {
+                else if (!saving_) {
                     fadeOutOutput_ = false;
                     fadeInOutput_ = true;
                 }
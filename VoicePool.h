@@ -0,0 +1,261 @@
+#pragma once
+
+#include "Commons.h"
+#include "Arena.h"
+#include "MoogVCO.h"
+
+/**
+ * @brief The MIDI note mode of osc2: a pool of MoogVCO voices, each with its
+ *        own envelope, that takes the place of the supersaw once a note has
+ *        been played, until all the notes are turned off by CC 123.
+ *        A note takes an idle voice, or steals the quietest of the released
+ *        ones, or else the oldest one.
+ *        The voices are rendered a block at a time each, the envelope is a
+ *        one pole at block rate ramped over the samples.
+ *        The number of voices that can be taken can be lowered to keep the
+ *        DSP load under control, see Adapt().
+ */
+class VoicePool
+{
+private:
+    struct Voice
+    {
+        MoogVCO* vco;
+        float freq;
+        float velocity;
+        float level;
+        uint32_t age;
+        uint8_t note;
+        bool gate;
+    };
+
+    PatchState* patchState_;
+
+    Voice voices_[kVoicesMax];
+    FloatArray scratch_;
+    FloatArray mix_;
+
+    size_t limit_;
+    size_t adaptBlocks_;
+    uint32_t age_;
+    float attackCoeff_;
+    float releaseCoeff_;
+    float oldVol_;
+    bool active_;
+
+    inline bool IsIdle(const Voice &voice)
+    {
+        return !voice.gate && 0 == voice.level;
+    }
+
+    Voice* Allocate(uint8_t note)
+    {
+        for (size_t i = 0; i < limit_; i++)
+        {
+            if (voices_[i].note == note && !IsIdle(voices_[i]))
+            {
+                // Retrigger.
+                return &voices_[i];
+            }
+        }
+
+        Voice* quietest = NULL;
+        Voice* oldest = NULL;
+        for (size_t i = 0; i < limit_; i++)
+        {
+            Voice* voice = &voices_[i];
+            if (IsIdle(*voice))
+            {
+                return voice;
+            }
+            if (!voice->gate && (NULL == quietest || voice->level < quietest->level))
+            {
+                quietest = voice;
+            }
+            if (NULL == oldest || voice->age < oldest->age)
+            {
+                oldest = voice;
+            }
+        }
+
+        return quietest ? quietest : oldest;
+    }
+
+public:
+    VoicePool(PatchState* patchState)
+    {
+        patchState_ = patchState;
+
+        for (size_t i = 0; i < kVoicesMax; i++)
+        {
+            voices_[i].vco = MoogVCO::create(patchState_->sampleRate);
+            voices_[i].vco->setSubMix(0.25f);
+            voices_[i].vco->setDrive(1.1f);
+            voices_[i].freq = kOscFreqMin;
+            voices_[i].velocity = 0;
+            voices_[i].level = 0;
+            voices_[i].age = 0;
+            voices_[i].note = 0;
+            voices_[i].gate = false;
+        }
+        scratch_ = ArenaCreateFloatArray(patchState_->blockSize);
+        mix_ = ArenaCreateFloatArray(patchState_->blockSize);
+
+        float blockSize = patchState_->blockSize;
+        attackCoeff_ = 1.f - expf(-blockSize / (kVoicesAttackSec * patchState_->sampleRate));
+        releaseCoeff_ = 1.f - expf(-blockSize / (kVoicesReleaseSec * patchState_->sampleRate));
+
+        limit_ = kVoicesMax;
+        adaptBlocks_ = 0;
+        age_ = 0;
+        oldVol_ = 0;
+        active_ = false;
+    }
+    ~VoicePool()
+    {
+        for (size_t i = 0; i < kVoicesMax; i++)
+        {
+            MoogVCO::destroy(voices_[i].vco);
+        }
+        ArenaDestroyFloatArray(scratch_);
+        ArenaDestroyFloatArray(mix_);
+    }
+
+    static VoicePool* create(PatchState* patchState)
+    {
+        return ArenaCreate<VoicePool>(MEMORY_REGION_FAST, patchState);
+    }
+
+    static void destroy(VoicePool* obj)
+    {
+        ArenaDestroy(obj);
+    }
+
+    void NoteOn(uint8_t note, uint8_t velocity)
+    {
+        if (0 == velocity)
+        {
+            NoteOff(note);
+
+            return;
+        }
+
+        Voice* voice = Allocate(note);
+        voice->note = note;
+        voice->freq = Clamp(M2F(note), kOscFreqMin, kOscFreqMax);
+        voice->velocity = velocity / 127.f;
+        voice->age = ++age_;
+        voice->gate = true;
+        active_ = true;
+    }
+
+    void NoteOff(uint8_t note)
+    {
+        for (size_t i = 0; i < kVoicesMax; i++)
+        {
+            if (voices_[i].gate && voices_[i].note == note)
+            {
+                voices_[i].gate = false;
+            }
+        }
+    }
+
+    /**
+     * @brief Releases all the voices and gives osc2 back to the supersaw.
+     */
+    void AllNotesOff()
+    {
+        for (size_t i = 0; i < kVoicesMax; i++)
+        {
+            voices_[i].gate = false;
+        }
+        active_ = false;
+    }
+
+    inline bool IsActive()
+    {
+        return active_;
+    }
+
+    inline size_t GetLimit()
+    {
+        return limit_;
+    }
+
+    /**
+     * @brief Called once per block with the DSP load, 1 being the whole
+     *        block. A voice is dropped when the load is too high and given
+     *        back when there's room again, no more often than
+     *        kVoicesAdaptBlocks so that the load measured can settle.
+     */
+    void Adapt(float load)
+    {
+        if (++adaptBlocks_ < kVoicesAdaptBlocks)
+        {
+            return;
+        }
+
+        if (load > kVoicesLoadHigh && limit_ > 1)
+        {
+            limit_--;
+            voices_[limit_].gate = false;
+            adaptBlocks_ = 0;
+        }
+        else if (load < kVoicesLoadLow && limit_ < kVoicesMax)
+        {
+            limit_++;
+            adaptBlocks_ = 0;
+        }
+    }
+
+    /**
+     * @brief Adds the voices to output, times gain.
+     */
+    void ProcessAdd(AudioBuffer &output, float gain)
+    {
+        size_t size = output.getSize();
+
+        mix_.clear();
+
+        for (size_t v = 0; v < kVoicesMax; v++)
+        {
+            Voice &voice = voices_[v];
+            if (IsIdle(voice))
+            {
+                continue;
+            }
+
+            float level = voice.level;
+            if (voice.gate)
+            {
+                ONE_POLE(voice.level, voice.velocity, attackCoeff_);
+            }
+            else
+            {
+                ONE_POLE(voice.level, 0, releaseCoeff_);
+                if (voice.level < kVoicesIdleLevel)
+                {
+                    voice.level = 0;
+                }
+            }
+            float increment = (voice.level - level) / size;
+
+            voice.vco->processBlock(voice.freq, scratch_, size, 1.f);
+            for (size_t i = 0; i < size; i++)
+            {
+                level += increment;
+                mix_[i] += scratch_[i] * level;
+            }
+        }
+
+        ParameterInterpolator volParam(&oldVol_, patchState_->params->Get(PARAM_OSC2_VOL) * kOScSuperSawGain * kVoicesGain, size, ParameterInterpolator::BY_SIZE);
+        float* left = output.getSamples(LEFT_CHANNEL).getData();
+        float* right = output.getSamples(RIGHT_CHANNEL).getData();
+        for (size_t i = 0; i < size; i++)
+        {
+            float out = mix_[i] * volParam.Next() * gain;
+            left[i] += out;
+            right[i] += out;
+        }
+    }
+};
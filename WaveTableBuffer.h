@@ -1,23 +1,131 @@
 #pragma once
 
 #include "Commons.h"
+#include "Arena.h"
 #include "Interpolator.h"
+#include "LooperBuffer.h"
+#include "Scheduler.h"
 
-class WaveTableBuffer
+/**
+ * @brief Reads the looper's buffer as a bank of kWaveTableNofTables
+ *        wavetables. The tables are copied out of the looper into a cache,
+ *        each one with kWaveTableNofLevels octave mip levels that have been
+ *        band-limited with a halfband filter: the oscillator picks the level
+ *        that doesn't alias at its frequency and reads it with a plain linear
+ *        interpolation.
+ *        The left table starts kWaveTableStereoOffset samples before the
+ *        table and the right one as many samples after it.
+ *        When the looper writes over a table, the table is rebuilt in the
+ *        background once the write head has moved past it.
+ */
+class WaveTableBuffer : public BackgroundJob
 {
 private:
-    FloatArray* buffer_;
-    int writeHead_;
+    // Units of work of a Build().
+    static constexpr size_t kBuildCost = 2 * kWaveTableCacheTableSize;
+    static_assert(kBuildCost <= kSchedulerBlockBudget, "A table must be rebuilt within a block's budget");
+
+    LooperBuffer* buffer_;
+    FloatArray cache_;
+
+    size_t levelOffsets_[kWaveTableNofLevels];
+    size_t levelOffset_;
+    float levelScale_;
+
+    uint32_t dirty_; // One bit per table
+
+    inline float* GetTable(int table, size_t channel)
+    {
+        return cache_.getData() + (table * 2 + channel) * kWaveTableCacheTableSize;
+    }
+
+    /**
+     * @brief The tables whose source overlaps a range of the looper's
+     *        channels, taps of the interpolation included.
+     */
+    inline uint32_t GetTables(int32_t start, int32_t size)
+    {
+        const int32_t offset = int32_t(kWaveTableStereoOffset) + 2;
+        const int32_t tableSize = kWaveTableLength + offset * 2;
+
+        uint32_t tables = 0;
+        for (int i = 0; i < kWaveTableNofTables; i++)
+        {
+            int32_t tableStart = i * kWaveTableStepLength - offset;
+            if (size >= kLooperChannelBufferLength ||
+                LooperBuffer::Wrap(start - tableStart) < tableSize ||
+                LooperBuffer::Wrap(tableStart - start) < size)
+            {
+                tables |= 1u << i;
+            }
+        }
+
+        return tables;
+    }
+
+    void Build(int table)
+    {
+        for (size_t c = 0; c < 2; c++)
+        {
+            const LooperSample* channel = buffer_->GetChannel(c);
+            float* src = GetTable(table, c);
+
+            // Level 0 is a copy of the looper's content.
+            float p = table * kWaveTableStepLength + (LEFT_CHANNEL == c ? -kWaveTableStereoOffset : kWaveTableStereoOffset);
+            int32_t i0 = int32_t(floorf(p));
+            float f = p - i0;
+            for (int32_t i = 0; i < kWaveTableLength; i++)
+            {
+                int32_t j = LooperBuffer::Wrap(i0 + i) * kLooperSampleStride;
+                src[i] = Interpolator::linear(channel[j], channel[j + kLooperSampleStride], f) * kLooperSampleScaleR;
+            }
+            src[kWaveTableLength] = src[0];
+
+            // Each level is the previous one through a 7 taps halfband
+            // filter (-1, 0, 9, 16, 9, 0, -1) / 32, decimated by 2. The
+            // table loops, so the taps wrap around.
+            size_t size = kWaveTableLength;
+            for (size_t k = 1; k < kWaveTableNofLevels; k++)
+            {
+                float* dst = src + size + 1;
+                size_t mask = size - 1;
+                size /= 2;
+                for (size_t i = 0; i < size; i++)
+                {
+                    size_t j = i * 2;
+                    dst[i] = 0.5f * src[j] + 0.28125f * (src[(j - 1) & mask] + src[j + 1]) -
+                        0.03125f * (src[(j - 3) & mask] + src[(j + 3) & mask]);
+                }
+                dst[size] = dst[0];
+                src = dst;
+            }
+        }
+    }
 
 public:
-    WaveTableBuffer(FloatArray* buffer)
+    WaveTableBuffer(LooperBuffer* buffer)
     {
         buffer_ = buffer;
-        writeHead_ = 0;
+        cache_ = ArenaCreateFloatArray(kWaveTableNofTables * 2 * kWaveTableCacheTableSize);
+
+        size_t offset = 0;
+        for (size_t k = 0; k < kWaveTableNofLevels; k++)
+        {
+            levelOffsets_[k] = offset;
+            offset += (kWaveTableLength >> k) + 1;
+        }
+        levelOffset_ = 0;
+        levelScale_ = 1.f;
+
+        // Built once the looper's buffer has been seeded.
+        dirty_ = ~0u >> (32 - kWaveTableNofTables);
+    }
+    ~WaveTableBuffer()
+    {
+        ArenaDestroyFloatArray(cache_);
     }
-    ~WaveTableBuffer() {}
 
-    static WaveTableBuffer* create(FloatArray* buffer)
+    static WaveTableBuffer* create(LooperBuffer* buffer)
     {
         return new WaveTableBuffer(buffer);
     }
@@ -27,49 +135,88 @@ public:
         delete obj;
     }
 
-    inline float ReadLeft(uint32_t position)
+    /**
+     * @brief Track the looper's writes and rebuild the tables that the write
+     *        head has left, as many as the budget allows.
+     */
+    size_t Run(size_t budget) override
     {
-        while (position >= kLooperChannelBufferLength)
+        uint32_t start, size;
+        uint32_t writing = 0;
+        if (buffer_->TakeChange(start, size))
         {
-            position -= kLooperChannelBufferLength;
+            writing = GetTables(start, size);
+            dirty_ |= writing;
         }
-        while (position < 0)
+
+        size_t used = 0;
+        uint32_t ready = dirty_ & ~writing;
+        while (ready && used + kBuildCost <= budget)
         {
-            position += kLooperChannelBufferLength;
+            int table = __builtin_ctz(ready);
+            Build(table);
+            dirty_ &= ~(1u << table);
+            ready &= ~(1u << table);
+            used += kBuildCost;
         }
 
-        return buffer_->getElement(position);
+        return used;
     }
 
-    inline float ReadRight(uint32_t position)
+    /**
+     * @brief Select the mip level for the block.
+     *
+     * @param increment the phase increment per sample, in samples of the
+     *        full size table
+     */
+    inline void SetIncrement(float increment)
     {
-        position += kLooperChannelBufferLength;
-
-        while (position >= kLooperTotalBufferLength)
+        int level = 0;
+        if (increment > 1.f)
         {
-            position -= kLooperChannelBufferLength;
+            level = Min(ceilf(log2f(increment)), kWaveTableNofLevels - 1);
         }
-        while (position < kLooperChannelBufferLength)
-        {
-            position += kLooperChannelBufferLength;
-        }
-
-        return buffer_->getElement(position);
+        levelOffset_ = levelOffsets_[level];
+        levelScale_ = 1.f / (1 << level);
     }
 
-    inline void ReadLinear(float p1, float p2, float x, float &left, float &right)
+    /**
+     * @brief Read a stereo frame, crossfading between a table and the next.
+     *
+     * @param table the first table
+     * @param phase [0, kWaveTableLength)
+     * @param x the crossfade to the next table, [0, 1]
+     */
+    inline void Read(int table, float phase, float x, float &left, float &right)
     {
-        float l0, l1;
-        float r0, r1;
+        phase *= levelScale_;
+        int32_t i = int32_t(phase);
+        float f = phase - i;
 
-        uint32_t i1 = uint32_t(p1);
-        uint32_t i2 = uint32_t(p2);
-        float f1 = p1 - i1;
-        float f2 = p2 - i2;
+        int next = (table + 1) % kWaveTableNofTables;
+        const float* l1 = GetTable(table, LEFT_CHANNEL) + levelOffset_ + i;
+        const float* r1 = GetTable(table, RIGHT_CHANNEL) + levelOffset_ + i;
+        const float* l2 = GetTable(next, LEFT_CHANNEL) + levelOffset_ + i;
+        const float* r2 = GetTable(next, RIGHT_CHANNEL) + levelOffset_ + i;
+
+        float x0 = 1.f - x;
+
+        left = Interpolator::linear(l1[0], l1[1], f) * x0 + Interpolator::linear(l2[0], l2[1], f) * x;
+        right = Interpolator::linear(r1[0], r1[1], f) * x0 + Interpolator::linear(r2[0], r2[1], f) * x;
+    }
+
+    /**
+     * @brief As Read(), from the sample before the phase, without
+     *        interpolating between the samples.
+     */
+    inline void ReadNearest(int table, float phase, float x, float &left, float &right)
+    {
+        int32_t i = int32_t(phase * levelScale_);
 
+        int next = (table + 1) % kWaveTableNofTables;
         float x0 = 1.f - x;
 
-        left = Interpolator::linear(ReadLeft(i1), ReadLeft(i1 + 1), f1) * x0 + Interpolator::linear(ReadLeft(i2), ReadLeft(i2 + 1), f2) * x;
-        right = Interpolator::linear(ReadRight(i1), ReadRight(i1 + 1), f1) * x0 + Interpolator::linear(ReadRight(i2), ReadRight(i2 + 1), f2) * x;
+        left = GetTable(table, LEFT_CHANNEL)[levelOffset_ + i] * x0 + GetTable(next, LEFT_CHANNEL)[levelOffset_ + i] * x;
+        right = GetTable(table, RIGHT_CHANNEL)[levelOffset_ + i] * x0 + GetTable(next, RIGHT_CHANNEL)[levelOffset_ + i] * x;
     }
 };
@@ -0,0 +1,507 @@
+// Native microbenchmarks of the DSP classes, one at a time
+// Runs each class on its own at the block sizes 16, 32, 64 and 128 and at the
+// corners of its parameters, on the same input, and prints a CSV line per run:
+//
+//   kernel,corner,block,ns_per_sample,hash
+//
+// The hash is FNV-1a of the bits of the output, so that an optimization that
+// changes the sound shows up even where the timing would hide it. The hashes
+// hold for a compiler and its flags, the baseline is remade along with them.
+//
+// Usage: ./bench_kernels [-s seconds] [-k kernel] [-c baseline.csv]
+//   -s  audio rendered per run, default 1
+//   -k  only the runs of this kernel
+//   -c  check the hashes against a baseline printed before, the runs that
+//       differ or that aren't in it are reported and the exit code is 1
+//
+// A run whose output is silent fails with or without -c, its hash would hold
+// whatever the kernel does.
+//
+// `make kernels` checks against kernels_baseline.csv, `make kernels-baseline`
+// writes it.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <cstring>
+#include <cmath>
+
+#include "owl_mocks.h"
+#include "../Commons.h"
+#include "../Arena.h"
+#include "../Profiler.h"
+#include "../MoogLadderFilter.h"
+#include "../Filter.h"
+#include "../Resonator.h"
+#include "../StereoWavefolder.h"
+#include "../StereoWidener.h"
+#include "../PhasePhaser.h"
+#include "../Echo.h"
+#include "../Ambience.h"
+#include "../LooperBuffer.h"
+#include "../WaveTableBuffer.h"
+#include "../StereoWaveTableOscillator.h"
+#include "../MoogVCO.h"
+#include "../Compressor.h"
+
+static const int kBlockSizes[] = { 16, 32, 64, 128 };
+
+struct Fixture {
+    PatchCtrls ctrls;
+    PatchCvs cvs;
+    PatchState state;
+    PatchParams params;
+};
+
+// The preset of bench_oneiroi, each module audible.
+static void InitFixture(Fixture& f, int blockSize) {
+    memset(&f.ctrls, 0, sizeof(f.ctrls));
+    memset(&f.cvs, 0, sizeof(f.cvs));
+    memset(&f.params, 0, sizeof(f.params));
+    f.state = PatchState{};
+
+    f.ctrls.osc2Vol = 0.7f;
+    f.ctrls.oscPitch = 110.f;
+    f.ctrls.oscUnison = 0.3f;
+    f.ctrls.oscDetune = 0.2f;
+    f.ctrls.filterVol = 0.8f;
+    f.ctrls.filterMode = 0.1f;
+    f.ctrls.filterCutoff = 0.6f;
+    f.ctrls.filterResonance = 0.5f;
+    f.ctrls.resonatorVol = 0.7f;
+    f.ctrls.resonatorTune = 0.5f;
+    f.ctrls.resonatorFeedback = 0.8f;
+    f.ctrls.resonatorDissonance = 0.3f;
+    f.ctrls.echoVol = 0.6f;
+    f.ctrls.echoRepeats = 0.6f;
+    f.ctrls.echoDensity = 0.5f;
+    f.ctrls.echoFilter = 0.5f;
+    f.ctrls.ambienceVol = 0.6f;
+    f.ctrls.ambienceDecay = 0.7f;
+    f.ctrls.ambienceSpacetime = 0.6f;
+    f.ctrls.ambienceAutoPan = 0.5f;
+
+    f.state.sampleRate = 48000.f;
+    f.state.blockSize = blockSize;
+    f.state.hostBlockSize = blockSize;
+    f.state.blockRate = f.state.sampleRate / blockSize;
+    f.state.clockSource = ClockSource::CLOCK_SOURCE_INTERNAL;
+    f.state.outLevel = 1.f;
+    f.state.startupPhase = StartupPhase::STARTUP_DONE;
+    f.state.params = &f.params;
+    f.state.tempo = TapTempo::create(f.state.blockRate, kLooperChannelBufferLength);
+    f.state.tempo->setFrequency(kInternalClockFreq);
+    f.state.clockSamples = f.state.tempo->getPeriodInSamples();
+    f.state.clockPeriod = f.state.clockSamples;
+}
+
+// Without the modulation, the parameters are the controls.
+static void SetParams(Fixture& f) {
+    f.params.values[PARAM_OSC2_VOL] = f.ctrls.osc2Vol;
+    f.params.values[PARAM_OSC_DETUNE] = f.ctrls.oscDetune;
+    f.params.values[PARAM_FILTER_CUTOFF] = f.ctrls.filterCutoff;
+    f.params.values[PARAM_FILTER_RESONANCE] = f.ctrls.filterResonance;
+    f.params.values[PARAM_RESONATOR_TUNE] = f.ctrls.resonatorTune;
+    f.params.values[PARAM_RESONATOR_FEEDBACK] = f.ctrls.resonatorFeedback;
+    f.params.values[PARAM_RESONATOR_DISSONANCE] = f.ctrls.resonatorDissonance;
+    f.params.values[PARAM_ECHO_REPEATS] = f.ctrls.echoRepeats;
+    f.params.values[PARAM_ECHO_DENSITY] = f.ctrls.echoDensity;
+    f.params.values[PARAM_AMBIENCE_DECAY] = f.ctrls.ambienceDecay;
+    f.params.values[PARAM_AMBIENCE_SPACETIME] = f.ctrls.ambienceSpacetime;
+}
+
+class Kernel {
+public:
+    virtual ~Kernel() {}
+    // In place, the buffer holds the input.
+    virtual void Process(AudioBuffer& buffer) = 0;
+};
+
+// The modules of the chain, made from the controls and the state.
+template <class T>
+class ModuleKernel : public Kernel {
+private:
+    T* module_;
+
+public:
+    ModuleKernel(Fixture& f) { module_ = T::create(&f.ctrls, &f.cvs, &f.state); }
+    ~ModuleKernel() { T::destroy(module_); }
+    void Process(AudioBuffer& buffer) override { module_->process(buffer, buffer); }
+};
+
+class FilterKernel : public Kernel {
+private:
+    Filter* filter_;
+
+public:
+    FilterKernel(Fixture& f, bool useMoog) { filter_ = Filter::create(&f.ctrls, &f.cvs, &f.state, useMoog); }
+    ~FilterKernel() { Filter::destroy(filter_); }
+    void Process(AudioBuffer& buffer) override { filter_->process(buffer, buffer); }
+};
+
+class MoogLadderKernel : public Kernel {
+private:
+    MoogLadderFilter* filter_;
+
+public:
+    MoogLadderKernel(Fixture& f, float cutoff, float resonance, float drive) {
+        filter_ = MoogLadderFilter::create(f.state.sampleRate);
+        filter_->setCutoff(cutoff);
+        filter_->setResonance(resonance);
+        filter_->setDrive(drive);
+    }
+    ~MoogLadderKernel() { MoogLadderFilter::destroy(filter_); }
+    void Process(AudioBuffer& buffer) override { filter_->process(buffer, buffer); }
+};
+
+class CompressorKernel : public Kernel {
+private:
+    Compressor* comp_;
+
+public:
+    CompressorKernel(Fixture& f, float threshold, float ratio) {
+        comp_ = Compressor::create(f.state.sampleRate);
+        comp_->setThreshold(threshold);
+        comp_->setRatio(ratio);
+    }
+    ~CompressorKernel() { Compressor::destroy(comp_); }
+    void Process(AudioBuffer& buffer) override { comp_->process(buffer, buffer); }
+};
+
+class MoogVcoKernel : public Kernel {
+private:
+    MoogVCO* vco_;
+    float freq_;
+
+public:
+    MoogVcoKernel(Fixture& f, float freq, float drive) {
+        vco_ = MoogVCO::create(f.state.sampleRate);
+        vco_->setSubMix(0.25f);
+        vco_->setDrive(drive);
+        freq_ = freq;
+    }
+    ~MoogVcoKernel() { MoogVCO::destroy(vco_); }
+    void Process(AudioBuffer& buffer) override {
+        FloatArray left = buffer.getSamples(LEFT_CHANNEL);
+        vco_->processBlock(freq_, left, buffer.getSize(), 1.f);
+        buffer.getSamples(RIGHT_CHANNEL).copyFrom(left);
+    }
+};
+
+// A looper's buffer holding length frames of a chord, the rest silent.
+static LooperBuffer* CreateLoop(int32_t length) {
+    LooperBuffer* buffer = LooperBuffer::create();
+    buffer->Clear();
+    while (buffer->Run(kLooperAllocatedLength) > 0) {}
+
+    RandomStream noise(2);
+    for (size_t c = 0; c < 2; c++) {
+        LooperSample* channel = buffer->GetChannel(c);
+        for (int32_t i = 0; i < length; i++) {
+            float s = 0.2f * (sinf(i * 0.0144f) + sinf(i * 0.0216f) + sinf(i * 0.0288f * (1 + c * 0.01f)));
+            channel[i * kLooperSampleStride] = ToLooperSample(s + noise.NextFloat(-0.01f, 0.01f));
+        }
+    }
+    buffer->MirrorGuards();
+    buffer->MarkChange(0, kLooperChannelBufferLength);
+
+    return buffer;
+}
+
+class LooperReadKernel : public Kernel {
+private:
+    LooperBuffer* buffer_;
+    LooperPosition position_;
+    float speed_;
+
+public:
+    LooperReadKernel(Fixture&, float speed) {
+        buffer_ = CreateLoop(48000);
+        position_ = speed < 0 ? 48000 : 0;
+        speed_ = speed;
+    }
+    ~LooperReadKernel() { LooperBuffer::destroy(buffer_); }
+    void Process(AudioBuffer& buffer) override {
+        PlaybackDirection direction = speed_ < 0 ? PLAYBACK_BACKWARDS : PLAYBACK_FORWARD;
+        buffer_->Read(position_, speed_, buffer, direction);
+        position_ = LooperBuffer::Wrap(int32_t(position_ + speed_ * buffer.getSize()));
+    }
+};
+
+class WaveTableKernel : public Kernel {
+private:
+    LooperBuffer* buffer_;
+    WaveTableBuffer* tables_;
+    StereoWaveTableOscillator* osc_;
+
+public:
+    // The whole buffer is filled, the tables the detune reads included.
+    WaveTableKernel(Fixture& f) {
+        buffer_ = CreateLoop(kLooperChannelBufferLength);
+        tables_ = WaveTableBuffer::create(buffer_);
+        // The first run takes the loop's change as still being written and
+        // leaves the tables, the next ones build them.
+        tables_->Run(0);
+        while (tables_->Run(1 << 30) > 0) {}
+        osc_ = StereoWaveTableOscillator::create(&f.ctrls, &f.cvs, &f.state, tables_);
+    }
+    ~WaveTableKernel() {
+        StereoWaveTableOscillator::destroy(osc_);
+        WaveTableBuffer::destroy(tables_);
+        LooperBuffer::destroy(buffer_);
+    }
+    void Process(AudioBuffer& buffer) override {
+        buffer.clear();
+        osc_->ProcessAdd(buffer, 1.f);
+    }
+};
+
+struct KernelCase {
+    const char* kernel;
+    const char* corner;
+    Kernel* (*create)(Fixture& f);
+};
+
+static const KernelCase kCases[] = {
+    { "MoogLadderFilter", "mid", [](Fixture& f) -> Kernel* { return new MoogLadderKernel(f, 1000.f, 1.f, 1.f); } },
+    { "MoogLadderFilter", "max_resonance", [](Fixture& f) -> Kernel* { return new MoogLadderKernel(f, 1000.f, 4.f, 1.f); } },
+    { "MoogLadderFilter", "max_cutoff_drive", [](Fixture& f) -> Kernel* { return new MoogLadderKernel(f, 20000.f, 2.f, 5.f); } },
+
+    { "Filter", "lp", [](Fixture& f) -> Kernel* { f.ctrls.filterMode = 0.1f; return new FilterKernel(f, false); } },
+    { "Filter", "bp", [](Fixture& f) -> Kernel* { f.ctrls.filterMode = 0.35f; return new FilterKernel(f, false); } },
+    { "Filter", "hp", [](Fixture& f) -> Kernel* { f.ctrls.filterMode = 0.6f; return new FilterKernel(f, false); } },
+    { "Filter", "cf", [](Fixture& f) -> Kernel* { f.ctrls.filterMode = 0.85f; return new FilterKernel(f, false); } },
+    { "Filter", "cf_moog", [](Fixture& f) -> Kernel* { f.ctrls.filterMode = 0.85f; return new FilterKernel(f, true); } },
+    { "Filter", "lp_max_resonance", [](Fixture& f) -> Kernel* {
+        f.ctrls.filterMode = 0.1f;
+        f.ctrls.filterResonance = 1.f;
+        return new FilterKernel(f, false); } },
+    { "Filter", "cf_max_resonance", [](Fixture& f) -> Kernel* {
+        f.ctrls.filterMode = 0.85f;
+        f.ctrls.filterResonance = 1.f;
+        return new FilterKernel(f, false); } },
+
+    { "Resonator", "mid", [](Fixture& f) -> Kernel* { return new ModuleKernel<Resonator>(f); } },
+    { "Resonator", "infinite_feedback", [](Fixture& f) -> Kernel* {
+        f.ctrls.resonatorFeedback = 1.f;
+        return new ModuleKernel<Resonator>(f); } },
+    { "Resonator", "max_dissonance", [](Fixture& f) -> Kernel* {
+        f.ctrls.resonatorDissonance = 1.f;
+        f.ctrls.resonatorTune = 1.f;
+        return new ModuleKernel<Resonator>(f); } },
+
+    { "StereoWavefolder", "mid", [](Fixture& f) -> Kernel* { return new ModuleKernel<StereoWavefolder>(f); } },
+    { "StereoWavefolder", "max_drive", [](Fixture& f) -> Kernel* {
+        f.ctrls.resonatorFeedback = 1.f;
+        f.ctrls.resonatorTune = 1.f;
+        return new ModuleKernel<StereoWavefolder>(f); } },
+
+    { "StereoWidener", "mid", [](Fixture& f) -> Kernel* { return new ModuleKernel<StereoWidener>(f); } },
+    { "StereoWidener", "max", [](Fixture& f) -> Kernel* {
+        f.ctrls.resonatorVol = 1.f;
+        f.ctrls.resonatorTune = 1.f;
+        return new ModuleKernel<StereoWidener>(f); } },
+
+    { "PhasePhaser", "mid", [](Fixture& f) -> Kernel* { return new ModuleKernel<PhasePhaser>(f); } },
+    { "PhasePhaser", "max_feedback", [](Fixture& f) -> Kernel* {
+        f.ctrls.resonatorFeedback = 1.f;
+        f.ctrls.resonatorTune = 1.f;
+        return new ModuleKernel<PhasePhaser>(f); } },
+
+    { "Echo", "mid", [](Fixture& f) -> Kernel* { return new ModuleKernel<Echo>(f); } },
+    { "Echo", "infinite_feedback", [](Fixture& f) -> Kernel* {
+        f.ctrls.echoRepeats = 1.f;
+        return new ModuleKernel<Echo>(f); } },
+    { "Echo", "min_density", [](Fixture& f) -> Kernel* {
+        f.ctrls.echoDensity = 0.f;
+        return new ModuleKernel<Echo>(f); } },
+    { "Echo", "external_clock", [](Fixture& f) -> Kernel* {
+        f.state.clockSource = ClockSource::CLOCK_SOURCE_EXTERNAL;
+        return new ModuleKernel<Echo>(f); } },
+
+    { "Ambience", "mid", [](Fixture& f) -> Kernel* { return new ModuleKernel<Ambience>(f); } },
+    { "Ambience", "max_decay", [](Fixture& f) -> Kernel* {
+        f.ctrls.ambienceDecay = 1.f;
+        f.ctrls.ambienceSpacetime = 1.f;
+        return new ModuleKernel<Ambience>(f); } },
+    { "Ambience", "reversed", [](Fixture& f) -> Kernel* {
+        f.ctrls.ambienceSpacetime = 0.f;
+        return new ModuleKernel<Ambience>(f); } },
+
+    { "LooperBuffer::Read", "unity", [](Fixture& f) -> Kernel* { return new LooperReadKernel(f, 1.f); } },
+    { "LooperBuffer::Read", "half_speed", [](Fixture& f) -> Kernel* { return new LooperReadKernel(f, 0.5f); } },
+    { "LooperBuffer::Read", "max_speed", [](Fixture& f) -> Kernel* { return new LooperReadKernel(f, 2.f); } },
+    { "LooperBuffer::Read", "max_speed_backwards", [](Fixture& f) -> Kernel* { return new LooperReadKernel(f, -2.f); } },
+
+    { "StereoWaveTableOscillator", "mid", [](Fixture& f) -> Kernel* { return new WaveTableKernel(f); } },
+    { "StereoWaveTableOscillator", "max_pitch", [](Fixture& f) -> Kernel* {
+        f.ctrls.oscPitch = kOscFreqMax;
+        return new WaveTableKernel(f); } },
+    { "StereoWaveTableOscillator", "max_detune", [](Fixture& f) -> Kernel* {
+        f.ctrls.oscDetune = 1.f;
+        f.ctrls.oscUnison = 1.f;
+        return new WaveTableKernel(f); } },
+
+    { "MoogVCO", "mid", [](Fixture& f) -> Kernel* { return new MoogVcoKernel(f, 110.f, 1.1f); } },
+    { "MoogVCO", "max_pitch_drive", [](Fixture& f) -> Kernel* { return new MoogVcoKernel(f, kOscFreqMax, 5.f); } },
+
+    { "Compressor", "mid", [](Fixture& f) -> Kernel* { return new CompressorKernel(f, -10.f, 4.f); } },
+    { "Compressor", "hard", [](Fixture& f) -> Kernel* { return new CompressorKernel(f, -40.f, 20.f); } },
+};
+
+struct Options {
+    float seconds = 1.f;
+    const char* kernel = NULL;
+    const char* baseline = NULL;
+};
+
+static bool ParseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) return false;
+        if (!strcmp(argv[i], "-s")) options.seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-k")) options.kernel = argv[++i];
+        else if (!strcmp(argv[i], "-c")) options.baseline = argv[++i];
+        else return false;
+    }
+    return options.seconds > 0;
+}
+
+static std::string Key(const char* kernel, const char* corner, int blockSize) {
+    return std::string(kernel) + "," + corner + "," + std::to_string(blockSize);
+}
+
+// The hashes of a baseline, by kernel,corner,block.
+static bool LoadBaseline(const char* path, std::map<std::string, std::string>& hashes) {
+    std::ifstream file(path);
+    if (!file) return false;
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t last = line.rfind(',');
+        size_t ns = line.rfind(',', last - 1);
+        if (std::string::npos == last || std::string::npos == ns || 0 == line.compare(0, 7, "kernel,")) continue;
+        hashes[line.substr(0, ns)] = line.substr(last + 1);
+    }
+    return true;
+}
+
+// FNV-1a of the bits of the samples.
+static inline uint64_t Hash(uint64_t hash, const float* samples, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        uint32_t bits;
+        memcpy(&bits, &samples[i], sizeof(bits));
+        for (size_t b = 0; b < 4; b++) {
+            hash = (hash ^ ((bits >> (b * 8)) & 0xff)) * 0x100000001b3ull;
+        }
+    }
+    return hash;
+}
+
+static inline bool IsSilent(const float* samples, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (0 != samples[i]) return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [-s seconds] [-k kernel] [-c baseline.csv]\n";
+        return 2;
+    }
+    std::map<std::string, std::string> baseline;
+    if (options.baseline && !LoadBaseline(options.baseline, baseline)) {
+        std::cerr << "No baseline " << options.baseline << ", make one with make kernels-baseline\n";
+        return 2;
+    }
+
+    EnableFlushToZero();
+
+    // The same input for every run: a 110Hz sine with some noise on top.
+    const size_t length = (size_t)(options.seconds * 48000.f) / 128 * 128;
+    float* input[2] = { new float[length], new float[length] };
+    RandomStream noise(1);
+    for (size_t i = 0; i < length; i++) {
+        float s = sinf(2 * M_PI * 110.f * i / 48000.f) * 0.3f;
+        input[LEFT_CHANNEL][i] = s + noise.NextFloat(-0.025f, 0.025f);
+        input[RIGHT_CHANNEL][i] = s + noise.NextFloat(-0.025f, 0.025f);
+    }
+
+    int failures = 0;
+    std::cout << "kernel,corner,block,ns_per_sample,hash\n";
+    for (const KernelCase& c : kCases) {
+        if (options.kernel && strcmp(options.kernel, c.kernel)) continue;
+
+        for (int blockSize : kBlockSizes) {
+            // Each run starts from the same seeds, whatever ran before.
+            Arena::Init(kArenaFastSize);
+            ResetRandomSeeds();
+            srand(1);
+            Fixture f;
+            InitFixture(f, blockSize);
+            Kernel* kernel = c.create(f);
+            SetParams(f);
+            AudioBuffer* buffer = AudioBuffer::create(2, blockSize);
+
+            uint64_t hash = 0xcbf29ce484222325ull;
+            bool silent = true;
+            ProfilerTick elapsed = 0;
+            for (size_t n = 0; n < length; n += blockSize) {
+                FloatArray left = buffer->getSamples(LEFT_CHANNEL);
+                FloatArray right = buffer->getSamples(RIGHT_CHANNEL);
+                memcpy(left.getData(), input[LEFT_CHANNEL] + n, blockSize * sizeof(float));
+                memcpy(right.getData(), input[RIGHT_CHANNEL] + n, blockSize * sizeof(float));
+
+                ProfilerTick start = ProfilerNow();
+                kernel->Process(*buffer);
+                elapsed += ProfilerNow() - start;
+
+                hash = Hash(hash, left.getData(), blockSize);
+                hash = Hash(hash, right.getData(), blockSize);
+                silent = silent && IsSilent(left.getData(), blockSize) && IsSilent(right.getData(), blockSize);
+            }
+
+            char hex[17];
+            snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)hash);
+            std::string key = Key(c.kernel, c.corner, blockSize);
+            char ns[16];
+            snprintf(ns, sizeof(ns), "%.2f", (double)elapsed / length);
+            std::cout << key << "," << ns << "," << hex << "\n";
+
+            // A silent run would match its baseline whatever the kernel does.
+            if (silent) {
+                std::cerr << key << ": output is silent\n";
+                failures++;
+            }
+            else if (options.baseline) {
+                auto found = baseline.find(key);
+                if (baseline.end() == found) {
+                    std::cerr << key << ": not in the baseline\n";
+                    failures++;
+                }
+                else if (found->second != hex) {
+                    std::cerr << key << ": output differs from the baseline\n";
+                    failures++;
+                }
+            }
+
+            AudioBuffer::destroy(buffer);
+            delete kernel;
+            TapTempo::destroy(f.state.tempo);
+            Arena::Deinit();
+        }
+    }
+
+    delete[] input[LEFT_CHANNEL];
+    delete[] input[RIGHT_CHANNEL];
+
+    if (options.baseline) {
+        std::cerr << (failures ? "FAILED: " : "OK: ") << failures << " runs differ from " << options.baseline << "\n";
+    }
+    else if (failures) {
+        std::cerr << "FAILED: " << failures << " runs are silent\n";
+    }
+    return failures ? 1 : 0;
+}
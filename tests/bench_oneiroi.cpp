@@ -0,0 +1,310 @@
+// Native offline render harness for the Oneiroi chain
+// Renders N seconds of blocks through Oneiroi::Process and reports the time
+// spent in each stage, as accounted by Profiler.h.
+//
+// Usage: ./bench_oneiroi [-s seconds] [-b blocksize] [-k subblock] [-e effect] [-w 0|1] [-f position] [-m mode] [-n notes] [-p seconds] [-q steps] [-c bpm]
+//   -b  host block size, default 64
+//   -k  process the host blocks in sub-blocks of this size as the patch does
+//       with USE_SUB_BLOCKS, 0 for off, default kSubBlockSize with
+//       USE_SUB_BLOCKS and 0 otherwise
+//   -e  effect slot 0-3 (resonator, wavefolder, widener, phaser), default
+//       cycles through all of them once per second
+//   -w  osc2 source (0 supersaw, 1 wavetable), default alternates every
+//       full effect cycle
+//   -f  filter position 1-4, default 1
+//   -m  filter mode 0-3 (lp, bp, hp, comb/moog), default 0
+//   -n  MIDI notes held from the start, played by the osc2 voices in place
+//       of the supersaw, default 0
+//   -p  morph back and forth between two snapshots of the controls, taking
+//       this many seconds each way, the effect and osc2 then being the
+//       snapshots', default 0 for none
+//   -q  the quality steps taken, 0-5 (see QualityStep), forced before each
+//       block over what the governor makes of the load, default 0
+//   -c  sync in pulses at this tempo, to the sample, default 0 for the
+//       internal clock
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "owl_mocks.h"
+#include "../TechnoMachine.h"
+#include "../Clock.h"
+#include "../Profiler.h"
+#include "../LoadMeter.h"
+#include "../Arena.h"
+#include "../SubBlockBuffer.h"
+
+struct BenchOptions {
+    float seconds = 10.f;
+    int blockSize = 64;
+#ifdef USE_SUB_BLOCKS
+    int subBlockSize = kSubBlockSize;
+#else
+    int subBlockSize = 0;
+#endif
+    int effect = -1;
+    int wavetable = -1;
+    int filterPosition = 1;
+    int filterMode = 0;
+    int notes = 0;
+    float morphSeconds = 0;
+    int quality = 0;
+    float bpm = 0;
+};
+
+static bool ParseOptions(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) return false;
+        if (!strcmp(argv[i], "-s")) options.seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-b")) options.blockSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-k")) options.subBlockSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-e")) options.effect = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-w")) options.wavetable = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f")) options.filterPosition = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-m")) options.filterMode = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-n")) options.notes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-p")) options.morphSeconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-q")) options.quality = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c")) options.bpm = atof(argv[++i]);
+        else return false;
+    }
+    return options.seconds > 0 && options.blockSize > 0 && options.blockSize <= AUDIO_MAX_BLOCK_SIZE && options.subBlockSize >= 0 &&
+        options.effect < kNumEffects && options.filterPosition >= 1 && options.filterPosition <= 4 &&
+        options.filterMode >= 0 && options.filterMode <= 3 && options.notes >= 0 && options.morphSeconds >= 0 &&
+        options.quality >= 0 && options.quality <= QUALITY_LAST && options.bpm >= 0;
+}
+
+// A busy preset: every source and effect audible, moderate feedbacks.
+static void InitPreset(PatchCtrls& ctrls, const BenchOptions& options) {
+    memset(&ctrls, 0, sizeof(ctrls));
+
+    ctrls.inputVol = 0.8f;
+    ctrls.looperVol = 0.7f;
+    ctrls.looperSos = 0.5f;
+    ctrls.looperFilter = 0.5f;
+    ctrls.looperSpeed = 0.75f;
+    ctrls.looperLength = 0.6f;
+    ctrls.looperRecording = 1.f;
+
+    ctrls.osc1Vol = 0.7f;
+    ctrls.osc2Vol = 0.7f;
+    ctrls.oscOctave = 0.5f;
+    ctrls.oscUnison = 0.3f;
+    ctrls.oscPitch = 0.5f;
+    ctrls.oscDetune = 0.2f;
+
+    ctrls.filterVol = 0.8f;
+    ctrls.filterMode = options.filterMode * 0.25f + 0.1f;
+    ctrls.filterNoiseLevel = 0.2f;
+    ctrls.filterCutoff = 0.6f;
+    ctrls.filterResonance = 0.5f;
+    ctrls.filterPosition = (options.filterPosition - 1) * 0.25f + 0.1f;
+
+    ctrls.resonatorVol = 0.7f;
+    ctrls.resonatorTune = 0.5f;
+    ctrls.resonatorFeedback = 0.8f;
+    ctrls.resonatorDissonance = 0.3f;
+
+    ctrls.echoVol = 0.6f;
+    ctrls.echoRepeats = 0.6f;
+    ctrls.echoDensity = 0.5f;
+    ctrls.echoFilter = 0.5f;
+
+    ctrls.ambienceVol = 0.6f;
+    ctrls.ambienceDecay = 0.7f;
+    ctrls.ambienceSpacetime = 0.6f;
+    ctrls.ambienceAutoPan = 0.5f;
+
+    ctrls.modLevel = 0.5f;
+    ctrls.modSpeed = 0.5f;
+    ctrls.modType = 0.3f;
+}
+
+static void InitState(PatchState& state, const BenchOptions& options) {
+    state.sampleRate = 48000.f;
+    state.blockSize = SubBlockBuffer::GetSize(options.blockSize, options.subBlockSize);
+    state.hostBlockSize = options.blockSize;
+    state.blockRate = state.sampleRate / state.blockSize;
+    state.inputLevel = 0;
+    state.inputRms = 0;
+    state.qualityLevel = 0;
+    state.clockSource = ClockSource::CLOCK_SOURCE_INTERNAL;
+    state.c2 = 1102.f / 4095.f;
+    state.c5 = 2334.f / 4095.f;
+    state.pitchZero = 2128.f / 4041.f;
+    state.speedZero = 0.5f;
+    state.outLevel = 1.f;
+    state.randomSlew = 1.f;
+    state.funcMode = FuncMode::FUNC_MODE_NONE;
+    state.startupPhase = StartupPhase::STARTUP_DONE;
+}
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [-s seconds] [-b blocksize] [-k subblock] [-e effect] [-w 0|1] [-f position] [-m mode] [-n notes] [-p seconds]\n";
+        return 2;
+    }
+
+    PatchCtrls patchCtrls;
+    PatchCvs patchCvs;
+    PatchState patchState{};
+    InitPreset(patchCtrls, options);
+    memset(&patchCvs, 0, sizeof(patchCvs));
+    InitState(patchState, options);
+
+    Arena::Init(kArenaFastSize);
+    EnableFlushToZero();
+    patchState.profiler = Profiler::create(patchState.sampleRate, patchState.blockSize);
+    patchState.loadMeter = LoadMeter::create(patchState.sampleRate, patchState.blockSize);
+
+    // Construction is timed as its own stage, out of the blocks.
+    PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_STARTUP);
+    Clock* clock = Clock::create(&patchCtrls, &patchState);
+    Oneiroi* oneiroi = Oneiroi::create(&patchCtrls, &patchCvs, &patchState);
+    PROFILER_END(patchState.profiler, PROFILER_STAGE_STARTUP);
+
+    // A chord of fifths from C3.
+    for (int i = 0; i < options.notes; i++) {
+        patchState.voices->NoteOn(48 + i * 7, 100);
+    }
+    // The preset and a darker, sparser one.
+    if (options.morphSeconds > 0) {
+        PatchCtrls other = patchCtrls;
+        other.filterCutoff = 0.2f;
+        other.echoRepeats = 0.2f;
+        other.ambienceDecay = 0.9f;
+        other.looperSpeed = 0.4f;
+        other.resonatorTune = 0.8f;
+        patchState.snapshots->Store(0, patchCtrls);
+        patchState.snapshots->Store(1, other);
+    }
+    AudioBuffer* buffer = AudioBuffer::create(2, options.blockSize);
+    SubBlockBuffer* subBlocks = patchState.blockSize < options.blockSize ? SubBlockBuffer::create(options.blockSize, patchState.blockSize) : NULL;
+
+    const int blocksPerSecond = (int)(patchState.sampleRate / options.blockSize);
+    const int nofBlocks = (int)(options.seconds * blocksPerSecond);
+    float phase = 0;
+    RandomStream inputNoise(1);
+    float peak = 0;
+    int nonFinite = 0;
+    double syncEdge = 0;
+    bool syncHigh = false;
+
+    ProfilerTick start = ProfilerNow();
+    for (int b = 0; b < nofBlocks; b++) {
+        // Switch the effect slot every second and osc2 every full round.
+        int second = b / blocksPerSecond;
+        int effect = options.effect >= 0 ? options.effect : second % kNumEffects;
+        int wavetable = options.wavetable >= 0 ? options.wavetable : (second / kNumEffects) % 2;
+        patchCtrls.effectType = (effect + 0.5f) / kNumEffects;
+        patchCtrls.oscUseWavetable = wavetable;
+        if (options.morphSeconds > 0 && b % (int)(options.morphSeconds * blocksPerSecond) == 0) {
+            int way = b / (int)(options.morphSeconds * blocksPerSecond) % 2;
+            patchState.snapshots->Morph(way, 1 - way, options.morphSeconds);
+        }
+
+        // Input: a 110Hz sine with some noise on top.
+        FloatArray left = buffer->getSamples(LEFT_CHANNEL);
+        FloatArray right = buffer->getSamples(RIGHT_CHANNEL);
+        for (int i = 0; i < options.blockSize; i++) {
+            float s = sinf(phase) * 0.3f;
+            phase += 2 * M_PI * 110.f / patchState.sampleRate;
+            if (phase >= 2 * M_PI) phase -= 2 * M_PI;
+            left[i] = s + inputNoise.NextFloat(-0.025f, 0.025f);
+            right[i] = s + inputNoise.NextFloat(-0.025f, 0.025f);
+        }
+
+        // Half the period high, at the sample of the host block each edge is
+        // due, as the firmware gives them.
+        double blockStart = (double)b * options.blockSize;
+        while (options.bpm > 0 && syncEdge < blockStart + options.blockSize) {
+            syncHigh = !syncHigh;
+            patchState.clockEvents->Push(syncHigh ? CLOCK_EVENT_SYNC_ON : CLOCK_EVENT_SYNC_OFF,
+                (size_t)(syncEdge - blockStart), options.blockSize);
+            syncEdge += 30.0 * patchState.sampleRate / options.bpm;
+        }
+
+        size_t count = subBlocks ? subBlocks->GetCount() : 1;
+        for (size_t k = 0; k < count; k++) {
+            if (subBlocks) subBlocks->Load(*buffer, k);
+            AudioBuffer& block = subBlocks ? subBlocks->Get() : *buffer;
+            patchState.loadMeter->Begin();
+            PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_BLOCK);
+            PROFILER_BEGIN(patchState.profiler, PROFILER_STAGE_CLOCK);
+            clock->Process();
+            PROFILER_END(patchState.profiler, PROFILER_STAGE_CLOCK);
+            patchState.qualityLevel = options.quality;
+            oneiroi->Process(block);
+            PROFILER_END(patchState.profiler, PROFILER_STAGE_BLOCK);
+            patchState.loadMeter->End();
+            patchState.profiler->EndBlock();
+            if (subBlocks) subBlocks->Store(*buffer, k);
+        }
+
+        for (int i = 0; i < options.blockSize; i++) {
+            if (!std::isfinite(left[i]) || !std::isfinite(right[i])) nonFinite++;
+            else peak = std::max(peak, std::max(fabsf(left[i]), fabsf(right[i])));
+        }
+    }
+    ProfilerTick total = ProfilerNow() - start;
+
+    double audioSeconds = (double)nofBlocks * options.blockSize / patchState.sampleRate;
+    double blockBudgetUs = 1e6 * patchState.blockSize / patchState.sampleRate;
+
+    const ProfilerStats& block = patchState.profiler->GetStats(PROFILER_STAGE_BLOCK);
+    uint64_t accounted = 0;
+    for (size_t i = 0; i < PROFILER_STAGE_BLOCK; i++) {
+        accounted += patchState.profiler->GetStats(i).total;
+    }
+
+    std::cout << "Oneiroi offline render\n";
+    std::cout << "  " << audioSeconds << " s of audio, " << nofBlocks << " blocks of " << options.blockSize
+              << " samples processed by " << patchState.blockSize << ", filter position " << options.filterPosition
+              << ", mode " << options.filterMode << ", quality steps " << options.quality << "\n";
+    if (options.bpm > 0) {
+        std::cout << "  clock " << (ClockSource::CLOCK_SOURCE_EXTERNAL == patchState.clockSource ? "external" : "internal")
+                  << ", period " << patchState.clockPeriod * patchState.blockSize << " samples for "
+                  << 60.0 * patchState.sampleRate / options.bpm << "\n";
+    }
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  render time " << total / 1e6 << " ms, " << audioSeconds * 1e9 / total << "x realtime, last "
+              << kProfilerRingSize << " blocks avg load " << patchState.profiler->GetLoad() * 100 << "%\n";
+    std::cout << "  startup " << patchState.profiler->GetStats(PROFILER_STAGE_STARTUP).total / 1e6 << " ms\n";
+    std::cout << "  block avg " << block.total / 1e3 / block.count << " us, max " << block.max / 1e3
+              << " us, budget " << blockBudgetUs << " us\n";
+    std::cout << "  output peak " << peak << ", non-finite samples " << nonFinite << "\n";
+    std::cout << "  memory fast " << Arena::Get(MEMORY_REGION_FAST)->GetUsed() / 1024.0 << " KB of "
+              << kArenaFastSize / 1024 << " KB, slow " << Arena::Get(MEMORY_REGION_SLOW)->GetUsed() / 1024.0
+              << " KB, overflow " << Arena::Get(MEMORY_REGION_FAST)->GetOverflow() / 1024.0 << " KB\n\n";
+
+    std::cout << std::left << std::setw(16) << "stage" << std::right
+              << std::setw(10) << "blocks" << std::setw(12) << "avg us" << std::setw(12) << "max us"
+              << std::setw(10) << "share" << std::setw(10) << "budget" << "\n";
+    for (size_t i = 0; i < PROFILER_STAGE_BLOCK; i++) {
+        const ProfilerStats& stats = patchState.profiler->GetStats(i);
+        if (stats.count == 0) continue;
+        double avg = stats.total / 1e3 / stats.count;
+        std::cout << std::left << std::setw(16) << kProfilerStageNames[i] << std::right
+                  << std::setw(10) << stats.count
+                  << std::setw(12) << avg
+                  << std::setw(12) << stats.max / 1e3
+                  << std::setw(9) << 100.0 * stats.total / accounted << "%"
+                  << std::setw(9) << 100.0 * avg / blockBudgetUs << "%\n";
+    }
+
+    AudioBuffer::destroy(buffer);
+    SubBlockBuffer::destroy(subBlocks);
+    Oneiroi::destroy(oneiroi);
+    Clock::destroy(clock);
+    TapTempo::destroy(patchState.tempo);
+    Profiler::destroy(patchState.profiler);
+    LoadMeter::destroy(patchState.loadMeter);
+    Arena::Deinit();
+
+    return 0;
+}
@@ -0,0 +1,275 @@
+// Native host for several Oneiroi instances side by side
+// Each Instance owns its controls, state, arenas and random seeds, bound to
+// the thread that runs it for as long as it runs (see Arena::Bind() and
+// BindRandomSeeds()), so that any worker can process any instance and the
+// output doesn't depend on which one did. The controls are posted to an
+// instance through a lock-free mailbox, applied at the start of its next
+// block. WorkerPool runs a batch of tasks, the blocks of the instances,
+// across cores, the idle workers stealing half of the tasks left to the
+// busiest one.
+//
+// Needs USE_INSTANCES. The instances have no LoadMeter: the governor and the
+// voice pool would adapt to the load measured, and the output would depend
+// on how busy the cores are.
+
+#pragma once
+
+#ifndef USE_INSTANCES
+#error "The instance host needs USE_INSTANCES"
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "owl_mocks.h"
+#include "../TechnoMachine.h"
+#include "../Clock.h"
+#include "../Arena.h"
+
+enum ParamTarget : uint8_t {
+    PARAM_TARGET_CTRL,
+    PARAM_TARGET_CV,
+};
+
+struct ParamMessage {
+    ParamTarget target;
+    uint8_t index; // Of the float in PatchCtrls or PatchCvs
+    float value;
+};
+
+static_assert(sizeof(PatchCtrls) % sizeof(float) == 0 && sizeof(PatchCtrls) / sizeof(float) <= 256, "PatchCtrls must be made of floats");
+static_assert(sizeof(PatchCvs) % sizeof(float) == 0 && sizeof(PatchCvs) / sizeof(float) <= 256, "PatchCvs must be made of floats");
+
+// The index of a field for ParamMessage, as in ParamIndex(&PatchCtrls::filterCutoff).
+template <typename S>
+inline uint8_t ParamIndex(float S::*field) {
+    static const S probe{};
+    return (uint8_t)(&(probe.*field) - reinterpret_cast<const float*>(&probe));
+}
+
+// One writer, the control thread, and one reader, the worker running the
+// instance's block: as ClockEvents, each only moves its own index. The
+// messages that don't fit are dropped.
+class ParamMailbox {
+private:
+    static constexpr uint32_t kSize = 256;
+    static_assert(0 == (kSize & (kSize - 1)), "The mailbox's size must be a power of 2");
+
+    ParamMessage messages_[kSize];
+    std::atomic<uint32_t> head_{0}; // The next one posted
+    std::atomic<uint32_t> tail_{0}; // The next one applied
+
+public:
+    bool Post(ParamTarget target, uint8_t index, float value) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= kSize) return false;
+        messages_[head & (kSize - 1)] = { target, index, value };
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Writes the messages posted so far into the controls and the CVs.
+    void Apply(PatchCtrls& ctrls, PatchCvs& cvs) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        uint32_t head = head_.load(std::memory_order_acquire);
+        float* fields[2] = { reinterpret_cast<float*>(&ctrls), reinterpret_cast<float*>(&cvs) };
+        const size_t counts[2] = { sizeof(PatchCtrls) / sizeof(float), sizeof(PatchCvs) / sizeof(float) };
+        for (; tail != head; tail++) {
+            const ParamMessage& m = messages_[tail & (kSize - 1)];
+            if (m.index < counts[m.target]) fields[m.target][m.index] = m.value;
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+};
+
+class Instance {
+private:
+    PatchCtrls ctrls_;
+    PatchCvs cvs_;
+    PatchState state_;
+    Arena* arenas_[MEMORY_REGION_LAST] = {};
+    uint32_t seeds_;
+    ParamMailbox mailbox_;
+
+    Clock* clock_;
+    Oneiroi* oneiroi_;
+
+    void Bind() {
+        Arena::Bind(arenas_);
+        BindRandomSeeds(&seeds_);
+    }
+
+    static void Unbind() {
+        Arena::Bind(NULL);
+        BindRandomSeeds(NULL);
+    }
+
+public:
+    // seed tells the instances apart, each one's streams starting from it.
+    Instance(const PatchCtrls& ctrls, uint32_t seed, float sampleRate, int blockSize) {
+        ctrls_ = ctrls;
+        memset(&cvs_, 0, sizeof(cvs_));
+        state_ = PatchState{};
+        state_.sampleRate = sampleRate;
+        state_.blockSize = blockSize;
+        state_.hostBlockSize = blockSize;
+        state_.blockRate = sampleRate / blockSize;
+        state_.clockSource = ClockSource::CLOCK_SOURCE_INTERNAL;
+        state_.c2 = 1102.f / 4095.f;
+        state_.c5 = 2334.f / 4095.f;
+        state_.pitchZero = 2128.f / 4041.f;
+        state_.speedZero = 0.5f;
+        state_.outLevel = 1.f;
+        state_.randomSlew = 1.f;
+        state_.funcMode = FuncMode::FUNC_MODE_NONE;
+        state_.startupPhase = StartupPhase::STARTUP_DONE;
+
+        Bind();
+        ResetRandomSeeds(kRandomSeed + seed * 0x6c078965);
+        Arena::Init(kArenaFastSize);
+        clock_ = Clock::create(&ctrls_, &state_);
+        oneiroi_ = Oneiroi::create(&ctrls_, &cvs_, &state_);
+        Unbind();
+    }
+    ~Instance() {
+        Bind();
+        Oneiroi::destroy(oneiroi_);
+        Clock::destroy(clock_);
+        TapTempo::destroy(state_.tempo);
+        Arena::Deinit();
+        Unbind();
+    }
+
+    // From the control thread only.
+    inline ParamMailbox& GetMailbox() { return mailbox_; }
+
+    // From any thread, one block at a time.
+    void Process(AudioBuffer& buffer) {
+        Bind();
+        mailbox_.Apply(ctrls_, cvs_);
+        clock_->Process();
+        oneiroi_->Process(buffer);
+        Unbind();
+    }
+};
+
+class WorkerPool {
+private:
+    // The tasks left to a worker, [first, last) packed in one word for a
+    // thief to take the back half of them with a single compare and swap.
+    struct alignas(64) Queue {
+        std::atomic<uint64_t> range{0};
+    };
+
+    static inline uint64_t Pack(uint32_t first, uint32_t last) { return (uint64_t)last << 32 | first; }
+    static inline uint32_t First(uint64_t range) { return (uint32_t)range; }
+    static inline uint32_t Last(uint64_t range) { return (uint32_t)(range >> 32); }
+
+    std::vector<std::thread> threads_;
+    std::vector<Queue> queues_;
+    const std::function<void(size_t)>* task_ = NULL;
+
+    std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    uint64_t batch_ = 0;
+    size_t running_ = 0;
+    bool quit_ = false;
+
+    bool TakeOwn(size_t w, uint32_t& index) {
+        std::atomic<uint64_t>& range = queues_[w].range;
+        uint64_t r = range.load(std::memory_order_acquire);
+        while (First(r) < Last(r)) {
+            if (range.compare_exchange_weak(r, Pack(First(r) + 1, Last(r)), std::memory_order_acq_rel)) {
+                index = First(r);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool Steal(size_t w) {
+        size_t count = queues_.size();
+        for (size_t k = 1; k < count; k++) {
+            std::atomic<uint64_t>& victim = queues_[(w + k) % count].range;
+            uint64_t r = victim.load(std::memory_order_acquire);
+            while (First(r) < Last(r)) {
+                uint32_t middle = Last(r) - (Last(r) - First(r) + 1) / 2;
+                if (victim.compare_exchange_weak(r, Pack(First(r), middle), std::memory_order_acq_rel)) {
+                    // The own queue is empty, no thief takes from it.
+                    queues_[w].range.store(Pack(middle, Last(r)), std::memory_order_release);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void RunTasks(size_t w) {
+        uint32_t index;
+        do {
+            while (TakeOwn(w, index)) (*task_)(index);
+        } while (Steal(w));
+    }
+
+    void Work(size_t w) {
+        EnableFlushToZero();
+        uint64_t batch = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                start_.wait(lock, [&] { return quit_ || batch_ != batch; });
+                if (quit_) return;
+                batch = batch_;
+            }
+            RunTasks(w);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (0 == --running_) done_.notify_one();
+            }
+        }
+    }
+
+public:
+    // threads counts the caller of Run(), that works along.
+    WorkerPool(size_t threads) : queues_(std::max<size_t>(threads, 1)) {
+        for (size_t w = 1; w < queues_.size(); w++) {
+            threads_.emplace_back(&WorkerPool::Work, this, w);
+        }
+    }
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        start_.notify_all();
+        for (std::thread& thread : threads_) thread.join();
+    }
+
+    inline size_t GetThreads() { return queues_.size(); }
+
+    // Runs task(0) to task(count - 1) and returns once they are all done.
+    void Run(size_t count, const std::function<void(size_t)>& task) {
+        size_t workers = queues_.size();
+        for (size_t w = 0; w < workers; w++) {
+            queues_[w].range.store(Pack(count * w / workers, count * (w + 1) / workers), std::memory_order_relaxed);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            task_ = &task;
+            running_ = workers - 1;
+            batch_++;
+        }
+        start_.notify_all();
+
+        RunTasks(0);
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [&] { return 0 == running_; });
+        task_ = NULL;
+    }
+};
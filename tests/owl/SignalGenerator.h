@@ -0,0 +1,3 @@
+// Forwards to the host mocks, see ../owl_mocks.h
+#pragma once
+#include "../owl_mocks.h"
@@ -1,4 +1,4 @@
-// Minimal OWL SDK mocks for Oneiroi unit tests
+// Minimal OWL SDK mocks for Oneiroi unit tests and the native bench
 // These stubs allow Commons.h and other headers to compile on desktop
 #pragma once
 
@@ -7,7 +7,7 @@
 #include <cmath>
 #include <cstring>
 
-// Stub for randf() used in RandomFloat
+// Stub for the SDK's randf(), the noise of the mocks
 inline float randf() {
     return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
 }
@@ -45,6 +45,8 @@ public:
 
     float* getData() { return data_; }
     size_t getSize() const { return size_; }
+    float& operator[](size_t i) { return data_[i]; }
+    const float& operator[](size_t i) const { return data_[i]; }
     float getElement(size_t i) const { return data_[i]; }
     void setElement(size_t i, float v) { data_[i] = v; }
     void clear() { if (data_) memset(data_, 0, size_ * sizeof(float)); }
@@ -55,10 +57,13 @@ public:
     void add(const FloatArray& other) {
         for (size_t i = 0; i < size_; i++) data_[i] += other.data_[i];
     }
+    void add(float scalar) {
+        for (size_t i = 0; i < size_; i++) data_[i] += scalar;
+    }
     void multiply(float scalar) {
         for (size_t i = 0; i < size_; i++) data_[i] *= scalar;
     }
-    void multiply(float scalar, FloatArray& dest) {
+    void multiply(float scalar, FloatArray dest) {
         for (size_t i = 0; i < size_; i++) dest.data_[i] = data_[i] * scalar;
     }
     float getMean() const {
@@ -66,6 +71,14 @@ public:
         for (size_t i = 0; i < size_; i++) sum += data_[i];
         return size_ > 0 ? sum / size_ : 0;
     }
+    float getRms() const {
+        float sum = 0;
+        for (size_t i = 0; i < size_; i++) sum += data_[i] * data_[i];
+        return size_ > 0 ? sqrtf(sum / size_) : 0;
+    }
+    void noise() {
+        for (size_t i = 0; i < size_; i++) data_[i] = randf() * 2.f - 1.f;
+    }
 };
 
 // Minimal AudioBuffer stub
@@ -77,7 +90,7 @@ private:
 public:
     AudioBuffer() : size_(0) {}
 
-    static AudioBuffer* create(int numChannels, size_t size) {
+    static AudioBuffer* create(int, size_t size) {
         AudioBuffer* buf = new AudioBuffer();
         buf->size_ = size;
         buf->channels_[0] = FloatArray::create(size);
@@ -107,19 +120,39 @@ public:
         channels_[0].add(other.channels_[0]);
         channels_[1].add(other.channels_[1]);
     }
+    void add(float scalar) {
+        channels_[0].add(scalar);
+        channels_[1].add(scalar);
+    }
     void multiply(float scalar) {
         channels_[0].multiply(scalar);
         channels_[1].multiply(scalar);
     }
 };
 
-// Stub for TapTempo
+// Stub for TapTempo, free running at the set frequency
 class TapTempo {
+private:
+    float sampleRate_ = 750.f;
+    float frequency_ = 2.0f; // 120 BPM
+    float phase_ = 0;
+
 public:
-    static TapTempo* create(float sr, size_t limit) { return new TapTempo(); }
+    static TapTempo* create(float sr, size_t) {
+        TapTempo* t = new TapTempo();
+        t->sampleRate_ = sr;
+        return t;
+    }
     static void destroy(TapTempo* t) { delete t; }
-    void trigger(bool on, uint16_t samples = 0) {}
-    float getFrequency() const { return 2.0f; } // 120 BPM
+    void trigger(bool, uint16_t = 0) {}
+    void setFrequency(float freq) { frequency_ = freq; }
+    float getFrequency() const { return frequency_; }
+    size_t getPeriodInSamples() const { return (size_t)(sampleRate_ / frequency_); }
+    void clock(size_t steps = 1) {
+        phase_ += steps * frequency_ / sampleRate_;
+        if (phase_ >= 1.f) phase_ -= 1.f;
+    }
+    bool isOn() const { return phase_ < 0.5f; }
 };
 
 // Stub Patch class
@@ -133,3 +166,351 @@ public:
 // Channel constants
 #define LEFT_CHANNEL 0
 #define RIGHT_CHANNEL 1
+
+#ifndef AUDIO_MAX_BLOCK_SIZE
+#define AUDIO_MAX_BLOCK_SIZE 1024
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// ---------------------------------------------------------------------------
+// DSP building blocks used by the Oneiroi chain. These follow the OWL SDK
+// interfaces closely enough for host rendering and benchmarking; the
+// algorithms are textbook versions with a comparable per-sample cost.
+// ---------------------------------------------------------------------------
+
+class Interpolator {
+public:
+    static float linear(float y1, float y2, float mu) {
+        return y1 + mu * (y2 - y1);
+    }
+    static float cubic(float y0, float y1, float y2, float y3, float mu) {
+        float mu2 = mu * mu;
+        float a0 = y3 - y2 - y0 + y1;
+        float a1 = y0 - y1 - a0;
+        float a2 = y2 - y0;
+        return a0 * mu * mu2 + a1 * mu2 + a2 * mu + y1;
+    }
+};
+
+class SignalProcessor {
+public:
+    virtual ~SignalProcessor() {}
+    virtual float process(float input) { return input; }
+};
+
+class SignalGenerator {
+public:
+    virtual ~SignalGenerator() {}
+    virtual float generate() { return 0; }
+    virtual void generate(FloatArray output) {
+        for (size_t i = 0; i < output.getSize(); i++) output[i] = generate();
+    }
+};
+
+class DcBlockingFilter {
+private:
+    float lambda_;
+    float x1_ = 0, y1_ = 0;
+
+public:
+    DcBlockingFilter(float lambda = 0.995f) : lambda_(lambda) {}
+    static DcBlockingFilter* create(float lambda = 0.995f) { return new DcBlockingFilter(lambda); }
+    static void destroy(DcBlockingFilter* obj) { delete obj; }
+    float process(float x) {
+        y1_ = x - x1_ + lambda_ * y1_;
+        x1_ = x;
+        return y1_;
+    }
+};
+
+class StereoDcBlockingFilter {
+private:
+    DcBlockingFilter left_, right_;
+
+public:
+    static StereoDcBlockingFilter* create(float = 0.995f) { return new StereoDcBlockingFilter(); }
+    static void destroy(StereoDcBlockingFilter* obj) { delete obj; }
+    void process(AudioBuffer& input, AudioBuffer& output) {
+        FloatArray li = input.getSamples(LEFT_CHANNEL), ri = input.getSamples(RIGHT_CHANNEL);
+        FloatArray lo = output.getSamples(LEFT_CHANNEL), ro = output.getSamples(RIGHT_CHANNEL);
+        for (size_t i = 0; i < input.getSize(); i++) {
+            lo[i] = left_.process(li[i]);
+            ro[i] = right_.process(ri[i]);
+        }
+    }
+};
+
+class FilterStage {
+public:
+    static constexpr float BUTTERWORTH_Q = 0.70710678f;
+};
+
+// RBJ cookbook biquad, transposed direct form II
+class BiquadFilter {
+private:
+    float sampleRate_;
+    float b0_ = 1, b1_ = 0, b2_ = 0, a1_ = 0, a2_ = 0;
+    float z1_ = 0, z2_ = 0;
+
+    void set(float b0, float b1, float b2, float a0, float a1, float a2) {
+        b0_ = b0 / a0; b1_ = b1 / a0; b2_ = b2 / a0;
+        a1_ = a1 / a0; a2_ = a2 / a0;
+    }
+
+public:
+    BiquadFilter(float sr) : sampleRate_(sr) {}
+    static BiquadFilter* create(float sr, size_t = 1) { return new BiquadFilter(sr); }
+    static void destroy(BiquadFilter* obj) { delete obj; }
+
+    void setLowPass(float fc, float q) {
+        float w = 2 * M_PI * fc / sampleRate_, c = cosf(w), a = sinf(w) / (2 * q);
+        set((1 - c) / 2, 1 - c, (1 - c) / 2, 1 + a, -2 * c, 1 - a);
+    }
+    void setHighPass(float fc, float q) {
+        float w = 2 * M_PI * fc / sampleRate_, c = cosf(w), a = sinf(w) / (2 * q);
+        set((1 + c) / 2, -(1 + c), (1 + c) / 2, 1 + a, -2 * c, 1 - a);
+    }
+    void setBandPass(float fc, float q) {
+        float w = 2 * M_PI * fc / sampleRate_, c = cosf(w), a = sinf(w) / (2 * q);
+        set(a, 0, -a, 1 + a, -2 * c, 1 - a);
+    }
+    void setNotch(float fc, float q) {
+        float w = 2 * M_PI * fc / sampleRate_, c = cosf(w), a = sinf(w) / (2 * q);
+        set(1, -2 * c, 1, 1 + a, -2 * c, 1 - a);
+    }
+    void setLowShelf(float fc, float gain) {
+        float A = sqrtf(gain), w = 2 * M_PI * fc / sampleRate_, c = cosf(w);
+        float a = sinf(w) / 2 * sqrtf(2.f), s = 2 * sqrtf(A) * a;
+        set(A * ((A + 1) - (A - 1) * c + s), 2 * A * ((A - 1) - (A + 1) * c), A * ((A + 1) - (A - 1) * c - s),
+            (A + 1) + (A - 1) * c + s, -2 * ((A - 1) + (A + 1) * c), (A + 1) + (A - 1) * c - s);
+    }
+    void setHighShelf(float fc, float gain) {
+        float A = sqrtf(gain), w = 2 * M_PI * fc / sampleRate_, c = cosf(w);
+        float a = sinf(w) / 2 * sqrtf(2.f), s = 2 * sqrtf(A) * a;
+        set(A * ((A + 1) + (A - 1) * c + s), -2 * A * ((A - 1) + (A + 1) * c), A * ((A + 1) + (A - 1) * c - s),
+            (A + 1) - (A - 1) * c + s, 2 * ((A - 1) - (A + 1) * c), (A + 1) - (A - 1) * c - s);
+    }
+    float process(float x) {
+        float y = b0_ * x + z1_;
+        z1_ = b1_ * x - a1_ * y + z2_;
+        z2_ = b2_ * x - a2_ * y;
+        return y;
+    }
+};
+
+// Cytomic (Andrew Simper) trapezoidal state variable filter
+class StateVariableFilter {
+private:
+    enum Mode { LP, BP, HP, NOTCH };
+    float sampleRate_;
+    float a1_ = 0, a2_ = 0, a3_ = 0, k_ = 1;
+    float ic1eq_ = 0, ic2eq_ = 0;
+    Mode mode_ = LP;
+
+    void set(float fc, float q, Mode mode) {
+        float g = tanf(M_PI * fc / sampleRate_);
+        k_ = 1.f / q;
+        a1_ = 1.f / (1.f + g * (g + k_));
+        a2_ = g * a1_;
+        a3_ = g * a2_;
+        mode_ = mode;
+    }
+
+public:
+    StateVariableFilter(float sr) : sampleRate_(sr) {}
+    static StateVariableFilter* create(float sr) { return new StateVariableFilter(sr); }
+    static void destroy(StateVariableFilter* obj) { delete obj; }
+
+    void setLowPass(float fc, float q) { set(fc, q, LP); }
+    void setBandPass(float fc, float q) { set(fc, q, BP); }
+    void setHighPass(float fc, float q) { set(fc, q, HP); }
+    void setNotch(float fc, float q) { set(fc, q, NOTCH); }
+    float process(float x) {
+        float v3 = x - ic2eq_;
+        float v1 = a1_ * ic1eq_ + a2_ * v3;
+        float v2 = ic2eq_ + a2_ * ic1eq_ + a3_ * v3;
+        ic1eq_ = 2 * v1 - ic1eq_;
+        ic2eq_ = 2 * v2 - ic2eq_;
+        switch (mode_) {
+        case BP: return v1;
+        case HP: return x - k_ * v1 - v2;
+        case NOTCH: return x - k_ * v1;
+        default: return v2;
+        }
+    }
+};
+
+// Oscillators
+class Oscillator : public SignalGenerator {
+public:
+    using SignalGenerator::generate;
+    virtual void setFrequency(float freq) = 0;
+    virtual float getFrequency() { return 0; }
+    virtual void setPhase(float) {}
+    virtual float getPhase() { return 0; }
+    virtual void reset() {}
+    virtual void generate(FloatArray, FloatArray) {}
+};
+
+template <class T>
+class OscillatorTemplate : public Oscillator {
+protected:
+    float sampleRate_ = 48000.f;
+    float frequency_ = 0;
+    float phase_ = 0;
+    float incr_ = 0;
+
+public:
+    static constexpr float begin_phase = 0;
+    static constexpr float end_phase = 1;
+
+    virtual ~OscillatorTemplate() {}
+    void setSampleRate(float sr) {
+        sampleRate_ = sr;
+        setFrequency(frequency_);
+    }
+    void setFrequency(float freq) override {
+        frequency_ = freq;
+        incr_ = freq * (T::end_phase - T::begin_phase) / sampleRate_;
+    }
+    float getFrequency() override { return frequency_; }
+    void setPhase(float phase) override { phase_ = phase; }
+    float getPhase() override { return phase_; }
+    void reset() override { phase_ = T::begin_phase; }
+    float generate() override {
+        float sample = static_cast<T*>(this)->getSample();
+        phase_ += incr_;
+        if (phase_ >= T::end_phase) phase_ -= T::end_phase - T::begin_phase;
+        return sample;
+    }
+};
+
+class SineOscillator : public OscillatorTemplate<SineOscillator> {
+public:
+    static constexpr float begin_phase = 0;
+    static constexpr float end_phase = 2 * M_PI;
+    SineOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static SineOscillator* create(float sr) { return new SineOscillator(sr); }
+    static void destroy(SineOscillator* obj) { delete obj; }
+    float getSample() { return sinf(phase_); }
+};
+
+class RampOscillator : public OscillatorTemplate<RampOscillator> {
+public:
+    RampOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static RampOscillator* create(float sr) { return new RampOscillator(sr); }
+    static void destroy(RampOscillator* obj) { delete obj; }
+    float getSample() { return phase_ * 2 - 1; }
+};
+
+class InvertedRampOscillator : public OscillatorTemplate<InvertedRampOscillator> {
+public:
+    InvertedRampOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static InvertedRampOscillator* create(float sr) { return new InvertedRampOscillator(sr); }
+    static void destroy(InvertedRampOscillator* obj) { delete obj; }
+    float getSample() { return 1 - phase_ * 2; }
+};
+
+class SquareWaveOscillator : public OscillatorTemplate<SquareWaveOscillator> {
+public:
+    SquareWaveOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static SquareWaveOscillator* create(float sr) { return new SquareWaveOscillator(sr); }
+    static void destroy(SquareWaveOscillator* obj) { delete obj; }
+    float getSample() { return phase_ < 0.5f ? 1 : -1; }
+};
+
+inline float polyblep(float t, float dt) {
+    if (t < dt) {
+        t /= dt;
+        return t + t - t * t - 1;
+    }
+    if (t > 1 - dt) {
+        t = (t - 1) / dt;
+        return t * t + t + t + 1;
+    }
+    return 0;
+}
+
+class AntialiasedRampOscillator : public OscillatorTemplate<AntialiasedRampOscillator> {
+public:
+    AntialiasedRampOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static AntialiasedRampOscillator* create(float sr) { return new AntialiasedRampOscillator(sr); }
+    static void destroy(AntialiasedRampOscillator* obj) { delete obj; }
+    float getSample() { return phase_ * 2 - 1 - polyblep(phase_, incr_); }
+};
+
+class AntialiasedSquareWaveOscillator : public OscillatorTemplate<AntialiasedSquareWaveOscillator> {
+public:
+    AntialiasedSquareWaveOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static AntialiasedSquareWaveOscillator* create(float sr) { return new AntialiasedSquareWaveOscillator(sr); }
+    static void destroy(AntialiasedSquareWaveOscillator* obj) { delete obj; }
+    float getSample() {
+        float s = phase_ < 0.5f ? 1 : -1;
+        float t = phase_ + 0.5f;
+        return s + polyblep(phase_, incr_) - polyblep(t < 1 ? t : t - 1, incr_);
+    }
+};
+
+template <class T>
+class PhaseShiftOscillator : public T {
+private:
+    float offset_;
+
+public:
+    PhaseShiftOscillator(float offset, float sr) : T(sr), offset_(offset) { T::setPhase(offset); }
+    static PhaseShiftOscillator* create(float offset, float sr) { return new PhaseShiftOscillator(offset, sr); }
+    static void destroy(PhaseShiftOscillator* obj) { delete obj; }
+    void reset() override { T::setPhase(offset_); }
+};
+
+// Sample and hold noise at the set frequency
+class NoiseOscillator : public OscillatorTemplate<NoiseOscillator> {
+private:
+    float sample_ = 0;
+
+public:
+    NoiseOscillator(float sr = 48000.f) { setSampleRate(sr); }
+    static NoiseOscillator* create(float sr) { return new NoiseOscillator(sr); }
+    static void destroy(NoiseOscillator* obj) { delete obj; }
+    float getSample() {
+        if (phase_ + incr_ >= end_phase) sample_ = randf() * 2 - 1;
+        return sample_;
+    }
+};
+
+class MorphingOscillator : public Oscillator {
+private:
+    Oscillator** oscs_;
+    size_t count_;
+    float morph_ = 0;
+
+public:
+    MorphingOscillator(size_t count) : count_(count) {
+        oscs_ = new Oscillator*[count]();
+    }
+    ~MorphingOscillator() {
+        for (size_t i = 0; i < count_; i++) delete oscs_[i];
+        delete[] oscs_;
+    }
+    static MorphingOscillator* create(size_t count, size_t) { return new MorphingOscillator(count); }
+    static void destroy(MorphingOscillator* obj) { delete obj; }
+    void setOscillator(size_t i, Oscillator* osc) { oscs_[i] = osc; }
+    void morph(float m) { morph_ = m; }
+    void setFrequency(float freq) override {
+        for (size_t i = 0; i < count_; i++) oscs_[i]->setFrequency(freq);
+    }
+    void reset() override {
+        for (size_t i = 0; i < count_; i++) oscs_[i]->reset();
+    }
+    using Oscillator::generate;
+    float generate() override {
+        float pos = morph_ * (count_ - 1);
+        size_t i = (size_t)pos;
+        if (i >= count_ - 1) return oscs_[count_ - 1]->generate();
+        float x = pos - i;
+        return oscs_[i]->generate() * (1 - x) + oscs_[i + 1]->generate() * x;
+    }
+};
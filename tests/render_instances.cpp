@@ -0,0 +1,235 @@
+// Offline render of several Oneiroi instances side by side
+// Renders N seconds of N instances, each with its own preset, input and
+// seed, the blocks being run across the worker pool of instance_host.h. A
+// cutoff sweep is posted to each instance's mailbox as the render goes.
+// Prints the render time and each instance's peak and output hash.
+//
+// Usage: ./render_instances [-n instances] [-t threads] [-s seconds] [-b blocksize] [-c blocks] [-v]
+//   -n  instances, default 8
+//   -t  threads, the caller included, default the cores
+//   -s  seconds, default 2
+//   -b  block size, default 64
+//   -c  blocks of an instance per task, default 8
+//   -v  render every instance again on its own, on one thread, and check
+//       that its output is the same, exits with 1 if not
+
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <memory>
+
+#include "instance_host.h"
+
+struct RenderOptions {
+    int instances = 8;
+    int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    float seconds = 2.f;
+    int blockSize = 64;
+    int chunk = 8;
+    bool verify = false;
+};
+
+struct InstanceResult {
+    float peak = 0;
+    int nonFinite = 0;
+    uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+static bool ParseOptions(int argc, char** argv, RenderOptions& options) {
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-v")) { options.verify = true; continue; }
+        if (i + 1 >= argc) return false;
+        if (!strcmp(argv[i], "-n")) options.instances = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-t")) options.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-s")) options.seconds = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-b")) options.blockSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-c")) options.chunk = atoi(argv[++i]);
+        else return false;
+    }
+    return options.instances > 0 && options.threads > 0 && options.seconds > 0 && options.blockSize > 0 &&
+        options.blockSize <= AUDIO_MAX_BLOCK_SIZE && options.chunk > 0;
+}
+
+// The bench's busy preset, moved around for each instance.
+static void InitPreset(PatchCtrls& ctrls, int instance) {
+    memset(&ctrls, 0, sizeof(ctrls));
+
+    ctrls.inputVol = 0.8f;
+    ctrls.looperVol = 0.7f;
+    ctrls.looperSos = 0.5f;
+    ctrls.looperFilter = 0.5f;
+    ctrls.looperSpeed = 0.6f + 0.05f * (instance % 5);
+    ctrls.looperLength = 0.6f;
+    ctrls.looperRecording = 1.f;
+
+    ctrls.osc1Vol = 0.7f;
+    ctrls.osc2Vol = 0.7f;
+    ctrls.oscOctave = 0.5f;
+    ctrls.oscUnison = 0.3f;
+    ctrls.oscPitch = 0.3f + 0.05f * (instance % 8);
+    ctrls.oscDetune = 0.2f;
+    ctrls.oscUseWavetable = instance / kNumEffects % 2;
+
+    ctrls.filterVol = 0.8f;
+    ctrls.filterMode = (instance % 4) * 0.25f + 0.1f;
+    ctrls.filterNoiseLevel = 0.2f;
+    ctrls.filterCutoff = 0.6f;
+    ctrls.filterResonance = 0.5f;
+    ctrls.filterPosition = 0.1f;
+
+    ctrls.resonatorVol = 0.7f;
+    ctrls.resonatorTune = 0.5f;
+    ctrls.resonatorFeedback = 0.8f;
+    ctrls.resonatorDissonance = 0.3f;
+    ctrls.effectType = (instance % kNumEffects + 0.5f) / kNumEffects;
+
+    ctrls.echoVol = 0.6f;
+    ctrls.echoRepeats = 0.6f;
+    ctrls.echoDensity = 0.5f;
+    ctrls.echoFilter = 0.5f;
+
+    ctrls.ambienceVol = 0.6f;
+    ctrls.ambienceDecay = 0.7f;
+    ctrls.ambienceSpacetime = 0.6f;
+    ctrls.ambienceAutoPan = 0.5f;
+
+    ctrls.modLevel = 0.5f;
+    ctrls.modSpeed = 0.5f;
+    ctrls.modType = (instance % 6) / 6.f + 0.03f;
+}
+
+static uint64_t Hash(uint64_t hash, const float* data, size_t size) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size * sizeof(float); i++) {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// The input of an instance: a sine a fifth above the previous one's, with
+// noise of its own on top.
+struct InstanceInput {
+    RandomStream noise;
+    float phase = 0;
+    float increment;
+
+    InstanceInput(int instance, float sampleRate) : noise(instance + 1) {
+        increment = 2 * M_PI * 110.f * powf(1.5f, instance % 4) / sampleRate;
+    }
+
+    void Fill(AudioBuffer& buffer) {
+        FloatArray left = buffer.getSamples(LEFT_CHANNEL);
+        FloatArray right = buffer.getSamples(RIGHT_CHANNEL);
+        for (size_t i = 0; i < buffer.getSize(); i++) {
+            float s = sinf(phase) * 0.3f;
+            phase += increment;
+            if (phase >= 2 * M_PI) phase -= 2 * M_PI;
+            left[i] = s + noise.NextFloat(-0.025f, 0.025f);
+            right[i] = s + noise.NextFloat(-0.025f, 0.025f);
+        }
+    }
+};
+
+// The render of count instances from first, on threads. Returns the time
+// taken in seconds.
+static double Render(const RenderOptions& options, int first, int count, int threads, std::vector<InstanceResult>& results) {
+    const float sampleRate = 48000.f;
+    const int nofBlocks = (int)(options.seconds * sampleRate / options.blockSize);
+    const uint8_t cutoff = ParamIndex(&PatchCtrls::filterCutoff);
+
+    std::vector<std::unique_ptr<Instance>> instances;
+    std::vector<std::unique_ptr<InstanceInput>> inputs;
+    std::vector<AudioBuffer*> buffers;
+    for (int i = first; i < first + count; i++) {
+        PatchCtrls ctrls;
+        InitPreset(ctrls, i);
+        instances.emplace_back(new Instance(ctrls, i, sampleRate, options.blockSize));
+        inputs.emplace_back(new InstanceInput(i, sampleRate));
+        buffers.push_back(AudioBuffer::create(2, options.blockSize));
+    }
+    results.assign(count, InstanceResult());
+
+    WorkerPool pool(threads);
+    auto start = std::chrono::steady_clock::now();
+    for (int b = 0; b < nofBlocks; b += options.chunk) {
+        int blocks = std::min(options.chunk, nofBlocks - b);
+
+        // A second long sweep of the cutoff, each instance a bit behind the
+        // previous one.
+        for (int i = 0; i < count; i++) {
+            float t = (float)(b * options.blockSize) / sampleRate + (first + i) * 0.125f;
+            instances[i]->GetMailbox().Post(PARAM_TARGET_CTRL, cutoff, 0.4f + 0.3f * sinf(2 * M_PI * t));
+        }
+
+        pool.Run(count, [&](size_t i) {
+            AudioBuffer& buffer = *buffers[i];
+            InstanceResult& result = results[i];
+            for (int k = 0; k < blocks; k++) {
+                inputs[i]->Fill(buffer);
+                instances[i]->Process(buffer);
+
+                FloatArray left = buffer.getSamples(LEFT_CHANNEL);
+                FloatArray right = buffer.getSamples(RIGHT_CHANNEL);
+                for (int j = 0; j < options.blockSize; j++) {
+                    if (!std::isfinite(left[j]) || !std::isfinite(right[j])) result.nonFinite++;
+                    else result.peak = std::max(result.peak, std::max(fabsf(left[j]), fabsf(right[j])));
+                }
+                result.hash = Hash(result.hash, left.getData(), options.blockSize);
+                result.hash = Hash(result.hash, right.getData(), options.blockSize);
+            }
+        });
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    for (AudioBuffer* buffer : buffers) AudioBuffer::destroy(buffer);
+
+    return elapsed.count();
+}
+
+int main(int argc, char** argv) {
+    RenderOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::cerr << "Usage: " << argv[0] << " [-n instances] [-t threads] [-s seconds] [-b blocksize] [-c blocks] [-v]\n";
+        return 2;
+    }
+    EnableFlushToZero();
+
+    std::vector<InstanceResult> results;
+    double seconds = Render(options, 0, options.instances, options.threads, results);
+    double audioSeconds = (int)(options.seconds * 48000.f / options.blockSize) * options.blockSize / 48000.0;
+
+    std::cout << "Oneiroi instances render\n";
+    std::cout << "  " << options.instances << " instances of " << audioSeconds << " s, blocks of "
+              << options.blockSize << ", " << options.chunk << " blocks per task, " << options.threads << " threads\n";
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  render time " << seconds * 1e3 << " ms, " << audioSeconds * options.instances / seconds
+              << "x realtime for one instance, " << audioSeconds / seconds << "x for all\n\n";
+
+    std::cout << std::left << std::setw(10) << "instance" << std::right << std::setw(10) << "peak"
+              << std::setw(12) << "non-finite" << "  hash\n";
+    for (int i = 0; i < options.instances; i++) {
+        char hex[17];
+        snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)results[i].hash);
+        std::cout << std::left << std::setw(10) << i << std::right << std::setw(10) << results[i].peak
+                  << std::setw(12) << results[i].nonFinite << "  " << hex << "\n";
+    }
+
+    if (options.verify) {
+        int failures = 0;
+        for (int i = 0; i < options.instances; i++) {
+            std::vector<InstanceResult> reference;
+            Render(options, i, 1, 1, reference);
+            if (reference[0].hash != results[i].hash) {
+                std::cerr << "DIFF: instance " << i << " on its own\n";
+                failures++;
+            }
+        }
+        std::cerr << (failures ? "FAIL: " : "OK: ") << failures << " instances differ on their own\n";
+        return failures ? 1 : 0;
+    }
+
+    return 0;
+}
@@ -1,97 +1,20 @@
 // Unit tests for Oneiroi Commons.h utility functions
-// Compile: g++ -std=c++17 -I.. test_commons.cpp -o test_commons && ./test_commons
+// Compile: g++ -std=c++17 -Iowl -I.. test_commons.cpp -o test_commons && ./test_commons
 
 #include <iostream>
 #include <cmath>
 #include <cassert>
+#include <map>
+#include <vector>
 
-// Include mocks before Commons.h to override OWL types
+// The mocks stand in for the OWL SDK that Commons.h and the code under test include
 #include "owl_mocks.h"
-
-// Stub Patch.h include (Commons.h includes it)
-#define Patch_h
-
-// Now include the actual code under test
+#include "../Commons.h"
 #include "../ParameterInterpolator.h"
-
-// Re-include just the functions we want to test (extracted from Commons.h)
-// We can't include full Commons.h due to complex dependencies, so we test the pure functions
-
-constexpr float kEps = 0.0001f;
-constexpr float kCvMinThreshold = 0.007f;
-
-inline float Max(float a, float b) { return (a > b) ? a : b; }
-inline float Min(float a, float b) { return (a < b) ? a : b; }
-inline float Clamp(float in, float min = 0.f, float max = 1.f) { return Min(Max(in, min), max); }
-
-inline float Map(float value, float aMin, float aMax, float bMin, float bMax) {
-    float k = fabs(bMax - bMin) / fabs(aMax - aMin) * (bMax > bMin ? 1 : -1);
-    return bMin + k * (value - aMin);
-}
-
-inline float MapExpo(float value, float aMin = 0.f, float aMax = 1.f, float bMin = 0.f, float bMax = 1.f) {
-    value = (value - aMin) / (aMax - aMin);
-    return bMin + (value * value) * (bMax - bMin);
-}
-
-inline float CenterMap(float value, float min = -1.f, float max = 1.f, float center = 0.55f) {
-    if (value < center) {
-        value = Map(value, 0.0f, center, min, 0.0f);
-    } else {
-        value = Map(value, center, 0.99f, 0.0f, max);
-    }
-    return value;
-}
-
-float SoftLimit(float x) {
-    return x * (27.f + x * x) / (27.f + 9.f * x * x);
-}
-
-float SoftClip(float x) {
-    if (x <= -3.f) return -1.f;
-    else if (x >= 3.f) return 1.f;
-    else return SoftLimit(x);
-}
-
-float HardClip(float x, float limit = 1.f) {
-    return Clamp(x, -limit, limit);
-}
-
-inline float LinearCrossFade(float a, float b, float pos) {
-    return a * (1.f - pos) + b * pos;
-}
-
-inline float M2F(float m) {
-    return powf(2.f, (m - 69) / 12.f) * 440.f;
-}
-
-inline float F2S(float freq, float sampleRate = 48000.f) {
-    return freq == 0.f ? 0.f : sampleRate / freq;
-}
-
-#define CONSTRAIN(var, min, max) if (var < (min)) { var = (min); } else if (var > (max)) { var = (max); }
-
-float Modulate(
-    float baseValue, float modAmount, float modValue,
-    float cvAmount = 0, float cvValue = 0,
-    float minValue = -1.f, float maxValue = 1.f,
-    bool modAttenuverters = false, bool cvAttenuverters = false
-) {
-    if (modAttenuverters) {
-        modAmount = CenterMap(modAmount);
-        if (modAmount >= -0.1f && modAmount <= 0.1f) modAmount = 0.f;
-    }
-    if (cvAttenuverters) {
-        cvAmount = CenterMap(cvAmount);
-        if (cvAmount >= -0.1f && cvAmount <= 0.1f) cvAmount = 0.f;
-    }
-    if (cvValue >= -kCvMinThreshold && cvValue <= kCvMinThreshold) {
-        cvValue = kCvMinThreshold;
-    }
-    baseValue += modAmount * modValue + cvAmount * cvValue;
-    CONSTRAIN(baseValue, minValue, maxValue);
-    return baseValue;
-}
+#include "../ChaosNoise.h"
+#include "../Oversampler.h"
+#include "../LooperStream.h"
+#include "../ClockEvents.h"
 
 // Test utilities
 int tests_passed = 0;
@@ -155,18 +78,156 @@ TEST(soft_clip_hard_limit) {
     ASSERT_NEAR(SoftClip(-5.0f), -1.0f, kEps);
 }
 
+TEST(fast_tanh_error) {
+    float maxError = 0;
+    for (int i = -8000; i <= 8000; i++) {
+        float x = i * 0.001f;
+        maxError = Max(maxError, fabsf(FastTanh(x) - tanhf(x)));
+    }
+    ASSERT_TRUE(maxError < 2e-4f);
+    ASSERT_NEAR(FastTanh(100.f), 1.f, 1e-4f);
+    ASSERT_NEAR(FastTanh(-100.f), -1.f, 1e-4f);
+}
+
+TEST(fast_sine_error) {
+    float maxError = 0;
+    for (int i = 0; i < 10000; i++) {
+        float phase = i * 0.0001f;
+        maxError = Max(maxError, fabsf(FastSine(phase) - sinf(2 * M_PI * phase)));
+    }
+    ASSERT_TRUE(maxError < 2e-6f);
+    ASSERT_NEAR(FastSine(0.25f), 1.f, 1e-5f);
+    ASSERT_NEAR(FastSine(0.75f), -1.f, 1e-5f);
+}
+
 TEST(hard_clip_limits) {
     ASSERT_NEAR(HardClip(2.0f, 1.0f), 1.0f, kEps);
     ASSERT_NEAR(HardClip(-2.0f, 1.0f), -1.0f, kEps);
     ASSERT_NEAR(HardClip(0.5f, 1.0f), 0.5f, kEps);
 }
 
+TEST(flush_to_zero) {
+    volatile float tiny = 1e-30f;
+    volatile float scale = 1e-10f;
+    EnableFlushToZero();
+    float product = tiny * scale;
+    ASSERT_TRUE(product == 0.f);
+    // A one pole decaying into silence ends at zero instead of denormals.
+    float state = 1.f;
+    for (int i = 0; i < 100000; i++) {
+        state += 0.01f * (0.f - state);
+    }
+    ASSERT_TRUE(state == 0.f || std::fpclassify(state) == FP_NORMAL);
+}
+
+TEST(looper_sample_round_trip) {
+    float maxError = 0;
+    for (int i = -1000; i <= 1000; i++) {
+        float value = i * 0.001f;
+        maxError = Max(maxError, fabsf(FromLooperSample(ToLooperSample(value)) - value));
+    }
+#ifdef USE_LOOPER_16BIT
+    ASSERT_TRUE(maxError <= 0.5f / 32767.f + 1e-7f);
+    ASSERT_TRUE(ToLooperSample(2.f) == 32767);
+    ASSERT_TRUE(ToLooperSample(-2.f) == -32767);
+    ASSERT_TRUE(ToLooperSample(0.f) == 0);
+#else
+    // Float samples are stored as they are.
+    ASSERT_TRUE(maxError == 0.f);
+    ASSERT_TRUE(FromLooperSample(ToLooperSample(2.f)) == 2.f);
+#endif
+}
+
+TEST(snapshot_half_round_trip) {
+    // The controls, 0 to 1, within half a step of the 11 bit mantissa.
+    float maxError = 0;
+    for (int i = 0; i <= 1000; i++) {
+        float value = i * 0.001f;
+        maxError = Max(maxError, fabsf(HalfToFloat(FloatToHalf(value)) - value));
+    }
+    ASSERT_TRUE(maxError <= 0.5f / 2048.f);
+    // Frequencies keep about a cent.
+    ASSERT_NEAR(HalfToFloat(FloatToHalf(440.f)), 440.f, 0.125f);
+    ASSERT_NEAR(HalfToFloat(FloatToHalf(-0.3f)), -0.3f, 1e-4f);
+    ASSERT_TRUE(HalfToFloat(FloatToHalf(1e-6f)) == 0.f);
+    ASSERT_TRUE(std::isinf(HalfToFloat(FloatToHalf(1e6f))));
+    ASSERT_TRUE(FloatToHalf(NAN) == 0x7e00);
+}
+
+TEST(pow2_table_error) {
+    float maxError = 0;
+    for (int i = -4000; i <= 4000; i++) {
+        float x = i * 0.005f;
+        maxError = Max(maxError, fabsf(Pow2(x) / powf(2.f, x) - 1.f));
+    }
+    ASSERT_TRUE(maxError < 1e-5f);
+    ASSERT_TRUE(Pow2(0.f) == 1.f);
+    ASSERT_TRUE(Pow2(-3.f) == 0.125f);
+    ASSERT_NEAR(Db2A(-6.f), powf(10.f, -0.3f), 1e-5f);
+    ASSERT_NEAR(Db2A(120.f) / 1e6f, 1.f, 1e-5f);
+}
+
+TEST(make_lut_matches_pow) {
+    // Built at compile time.
+    static constexpr LutTable<float, 32> kTable = MakeLut<float, 32>(0.f, -160.f, 3.0);
+    static_assert(kTable.values[31] == -160.f, "The last value is max");
+    for (int i = 0; i < 32; i++) {
+        ASSERT_NEAR(kTable.values[i], -160.f * powf(i / 31.f, 3.f), 1e-3f);
+    }
+    static constexpr LutTable<uint32_t, 128> kLinear = MakeLut<uint32_t, 128>(0, 127 * 1000);
+    ASSERT_TRUE(kLinear.values[64] == 64000);
+    ASSERT_NEAR(ConstLog2(10.0), log2(10.0), 1e-12);
+}
+
 TEST(linear_crossfade) {
     ASSERT_NEAR(LinearCrossFade(0.f, 1.f, 0.f), 0.f, kEps);
     ASSERT_NEAR(LinearCrossFade(0.f, 1.f, 1.f), 1.f, kEps);
     ASSERT_NEAR(LinearCrossFade(0.f, 1.f, 0.5f), 0.5f, kEps);
 }
 
+TEST(random_stream_fill) {
+    // The same seed gives the same stream, within the range and centered.
+    RandomStream a(7), b(7), c(8);
+    float x[1001], y[1001], z[1001];
+    a.Fill(x, 1001, -1.f, 1.f);
+    b.Fill(y, 1001, -1.f, 1.f);
+    c.Fill(z, 1001, -1.f, 1.f);
+    float sum = 0;
+    int same = 0;
+    for (int i = 0; i < 1001; i++) {
+        ASSERT_TRUE(x[i] == y[i]);
+        ASSERT_TRUE(x[i] >= -1.f && x[i] < 1.f);
+        sum += x[i];
+        same += x[i] == z[i];
+    }
+    ASSERT_NEAR(sum / 1001, 0.f, 0.1f);
+    ASSERT_TRUE(same < 2);
+    float v = a.NextFloat(0.f, 1.f);
+    ASSERT_TRUE(v >= 0.f && v < 1.f);
+}
+
+TEST(chaos_noise_render) {
+    // A block rendered is the same as the samples processed one by one, at
+    // a low and a high frequency.
+    const float freqs[] = { 180.f, 15000.f };
+    for (float freq : freqs) {
+        ChaosNoise a, b;
+        a.Init(48000.f);
+        b.Init(48000.f);
+        a.SetChaos(1.9f);
+        b.SetChaos(1.9f);
+        a.SetFreq(freq);
+        b.SetFreq(freq);
+        float block[1000];
+        for (int k = 0; k < 3; k++) {
+            a.Render(block, 1000);
+            for (int i = 0; i < 1000; i++) {
+                ASSERT_TRUE(block[i] == b.Process());
+            }
+        }
+    }
+}
+
 TEST(m2f_a4_is_440) {
     // MIDI note 69 = A4 = 440 Hz
     ASSERT_NEAR(M2F(69), 440.f, 0.01f);
@@ -251,38 +312,6 @@ TEST(param_interp_subsample) {
 
 // ============ HYSTERESIS QUANTIZER TESTS ============
 
-// Minimal HysteresisQuantizer implementation for testing
-class HysteresisQuantizer {
-public:
-    void Init(int num_steps, float hysteresis, bool symmetric) {
-        num_steps_ = num_steps;
-        hysteresis_ = hysteresis;
-        scale_ = static_cast<float>(symmetric ? num_steps - 1 : num_steps);
-        offset_ = symmetric ? 0.0f : -0.5f;
-        quantized_value_ = 0;
-    }
-
-    int Process(float value) {
-        value *= scale_;
-        value += offset_;
-        float hysteresis_sign = value > static_cast<float>(quantized_value_) ? -1.0f : +1.0f;
-        int q = static_cast<int>(value + hysteresis_sign * hysteresis_ + 0.5f);
-        if (q < 0) q = 0;
-        if (q > num_steps_ - 1) q = num_steps_ - 1;
-        quantized_value_ = q;
-        return q;
-    }
-
-    int quantized_value() const { return quantized_value_; }
-
-private:
-    int num_steps_;
-    float hysteresis_;
-    float scale_;
-    float offset_;
-    int quantized_value_;
-};
-
 TEST(quantizer_basic_steps) {
     HysteresisQuantizer q;
     q.Init(4, 0.0f, false);  // 4 steps, no hysteresis
@@ -316,6 +345,207 @@ TEST(quantizer_clamps_bounds) {
     ASSERT_EQ(q.Process(1.5f), 3);    // Clamps to max
 }
 
+// ============ OVERSAMPLER TESTS ============
+
+// The index of the largest output of an impulse through the filters.
+int OversamplerImpulseDelay(Oversampler &os) {
+    int delay = 0;
+    float peak = 0;
+    for (int n = 0; n < 64; n++) {
+        float out = os.Process(0 == n ? 1.f : 0.f, [](float x) { return x; });
+        if (fabsf(out) > peak) {
+            peak = fabsf(out);
+            delay = n;
+        }
+    }
+    return delay;
+}
+
+// The RMS of the output, past the filters' latency.
+template <typename Stage>
+float OversamplerRms(Oversampler &os, float freq, Stage stage) {
+    float sum = 0;
+    int count = 0;
+    for (int n = 0; n < 4800; n++) {
+        float out = os.Process(sinf(k2Pi * freq * n), stage);
+        if (n >= 480) {
+            sum += out * out;
+            count++;
+        }
+    }
+    return sqrtf(sum / count);
+}
+
+TEST(oversampler_latency_matches_impulse) {
+    for (int factor = 2; factor <= 4; factor *= 2) {
+        Oversampler os(factor);
+        ASSERT_EQ(OversamplerImpulseDelay(os), os.GetLatency());
+        // At 1x the stage's output is delayed as much.
+        Oversampler reduced(factor);
+        reduced.SetReduced(true);
+        for (int n = 0; n < 256; n++) {
+            reduced.Process(0.f, [](float x) { return x; });
+        }
+        ASSERT_EQ(OversamplerImpulseDelay(reduced), os.GetLatency());
+    }
+}
+
+TEST(oversampler_passband_unity) {
+    for (int factor = 2; factor <= 4; factor *= 2) {
+        // 1 and 8kHz at 48kHz.
+        for (float freq : {1.f / 48.f, 1.f / 6.f}) {
+            Oversampler os(factor);
+            ASSERT_NEAR(OversamplerRms(os, freq, [](float x) { return x; }), sqrtf(0.5f), 0.01f);
+        }
+    }
+}
+
+TEST(oversampler_rejects_above_nyquist) {
+    for (int factor = 2; factor <= 4; factor *= 2) {
+        // Squared, a tone at 0.34 of the rate is DC and a tone at 0.68, just
+        // above the Nyquist frequency, that would alias to 0.32. The stage
+        // takes the DC out and the rest is filtered, 50dB down.
+        Oversampler os(factor);
+        float rms = OversamplerRms(os, 0.34f, [](float x) { return x * x - 0.5f; });
+        ASSERT_TRUE(rms < 0.003f * sqrtf(0.125f));
+    }
+}
+
+// ============ LOOPER STREAM TESTS ============
+
+// A store whose transfers take kRuns calls of IsBusy(), the frames are only
+// copied at the end like a DMA would.
+class SlowLooperStore : public LooperStore {
+public:
+    static constexpr int kRuns = 50;
+
+    std::map<uint32_t, std::vector<LooperSample>> pages;
+    bool missing = false;
+
+    void BeginWrite(uint32_t page, const LooperSample* frames) override {
+        Begin(page, const_cast<LooperSample*>(frames), true);
+    }
+
+    void BeginRead(uint32_t page, LooperSample* frames) override {
+        Begin(page, frames, false);
+    }
+
+    bool IsBusy() override {
+        if (busy_ > 0 && 0 == --busy_) {
+            std::vector<LooperSample> &stored = pages[page_];
+            if (writing_) {
+                stored.assign(frames_, frames_ + kLooperStreamPageFrames * 2);
+            } else if (stored.empty()) {
+                missing = true;
+            } else {
+                std::copy(stored.begin(), stored.end(), frames_);
+            }
+        }
+        return busy_ > 0;
+    }
+
+private:
+    int busy_ = 0;
+    uint32_t page_ = 0;
+    LooperSample* frames_ = nullptr;
+    bool writing_ = false;
+
+    void Begin(uint32_t page, LooperSample* frames, bool writing) {
+        busy_ = kRuns;
+        page_ = page;
+        frames_ = frames;
+        writing_ = writing;
+    }
+};
+
+inline float StreamTestValue(int32_t frame, size_t channel) {
+    return ((frame * 7 + channel * 3) % 1999 + 1) * 0.001f - 1.f;
+}
+
+TEST(looper_stream_slow_store_round_trip) {
+    const size_t size = 64;
+    const int32_t blocks = kLooperChannelBufferLength * 3 / size;
+    LooperBuffer* buffer = LooperBuffer::create();
+    SlowLooperStore store;
+    LooperStream* stream = LooperStream::create(buffer, &store);
+
+    // Three windows of the take, recorded faster than the store can page
+    // the buffer out.
+    std::vector<bool> kept(blocks);
+    for (int32_t b = 0; b < blocks; b++) {
+        int32_t position = b * size;
+        kept[b] = stream->Writable(position, size);
+        if (kept[b]) {
+            for (size_t c = 0; c < 2; c++) {
+                LooperSample* channel = buffer->GetChannel(c);
+                for (size_t i = 0; i < size; i++) {
+                    int32_t frame = position + i;
+                    channel[LooperBuffer::Wrap(frame) * kLooperSampleStride] = ToLooperSample(StreamTestValue(frame, c));
+                }
+            }
+            stream->Written(position, size);
+        }
+        stream->SetHead(STREAM_HEAD_WRITE, position + size, 1);
+        stream->Run(kSchedulerBlockBudget);
+    }
+    ASSERT_TRUE(stream->GetDropped() > 0);
+
+    // Played back a page at a time, the blocks that were kept come back and
+    // the dropped ones are blank.
+    float maxError = 0;
+    stream->SetHead(STREAM_HEAD_WRITE, 0, 0);
+    for (int32_t page = 0; page < blocks * int32_t(size) / kLooperStreamPageFrames; page++) {
+        stream->SetHead(STREAM_HEAD_READ, page * kLooperStreamPageFrames, 1);
+        for (int i = 0; i < 4 * (SlowLooperStore::kRuns + 1) * (kLooperStreamPagesAhead + 2); i++) {
+            stream->Run(kSchedulerBlockBudget);
+        }
+        for (size_t c = 0; c < 2; c++) {
+            const LooperSample* channel = buffer->GetChannel(c);
+            for (int32_t i = 0; i < kLooperStreamPageFrames; i++) {
+                int32_t frame = page * kLooperStreamPageFrames + i;
+                float expected = kept[frame / size] ? StreamTestValue(frame, c) : 0.f;
+                float value = FromLooperSample(channel[LooperBuffer::Wrap(frame) * kLooperSampleStride]);
+                maxError = Max(maxError, fabsf(value - expected));
+            }
+        }
+    }
+    ASSERT_TRUE(!store.missing);
+    ASSERT_TRUE(maxError <= 1.f / 32767.f);
+
+    LooperStream::destroy(stream);
+    LooperBuffer::destroy(buffer);
+}
+
+// ============ CLOCK EVENTS TESTS ============
+
+TEST(clock_events_pop_by_offset) {
+    ClockEvents events;
+    events.Latch();
+    ClockEvent event;
+    ASSERT_TRUE(!events.Pop(event, 64));
+
+    // A MIDI clock that came after a sync edge but falls before it.
+    events.Push(CLOCK_EVENT_SYNC_ON, 40, 64);
+    events.Push(CLOCK_EVENT_MIDI_CLOCK, 0, 64);
+    events.Push(CLOCK_EVENT_SYNC_OFF, 40, 64);
+    events.Latch();
+    events.Push(CLOCK_EVENT_MIDI_STOP, 0, 64);
+
+    // The first sub-block, then the second one.
+    ASSERT_TRUE(events.Pop(event, 32));
+    ASSERT_TRUE(CLOCK_EVENT_MIDI_CLOCK == event.type && 0 == event.offset);
+    ASSERT_TRUE(!events.Pop(event, 32));
+    ASSERT_TRUE(events.Pop(event, 64));
+    ASSERT_TRUE(CLOCK_EVENT_SYNC_ON == event.type);
+    ASSERT_TRUE(events.Pop(event, 64));
+    ASSERT_TRUE(CLOCK_EVENT_SYNC_OFF == event.type);
+    // What came in during the block is the next one's.
+    ASSERT_TRUE(!events.Pop(event, 64));
+    events.Latch();
+    ASSERT_TRUE(events.Pop(event, 64));
+    ASSERT_TRUE(CLOCK_EVENT_MIDI_STOP == event.type);
+}
+
 // ============ MAIN ============
 
 int main() {
@@ -335,12 +565,20 @@ int main() {
     std::cout << "\nClipping:\n";
     RUN_TEST(soft_clip_within_range);
     RUN_TEST(soft_clip_hard_limit);
+    RUN_TEST(fast_tanh_error);
+    RUN_TEST(fast_sine_error);
     RUN_TEST(hard_clip_limits);
+    RUN_TEST(looper_sample_round_trip);
+    RUN_TEST(snapshot_half_round_trip);
 
     std::cout << "\nCrossfade:\n";
     RUN_TEST(linear_crossfade);
 
     std::cout << "\nMIDI/Frequency:\n";
+    RUN_TEST(pow2_table_error);
+    RUN_TEST(make_lut_matches_pow);
+    RUN_TEST(random_stream_fill);
+    RUN_TEST(chaos_noise_render);
     RUN_TEST(m2f_a4_is_440);
     RUN_TEST(m2f_octave_doubles);
     RUN_TEST(f2s_conversion);
@@ -362,6 +600,21 @@ int main() {
     RUN_TEST(quantizer_with_hysteresis);
     RUN_TEST(quantizer_clamps_bounds);
 
+    // Last, it changes the FPU mode of the thread.
+    std::cout << "\nOversampler:\n";
+    RUN_TEST(oversampler_latency_matches_impulse);
+    RUN_TEST(oversampler_passband_unity);
+    RUN_TEST(oversampler_rejects_above_nyquist);
+
+    std::cout << "\nLooperStream:\n";
+    RUN_TEST(looper_stream_slow_store_round_trip);
+
+    std::cout << "\nClockEvents:\n";
+    RUN_TEST(clock_events_pop_by_offset);
+
+    std::cout << "\nFPU:\n";
+    RUN_TEST(flush_to_zero);
+
     std::cout << "\n=== Results: " << tests_passed << " passed, " << tests_failed << " failed ===\n\n";
 
     return tests_failed > 0 ? 1 : 0;